@@ -0,0 +1,270 @@
+/**
+ *  benchmarks/benchmark-latency
+ *
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <gaeguli/gaeguli.h>
+
+#include "common.h"
+#include "gaeguli/test/receiver.h"
+
+/*
+ * Measures glass-to-glass latency: the time from a frame leaving the video
+ * test source until a receiver on the loopback interface decodes it. Each
+ * combination of codec, stream type, MPEG-TS mode and SRT latency selected
+ * on the command line streams for a while and reports the percentiles of
+ * the frames' latencies.
+ */
+
+#define PORT                    8888
+#define BITRATE                 2000000
+#define WARMUP_TIME_US          (2 * G_USEC_PER_SEC)
+
+static struct
+{
+  gint duration;
+  const gchar *codecs;
+  const gchar *stream_types;
+  const gchar *ts_modes;
+  const gchar *srt_latencies;
+  gboolean sink_pacing;
+} options;
+
+typedef struct
+{
+  GMutex lock;
+  GArray *samples;
+  gint64 start_time;
+} LatencyData;
+
+typedef struct
+{
+  GaeguliVideoCodec codec;
+  GaeguliVideoStreamType stream_type;
+  GaeguliMpegTsMode ts_mode;
+  guint srt_latency;
+} BenchmarkCase;
+
+static void
+latency_cb (GstClockTime latency, LatencyData * data)
+{
+  g_mutex_lock (&data->lock);
+  /* Skip samples from while the receiver was still catching up. */
+  if (g_get_monotonic_time () >= data->start_time) {
+    g_array_append_val (data->samples, latency);
+  }
+  g_mutex_unlock (&data->lock);
+}
+
+static gint
+compare_clock_time (gconstpointer a, gconstpointer b)
+{
+  GstClockTime ta = *(const GstClockTime *) a;
+  GstClockTime tb = *(const GstClockTime *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+static gdouble
+percentile_ms (GArray * sorted, guint percentile)
+{
+  guint i = (sorted->len - 1) * percentile / 100;
+
+  return g_array_index (sorted, GstClockTime, i) / (gdouble) GST_MSECOND;
+}
+
+static void
+report (const BenchmarkCase * c, GArray * samples)
+{
+  const gchar *codec =
+      gaeguli_benchmark_enum_nick (GAEGULI_TYPE_VIDEO_CODEC, c->codec);
+  const gchar *stream_type =
+      gaeguli_benchmark_enum_nick (GAEGULI_TYPE_VIDEO_STREAM_TYPE,
+      c->stream_type);
+  g_autofree gchar *name = NULL;
+
+  if (c->stream_type == GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS) {
+    name = g_strdup_printf ("%s %s %s", codec, stream_type,
+        gaeguli_benchmark_enum_nick (GAEGULI_TYPE_MPEG_TS_MODE, c->ts_mode));
+  } else {
+    name = g_strdup_printf ("%s %s", codec, stream_type);
+  }
+
+  if (samples->len == 0) {
+    g_print ("%-36s %4u ms  no frames received\n", name, c->srt_latency);
+    return;
+  }
+
+  g_array_sort (samples, compare_clock_time);
+
+  g_print ("%-36s %4u ms %6u frames  p50 %7.1f ms  p95 %7.1f ms  "
+      "p99 %7.1f ms\n", name, c->srt_latency, samples->len,
+      percentile_ms (samples, 50), percentile_ms (samples, 95),
+      percentile_ms (samples, 99));
+}
+
+static void
+run_case (const BenchmarkCase * c)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *uri = NULL;
+  GaeguliTarget *target;
+  LatencyData data = { 0 };
+  GVariantDict attr;
+
+  g_mutex_init (&data.lock);
+  data.samples = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  data.start_time = g_get_monotonic_time () + WARMUP_TIME_US;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_1280X720, 30);
+
+  receiver = gaeguli_tests_create_latency_receiver (GAEGULI_SRT_MODE_LISTENER,
+      PORT, c->stream_type, c->srt_latency,
+      (GaeguliTestsLatencyFunc) latency_cb, &data);
+
+  uri = g_strdup_printf ("srt://127.0.0.1:%d?latency=%u", PORT,
+      c->srt_latency);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", c->codec);
+  g_variant_dict_insert (&attr, "stream-type", "i", c->stream_type);
+  g_variant_dict_insert (&attr, "bitrate", "u", BITRATE);
+  g_variant_dict_insert (&attr, "mpeg-ts-mode", "i", c->ts_mode);
+  g_variant_dict_insert (&attr, "sink-pacing", "b", options.sink_pacing);
+  g_variant_dict_insert (&attr, "uri", "s", uri);
+
+  target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  g_assert_true (gaeguli_tests_stamp_capture_time (target));
+
+  g_timeout_add_seconds (options.duration, (GSourceFunc) g_main_loop_quit,
+      loop);
+  g_main_loop_run (loop);
+
+  gaeguli_pipeline_stop (pipeline);
+  gst_element_set_state (receiver, GST_STATE_NULL);
+
+  report (c, data.samples);
+
+  g_array_unref (data.samples);
+  g_mutex_clear (&data.lock);
+}
+
+static gboolean
+is_supported (const BenchmarkCase * c)
+{
+  /* RTP over SRT is implemented only for x264. */
+  return c->stream_type != GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT ||
+      c->codec == GAEGULI_VIDEO_CODEC_H264_X264;
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr (GOptionContext) context = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GArray) codecs = NULL;
+  g_autoptr (GArray) stream_types = NULL;
+  g_autoptr (GArray) ts_modes = NULL;
+  g_autoptr (GArray) srt_latencies = NULL;
+  GOptionEntry entries[] = {
+    {"duration", 'd', 0, G_OPTION_ARG_INT, &options.duration,
+        "Seconds to measure each case for", NULL},
+    {"codecs", 'c', 0, G_OPTION_ARG_STRING, &options.codecs,
+        "Codecs to measure", "h264-x264,h265-x265"},
+    {"stream-types", 's', 0, G_OPTION_ARG_STRING, &options.stream_types,
+        "Stream types to measure", "mpeg-ts,rtp"},
+    {"ts-modes", 't', 0, G_OPTION_ARG_STRING, &options.ts_modes,
+        "MPEG-TS modes to measure", "smoothed,low-latency"},
+    {"srt-latencies", 'l', 0, G_OPTION_ARG_STRING, &options.srt_latencies,
+        "SRT latencies to measure, in milliseconds", "20,120"},
+    {"sink-pacing", 'p', 0, G_OPTION_ARG_NONE, &options.sink_pacing,
+        "Pace sending in the sink", NULL},
+    {NULL}
+  };
+  guint i, j, k, l;
+
+  options.duration = 10;
+  options.codecs = "h264-x264,h265-x265";
+  options.stream_types = "mpeg-ts,rtp";
+  options.ts_modes = "smoothed,low-latency";
+  options.srt_latencies = "20,120";
+  options.sink_pacing = FALSE;
+
+  gst_init (&argc, &argv);
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return -1;
+  }
+
+  codecs = gaeguli_benchmark_parse_enum_list (GAEGULI_TYPE_VIDEO_CODEC,
+      options.codecs);
+  stream_types =
+      gaeguli_benchmark_parse_enum_list (GAEGULI_TYPE_VIDEO_STREAM_TYPE,
+      options.stream_types);
+  ts_modes = gaeguli_benchmark_parse_enum_list (GAEGULI_TYPE_MPEG_TS_MODE,
+      options.ts_modes);
+  srt_latencies = gaeguli_benchmark_parse_uint_list (options.srt_latencies);
+
+  if (!codecs || !stream_types || !ts_modes || !srt_latencies) {
+    return -1;
+  }
+
+  g_print ("%-36s %7s\n", "case", "latency");
+
+  for (i = 0; i < codecs->len; ++i) {
+    for (j = 0; j < stream_types->len; ++j) {
+      for (k = 0; k < ts_modes->len; ++k) {
+        for (l = 0; l < srt_latencies->len; ++l) {
+          BenchmarkCase c;
+
+          c.codec = g_array_index (codecs, gint, i);
+          c.stream_type = g_array_index (stream_types, gint, j);
+          c.ts_mode = g_array_index (ts_modes, gint, k);
+          c.srt_latency = g_array_index (srt_latencies, guint, l);
+
+          if (c.stream_type != GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS) {
+            /* The MPEG-TS mode makes no difference; measure once. */
+            if (k > 0) {
+              continue;
+            }
+            c.ts_mode = GAEGULI_MPEG_TS_MODE_SMOOTHED;
+          }
+
+          if (is_supported (&c)) {
+            run_case (&c);
+          }
+        }
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,536 @@
+/**
+ *  benchmarks/benchmark-throughput
+ *
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <gaeguli/gaeguli.h>
+
+#include "common.h"
+#include "gaeguli/test/receiver.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Measures how many targets the encoders keep up with. Each combination of
+ * codec, resolution, framerate and target count selected on the command line
+ * streams to local SRT receivers or records to files for a while. The results
+ * are printed as JSON: the frame rate the slowest and the average encoder
+ * sustained, frames lost in the source and in the targets' queues, CPU usage
+ * of each thread and the resident memory size.
+ *
+ * Unless --shared is given, every target gets a slightly different bitrate,
+ * so that each has its own encoder instead of sharing one.
+ */
+
+#define BASE_PORT               9000
+#define BITRATE                 2000000
+#define WARMUP_SECONDS          2
+
+static struct
+{
+  gint duration;
+  const gchar *codecs;
+  const gchar *resolutions;
+  const gchar *framerates;
+  const gchar *target_counts;
+  gboolean record;
+  gboolean shared;
+} options;
+
+typedef struct
+{
+  GaeguliVideoCodec codec;
+  GaeguliVideoResolution resolution;
+  guint framerate;
+  guint n_targets;
+} BenchmarkCase;
+
+typedef struct
+{
+  GPtrArray *encoders;
+  gint *frames;
+} EncoderCounters;
+
+typedef struct
+{
+  gchar *name;
+  guint64 ticks;
+} ThreadTimes;
+
+static void
+thread_times_free (ThreadTimes * times)
+{
+  g_free (times->name);
+  g_free (times);
+}
+
+/* Maps thread ids to the CPU time the threads used so far. */
+static GHashTable *
+read_thread_times (void)
+{
+  GHashTable *result = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) thread_times_free);
+  g_autoptr (GDir) dir = g_dir_open ("/proc/self/task", 0, NULL);
+  const gchar *tid;
+
+  if (dir == NULL) {
+    return result;
+  }
+
+  while ((tid = g_dir_read_name (dir))) {
+    g_autofree gchar *path = g_strdup_printf ("/proc/self/task/%s/stat", tid);
+    g_autofree gchar *contents = NULL;
+    g_auto (GStrv) fields = NULL;
+    gchar *name_start;
+    gchar *name_end;
+    ThreadTimes *times;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+      continue;
+    }
+
+    /* The thread name may contain spaces and parentheses. */
+    name_start = strchr (contents, '(');
+    name_end = strrchr (contents, ')');
+    if (!name_start || !name_end || name_end < name_start) {
+      continue;
+    }
+
+    *name_end = '\0';
+    fields = g_strsplit (name_end + 2, " ", -1);
+    /* utime and stime are the 14th and 15th fields, counting from the pid. */
+    if (g_strv_length (fields) < 13) {
+      continue;
+    }
+
+    times = g_new0 (ThreadTimes, 1);
+    times->name = g_strdup (name_start + 1);
+    times->ticks = g_ascii_strtoull (fields[11], NULL, 10) +
+        g_ascii_strtoull (fields[12], NULL, 10);
+
+    g_hash_table_insert (result, g_strdup (tid), times);
+  }
+
+  return result;
+}
+
+static guint64
+read_rss_kb (void)
+{
+  g_autofree gchar *contents = NULL;
+  gchar *line;
+
+  if (!g_file_get_contents ("/proc/self/status", &contents, NULL, NULL)) {
+    return 0;
+  }
+
+  line = strstr (contents, "VmRSS:");
+  if (line == NULL) {
+    return 0;
+  }
+
+  return g_ascii_strtoull (line + strlen ("VmRSS:"), NULL, 10);
+}
+
+static GstPadProbeReturn
+count_frame_cb (GstPad * pad, GstPadProbeInfo * info, gint * frames)
+{
+  g_atomic_int_inc (frames);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+add_encoder (const GValue * value, GPtrArray * encoders)
+{
+  GstElement *element = g_value_get_object (value);
+
+  if (g_str_equal (GST_OBJECT_NAME (element), "enc")) {
+    g_ptr_array_add (encoders, gst_object_ref (element));
+  }
+}
+
+/* Counts the frames coming out of every encoder of the pipeline @target
+ * belongs to. */
+static void
+encoder_counters_init (EncoderCounters * counters, GaeguliTarget * target)
+{
+  g_autoptr (GstIterator) it = NULL;
+  GstObject *top = gst_object_ref (target->pipeline);
+  GstObject *parent;
+  guint i;
+
+  while ((parent = gst_object_get_parent (top))) {
+    gst_object_unref (top);
+    top = parent;
+  }
+
+  counters->encoders = g_ptr_array_new_with_free_func (gst_object_unref);
+
+  it = gst_bin_iterate_recurse (GST_BIN (top));
+  gst_iterator_foreach (it, (GstIteratorForeachFunction) add_encoder,
+      counters->encoders);
+  gst_object_unref (top);
+
+  counters->frames = g_new0 (gint, counters->encoders->len);
+
+  for (i = 0; i < counters->encoders->len; ++i) {
+    g_autoptr (GstPad) srcpad =
+        gst_element_get_static_pad (counters->encoders->pdata[i], "src");
+
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) count_frame_cb, &counters->frames[i], NULL);
+  }
+}
+
+static gint *
+encoder_counters_snapshot (EncoderCounters * counters)
+{
+  gint *snapshot = g_new0 (gint, counters->encoders->len);
+  guint i;
+
+  for (i = 0; i < counters->encoders->len; ++i) {
+    snapshot[i] = g_atomic_int_get (&counters->frames[i]);
+  }
+
+  return snapshot;
+}
+
+static void
+json_append_string (GString * json, const gchar * str)
+{
+  g_string_append_c (json, '"');
+  for (; *str; ++str) {
+    if (*str == '"' || *str == '\\') {
+      g_string_append_c (json, '\\');
+      g_string_append_c (json, *str);
+    } else if ((guchar) * str < 0x20) {
+      g_string_append_printf (json, "\\u%04x", *str);
+    } else {
+      g_string_append_c (json, *str);
+    }
+  }
+  g_string_append_c (json, '"');
+}
+
+static void
+append_thread_usage (GString * json, GHashTable * start, GHashTable * end,
+    gdouble seconds, guint n_targets)
+{
+  g_autoptr (GHashTable) usage =
+      g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+  gdouble ticks_per_second = sysconf (_SC_CLK_TCK);
+  gdouble total = 0;
+  GHashTableIter iter;
+  gpointer key, value;
+  gboolean first = TRUE;
+
+  /* Threads with the same name, e.g. x264's workers, are summed up. */
+  g_hash_table_iter_init (&iter, end);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    ThreadTimes *end_times = value;
+    ThreadTimes *start_times = g_hash_table_lookup (start, key);
+    guint64 ticks = end_times->ticks;
+    gdouble *percent;
+
+    if (start_times && start_times->ticks <= ticks) {
+      ticks -= start_times->ticks;
+    }
+
+    percent = g_hash_table_lookup (usage, end_times->name);
+    if (percent == NULL) {
+      percent = g_new0 (gdouble, 1);
+      g_hash_table_insert (usage, end_times->name, percent);
+    }
+
+    *percent += ticks / ticks_per_second / seconds * 100;
+    total += ticks / ticks_per_second / seconds * 100;
+  }
+
+  g_string_append_printf (json, "\"cpu_percent\": {\"total\": %.1f, "
+      "\"per_target\": %.1f, ", total, total / n_targets);
+  g_string_append (json, "\"threads\": {");
+
+  g_hash_table_iter_init (&iter, usage);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    if (!first) {
+      g_string_append (json, ", ");
+    }
+    first = FALSE;
+
+    json_append_string (json, key);
+    g_string_append_printf (json, ": %.1f", *(gdouble *) value);
+  }
+
+  g_string_append (json, "}}");
+}
+
+static void
+run_for (guint seconds)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+
+  g_timeout_add_seconds (seconds, (GSourceFunc) g_main_loop_quit, loop);
+  g_main_loop_run (loop);
+}
+
+static void
+run_case (const BenchmarkCase * c, GString * json)
+{
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GPtrArray) receivers = NULL;
+  g_autoptr (GPtrArray) targets = NULL;
+  g_autoptr (GPtrArray) locations = NULL;
+  g_autoptr (GHashTable) start_times = NULL;
+  g_autoptr (GHashTable) end_times = NULL;
+  g_autofree gint *start_frames = NULL;
+  g_autofree gint *end_frames = NULL;
+  EncoderCounters counters = { 0 };
+  gint64 start_time;
+  gdouble seconds;
+  gdouble min_fps = G_MAXDOUBLE;
+  gdouble total_fps = 0;
+  guint64 source_dropped = 0;
+  guint64 queue_dropped = 0;
+  guint i;
+
+  receivers = g_ptr_array_new_with_free_func (gst_object_unref);
+  targets = g_ptr_array_new ();
+  locations = g_ptr_array_new_with_free_func (g_free);
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      c->resolution, c->framerate);
+
+  for (i = 0; i < c->n_targets; ++i) {
+    g_autoptr (GError) error = NULL;
+    GaeguliTarget *target;
+    GVariantDict attr;
+
+    g_variant_dict_init (&attr, NULL);
+    g_variant_dict_insert (&attr, "codec", "i", c->codec);
+    g_variant_dict_insert (&attr, "stream-type", "i",
+        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+    g_variant_dict_insert (&attr, "bitrate", "u",
+        options.shared ? BITRATE : BITRATE + i * 1000);
+
+    if (options.record) {
+      gchar *location = g_build_filename (g_get_tmp_dir (),
+          "gaeguli-benchmark-XXXXXX.ts", NULL);
+
+      g_close (g_mkstemp (location), NULL);
+      g_ptr_array_add (locations, location);
+
+      g_variant_dict_insert (&attr, "is-record", "b", TRUE);
+      g_variant_dict_insert (&attr, "location", "s", location);
+    } else {
+      g_autofree gchar *uri =
+          g_strdup_printf ("srt://127.0.0.1:%u", BASE_PORT + i);
+
+      g_ptr_array_add (receivers,
+          gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER,
+              BASE_PORT + i));
+
+      g_variant_dict_insert (&attr, "uri", "s", uri);
+    }
+
+    target = gaeguli_pipeline_add_target_full (pipeline,
+        g_variant_dict_end (&attr), &error);
+    g_assert_no_error (error);
+
+    gaeguli_target_start (target, &error);
+    g_assert_no_error (error);
+
+    g_ptr_array_add (targets, target);
+  }
+
+  encoder_counters_init (&counters, g_ptr_array_index (targets, 0));
+
+  run_for (WARMUP_SECONDS);
+
+  start_frames = encoder_counters_snapshot (&counters);
+  start_times = read_thread_times ();
+  start_time = g_get_monotonic_time ();
+
+  run_for (options.duration);
+
+  end_frames = encoder_counters_snapshot (&counters);
+  end_times = read_thread_times ();
+  seconds = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+
+  for (i = 0; i < counters.encoders->len; ++i) {
+    gint frames = end_frames[i] - start_frames[i];
+    gdouble expected = c->framerate * seconds;
+
+    min_fps = MIN (min_fps, frames / seconds);
+    total_fps += frames / seconds;
+    if (frames < expected) {
+      source_dropped += expected - frames;
+    }
+  }
+
+  if (!options.record) {
+    for (i = 0; i < targets->len; ++i) {
+      GaeguliTargetStats stats;
+
+      if (gaeguli_target_get_stats_into (g_ptr_array_index (targets, i),
+              &stats, NULL)) {
+        queue_dropped += stats.buffers_dropped;
+      }
+    }
+  }
+
+  g_string_append_printf (json, "    {\"codec\": \"%s\", "
+      "\"resolution\": \"%s\", \"framerate\": %u, \"targets\": %u, "
+      "\"sink\": \"%s\", \"encoders\": %u, ",
+      gaeguli_benchmark_enum_nick (GAEGULI_TYPE_VIDEO_CODEC, c->codec),
+      gaeguli_benchmark_enum_nick (GAEGULI_TYPE_VIDEO_RESOLUTION,
+          c->resolution), c->framerate, c->n_targets,
+      options.record ? "file" : "srt", counters.encoders->len);
+
+  if (counters.encoders->len > 0) {
+    g_string_append_printf (json, "\"fps\": {\"min\": %.2f, \"mean\": %.2f}, ",
+        min_fps, total_fps / counters.encoders->len);
+  } else {
+    g_string_append (json, "\"fps\": null, ");
+  }
+
+  g_string_append_printf (json, "\"frames_dropped\": {\"source\": %"
+      G_GUINT64_FORMAT ", ", source_dropped);
+  if (options.record) {
+    /* Recording targets don't report statistics. */
+    g_string_append (json, "\"queue\": null}, ");
+  } else {
+    g_string_append_printf (json, "\"queue\": %" G_GUINT64_FORMAT "}, ",
+        queue_dropped);
+  }
+
+  append_thread_usage (json, start_times, end_times, seconds, c->n_targets);
+
+  g_string_append_printf (json, ", \"rss_kb\": %" G_GUINT64_FORMAT "}",
+      read_rss_kb ());
+
+  gaeguli_pipeline_stop (pipeline);
+
+  for (i = 0; i < receivers->len; ++i) {
+    gst_element_set_state (g_ptr_array_index (receivers, i), GST_STATE_NULL);
+  }
+
+  for (i = 0; i < locations->len; ++i) {
+    g_unlink (g_ptr_array_index (locations, i));
+  }
+
+  g_ptr_array_unref (counters.encoders);
+  g_free (counters.frames);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr (GOptionContext) context = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GArray) codecs = NULL;
+  g_autoptr (GArray) resolutions = NULL;
+  g_autoptr (GArray) framerates = NULL;
+  g_autoptr (GArray) target_counts = NULL;
+  g_autoptr (GString) json = g_string_new (NULL);
+  GOptionEntry entries[] = {
+    {"duration", 'd', 0, G_OPTION_ARG_INT, &options.duration,
+        "Seconds to measure each case for", NULL},
+    {"codecs", 'c', 0, G_OPTION_ARG_STRING, &options.codecs,
+        "Codecs to measure", "h264-x264,h265-x265"},
+    {"resolutions", 'r', 0, G_OPTION_ARG_STRING, &options.resolutions,
+        "Resolutions to measure", "640x480,1280x720,1920x1080"},
+    {"framerates", 'f', 0, G_OPTION_ARG_STRING, &options.framerates,
+        "Framerates to measure", "15,30"},
+    {"targets", 't', 0, G_OPTION_ARG_STRING, &options.target_counts,
+        "Numbers of targets to measure", "1,2,4"},
+    {"record", 0, 0, G_OPTION_ARG_NONE, &options.record,
+        "Record to files instead of streaming over SRT", NULL},
+    {"shared", 0, 0, G_OPTION_ARG_NONE, &options.shared,
+        "Give all targets the same encoding settings", NULL},
+    {NULL}
+  };
+  gboolean first = TRUE;
+  guint i, j, k, l;
+
+  options.duration = 5;
+  options.codecs = "h264-x264,h265-x265";
+  options.resolutions = "640x480,1280x720,1920x1080";
+  options.framerates = "15,30";
+  options.target_counts = "1,2,4";
+  options.record = FALSE;
+  options.shared = FALSE;
+
+  gst_init (&argc, &argv);
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return -1;
+  }
+
+  codecs = gaeguli_benchmark_parse_enum_list (GAEGULI_TYPE_VIDEO_CODEC,
+      options.codecs);
+  resolutions =
+      gaeguli_benchmark_parse_enum_list (GAEGULI_TYPE_VIDEO_RESOLUTION,
+      options.resolutions);
+  framerates = gaeguli_benchmark_parse_uint_list (options.framerates);
+  target_counts = gaeguli_benchmark_parse_uint_list (options.target_counts);
+
+  if (!codecs || !resolutions || !framerates || !target_counts) {
+    return -1;
+  }
+
+  g_string_append_printf (json, "{\n  \"benchmark\": \"throughput\",\n"
+      "  \"duration\": %d,\n  \"results\": [\n", options.duration);
+
+  for (i = 0; i < codecs->len; ++i) {
+    for (j = 0; j < resolutions->len; ++j) {
+      for (k = 0; k < framerates->len; ++k) {
+        for (l = 0; l < target_counts->len; ++l) {
+          BenchmarkCase c;
+
+          c.codec = g_array_index (codecs, gint, i);
+          c.resolution = g_array_index (resolutions, gint, j);
+          c.framerate = g_array_index (framerates, guint, k);
+          c.n_targets = g_array_index (target_counts, guint, l);
+
+          if (c.n_targets == 0) {
+            continue;
+          }
+
+          if (!first) {
+            g_string_append (json, ",\n");
+          }
+          first = FALSE;
+
+          run_case (&c, json);
+        }
+      }
+    }
+  }
+
+  g_string_append (json, "\n  ]\n}\n");
+
+  g_print ("%s", json->str);
+
+  return 0;
+}
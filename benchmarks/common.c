@@ -0,0 +1,73 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "common.h"
+
+const gchar *
+gaeguli_benchmark_enum_nick (GType type, gint value)
+{
+  g_autoptr (GEnumClass) enum_class = g_type_class_ref (type);
+
+  return g_enum_get_value (enum_class, value)->value_nick;
+}
+
+/* Parses a comma separated list of enum nicks. */
+GArray *
+gaeguli_benchmark_parse_enum_list (GType type, const gchar * list)
+{
+  g_autoptr (GEnumClass) enum_class = g_type_class_ref (type);
+  g_auto (GStrv) nicks = g_strsplit (list, ",", -1);
+  GArray *values = g_array_new (FALSE, FALSE, sizeof (gint));
+  gchar **nick;
+
+  for (nick = nicks; *nick; ++nick) {
+    GEnumValue *value = g_enum_get_value_by_nick (enum_class, *nick);
+
+    if (value == NULL) {
+      g_printerr ("Unknown value '%s'\n", *nick);
+      g_array_unref (values);
+      return NULL;
+    }
+
+    g_array_append_val (values, value->value);
+  }
+
+  return values;
+}
+
+GArray *
+gaeguli_benchmark_parse_uint_list (const gchar * list)
+{
+  g_auto (GStrv) items = g_strsplit (list, ",", -1);
+  GArray *values = g_array_new (FALSE, FALSE, sizeof (guint));
+  gchar **item;
+
+  for (item = items; *item; ++item) {
+    gchar *end;
+    guint value = g_ascii_strtoull (*item, &end, 10);
+
+    if (**item == '\0' || *end != '\0') {
+      g_printerr ("Invalid number '%s'\n", *item);
+      g_array_unref (values);
+      return NULL;
+    }
+
+    g_array_append_val (values, value);
+  }
+
+  return values;
+}
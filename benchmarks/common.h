@@ -0,0 +1,33 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_BENCHMARK_COMMON_H__
+#define __GAEGULI_BENCHMARK_COMMON_H__
+
+#include <gaeguli/gaeguli.h>
+
+const gchar      *gaeguli_benchmark_enum_nick   (GType type,
+                                                 gint value);
+
+GArray           *gaeguli_benchmark_parse_enum_list
+                                                (GType type,
+                                                 const gchar *list);
+
+GArray           *gaeguli_benchmark_parse_uint_list
+                                                (const gchar *list);
+
+#endif // __GAEGULI_BENCHMARK_COMMON_H__
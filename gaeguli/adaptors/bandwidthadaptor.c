@@ -59,6 +59,35 @@ gaeguli_bandwidth_adaptor_on_enabled (GaeguliStreamAdaptor * adaptor)
   }
 }
 
+/* A listener's encoder serves all its callers, so it has to fit the slowest
+ * one. Targets with renditions give slow callers an encode of their own. */
+static gboolean
+_get_bandwidth (GstStructure * stats, gdouble * bandwidth)
+{
+  gboolean found = FALSE;
+
+  if (gst_structure_has_field (stats, "callers")) {
+    GValueArray *array;
+    guint i;
+
+    array = g_value_get_boxed (gst_structure_get_value (stats, "callers"));
+
+    for (i = 0; i < array->n_values; ++i) {
+      GstStructure *caller = g_value_get_boxed (&array->values[i]);
+      gdouble val;
+
+      if (gst_structure_get_double (caller, "bandwidth-mbps", &val)) {
+        *bandwidth = found ? MIN (*bandwidth, val) : val;
+        found = TRUE;
+      }
+    }
+  } else {
+    found = gst_structure_get_double (stats, "bandwidth-mbps", bandwidth);
+  }
+
+  return found;
+}
+
 static void
 gaeguli_bandwidth_adaptor_on_stats (GaeguliStreamAdaptor * adaptor,
     GstStructure * stats)
@@ -76,14 +105,7 @@ gaeguli_bandwidth_adaptor_on_stats (GaeguliStreamAdaptor * adaptor,
     }
   }
 
-  if (gst_structure_has_field (stats, "callers")) {
-    GValueArray *array;
-
-    array = g_value_get_boxed (gst_structure_get_value (stats, "callers"));
-    stats = g_value_get_boxed (&array->values[array->n_values - 1]);
-  }
-
-  if (gst_structure_get_double (stats, "bandwidth-mbps", &srt_bandwidth)) {
+  if (_get_bandwidth (stats, &srt_bandwidth)) {
     gint new_bitrate = self->current_bitrate;
 
     /* Convert to bits per second */
@@ -0,0 +1,286 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <adaptors/delaygradientadaptor.h>
+
+/* Length of the window the delay trend is measured over. */
+#define WINDOW_MS               500
+#define MIN_WINDOW_SAMPLES      3
+#define MAX_WINDOW_SAMPLES      64
+
+/* The delay is rising when the trend predicts it grew by more than this
+ * across the window, and is flat when it changed by less than that. */
+#define OVERUSE_DELAY_MS        10.0
+#define FLAT_DELAY_MS           3.0
+
+#define DECREASE_FACTOR         0.85
+#define INCREASE_FACTOR         1.08
+#define MIN_BITRATE             100000
+
+struct _GaeguliDelayGradientStreamAdaptor
+{
+  GaeguliStreamAdaptor parent;
+
+  guint current_bitrate;
+
+  gdouble delays[MAX_WINDOW_SAMPLES];
+  guint n_delays;
+  guint next_delay;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (GaeguliDelayGradientStreamAdaptor,
+    gaeguli_delay_gradient_stream_adaptor, GAEGULI_TYPE_STREAM_ADAPTOR)
+/* *INDENT-ON* */
+
+GaeguliStreamAdaptor *
+gaeguli_delay_gradient_stream_adaptor_new (GstElement * srtsink,
+    GstStructure * baseline_parameters)
+{
+  g_return_val_if_fail (srtsink != NULL, NULL);
+
+  return g_object_new (GAEGULI_TYPE_DELAY_GRADIENT_STREAM_ADAPTOR,
+      "srtsink", srtsink, "baseline-parameters", baseline_parameters, NULL);
+}
+
+static guint
+_get_window_samples (GaeguliDelayGradientStreamAdaptor * self)
+{
+  guint interval;
+
+  g_object_get (self, "stats-interval", &interval, NULL);
+
+  return CLAMP (WINDOW_MS / MAX (interval, 1), MIN_WINDOW_SAMPLES,
+      MAX_WINDOW_SAMPLES);
+}
+
+static void
+_reset_window (GaeguliDelayGradientStreamAdaptor * self)
+{
+  self->n_delays = 0;
+  self->next_delay = 0;
+}
+
+/* Least squares fit of the delays in the window, in milliseconds of change
+ * per sample. */
+static gdouble
+_get_delay_slope (GaeguliDelayGradientStreamAdaptor * self)
+{
+  guint first = (self->next_delay + MAX_WINDOW_SAMPLES - self->n_delays) %
+      MAX_WINDOW_SAMPLES;
+  gdouble mean_x = (self->n_delays - 1) / 2.0;
+  gdouble mean_y = 0;
+  gdouble num = 0;
+  gdouble den = 0;
+  guint i;
+
+  for (i = 0; i < self->n_delays; ++i) {
+    mean_y += self->delays[(first + i) % MAX_WINDOW_SAMPLES];
+  }
+  mean_y /= self->n_delays;
+
+  for (i = 0; i < self->n_delays; ++i) {
+    gdouble y = self->delays[(first + i) % MAX_WINDOW_SAMPLES];
+
+    num += (i - mean_x) * (y - mean_y);
+    den += (i - mean_x) * (i - mean_x);
+  }
+
+  return den > 0 ? num / den : 0;
+}
+
+/* Queued data waits in the send buffer before it shows in the RTT. */
+static gboolean
+_get_caller_delay_ms (const GstStructure * stats, gdouble * delay_ms)
+{
+  gint send_buffer_ms = 0;
+  gdouble rtt_ms;
+
+  if (!gst_structure_get_double (stats, "rtt-ms", &rtt_ms)) {
+    return FALSE;
+  }
+
+  gst_structure_get_int (stats, "send-buffer-ms", &send_buffer_ms);
+  *delay_ms = rtt_ms + send_buffer_ms;
+
+  return TRUE;
+}
+
+/* A listener's encoder serves all of its callers, so it has to follow the
+ * one whose delay is the highest. */
+static gboolean
+_get_delay_ms (GstStructure * stats, gdouble * delay_ms)
+{
+  gboolean found = FALSE;
+
+  if (gst_structure_has_field (stats, "callers")) {
+    GValueArray *array;
+    guint i;
+
+    array = g_value_get_boxed (gst_structure_get_value (stats, "callers"));
+
+    for (i = 0; i < array->n_values; ++i) {
+      GstStructure *caller = g_value_get_boxed (&array->values[i]);
+      gdouble val;
+
+      if (_get_caller_delay_ms (caller, &val)) {
+        *delay_ms = found ? MAX (*delay_ms, val) : val;
+        found = TRUE;
+      }
+    }
+  } else {
+    found = _get_caller_delay_ms (stats, delay_ms);
+  }
+
+  return found;
+}
+
+static void
+_set_bitrate (GaeguliDelayGradientStreamAdaptor * self, guint bitrate)
+{
+  if (self->current_bitrate == bitrate) {
+    return;
+  }
+
+  g_debug ("Changing bitrate from %u to %u", self->current_bitrate, bitrate);
+
+  self->current_bitrate = bitrate;
+
+  gaeguli_stream_adaptor_signal_encoding_parameters (GAEGULI_STREAM_ADAPTOR
+      (self), GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, bitrate, NULL);
+}
+
+static void
+gaeguli_delay_gradient_adaptor_on_enabled (GaeguliStreamAdaptor * adaptor)
+{
+  GaeguliDelayGradientStreamAdaptor *self =
+      GAEGULI_DELAY_GRADIENT_STREAM_ADAPTOR (adaptor);
+
+  /* Like the bandwidth adaptor, operate only in constant bitrate mode. */
+  gaeguli_stream_adaptor_signal_encoding_parameters (adaptor,
+      GAEGULI_ENCODING_PARAMETER_RATECTRL,
+      GAEGULI_TYPE_VIDEO_BITRATE_CONTROL, GAEGULI_VIDEO_BITRATE_CONTROL_CBR,
+      NULL);
+
+  if (!gaeguli_stream_adaptor_get_baseline_parameter_uint (adaptor,
+          GAEGULI_ENCODING_PARAMETER_BITRATE, &self->current_bitrate)) {
+    g_warning ("Couldn't read baseline bitrate");
+  }
+
+  _reset_window (self);
+}
+
+static void
+gaeguli_delay_gradient_adaptor_on_stats (GaeguliStreamAdaptor * adaptor,
+    GstStructure * stats)
+{
+  GaeguliDelayGradientStreamAdaptor *self =
+      GAEGULI_DELAY_GRADIENT_STREAM_ADAPTOR (adaptor);
+  guint baseline_bitrate = G_MAXUINT;
+  guint window_samples;
+  gdouble delay_ms;
+  gdouble change;
+
+  if (self->current_bitrate == 0) {
+    if (!gaeguli_stream_adaptor_get_baseline_parameter_uint (adaptor,
+            GAEGULI_ENCODING_PARAMETER_BITRATE, &self->current_bitrate)) {
+      g_warning ("Couldn't read baseline bitrate");
+      return;
+    }
+  }
+
+  if (!_get_delay_ms (stats, &delay_ms)) {
+    return;
+  }
+
+  window_samples = _get_window_samples (self);
+
+  self->delays[self->next_delay] = delay_ms;
+  self->next_delay = (self->next_delay + 1) % MAX_WINDOW_SAMPLES;
+  self->n_delays = MIN (self->n_delays + 1, window_samples);
+
+  if (self->n_delays < window_samples) {
+    return;
+  }
+
+  /* How much the delay changed across the window according to its trend. */
+  change = _get_delay_slope (self) * (window_samples - 1);
+
+  gaeguli_stream_adaptor_get_baseline_parameter_uint (adaptor,
+      GAEGULI_ENCODING_PARAMETER_BITRATE, &baseline_bitrate);
+
+  if (change > OVERUSE_DELAY_MS) {
+    g_debug ("Queueing delay rose by %.1f ms", change);
+
+    _set_bitrate (self, MAX (self->current_bitrate * DECREASE_FACTOR,
+            MIN (MIN_BITRATE, baseline_bitrate)));
+  } else if (ABS (change) < FLAT_DELAY_MS &&
+      self->current_bitrate < baseline_bitrate) {
+    _set_bitrate (self, MIN (self->current_bitrate * INCREASE_FACTOR,
+            baseline_bitrate));
+  } else {
+    /* Either the delay is falling as queues drain, or there's nothing to
+     * probe for; keep sliding the window. */
+    return;
+  }
+
+  /* Judge the effect of the change on a fresh window. */
+  _reset_window (self);
+}
+
+static void
+gaeguli_delay_gradient_adaptor_on_baseline_update (GaeguliStreamAdaptor *
+    adaptor, GstStructure * baseline_params)
+{
+  GaeguliDelayGradientStreamAdaptor *self =
+      GAEGULI_DELAY_GRADIENT_STREAM_ADAPTOR (adaptor);
+  guint new_bitrate;
+
+  if (!baseline_params || !gst_structure_get_uint (baseline_params,
+          GAEGULI_ENCODING_PARAMETER_BITRATE, &new_bitrate)) {
+    return;
+  }
+
+  if (new_bitrate < self->current_bitrate || self->current_bitrate == 0) {
+    self->current_bitrate = new_bitrate;
+
+    if (gaeguli_stream_adaptor_is_enabled (adaptor)) {
+      gaeguli_stream_adaptor_signal_encoding_parameters (adaptor,
+          GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT,
+          self->current_bitrate, NULL);
+    }
+  }
+}
+
+static void
+gaeguli_delay_gradient_stream_adaptor_init (GaeguliDelayGradientStreamAdaptor
+    * self)
+{
+}
+
+static void
+gaeguli_delay_gradient_stream_adaptor_class_init
+    (GaeguliDelayGradientStreamAdaptorClass * klass)
+{
+  GaeguliStreamAdaptorClass *streamadaptor_class =
+      GAEGULI_STREAM_ADAPTOR_CLASS (klass);
+
+  streamadaptor_class->on_enabled = gaeguli_delay_gradient_adaptor_on_enabled;
+  streamadaptor_class->on_stats = gaeguli_delay_gradient_adaptor_on_stats;
+  streamadaptor_class->on_baseline_update =
+      gaeguli_delay_gradient_adaptor_on_baseline_update;
+}
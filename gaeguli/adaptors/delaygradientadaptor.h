@@ -0,0 +1,48 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_DELAY_GRADIENT_STREAM_ADAPTOR_H__
+#define __GAEGULI_DELAY_GRADIENT_STREAM_ADAPTOR_H__
+
+#include "gaeguli/gaeguli.h"
+
+G_BEGIN_DECLS
+
+#define GAEGULI_TYPE_DELAY_GRADIENT_STREAM_ADAPTOR   (gaeguli_delay_gradient_stream_adaptor_get_type ())
+G_DECLARE_FINAL_TYPE (GaeguliDelayGradientStreamAdaptor, gaeguli_delay_gradient_stream_adaptor, GAEGULI,
+    DELAY_GRADIENT_STREAM_ADAPTOR, GaeguliStreamAdaptor)
+
+/**
+ * gaeguli_delay_gradient_stream_adaptor_new:
+ * @srtsink: a #GstSrtSink element to collect data from
+ * @baseline_parameters: baseline encoding parameters
+ *
+ * Creates a stream adaptor that follows the trend of the queueing delay,
+ * i.e. the round-trip time plus the time the data waits in SRT's send buffer.
+ * The adaptor lowers the bitrate as soon as the delay starts to rise, before
+ * the network begins to lose packets, and raises it back towards the baseline
+ * bitrate while the delay stays flat.
+ *
+ * Returns: a #GaeguliStreamAdaptor instance
+ */
+GaeguliStreamAdaptor     *gaeguli_delay_gradient_stream_adaptor_new
+                                                (GstElement            *srtsink,
+                                                 GstStructure          *baseline_parameters);
+
+G_END_DECLS
+
+#endif // __GAEGULI_DELAY_GRADIENT_STREAM_ADAPTOR_H__
@@ -0,0 +1,421 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <adaptors/ladderadaptor.h>
+
+#include <stdio.h>
+
+#define DEFAULT_LADDER \
+    "1920x1080@30:4000,1280x720@30:2500,1280x720@15:1200,640x480@15:500"
+
+/* Same headroom over SRT's estimate as the bandwidth adaptor takes. */
+#define BANDWIDTH_FACTOR        1.2
+
+/* Stepping up needs a margin over the rung's minimum bitrate, held for this
+ * long, so that the adaptor doesn't flap between two rungs. */
+#define UPGRADE_MARGIN          1.25
+#define UPGRADE_HOLD_MS         3000
+
+/* Smaller bitrate changes within a rung aren't worth signalling. */
+#define BITRATE_TOLERANCE       0.1
+
+typedef struct
+{
+  guint width;
+  guint height;
+  guint framerate;
+  guint min_bitrate;
+} Rung;
+
+struct _GaeguliLadderStreamAdaptor
+{
+  GaeguliStreamAdaptor parent;
+
+  gchar *ladder;
+  GArray *rungs;
+
+  gint current_rung;
+  guint current_bitrate;
+  gdouble estimate;
+  guint n_up;
+};
+
+enum
+{
+  PROP_LADDER = 1,
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (GaeguliLadderStreamAdaptor, gaeguli_ladder_stream_adaptor,
+    GAEGULI_TYPE_STREAM_ADAPTOR)
+/* *INDENT-ON* */
+
+GaeguliStreamAdaptor *
+gaeguli_ladder_stream_adaptor_new (GstElement * srtsink,
+    GstStructure * baseline_parameters)
+{
+  g_return_val_if_fail (srtsink != NULL, NULL);
+
+  return g_object_new (GAEGULI_TYPE_LADDER_STREAM_ADAPTOR,
+      "srtsink", srtsink, "baseline-parameters", baseline_parameters, NULL);
+}
+
+static GArray *
+_parse_ladder (const gchar * ladder)
+{
+  g_autoptr (GArray) rungs = g_array_new (FALSE, FALSE, sizeof (Rung));
+  g_auto (GStrv) tokens = g_strsplit (ladder, ",", -1);
+  gchar **it;
+
+  for (it = tokens; *it; ++it) {
+    Rung rung;
+
+    if (sscanf (*it, " %ux%u@%u:%u", &rung.width, &rung.height,
+            &rung.framerate, &rung.min_bitrate) != 4 || rung.width == 0 ||
+        rung.height == 0 || rung.framerate == 0) {
+      return NULL;
+    }
+
+    rung.min_bitrate *= 1000;
+    g_array_append_val (rungs, rung);
+  }
+
+  return rungs->len > 0 ? g_steal_pointer (&rungs) : NULL;
+}
+
+static guint
+_ms_to_samples (GaeguliLadderStreamAdaptor * self, guint ms)
+{
+  guint interval;
+
+  g_object_get (self, "stats-interval", &interval, NULL);
+
+  return MAX (ms / MAX (interval, 1), 1);
+}
+
+/* Rungs above the baseline resolution would only upscale the video. */
+static gboolean
+_rung_fits (GaeguliLadderStreamAdaptor * self, const Rung * rung)
+{
+  GaeguliStreamAdaptor *adaptor = GAEGULI_STREAM_ADAPTOR (self);
+  guint width = 0;
+  guint height = 0;
+
+  gaeguli_stream_adaptor_get_baseline_parameter_uint (adaptor,
+      GAEGULI_ENCODING_PARAMETER_WIDTH, &width);
+  gaeguli_stream_adaptor_get_baseline_parameter_uint (adaptor,
+      GAEGULI_ENCODING_PARAMETER_HEIGHT, &height);
+
+  return width == 0 || height == 0 ||
+      (guint64) rung->width * rung->height <= (guint64) width * height;
+}
+
+/* The best fitting rung whose minimum bitrate times @margin is covered by
+ * @bitrate, or the worst fitting rung if there's none. */
+static gint
+_find_rung (GaeguliLadderStreamAdaptor * self, gdouble bitrate,
+    gdouble margin)
+{
+  gint last = -1;
+  guint i;
+
+  for (i = 0; i < self->rungs->len; ++i) {
+    Rung *rung = &g_array_index (self->rungs, Rung, i);
+
+    if (!_rung_fits (self, rung)) {
+      continue;
+    }
+
+    last = i;
+
+    if (rung->min_bitrate * margin <= bitrate) {
+      break;
+    }
+  }
+
+  return last;
+}
+
+static guint
+_get_top_framerate (GaeguliLadderStreamAdaptor * self)
+{
+  guint framerate = 0;
+  guint i;
+
+  for (i = 0; i < self->rungs->len; ++i) {
+    Rung *rung = &g_array_index (self->rungs, Rung, i);
+
+    if (_rung_fits (self, rung)) {
+      framerate = MAX (framerate, rung->framerate);
+    }
+  }
+
+  return framerate;
+}
+
+/* The lowest bandwidth of all the connected sockets. */
+static gboolean
+_get_bandwidth (GstStructure * stats, gdouble * bandwidth)
+{
+  gboolean found = FALSE;
+
+  if (gst_structure_has_field (stats, "callers")) {
+    GValueArray *array;
+    guint i;
+
+    array = g_value_get_boxed (gst_structure_get_value (stats, "callers"));
+
+    for (i = 0; i < array->n_values; ++i) {
+      GstStructure *caller = g_value_get_boxed (&array->values[i]);
+      gdouble val;
+
+      if (gst_structure_get_double (caller, "bandwidth-mbps", &val)) {
+        *bandwidth = found ? MIN (*bandwidth, val) : val;
+        found = TRUE;
+      }
+    }
+  } else {
+    found = gst_structure_get_double (stats, "bandwidth-mbps", bandwidth);
+  }
+
+  return found;
+}
+
+static void
+_apply_rung (GaeguliLadderStreamAdaptor * self, gint rung_idx, guint bitrate)
+{
+  Rung *rung = &g_array_index (self->rungs, Rung, rung_idx);
+  guint framerate = rung->framerate;
+
+  if (rung_idx != self->current_rung) {
+    g_debug ("Moving to %ux%u@%u", rung->width, rung->height, framerate);
+    self->n_up = 0;
+  }
+
+  self->current_rung = rung_idx;
+  self->current_bitrate = bitrate;
+
+  if (framerate == _get_top_framerate (self)) {
+    /* Don't cap what the video source delivers. */
+    framerate = 0;
+  }
+
+  gaeguli_stream_adaptor_signal_encoding_parameters (GAEGULI_STREAM_ADAPTOR
+      (self), GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, bitrate,
+      GAEGULI_ENCODING_PARAMETER_WIDTH, G_TYPE_UINT, rung->width,
+      GAEGULI_ENCODING_PARAMETER_HEIGHT, G_TYPE_UINT, rung->height,
+      GAEGULI_ENCODING_PARAMETER_FRAMERATE, G_TYPE_UINT, framerate, NULL);
+}
+
+/* With @force, jumps straight to the rung the estimate allows and signals
+ * the parameters even if nothing seems to change. */
+static void
+_update (GaeguliLadderStreamAdaptor * self, gboolean force)
+{
+  GaeguliStreamAdaptor *adaptor = GAEGULI_STREAM_ADAPTOR (self);
+  guint baseline_bitrate;
+  guint bitrate;
+  gint down;
+  gint up;
+  gint rung;
+
+  if (!gaeguli_stream_adaptor_get_baseline_parameter_uint (adaptor,
+          GAEGULI_ENCODING_PARAMETER_BITRATE, &baseline_bitrate)) {
+    g_warning ("Couldn't read baseline bitrate");
+    return;
+  }
+
+  down = _find_rung (self, self->estimate, 1.0);
+  if (down < 0) {
+    g_debug ("No rung of the ladder fits the baseline resolution");
+    return;
+  }
+
+  if (self->current_rung < 0) {
+    /* The encoder starts at the baseline, that is on the top rung. */
+    self->current_rung = _find_rung (self, G_MAXDOUBLE, 1.0);
+    self->current_bitrate = baseline_bitrate;
+  }
+
+  up = _find_rung (self, self->estimate, UPGRADE_MARGIN);
+  rung = self->current_rung;
+
+  if (force || down > rung) {
+    rung = down;
+  } else if (up < rung) {
+    if (++self->n_up >= _ms_to_samples (self, UPGRADE_HOLD_MS)) {
+      rung = up;
+    }
+  } else {
+    self->n_up = 0;
+  }
+
+  bitrate = MIN (self->estimate, baseline_bitrate);
+
+  if (force || rung != self->current_rung ||
+      ABS ((gdouble) bitrate - self->current_bitrate) >
+      self->current_bitrate * BITRATE_TOLERANCE ||
+      (bitrate == baseline_bitrate && self->current_bitrate != bitrate)) {
+    _apply_rung (self, rung, bitrate);
+  }
+}
+
+static void
+gaeguli_ladder_adaptor_on_enabled (GaeguliStreamAdaptor * adaptor)
+{
+  GaeguliLadderStreamAdaptor *self = GAEGULI_LADDER_STREAM_ADAPTOR (adaptor);
+
+  /* Like the bandwidth adaptor, operate only in constant bitrate mode. */
+  gaeguli_stream_adaptor_signal_encoding_parameters (adaptor,
+      GAEGULI_ENCODING_PARAMETER_RATECTRL,
+      GAEGULI_TYPE_VIDEO_BITRATE_CONTROL, GAEGULI_VIDEO_BITRATE_CONTROL_CBR,
+      NULL);
+
+  self->current_rung = -1;
+  self->estimate = 0;
+  self->n_up = 0;
+}
+
+static void
+gaeguli_ladder_adaptor_on_stats (GaeguliStreamAdaptor * adaptor,
+    GstStructure * stats)
+{
+  GaeguliLadderStreamAdaptor *self = GAEGULI_LADDER_STREAM_ADAPTOR (adaptor);
+  gdouble bandwidth;
+
+  if (!_get_bandwidth (stats, &bandwidth)) {
+    return;
+  }
+
+  self->estimate = bandwidth * 1e6 * BANDWIDTH_FACTOR;
+
+  _update (self, FALSE);
+}
+
+static void
+gaeguli_ladder_adaptor_on_baseline_update (GaeguliStreamAdaptor * adaptor,
+    GstStructure * baseline_params)
+{
+  GaeguliLadderStreamAdaptor *self = GAEGULI_LADDER_STREAM_ADAPTOR (adaptor);
+
+  /* The new baseline may rule out rungs or change the bitrate cap. */
+  if (baseline_params && self->estimate > 0 &&
+      gaeguli_stream_adaptor_is_enabled (adaptor)) {
+    _update (self, TRUE);
+  }
+}
+
+static void
+gaeguli_ladder_stream_adaptor_init (GaeguliLadderStreamAdaptor * self)
+{
+  self->ladder = g_strdup (DEFAULT_LADDER);
+  self->rungs = _parse_ladder (self->ladder);
+  self->current_rung = -1;
+}
+
+static void
+gaeguli_ladder_stream_adaptor_set_ladder (GaeguliLadderStreamAdaptor * self,
+    const gchar * ladder)
+{
+  GArray *rungs;
+
+  if (!ladder || !(rungs = _parse_ladder (ladder))) {
+    g_warning ("Invalid ladder \"%s\"", GST_STR_NULL (ladder));
+    return;
+  }
+
+  g_free (self->ladder);
+  self->ladder = g_strdup (ladder);
+  g_array_unref (self->rungs);
+  self->rungs = rungs;
+
+  /* Rung indices of the old ladder are meaningless now. */
+  self->current_rung = -1;
+  self->n_up = 0;
+
+  if (self->estimate > 0 &&
+      gaeguli_stream_adaptor_is_enabled (GAEGULI_STREAM_ADAPTOR (self))) {
+    _update (self, TRUE);
+  }
+}
+
+static void
+gaeguli_ladder_stream_adaptor_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec)
+{
+  GaeguliLadderStreamAdaptor *self = GAEGULI_LADDER_STREAM_ADAPTOR (object);
+
+  switch (property_id) {
+    case PROP_LADDER:
+      gaeguli_ladder_stream_adaptor_set_ladder (self,
+          g_value_get_string (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+gaeguli_ladder_stream_adaptor_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec)
+{
+  GaeguliLadderStreamAdaptor *self = GAEGULI_LADDER_STREAM_ADAPTOR (object);
+
+  switch (property_id) {
+    case PROP_LADDER:
+      g_value_set_string (value, self->ladder);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+gaeguli_ladder_stream_adaptor_finalize (GObject * object)
+{
+  GaeguliLadderStreamAdaptor *self = GAEGULI_LADDER_STREAM_ADAPTOR (object);
+
+  g_clear_pointer (&self->ladder, g_free);
+  g_clear_pointer (&self->rungs, g_array_unref);
+
+  G_OBJECT_CLASS (gaeguli_ladder_stream_adaptor_parent_class)->finalize
+      (object);
+}
+
+static void
+gaeguli_ladder_stream_adaptor_class_init (GaeguliLadderStreamAdaptorClass *
+    klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GaeguliStreamAdaptorClass *streamadaptor_class =
+      GAEGULI_STREAM_ADAPTOR_CLASS (klass);
+
+  gobject_class->set_property = gaeguli_ladder_stream_adaptor_set_property;
+  gobject_class->get_property = gaeguli_ladder_stream_adaptor_get_property;
+  gobject_class->finalize = gaeguli_ladder_stream_adaptor_finalize;
+
+  streamadaptor_class->on_enabled = gaeguli_ladder_adaptor_on_enabled;
+  streamadaptor_class->on_stats = gaeguli_ladder_adaptor_on_stats;
+  streamadaptor_class->on_baseline_update =
+      gaeguli_ladder_adaptor_on_baseline_update;
+
+  g_object_class_install_property (gobject_class, PROP_LADDER,
+      g_param_spec_string ("ladder", "Resolution and framerate ladder",
+          "Comma separated WIDTHxHEIGHT@FPS:KBPS rungs from the best to the "
+          "worst, KBPS being the least bitrate the rung is used at",
+          DEFAULT_LADDER, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
@@ -0,0 +1,53 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_LADDER_STREAM_ADAPTOR_H__
+#define __GAEGULI_LADDER_STREAM_ADAPTOR_H__
+
+#include "gaeguli/gaeguli.h"
+
+G_BEGIN_DECLS
+
+#define GAEGULI_TYPE_LADDER_STREAM_ADAPTOR   (gaeguli_ladder_stream_adaptor_get_type ())
+G_DECLARE_FINAL_TYPE (GaeguliLadderStreamAdaptor, gaeguli_ladder_stream_adaptor, GAEGULI,
+    LADDER_STREAM_ADAPTOR, GaeguliStreamAdaptor)
+
+/**
+ * gaeguli_ladder_stream_adaptor_new:
+ * @srtsink: a #GstSrtSink element to collect data from
+ * @baseline_parameters: baseline encoding parameters
+ *
+ * Creates a stream adaptor that walks a ladder of resolutions and framerates
+ * according to the bandwidth SRT estimates, e.g. from 1080p30 through 720p30
+ * and 720p15 down to 480p15. Each rung of the "ladder" property is written as
+ * `WIDTHxHEIGHT@FPS:KBPS`, where KBPS is the least bitrate the rung looks
+ * good at, and the rungs are ordered from the best to the worst. Rungs larger
+ * than the baseline resolution are skipped.
+ *
+ * The adaptor steps down as soon as the bandwidth drops and back up only
+ * after the bandwidth has stayed high enough for a while. Within a rung, it
+ * follows the bandwidth with the bitrate like the bandwidth adaptor does.
+ *
+ * Returns: a #GaeguliStreamAdaptor instance
+ */
+GaeguliStreamAdaptor     *gaeguli_ladder_stream_adaptor_new
+                                                (GstElement            *srtsink,
+                                                 GstStructure          *baseline_parameters);
+
+G_END_DECLS
+
+#endif // __GAEGULI_LADDER_STREAM_ADAPTOR_H__
@@ -0,0 +1,287 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <adaptors/sendbufferadaptor.h>
+
+/* srtsink's default when the sink doesn't tell. */
+#define DEFAULT_SRT_LATENCY_MS  125
+#define DEFAULT_BUFFER_FRACTION 0.25
+
+/* How long the buffer has to stay above the target level before the next
+ * stage, and below half of it before going a stage back. */
+#define ESCALATE_MS             200
+#define RECOVER_MS              2000
+
+#define BITRATE_FACTOR          0.75
+#define FRAME_SKIP              3
+#define FRAMERATE_DIVISOR       2
+
+typedef enum
+{
+  STAGE_NONE,
+  STAGE_BITRATE,
+  STAGE_FRAME_SKIP,
+  STAGE_FRAMERATE,
+} Stage;
+
+struct _GaeguliSendBufferStreamAdaptor
+{
+  GaeguliStreamAdaptor parent;
+
+  gdouble buffer_fraction;
+
+  Stage stage;
+  guint n_over;
+  guint n_under;
+};
+
+enum
+{
+  PROP_BUFFER_FRACTION = 1,
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (GaeguliSendBufferStreamAdaptor,
+    gaeguli_send_buffer_stream_adaptor, GAEGULI_TYPE_STREAM_ADAPTOR)
+/* *INDENT-ON* */
+
+GaeguliStreamAdaptor *
+gaeguli_send_buffer_stream_adaptor_new (GstElement * srtsink,
+    GstStructure * baseline_parameters)
+{
+  g_return_val_if_fail (srtsink != NULL, NULL);
+
+  return g_object_new (GAEGULI_TYPE_SEND_BUFFER_STREAM_ADAPTOR,
+      "srtsink", srtsink, "baseline-parameters", baseline_parameters, NULL);
+}
+
+static guint
+_get_srt_latency_ms (GaeguliSendBufferStreamAdaptor * self)
+{
+  g_autoptr (GstElement) srtsink = NULL;
+  gint latency = DEFAULT_SRT_LATENCY_MS;
+
+  g_object_get (self, "srtsink", &srtsink, NULL);
+
+  if (srtsink &&
+      g_object_class_find_property (G_OBJECT_GET_CLASS (srtsink), "latency")) {
+    g_object_get (srtsink, "latency", &latency, NULL);
+  }
+
+  return MAX (latency, 1);
+}
+
+static guint
+_ms_to_samples (GaeguliSendBufferStreamAdaptor * self, guint ms)
+{
+  guint interval;
+
+  g_object_get (self, "stats-interval", &interval, NULL);
+
+  return MAX (ms / MAX (interval, 1), 1);
+}
+
+/* The fullest send buffer of all the connected sockets. */
+static gboolean
+_get_send_buffer_ms (GstStructure * stats, gint * send_buffer_ms)
+{
+  gboolean found = FALSE;
+
+  *send_buffer_ms = 0;
+
+  if (gst_structure_has_field (stats, "callers")) {
+    GValueArray *array;
+    guint i;
+
+    array = g_value_get_boxed (gst_structure_get_value (stats, "callers"));
+
+    for (i = 0; i < array->n_values; ++i) {
+      GstStructure *caller = g_value_get_boxed (&array->values[i]);
+      gint val;
+
+      if (gst_structure_get_int (caller, "send-buffer-ms", &val)) {
+        *send_buffer_ms = MAX (*send_buffer_ms, val);
+        found = TRUE;
+      }
+    }
+  } else {
+    found = gst_structure_get_int (stats, "send-buffer-ms", send_buffer_ms);
+  }
+
+  return found;
+}
+
+static void
+_apply_stage (GaeguliSendBufferStreamAdaptor * self)
+{
+  GaeguliStreamAdaptor *adaptor = GAEGULI_STREAM_ADAPTOR (self);
+  guint bitrate;
+
+  if (!gaeguli_stream_adaptor_get_baseline_parameter_uint (adaptor,
+          GAEGULI_ENCODING_PARAMETER_BITRATE, &bitrate)) {
+    g_warning ("Couldn't read baseline bitrate");
+    return;
+  }
+
+  if (self->stage >= STAGE_BITRATE) {
+    bitrate *= BITRATE_FACTOR;
+  }
+
+  g_debug ("Send buffer adaptor at stage %d", self->stage);
+
+  /* Always send all the parameters; each stage replaces the previous one. */
+  gaeguli_stream_adaptor_signal_encoding_parameters (adaptor,
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, bitrate,
+      GAEGULI_ENCODING_PARAMETER_FRAME_SKIP, G_TYPE_UINT,
+      self->stage == STAGE_FRAME_SKIP ? FRAME_SKIP : 0,
+      GAEGULI_ENCODING_PARAMETER_FRAMERATE_DIVISOR, G_TYPE_UINT,
+      self->stage == STAGE_FRAMERATE ? FRAMERATE_DIVISOR : 0, NULL);
+}
+
+static void
+gaeguli_send_buffer_adaptor_on_enabled (GaeguliStreamAdaptor * adaptor)
+{
+  GaeguliSendBufferStreamAdaptor *self =
+      GAEGULI_SEND_BUFFER_STREAM_ADAPTOR (adaptor);
+
+  /* Like the bandwidth adaptor, operate only in constant bitrate mode. */
+  gaeguli_stream_adaptor_signal_encoding_parameters (adaptor,
+      GAEGULI_ENCODING_PARAMETER_RATECTRL,
+      GAEGULI_TYPE_VIDEO_BITRATE_CONTROL, GAEGULI_VIDEO_BITRATE_CONTROL_CBR,
+      NULL);
+
+  self->stage = STAGE_NONE;
+  self->n_over = 0;
+  self->n_under = 0;
+}
+
+static void
+gaeguli_send_buffer_adaptor_on_stats (GaeguliStreamAdaptor * adaptor,
+    GstStructure * stats)
+{
+  GaeguliSendBufferStreamAdaptor *self =
+      GAEGULI_SEND_BUFFER_STREAM_ADAPTOR (adaptor);
+  gdouble target_ms;
+  gint send_buffer_ms;
+
+  if (!_get_send_buffer_ms (stats, &send_buffer_ms)) {
+    return;
+  }
+
+  target_ms = _get_srt_latency_ms (self) * self->buffer_fraction;
+
+  if (send_buffer_ms > target_ms) {
+    self->n_under = 0;
+
+    if (++self->n_over >= _ms_to_samples (self, ESCALATE_MS) &&
+        self->stage < STAGE_FRAMERATE) {
+      g_debug ("%d ms in the send buffer, more than %.0f ms", send_buffer_ms,
+          target_ms);
+
+      ++self->stage;
+      self->n_over = 0;
+      _apply_stage (self);
+    }
+  } else if (send_buffer_ms < target_ms / 2) {
+    self->n_over = 0;
+
+    if (++self->n_under >= _ms_to_samples (self, RECOVER_MS) &&
+        self->stage > STAGE_NONE) {
+      --self->stage;
+      self->n_under = 0;
+      _apply_stage (self);
+    }
+  } else {
+    self->n_over = 0;
+    self->n_under = 0;
+  }
+}
+
+static void
+gaeguli_send_buffer_adaptor_on_baseline_update (GaeguliStreamAdaptor *
+    adaptor, GstStructure * baseline_params)
+{
+  GaeguliSendBufferStreamAdaptor *self =
+      GAEGULI_SEND_BUFFER_STREAM_ADAPTOR (adaptor);
+
+  if (baseline_params && self->stage > STAGE_NONE &&
+      gaeguli_stream_adaptor_is_enabled (adaptor)) {
+    /* Scale the reduced bitrate from the new baseline. */
+    _apply_stage (self);
+  }
+}
+
+static void
+gaeguli_send_buffer_stream_adaptor_init (GaeguliSendBufferStreamAdaptor * self)
+{
+  self->buffer_fraction = DEFAULT_BUFFER_FRACTION;
+}
+
+static void
+gaeguli_send_buffer_stream_adaptor_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec)
+{
+  GaeguliSendBufferStreamAdaptor *self =
+      GAEGULI_SEND_BUFFER_STREAM_ADAPTOR (object);
+
+  switch (property_id) {
+    case PROP_BUFFER_FRACTION:
+      self->buffer_fraction = g_value_get_double (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+gaeguli_send_buffer_stream_adaptor_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec)
+{
+  GaeguliSendBufferStreamAdaptor *self =
+      GAEGULI_SEND_BUFFER_STREAM_ADAPTOR (object);
+
+  switch (property_id) {
+    case PROP_BUFFER_FRACTION:
+      g_value_set_double (value, self->buffer_fraction);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+gaeguli_send_buffer_stream_adaptor_class_init
+    (GaeguliSendBufferStreamAdaptorClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GaeguliStreamAdaptorClass *streamadaptor_class =
+      GAEGULI_STREAM_ADAPTOR_CLASS (klass);
+
+  gobject_class->set_property = gaeguli_send_buffer_stream_adaptor_set_property;
+  gobject_class->get_property = gaeguli_send_buffer_stream_adaptor_get_property;
+
+  streamadaptor_class->on_enabled = gaeguli_send_buffer_adaptor_on_enabled;
+  streamadaptor_class->on_stats = gaeguli_send_buffer_adaptor_on_stats;
+  streamadaptor_class->on_baseline_update =
+      gaeguli_send_buffer_adaptor_on_baseline_update;
+
+  g_object_class_install_property (gobject_class, PROP_BUFFER_FRACTION,
+      g_param_spec_double ("buffer-fraction", "Send buffer fraction",
+          "Part of the SRT latency the data may wait in the send buffer",
+          0.01, 1.0, DEFAULT_BUFFER_FRACTION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
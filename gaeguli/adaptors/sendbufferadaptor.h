@@ -0,0 +1,50 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_SEND_BUFFER_STREAM_ADAPTOR_H__
+#define __GAEGULI_SEND_BUFFER_STREAM_ADAPTOR_H__
+
+#include "gaeguli/gaeguli.h"
+
+G_BEGIN_DECLS
+
+#define GAEGULI_TYPE_SEND_BUFFER_STREAM_ADAPTOR   (gaeguli_send_buffer_stream_adaptor_get_type ())
+G_DECLARE_FINAL_TYPE (GaeguliSendBufferStreamAdaptor, gaeguli_send_buffer_stream_adaptor, GAEGULI,
+    SEND_BUFFER_STREAM_ADAPTOR, GaeguliStreamAdaptor)
+
+/**
+ * gaeguli_send_buffer_stream_adaptor_new:
+ * @srtsink: a #GstSrtSink element to collect data from
+ * @baseline_parameters: baseline encoding parameters
+ *
+ * Creates a stream adaptor that keeps the data waiting in SRT's send buffer
+ * below a fraction of the SRT latency, so that SRT doesn't have to drop
+ * packets which are too late to send. While the buffer stays above that
+ * level, the adaptor escalates step by step: it lowers the bitrate, then
+ * skips frames before the encoder, then halves the framerate. Each step is
+ * reported through #GaeguliStreamAdaptor::stream-quality-dropped. Once the
+ * buffer has drained, the steps get reverted in the opposite order.
+ *
+ * Returns: a #GaeguliStreamAdaptor instance
+ */
+GaeguliStreamAdaptor     *gaeguli_send_buffer_stream_adaptor_new
+                                                (GstElement            *srtsink,
+                                                 GstStructure          *baseline_parameters);
+
+G_END_DECLS
+
+#endif // __GAEGULI_SEND_BUFFER_STREAM_ADAPTOR_H__
@@ -0,0 +1,1580 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "encodebranch.h"
+
+#include "types.h"
+#include "encodedframemeta.h"
+#include "gaeguli-internal.h"
+
+#include <gst/video/video.h>
+#include <string.h>
+
+#define DEFAULT_KEYFRAME_MIN_INTERVAL   1000
+#define DEFAULT_FRAMERATE               15
+/* SRT can't recover a lost packet in less than a round trip. */
+#define MIN_SRT_LATENCY_MS              20
+
+#define TS_PACKET_SIZE                  188
+#define TS_PACKETS_PER_SRT_PAYLOAD      7
+
+typedef enum
+{
+  ENCODE_BRANCH_STATE_NEW,
+  ENCODE_BRANCH_STATE_LINKING,
+  ENCODE_BRANCH_STATE_LINKED,
+  ENCODE_BRANCH_STATE_RETIRED,
+} EncodeBranchState;
+
+struct _GaeguliEncodeBranch
+{
+  GObject parent;
+
+  GMutex lock;
+
+  EncodeBranchState state;
+
+  GstElement *bin;
+  GstElement *encoder;
+  /* Encoders of all the renditions; the first one is encoder. */
+  GPtrArray *rendition_encoders;
+  GstElement *tee;
+  GaeguliEncodeBranch *upstream;
+  GstPad *source_pad;
+  GstPad *sinkpad;
+  gulong pending_pad_probe;
+  guint n_legs;
+
+  gchar *key;
+  GVariant *attributes;
+  GstStructure *parameters;
+
+  gint64 last_key_unit_time;
+  guint keyframe_min_interval;
+
+  /* Frames dropped before the encoder, see _frame_drop_probe_cb(). */
+  guint frame_skip;
+  guint framerate_divisor;
+  guint n_frames;
+  gulong frame_drop_probe;
+
+  /* Encoded frame statistics, see _encoded_frame_probe_cb(). */
+  guint64 frames_encoded;
+  gdouble average_qp;
+  gulong encoded_frame_probe;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (GaeguliEncodeBranch, gaeguli_encode_branch, G_TYPE_OBJECT)
+/* *INDENT-ON* */
+
+#define LOCK_BRANCH \
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock)
+
+static void
+gaeguli_encode_branch_init (GaeguliEncodeBranch * self)
+{
+  g_mutex_init (&self->lock);
+  self->state = ENCODE_BRANCH_STATE_NEW;
+  self->keyframe_min_interval = DEFAULT_KEYFRAME_MIN_INTERVAL;
+}
+
+static void
+gaeguli_encode_branch_dispose (GObject * object)
+{
+  GaeguliEncodeBranch *self = GAEGULI_ENCODE_BRANCH (object);
+
+  if (self->frame_drop_probe) {
+    g_autoptr (GstPad) encoder_sinkpad =
+        gst_element_get_static_pad (self->encoder, "sink");
+
+    gst_pad_remove_probe (encoder_sinkpad, self->frame_drop_probe);
+    self->frame_drop_probe = 0;
+  }
+
+  if (self->encoded_frame_probe) {
+    g_autoptr (GstPad) encoder_srcpad =
+        gst_element_get_static_pad (self->encoder, "src");
+
+    gst_pad_remove_probe (encoder_srcpad, self->encoded_frame_probe);
+    self->encoded_frame_probe = 0;
+  }
+
+  gst_clear_object (&self->bin);
+  gst_clear_object (&self->encoder);
+  g_clear_pointer (&self->rendition_encoders, g_ptr_array_unref);
+  gst_clear_object (&self->tee);
+  gst_clear_object (&self->source_pad);
+  g_clear_object (&self->upstream);
+  gst_clear_object (&self->sinkpad);
+
+  G_OBJECT_CLASS (gaeguli_encode_branch_parent_class)->dispose (object);
+}
+
+static void
+gaeguli_encode_branch_finalize (GObject * object)
+{
+  GaeguliEncodeBranch *self = GAEGULI_ENCODE_BRANCH (object);
+
+  g_clear_pointer (&self->key, g_free);
+  g_clear_pointer (&self->attributes, g_variant_unref);
+  gst_clear_structure (&self->parameters);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gaeguli_encode_branch_parent_class)->finalize (object);
+}
+
+static void
+gaeguli_encode_branch_class_init (GaeguliEncodeBranchClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->dispose = gaeguli_encode_branch_dispose;
+  gobject_class->finalize = gaeguli_encode_branch_finalize;
+}
+
+typedef struct _pipeline_format_params PipelineFormatParams;
+
+typedef GString *(*PipelineFormatFunc) (PipelineFormatParams * params,
+    guint idr_period);
+
+struct _pipeline_format_params
+{
+  const gchar *enc_str;
+  GaeguliVideoCodec codec;
+  GaeguliVideoStreamType stream_type;
+  PipelineFormatFunc format_func;
+  /* MPEG-TS muxer; the smoothed one when NULL. */
+  const gchar *mux_str;
+};
+
+static GString *
+_format_general_pipeline (PipelineFormatParams * params, guint idr_period)
+{
+  g_autoptr (GString) str = g_string_new (NULL);
+
+  g_string_printf (str, params->enc_str, idr_period);
+  g_string_append_printf (str, " ! ");
+  g_string_append (str,
+      params->mux_str ? params->mux_str : GAEGULI_PIPELINE_MPEGTSMUX_STR);
+
+  g_debug ("format general pipeline[%s]", str->str);
+
+  return g_steal_pointer (&str);
+}
+
+static GString *
+_format_rtp_over_srt_pipeline (PipelineFormatParams * params, guint idr_period)
+{
+  g_autoptr (GString) str = g_string_new (NULL);
+  const gchar *payloader = NULL;
+
+  g_string_printf (str, params->enc_str, idr_period);
+
+  /* append rtp payloader */
+  switch (params->codec) {
+    case GAEGULI_VIDEO_CODEC_H264_X264:
+    case GAEGULI_VIDEO_CODEC_H264_VAAPI:
+    case GAEGULI_VIDEO_CODEC_H264_OMX:
+      payloader = "rtph264pay";
+      break;
+    case GAEGULI_VIDEO_CODEC_H265_X265:
+    case GAEGULI_VIDEO_CODEC_H265_VAAPI:
+    case GAEGULI_VIDEO_CODEC_H265_OMX:
+      payloader = "rtph265pay";
+      break;
+    default:
+      return NULL;
+  }
+
+  /* FIXME: We might want to set properties. */
+  g_string_append_printf (str, " ! %s mtu=1316 config-interval=-1 ", payloader);
+  g_string_append_printf (str,
+      " ! application/x-rtp, payload=96, rate=9000 ! muxsink_first.sink_0 ");
+  g_string_append_printf (str,
+      " appsrc name=appsrc format=time is-live=true do-timestamp=true caps=text/x-raw");
+  g_string_append_printf (str,
+      " ! queue ! rtpgstpay pt=99 mtu=1316 config-interval=1 ! application/x-rtp, payload=99, rate=9000 ! muxsink_first.sink_1 ");
+  g_string_append (str, GAEGULI_PIPELINE_RTPMUX_STR);
+
+  g_debug ("format rtp-over-srt pipeline[%s]", str->str);
+
+  return g_steal_pointer (&str);
+}
+
+static PipelineFormatParams pipeline_format_params[] = {
+  {GAEGULI_PIPELINE_GENERAL_H264ENC_STR, GAEGULI_VIDEO_CODEC_H264_X264,
+        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      _format_general_pipeline},
+  {GAEGULI_PIPELINE_GENERAL_H265ENC_STR, GAEGULI_VIDEO_CODEC_H265_X265,
+        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      _format_general_pipeline},
+  {GAEGULI_PIPELINE_VAAPI_H264_STR, GAEGULI_VIDEO_CODEC_H264_VAAPI,
+        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      _format_general_pipeline},
+  {GAEGULI_PIPELINE_VAAPI_H265_STR, GAEGULI_VIDEO_CODEC_H265_VAAPI,
+        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      _format_general_pipeline},
+  {GAEGULI_PIPELINE_NVIDIA_TX1_H264ENC_STR, GAEGULI_VIDEO_CODEC_H264_OMX,
+        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      _format_general_pipeline},
+  {GAEGULI_PIPELINE_NVIDIA_TX1_H265ENC_STR, GAEGULI_VIDEO_CODEC_H265_OMX,
+        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      _format_general_pipeline},
+  {GAEGULI_PIPELINE_GENERAL_H264ENC_STR, GAEGULI_VIDEO_CODEC_H264_X264,
+        GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT,
+      _format_rtp_over_srt_pipeline},
+  {NULL, 0, 0},
+};
+
+static GString *
+_get_pipeline_string (GaeguliVideoCodec codec,
+    GaeguliVideoStreamType stream_type, GaeguliMpegTsMode ts_mode,
+    guint idr_period)
+{
+  PipelineFormatParams *params = pipeline_format_params;
+
+  for (; params->enc_str != NULL; params++) {
+    if (params->codec == codec && params->stream_type == stream_type) {
+      g_autoptr (GstElementFactory) factory = NULL;
+      PipelineFormatParams format_params = *params;
+
+      if (codec == GAEGULI_VIDEO_CODEC_H264_X264 &&
+          (factory = gst_element_factory_find ("gaegulix264enc"))) {
+        /* Prefer the in-tree element, which can change its rate control
+         * without being restarted. */
+        format_params.enc_str = GAEGULI_PIPELINE_GAEGULI_H264ENC_STR;
+      }
+
+      if (ts_mode == GAEGULI_MPEG_TS_MODE_LOW_LATENCY) {
+        format_params.mux_str = GAEGULI_PIPELINE_MPEGTSMUX_LOW_LATENCY_STR;
+      }
+
+      return params->format_func (&format_params, idr_period);
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean
+_is_compatible (GaeguliVideoCodec codec, GaeguliVideoStreamType stream_type)
+{
+  if ((stream_type == GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS ||
+          stream_type == GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT) &&
+      ((codec == GAEGULI_VIDEO_CODEC_H264_X264) ||
+          (codec == GAEGULI_VIDEO_CODEC_H264_VAAPI) ||
+          (codec == GAEGULI_VIDEO_CODEC_H264_OMX) ||
+          (codec == GAEGULI_VIDEO_CODEC_H265_X265) ||
+          (codec == GAEGULI_VIDEO_CODEC_H265_VAAPI) ||
+          (codec == GAEGULI_VIDEO_CODEC_H265_OMX))) {
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static guint
+_get_idr_period (GVariantDict * attr)
+{
+  guint idr_period = 10;
+
+  if (!g_variant_dict_lookup (attr, "idr-period", "u", &idr_period)) {
+    guint framerate = 15;
+    if (!g_variant_dict_lookup (attr, "framerate", "u", &framerate)) {
+      idr_period = framerate > 6 ? framerate / 2 : framerate;
+    }
+  }
+
+  return idr_period;
+}
+
+void
+gaeguli_video_resolution_get_size (GaeguliVideoResolution resolution,
+    gint * width, gint * height)
+{
+  switch (resolution) {
+    case GAEGULI_VIDEO_RESOLUTION_640X480:
+      *width = 640;
+      *height = 480;
+      break;
+    case GAEGULI_VIDEO_RESOLUTION_1280X720:
+      *width = 1280;
+      *height = 720;
+      break;
+    case GAEGULI_VIDEO_RESOLUTION_1920X1080:
+      *width = 1920;
+      *height = 1080;
+      break;
+    case GAEGULI_VIDEO_RESOLUTION_3840X2160:
+      *width = 3840;
+      *height = 2160;
+      break;
+    default:
+      *width = -1;
+      *height = -1;
+      break;
+  }
+}
+
+/* Replaces periodic IDR frames with a rolling intra refresh, which keeps the
+ * encoded frames close to the average size. key-int-max then sets the
+ * refresh period. */
+static void
+_enable_intra_refresh (GstElement * pipeline)
+{
+  g_autoptr (GstElement) encoder = NULL;
+  const gchar *encoder_type;
+
+  encoder = gst_bin_get_by_name (GST_BIN (pipeline), "enc");
+  encoder_type =
+      gst_plugin_feature_get_name (gst_element_get_factory (encoder));
+
+  if (g_str_equal (encoder_type, "x264enc") ||
+      g_str_equal (encoder_type, "gaegulix264enc")) {
+    g_object_set (encoder, "intra-refresh", TRUE, NULL);
+  } else if (g_str_equal (encoder_type, "x265enc")) {
+    g_object_set (encoder, "option-string", "intra-refresh=1", NULL);
+  } else {
+    g_warning ("Intra refresh isn't supported by '%s'", encoder_type);
+  }
+}
+
+static const guint8 *
+_get_ts_null_packets (void)
+{
+  static guint8 *packets = NULL;
+
+  if (g_once_init_enter (&packets)) {
+    gsize size = TS_PACKET_SIZE * (TS_PACKETS_PER_SRT_PAYLOAD - 1);
+    guint8 *p = g_malloc (size);
+    gsize offset;
+
+    memset (p, 0xff, size);
+    for (offset = 0; offset < size; offset += TS_PACKET_SIZE) {
+      /* PID 0x1fff, payload only. */
+      p[offset] = 0x47;
+      p[offset + 1] = 0x1f;
+      p[offset + 2] = 0xff;
+      p[offset + 3] = 0x10;
+    }
+
+    g_once_init_leave (&packets, p);
+  }
+
+  return packets;
+}
+
+static GstBuffer *
+_get_srt_payload_padding (gsize size)
+{
+  guint n_packets = (size / TS_PACKET_SIZE) % TS_PACKETS_PER_SRT_PAYLOAD;
+
+  if (n_packets == 0) {
+    return NULL;
+  }
+
+  n_packets = TS_PACKETS_PER_SRT_PAYLOAD - n_packets;
+
+  return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      (gpointer) _get_ts_null_packets (),
+      TS_PACKET_SIZE * (TS_PACKETS_PER_SRT_PAYLOAD - 1), 0,
+      n_packets * TS_PACKET_SIZE, NULL, NULL);
+}
+
+/* Completes the last SRT payload of every muxer output with null packets.
+ * The muxer outputs each access unit as soon as it is muxed, and srtsink
+ * then sends it as whole 1316-byte payloads, with nothing left over waiting
+ * for the next frame. */
+static GstPadProbeReturn
+_pad_to_srt_payload_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstBuffer *padding;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    padding = _get_srt_payload_padding (gst_buffer_get_size (buffer));
+    if (padding) {
+      GST_PAD_PROBE_INFO_DATA (info) = gst_buffer_append (buffer, padding);
+    }
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    padding = _get_srt_payload_padding (gst_buffer_list_calculate_size (list));
+    if (padding) {
+      list = gst_buffer_list_make_writable (list);
+      gst_buffer_list_add (list, padding);
+      GST_PAD_PROBE_INFO_DATA (info) = list;
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+_enable_srt_payload_padding (GstElement * pipeline)
+{
+  g_autoptr (GstElement) mux = NULL;
+  g_autoptr (GstPad) srcpad = NULL;
+
+  mux = gst_bin_get_by_name (GST_BIN (pipeline), "muxsink_first");
+  srcpad = gst_element_get_static_pad (mux, "src");
+
+  gst_pad_add_probe (srcpad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      _pad_to_srt_payload_probe_cb, NULL, NULL);
+}
+
+/*
+ * Splits the "latency-budget-ms" attribute among the stages of a target
+ * pipeline. The encoder gets one frame interval, which is what it needs
+ * without lookahead, and the muxer half of that for smoothing timestamps.
+ * A quarter of the rest bounds the target's queue and SRT gets the remainder
+ * for retransmissions.
+ */
+gboolean
+gaeguli_latency_budget_from_attributes (GVariant * attributes,
+    GaeguliLatencyBudget * budget)
+{
+  guint total_ms = 0;
+  guint framerate = DEFAULT_FRAMERATE;
+  guint frame_ms;
+  guint remaining_ms;
+
+  memset (budget, 0, sizeof (GaeguliLatencyBudget));
+
+  if (attributes == NULL ||
+      !g_variant_lookup (attributes, "latency-budget-ms", "u", &total_ms) ||
+      total_ms == 0) {
+    return FALSE;
+  }
+
+  g_variant_lookup (attributes, "framerate", "u", &framerate);
+  framerate = MAX (framerate, 1);
+  frame_ms = (1000 + framerate - 1) / framerate;
+
+  budget->total_ms = total_ms;
+  budget->encoder_ms = frame_ms;
+  budget->mux_ms = (frame_ms + 1) / 2;
+
+  remaining_ms = total_ms - MIN (total_ms, budget->encoder_ms + budget->mux_ms);
+
+  /* Queue time 0 would mean unlimited; hold at least a frame. */
+  budget->queue_ms = MAX (remaining_ms / 4, frame_ms);
+  if (remaining_ms > budget->queue_ms + MIN_SRT_LATENCY_MS) {
+    budget->srt_ms = remaining_ms - budget->queue_ms;
+  } else {
+    budget->srt_ms = MIN_SRT_LATENCY_MS;
+  }
+
+  if (budget->encoder_ms + budget->mux_ms + budget->queue_ms +
+      budget->srt_ms > total_ms) {
+    g_warning ("Latency budget of %u ms is too small, the pipeline needs "
+        "%u ms", total_ms, budget->encoder_ms + budget->mux_ms +
+        budget->queue_ms + budget->srt_ms);
+  }
+
+  return TRUE;
+}
+
+static void
+_apply_latency_budget (GstElement * pipeline,
+    const GaeguliLatencyBudget * budget)
+{
+  g_autoptr (GstElement) encoder = NULL;
+  g_autoptr (GstElement) mux = NULL;
+  g_autoptr (GstElement) tsparse = NULL;
+  const gchar *encoder_type;
+
+  encoder = gst_bin_get_by_name (GST_BIN (pipeline), "enc");
+  encoder_type =
+      gst_plugin_feature_get_name (gst_element_get_factory (encoder));
+
+  /* gaegulix264enc always runs x264's zerolatency tune as it is, but
+   * x264enc properties override the tune with their own defaults. */
+  if (g_str_equal (encoder_type, "x264enc")) {
+    g_object_set (encoder, "sliced-threads", TRUE, "rc-lookahead", 0,
+        "sync-lookahead", 0, NULL);
+  }
+
+  mux = gst_bin_get_by_name (GST_BIN (pipeline), "muxsink_first");
+  /* The muxer has a single live input, so it has no reason to wait for
+   * data to aggregate. */
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (mux), "latency")) {
+    g_object_set (mux, "latency", G_GUINT64_CONSTANT (0), NULL);
+  }
+
+  tsparse = gst_bin_get_by_name (GST_BIN (pipeline), "tsparse");
+  if (tsparse) {
+    /* In microseconds. */
+    g_object_set (tsparse, "smoothing-latency", budget->mux_ms * 1000, NULL);
+  }
+}
+
+static GstElement *
+_build_pipeline (GVariant * attributes, GError ** error)
+{
+  g_autoptr (GString) pipeline_str = NULL;
+  g_autoptr (GstElement) pipeline = NULL;
+  g_autoptr (GstElement) target_capsfilter = NULL;
+  g_autoptr (GstCaps) caps = NULL;
+  GstCaps *target_caps = NULL;
+  GVariantDict attr;
+
+  GaeguliVideoCodec codec = GAEGULI_VIDEO_CODEC_H264_X264;
+  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
+  GaeguliVideoStreamType stream_type = GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS;
+  GaeguliVideoRefreshMode refresh_mode = GAEGULI_VIDEO_REFRESH_MODE_IDR;
+  GaeguliMpegTsMode ts_mode = GAEGULI_MPEG_TS_MODE_SMOOTHED;
+  GaeguliLatencyBudget budget;
+  guint idr_period;
+  gint target_height, target_width;
+
+  g_variant_dict_init (&attr, attributes);
+
+  g_variant_dict_lookup (&attr, "codec", "i", &codec);
+  g_variant_dict_lookup (&attr, "stream-type", "i", &stream_type);
+  g_variant_dict_lookup (&attr, "refresh-mode", "i", &refresh_mode);
+  g_variant_dict_lookup (&attr, "mpeg-ts-mode", "i", &ts_mode);
+  idr_period = _get_idr_period (&attr);
+
+  g_variant_dict_lookup (&attr, "resolution", "i", &resolution);
+
+  g_variant_dict_clear (&attr);
+
+  if (!_is_compatible (codec, stream_type)) {
+    g_set_error (error, GAEGULI_TRANSMIT_ERROR,
+        GAEGULI_TRANSMIT_ERROR_MISMATCHED_CODEC,
+        "Mismatched codec and stream type");
+    return NULL;
+  }
+
+  if (resolution == GAEGULI_VIDEO_RESOLUTION_UNKNOWN) {
+    g_set_error (error, GAEGULI_RESOURCE_ERROR,
+        GAEGULI_RESOURCE_ERROR_UNSUPPORTED,
+        "Not found target resolution parameter");
+    return NULL;
+  }
+
+  gaeguli_video_resolution_get_size (resolution, &target_width,
+      &target_height);
+
+  g_debug ("stream type is %d", stream_type);
+  g_debug ("codec is %d", codec);
+
+  pipeline_str = _get_pipeline_string (codec, stream_type, ts_mode,
+      idr_period);
+
+  if (pipeline_str == NULL) {
+    g_set_error (error, GAEGULI_RESOURCE_ERROR,
+        GAEGULI_RESOURCE_ERROR_UNSUPPORTED, "Can't determine encoding method");
+    return NULL;
+  }
+
+  pipeline = gst_parse_launch (pipeline_str->str, error);
+  if (pipeline == NULL) {
+    return NULL;
+  }
+
+  if (refresh_mode == GAEGULI_VIDEO_REFRESH_MODE_INTRA_REFRESH) {
+    _enable_intra_refresh (pipeline);
+  }
+
+  if (stream_type == GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS &&
+      ts_mode == GAEGULI_MPEG_TS_MODE_LOW_LATENCY) {
+    _enable_srt_payload_padding (pipeline);
+  }
+
+  if (gaeguli_latency_budget_from_attributes (attributes, &budget)) {
+    _apply_latency_budget (pipeline, &budget);
+  }
+
+  target_capsfilter = gst_bin_get_by_name (GST_BIN (pipeline), "target_caps");
+  if (target_capsfilter == NULL)
+    goto bailout;
+
+  caps = gst_caps_new_empty ();
+
+  switch (codec) {
+    case GAEGULI_VIDEO_CODEC_H264_X264:
+    case GAEGULI_VIDEO_CODEC_H265_X265:{
+      target_caps = gst_caps_from_string ("video/x-raw");
+      gst_caps_set_simple (target_caps, "width", G_TYPE_INT, target_width,
+          "height", G_TYPE_INT, target_height, NULL);
+      break;
+    }
+    case GAEGULI_VIDEO_CODEC_H264_VAAPI:
+    case GAEGULI_VIDEO_CODEC_H265_VAAPI:{
+      target_caps = gst_caps_from_string ("video/x-raw(memory:VASurface)");
+      gst_caps_set_simple (target_caps, "width", G_TYPE_INT, target_width,
+          "height", G_TYPE_INT, target_height, NULL);
+      break;
+    }
+    case GAEGULI_VIDEO_CODEC_H264_OMX:
+    case GAEGULI_VIDEO_CODEC_H265_OMX:{
+      /* FIXME: We maynot assume that omx comes only from nvidia. */
+      target_caps = gst_caps_from_string ("video/x-raw(memory:NVMM)");
+      gst_caps_set_simple (target_caps, "width", G_TYPE_INT, target_width,
+          "height", G_TYPE_INT, target_height, "format", G_TYPE_STRING, "I420",
+          NULL);
+    }
+    default:
+      break;
+  }
+
+  if (target_caps != NULL) {
+    gst_caps_append (caps, target_caps);
+  }
+
+  g_object_set (target_capsfilter, "caps", caps, NULL);
+
+bailout:
+  return g_steal_pointer (&pipeline);
+}
+
+gchar *
+gaeguli_encode_branch_key_from_attributes (GVariant * attributes)
+{
+  GVariantDict attr;
+
+  GaeguliVideoCodec codec = GAEGULI_VIDEO_CODEC_H264_X264;
+  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
+  GaeguliVideoBitrateControl bitrate_control = GAEGULI_VIDEO_BITRATE_CONTROL_CBR;
+  GaeguliVideoStreamType stream_type = GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS;
+  GaeguliVideoRefreshMode refresh_mode = GAEGULI_VIDEO_REFRESH_MODE_IDR;
+  GaeguliMpegTsMode ts_mode = GAEGULI_MPEG_TS_MODE_SMOOTHED;
+  guint bitrate = 512;
+  guint idr_period;
+  guint latency_budget = 0;
+  g_autoptr (GVariant) renditions = NULL;
+  g_autofree gchar *key = NULL;
+
+  g_variant_dict_init (&attr, attributes);
+
+  g_variant_dict_lookup (&attr, "codec", "i", &codec);
+  g_variant_dict_lookup (&attr, "resolution", "i", &resolution);
+  g_variant_dict_lookup (&attr, "bitrate-control", "i", &bitrate_control);
+  g_variant_dict_lookup (&attr, "bitrate", "u", &bitrate);
+  g_variant_dict_lookup (&attr, "stream-type", "i", &stream_type);
+  g_variant_dict_lookup (&attr, "refresh-mode", "i", &refresh_mode);
+  idr_period = _get_idr_period (&attr);
+  g_variant_dict_lookup (&attr, "latency-budget-ms", "u", &latency_budget);
+  g_variant_dict_lookup (&attr, "mpeg-ts-mode", "i", &ts_mode);
+
+  g_variant_dict_clear (&attr);
+
+  /* RTP branches carry a per-target text stream next to the video, so they
+   * can't be shared. */
+  if (stream_type != GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS) {
+    return NULL;
+  }
+
+  key = g_strdup_printf ("%d:%d:%d:%u:%u:%d:%d:%u:%d", codec, resolution,
+      bitrate_control, bitrate, idr_period, stream_type, refresh_mode,
+      latency_budget, ts_mode);
+
+  renditions = gaeguli_renditions_from_attributes (attributes);
+  if (renditions) {
+    g_autofree gchar *renditions_str = g_variant_print (renditions, FALSE);
+
+    return g_strconcat (key, ":", renditions_str, NULL);
+  }
+
+  return g_steal_pointer (&key);
+}
+
+static gboolean
+_is_software_codec (GaeguliVideoCodec codec)
+{
+  return codec == GAEGULI_VIDEO_CODEC_H264_X264 ||
+      codec == GAEGULI_VIDEO_CODEC_H265_X265;
+}
+
+gchar *
+gaeguli_encode_branch_scaler_key_from_attributes (GVariant * attributes)
+{
+  GVariantDict attr;
+
+  g_autoptr (GVariant) renditions = NULL;
+  GaeguliVideoCodec codec = GAEGULI_VIDEO_CODEC_H264_X264;
+  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
+
+  g_variant_dict_init (&attr, attributes);
+
+  g_variant_dict_lookup (&attr, "codec", "i", &codec);
+  g_variant_dict_lookup (&attr, "resolution", "i", &resolution);
+
+  g_variant_dict_clear (&attr);
+
+  /* Hardware encoders scale in their own memory domain and simulcast
+   * branches scale to each of their resolutions themselves. */
+  renditions = gaeguli_renditions_from_attributes (attributes);
+  if (!_is_software_codec (codec) || renditions ||
+      resolution == GAEGULI_VIDEO_RESOLUTION_UNKNOWN) {
+    return NULL;
+  }
+
+  return g_strdup_printf ("scale:%d", resolution);
+}
+
+GVariant *
+gaeguli_renditions_from_attributes (GVariant * attributes)
+{
+  GVariant *renditions;
+
+  if (attributes == NULL) {
+    return NULL;
+  }
+
+  renditions = g_variant_lookup_value (attributes, "renditions",
+      G_VARIANT_TYPE ("a(iu)"));
+  if (renditions && g_variant_n_children (renditions) == 0) {
+    g_clear_pointer (&renditions, g_variant_unref);
+  }
+
+  return renditions;
+}
+
+/*
+ * Builds a branch that encodes every rendition and muxes each one as a
+ * separate program of a single MPEG-TS. The video gets converted once and
+ * scaled once per distinct resolution, which the renditions of that
+ * resolution share. All the encoders start from the same frame and use the
+ * same keyframe period without scene cut detection, and keyframe requests
+ * reach all of them through the muxer, so their IDR frames line up and
+ * receivers can switch programs at any of them.
+ */
+static GstElement *
+_build_simulcast_pipeline (GVariant * attributes, GVariant * renditions,
+    GError ** error)
+{
+  g_autoptr (GString) str = NULL;
+  g_autoptr (GArray) resolutions = NULL;
+  g_autoptr (GstElement) pipeline = NULL;
+  g_autoptr (GstElement) mux = NULL;
+  g_autoptr (GstElementFactory) factory = NULL;
+  GstStructure *prog_map;
+  GVariantDict attr;
+  GVariantIter iter;
+
+  GaeguliVideoCodec codec = GAEGULI_VIDEO_CODEC_H264_X264;
+  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
+  GaeguliVideoStreamType stream_type = GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS;
+  GaeguliVideoRefreshMode refresh_mode = GAEGULI_VIDEO_REFRESH_MODE_IDR;
+  GaeguliMpegTsMode ts_mode = GAEGULI_MPEG_TS_MODE_SMOOTHED;
+  GaeguliLatencyBudget budget;
+  const gchar *enc_str;
+  guint idr_period;
+  guint n_renditions;
+  guint i, j;
+
+  g_variant_dict_init (&attr, attributes);
+
+  g_variant_dict_lookup (&attr, "codec", "i", &codec);
+  g_variant_dict_lookup (&attr, "stream-type", "i", &stream_type);
+  g_variant_dict_lookup (&attr, "refresh-mode", "i", &refresh_mode);
+  g_variant_dict_lookup (&attr, "mpeg-ts-mode", "i", &ts_mode);
+  idr_period = _get_idr_period (&attr);
+
+  g_variant_dict_clear (&attr);
+
+  if (stream_type != GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS ||
+      !_is_software_codec (codec)) {
+    g_set_error (error, GAEGULI_RESOURCE_ERROR,
+        GAEGULI_RESOURCE_ERROR_UNSUPPORTED,
+        "Renditions need a software encoder and MPEG-TS");
+    return NULL;
+  }
+
+  if (refresh_mode == GAEGULI_VIDEO_REFRESH_MODE_INTRA_REFRESH) {
+    g_warning ("Renditions use IDR frames, so that receivers can switch "
+        "between them");
+  }
+
+  if (codec == GAEGULI_VIDEO_CODEC_H265_X265) {
+    enc_str = GAEGULI_PIPELINE_SIMULCAST_H265ENC_STR;
+  } else if ((factory = gst_element_factory_find ("gaegulix264enc"))) {
+    enc_str = GAEGULI_PIPELINE_SIMULCAST_GAEGULI_H264ENC_STR;
+  } else {
+    enc_str = GAEGULI_PIPELINE_SIMULCAST_H264ENC_STR;
+  }
+
+  str = g_string_new (GAEGULI_PIPELINE_SIMULCAST_CONVERT_STR);
+  resolutions = g_array_new (FALSE, FALSE, sizeof (GaeguliVideoResolution));
+
+  g_variant_iter_init (&iter, renditions);
+  for (i = 0; g_variant_iter_next (&iter, "(iu)", &resolution, NULL); ++i) {
+    g_autofree gchar *name = NULL;
+    gint width, height;
+
+    gaeguli_video_resolution_get_size (resolution, &width, &height);
+    if (width <= 0 || height <= 0) {
+      g_set_error (error, GAEGULI_RESOURCE_ERROR,
+          GAEGULI_RESOURCE_ERROR_UNSUPPORTED,
+          "Rendition %u has no valid resolution", i);
+      return NULL;
+    }
+
+    for (j = 0; j < resolutions->len; ++j) {
+      if (g_array_index (resolutions, GaeguliVideoResolution, j) ==
+          resolution) {
+        break;
+      }
+    }
+
+    if (j == resolutions->len) {
+      g_array_append_val (resolutions, resolution);
+      g_string_append_printf (str, GAEGULI_PIPELINE_SIMULCAST_SCALER_STR, j,
+          j);
+    }
+
+    /* The target controls the first rendition like any other encoder. */
+    name = i == 0 ? g_strdup ("enc") : g_strdup_printf ("enc_%u", i);
+    g_string_append_printf (str, enc_str, j, name, idr_period, i);
+  }
+  n_renditions = i;
+
+  g_string_append (str, ts_mode == GAEGULI_MPEG_TS_MODE_LOW_LATENCY ?
+      GAEGULI_PIPELINE_MPEGTSMUX_LOW_LATENCY_STR :
+      GAEGULI_PIPELINE_MPEGTSMUX_STR);
+
+  g_debug ("format simulcast pipeline[%s]", str->str);
+
+  pipeline = gst_parse_launch (str->str, error);
+  if (pipeline == NULL) {
+    return NULL;
+  }
+
+  for (j = 0; j < resolutions->len; ++j) {
+    g_autofree gchar *name = g_strdup_printf ("scaler_caps_%u", j);
+    g_autoptr (GstElement) capsfilter = NULL;
+    g_autoptr (GstCaps) caps = NULL;
+    gint width, height;
+
+    gaeguli_video_resolution_get_size (g_array_index (resolutions,
+            GaeguliVideoResolution, j), &width, &height);
+
+    capsfilter = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, width,
+        "height", G_TYPE_INT, height, NULL);
+    g_object_set (capsfilter, "caps", caps, NULL);
+  }
+
+  /* Programs are numbered from 1 in the order of the renditions. */
+  prog_map = gst_structure_new_empty ("prog-map");
+  for (i = 0; i < n_renditions; ++i) {
+    g_autofree gchar *pad_name = g_strdup_printf ("sink_%u", i);
+
+    gst_structure_set (prog_map, pad_name, G_TYPE_INT, i + 1, NULL);
+  }
+
+  mux = gst_bin_get_by_name (GST_BIN (pipeline), "muxsink_first");
+  g_object_set (mux, "prog-map", prog_map, NULL);
+  gst_structure_free (prog_map);
+
+  if (ts_mode == GAEGULI_MPEG_TS_MODE_LOW_LATENCY) {
+    _enable_srt_payload_padding (pipeline);
+  }
+
+  if (gaeguli_latency_budget_from_attributes (attributes, &budget)) {
+    _apply_latency_budget (pipeline, &budget);
+  }
+
+  return g_steal_pointer (&pipeline);
+}
+
+/* Dropping raw frames ahead of the encoder never loses a frame that others
+ * depend on, so the stream stays decodable, unlike when SRT drops encoded
+ * packets that are too late to send. */
+static GstPadProbeReturn
+_frame_drop_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GaeguliEncodeBranch *self = GAEGULI_ENCODE_BRANCH (user_data);
+  guint frame_skip = g_atomic_int_get (&self->frame_skip);
+  guint framerate_divisor = g_atomic_int_get (&self->framerate_divisor);
+  /* Only touched from the streaming thread. */
+  guint n = self->n_frames++;
+
+  if (framerate_divisor > 1 && n % framerate_divisor != 0) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  if (frame_skip > 0 && n % frame_skip == frame_skip - 1) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Encoders that attach a GaeguliEncodedFrameMeta tell what quality each frame
+ * got, which the encoded byte count alone doesn't. */
+static GstPadProbeReturn
+_encoded_frame_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GaeguliEncodeBranch *self = GAEGULI_ENCODE_BRANCH (user_data);
+  GaeguliEncodedFrameMeta *meta =
+      gaeguli_buffer_get_encoded_frame_meta (GST_PAD_PROBE_INFO_BUFFER (info));
+
+  if (meta) {
+    LOCK_BRANCH;
+
+    /* Smooth out the QP swings between keyframes and the frames after. */
+    if (self->frames_encoded == 0) {
+      self->average_qp = meta->average_qp;
+    } else {
+      self->average_qp += (meta->average_qp - self->average_qp) / 16;
+    }
+    ++self->frames_encoded;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GaeguliEncodeBranch *
+gaeguli_encode_branch_new_with_bin (GstPad * source_pad, GstElement * bin)
+{
+  GaeguliEncodeBranch *self;
+  g_autoptr (GstElement) enc_first = NULL;
+  g_autoptr (GstPad) enc_sinkpad = NULL;
+  GaeguliEncodeBranch *upstream;
+
+  self = g_object_new (GAEGULI_TYPE_ENCODE_BRANCH, NULL);
+
+  self->bin = gst_object_ref_sink (bin);
+  self->encoder = gst_bin_get_by_name (GST_BIN (self->bin), "enc");
+  self->tee = gst_bin_get_by_name (GST_BIN (self->bin), "enc_tee");
+
+  enc_first = gst_bin_get_by_name (GST_BIN (self->bin), "enc_first");
+  enc_sinkpad = gst_element_get_static_pad (enc_first, "sink");
+
+  self->sinkpad = gst_ghost_pad_new (NULL, enc_sinkpad);
+  gst_object_ref_sink (self->sinkpad);
+  gst_element_add_pad (self->bin, self->sinkpad);
+
+  self->source_pad = gst_object_ref (source_pad);
+
+  if (self->encoder) {
+    g_autoptr (GstPad) encoder_sinkpad =
+        gst_element_get_static_pad (self->encoder, "sink");
+    g_autoptr (GstPad) encoder_srcpad =
+        gst_element_get_static_pad (self->encoder, "src");
+
+    self->frame_drop_probe = gst_pad_add_probe (encoder_sinkpad,
+        GST_PAD_PROBE_TYPE_BUFFER, _frame_drop_probe_cb, self, NULL);
+    self->encoded_frame_probe = gst_pad_add_probe (encoder_srcpad,
+        GST_PAD_PROBE_TYPE_BUFFER, _encoded_frame_probe_cb, self, NULL);
+  }
+
+  /* Branches can be chained, e.g. an encoder fed by a scaler. */
+  upstream = gaeguli_encode_branch_from_pad (source_pad);
+  if (upstream) {
+    self->upstream = g_object_ref (upstream);
+  }
+
+  g_object_set_data (G_OBJECT (self->bin), "gaeguli-encode-branch", self);
+
+  return self;
+}
+
+GaeguliEncodeBranch *
+gaeguli_encode_branch_new (GstPad * source_pad, GVariant * attributes,
+    GError ** error)
+{
+  GaeguliEncodeBranch *self;
+  GstElement *bin;
+  g_autoptr (GstElement) muxsink_first = NULL;
+  g_autoptr (GVariant) renditions = NULL;
+
+  g_return_val_if_fail (GST_IS_PAD (source_pad), NULL);
+  g_return_val_if_fail (attributes != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  renditions = gaeguli_renditions_from_attributes (attributes);
+  if (renditions) {
+    bin = _build_simulcast_pipeline (attributes, renditions, error);
+  } else {
+    bin = _build_pipeline (attributes, error);
+  }
+  if (bin == NULL) {
+    return NULL;
+  }
+
+  self = gaeguli_encode_branch_new_with_bin (source_pad, bin);
+
+  self->rendition_encoders =
+      g_ptr_array_new_with_free_func (gst_object_unref);
+  g_ptr_array_add (self->rendition_encoders, gst_object_ref (self->encoder));
+  if (renditions) {
+    guint i;
+
+    for (i = 1; i < g_variant_n_children (renditions); ++i) {
+      g_autofree gchar *name = g_strdup_printf ("enc_%u", i);
+
+      g_ptr_array_add (self->rendition_encoders,
+          gst_bin_get_by_name (GST_BIN (self->bin), name));
+    }
+  }
+
+  muxsink_first = gst_bin_get_by_name (GST_BIN (self->bin), "muxsink_first");
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (muxsink_first),
+          "pcr-interval")) {
+    g_info ("set pcr-interval to 360");
+    g_object_set (G_OBJECT (muxsink_first), "pcr-interval", 360, NULL);
+  }
+
+  self->attributes = g_variant_ref_sink (attributes);
+  self->key = gaeguli_encode_branch_key_from_attributes (attributes);
+
+  g_variant_lookup (self->attributes, "keyframe-min-interval", "u",
+      &self->keyframe_min_interval);
+
+  return self;
+}
+
+GaeguliEncodeBranch *
+gaeguli_encode_branch_new_scaler (GstPad * source_pad, GVariant * attributes,
+    GError ** error)
+{
+  GaeguliEncodeBranch *self;
+  GstElement *bin;
+  g_autoptr (GstElement) capsfilter = NULL;
+  g_autoptr (GstCaps) caps = NULL;
+  GVariantDict attr;
+
+  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
+  gint width, height;
+
+  g_return_val_if_fail (GST_IS_PAD (source_pad), NULL);
+  g_return_val_if_fail (attributes != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_variant_dict_init (&attr, attributes);
+  g_variant_dict_lookup (&attr, "resolution", "i", &resolution);
+  g_variant_dict_clear (&attr);
+
+  gaeguli_video_resolution_get_size (resolution, &width, &height);
+
+  g_debug ("format scaler pipeline[%s]", GAEGULI_PIPELINE_SCALER_STR);
+
+  bin = gst_parse_launch (GAEGULI_PIPELINE_SCALER_STR, error);
+  if (bin == NULL) {
+    return NULL;
+  }
+
+  capsfilter = gst_bin_get_by_name (GST_BIN (bin), "target_caps");
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, width,
+      "height", G_TYPE_INT, height, NULL);
+  g_object_set (capsfilter, "caps", caps, NULL);
+
+  self = gaeguli_encode_branch_new_with_bin (source_pad, bin);
+
+  self->attributes = g_variant_ref_sink (attributes);
+  self->key = gaeguli_encode_branch_scaler_key_from_attributes (attributes);
+
+  return self;
+}
+
+GaeguliEncodeBranch *
+gaeguli_encode_branch_fork (GaeguliEncodeBranch * self, GError ** error)
+{
+  GaeguliEncodeBranch *branch;
+  g_autoptr (GstPad) source_pad = NULL;
+
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), NULL);
+
+  if (self->upstream) {
+    source_pad = gaeguli_encode_branch_request_pad (self->upstream);
+  } else {
+    GstElement *tee = GST_PAD_PARENT (self->source_pad);
+
+    source_pad = gst_element_request_pad (tee,
+        gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS (tee),
+            "src_%u"), NULL, NULL);
+  }
+
+  if (source_pad == NULL) {
+    g_set_error (error, GAEGULI_RESOURCE_ERROR,
+        GAEGULI_RESOURCE_ERROR_UNSUPPORTED,
+        "Can't get a source pad for a new encode branch");
+    return NULL;
+  }
+
+  branch = gaeguli_encode_branch_new (source_pad, self->attributes, error);
+  if (branch == NULL) {
+    if (self->upstream) {
+      gaeguli_encode_branch_release_pad (self->upstream, source_pad);
+    } else {
+      gst_element_release_request_pad (GST_PAD_PARENT (source_pad),
+          source_pad);
+    }
+    return NULL;
+  }
+
+  /* A forked branch follows its own encoding parameters and mustn't be
+   * picked up by new targets. */
+  g_clear_pointer (&branch->key, g_free);
+
+  if (self->parameters) {
+    branch->parameters = gst_structure_copy (self->parameters);
+  }
+
+  return branch;
+}
+
+GaeguliEncodeBranch *
+gaeguli_encode_branch_from_pad (GstPad * pad)
+{
+  GstObject *parent;
+
+  g_return_val_if_fail (GST_IS_PAD (pad), NULL);
+
+  parent = GST_OBJECT_PARENT (pad);
+  if (parent == NULL) {
+    return NULL;
+  }
+
+  return g_object_get_data (G_OBJECT (parent), "gaeguli-encode-branch");
+}
+
+const gchar *
+gaeguli_encode_branch_get_key (GaeguliEncodeBranch * self)
+{
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), NULL);
+
+  return self->key;
+}
+
+GstElement *
+gaeguli_encode_branch_get_bin (GaeguliEncodeBranch * self)
+{
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), NULL);
+
+  return self->bin;
+}
+
+GstElement *
+gaeguli_encode_branch_get_encoder (GaeguliEncodeBranch * self)
+{
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), NULL);
+
+  return self->encoder;
+}
+
+guint
+gaeguli_encode_branch_get_n_renditions (GaeguliEncodeBranch * self)
+{
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), 0);
+
+  return self->rendition_encoders ? self->rendition_encoders->len : 0;
+}
+
+GstElement *
+gaeguli_encode_branch_get_rendition_encoder (GaeguliEncodeBranch * self,
+    guint index)
+{
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), NULL);
+  g_return_val_if_fail (index < gaeguli_encode_branch_get_n_renditions (self),
+      NULL);
+
+  return g_ptr_array_index (self->rendition_encoders, index);
+}
+
+static GstPadProbeReturn
+_link_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GaeguliEncodeBranch *self = GAEGULI_ENCODE_BRANCH (user_data);
+
+  /* Remove the probe first. See target.c:_link_probe_cb() for details. */
+  gst_pad_remove_probe (pad, info->id);
+
+  {
+    LOCK_BRANCH;
+
+    if (self->pending_pad_probe == info->id) {
+      self->pending_pad_probe = 0;
+    }
+
+    if (self->state != ENCODE_BRANCH_STATE_LINKING) {
+      /* All legs got released before the first buffer arrived. */
+      goto out;
+    }
+
+    gst_element_sync_state_with_parent (self->bin);
+    if (gst_pad_link (self->source_pad, self->sinkpad) != GST_PAD_LINK_OK) {
+      g_error ("failed to link encode branch to Gaeguli pipeline");
+    }
+
+    self->state = ENCODE_BRANCH_STATE_LINKED;
+
+    g_debug ("encode branch %p linked", self);
+  }
+
+out:
+  return GST_PAD_PROBE_REMOVE;
+}
+
+void
+gaeguli_encode_branch_start (GaeguliEncodeBranch * self)
+{
+  LOCK_BRANCH;
+
+  if (self->state != ENCODE_BRANCH_STATE_NEW) {
+    return;
+  }
+
+  if (self->upstream) {
+    gaeguli_encode_branch_start (self->upstream);
+  }
+
+  gst_bin_add (GST_BIN (GST_ELEMENT_PARENT (GST_PAD_PARENT
+              (self->source_pad))), self->bin);
+
+  self->state = ENCODE_BRANCH_STATE_LINKING;
+  self->pending_pad_probe = gst_pad_add_probe (self->source_pad,
+      GST_PAD_PROBE_TYPE_BLOCK, _link_probe_cb, g_object_ref (self),
+      g_object_unref);
+}
+
+static gboolean
+_unlink_finish_in_main_thread (GaeguliEncodeBranch * self)
+{
+  gst_element_set_state (self->bin, GST_STATE_NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gaeguli_encode_branch_release_source_pad (GaeguliEncodeBranch * self)
+{
+  if (self->upstream) {
+    gaeguli_encode_branch_release_pad (self->upstream, self->source_pad);
+  } else {
+    gst_element_release_request_pad (GST_PAD_PARENT (self->source_pad),
+        self->source_pad);
+  }
+}
+
+static GstPadProbeReturn
+_unlink_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GaeguliEncodeBranch *self = GAEGULI_ENCODE_BRANCH (user_data);
+
+  g_autoptr (GstElement) container = NULL;
+
+  gst_pad_remove_probe (pad, info->id);
+
+  if (!gst_pad_unlink (self->source_pad, self->sinkpad)) {
+    g_error ("failed to unlink encode branch");
+  }
+
+  gaeguli_encode_branch_release_source_pad (self);
+
+  container = GST_ELEMENT (gst_object_get_parent (GST_OBJECT (self->bin)));
+  gst_bin_remove (GST_BIN (container), self->bin);
+
+  /* This probe gets called from the video source streaming thread, so let
+   * the state change happen in the main thread. */
+  g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+      (GSourceFunc) _unlink_finish_in_main_thread,
+      g_object_ref (self), g_object_unref);
+
+  g_debug ("encode branch %p unlinked", self);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Must be called with the branch lock held. */
+static void
+gaeguli_encode_branch_retire (GaeguliEncodeBranch * self)
+{
+  switch (self->state) {
+    case ENCODE_BRANCH_STATE_NEW:
+      gaeguli_encode_branch_release_source_pad (self);
+      break;
+    case ENCODE_BRANCH_STATE_LINKING:{
+      g_autoptr (GstElement) container = NULL;
+
+      gst_pad_remove_probe (self->source_pad, self->pending_pad_probe);
+      self->pending_pad_probe = 0;
+
+      gaeguli_encode_branch_release_source_pad (self);
+
+      container = GST_ELEMENT (gst_object_get_parent (GST_OBJECT (self->bin)));
+      gst_bin_remove (GST_BIN (container), self->bin);
+      break;
+    }
+    case ENCODE_BRANCH_STATE_LINKED:
+      gst_pad_add_probe (self->source_pad, GST_PAD_PROBE_TYPE_BLOCK,
+          _unlink_probe_cb, g_object_ref (self), g_object_unref);
+      break;
+    case ENCODE_BRANCH_STATE_RETIRED:
+      return;
+  }
+
+  self->state = ENCODE_BRANCH_STATE_RETIRED;
+}
+
+GstPad *
+gaeguli_encode_branch_request_pad (GaeguliEncodeBranch * self)
+{
+  g_autoptr (GstPad) tee_srcpad = NULL;
+  GstPad *pad;
+
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), NULL);
+
+  {
+    LOCK_BRANCH;
+
+    if (self->state == ENCODE_BRANCH_STATE_RETIRED) {
+      g_warning ("Can't attach a target to a retired encode branch");
+      return NULL;
+    }
+
+    tee_srcpad = gst_element_request_pad (self->tee,
+        gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS (self->tee),
+            "src_%u"), NULL, NULL);
+
+    pad = gst_ghost_pad_new (NULL, tee_srcpad);
+    gst_element_add_pad (self->bin, pad);
+
+    ++self->n_legs;
+  }
+
+  return gst_object_ref (pad);
+}
+
+void
+gaeguli_encode_branch_release_pad (GaeguliEncodeBranch * self, GstPad * pad)
+{
+  g_autoptr (GstPad) tee_srcpad = NULL;
+
+  g_return_if_fail (GAEGULI_IS_ENCODE_BRANCH (self));
+  g_return_if_fail (GST_IS_GHOST_PAD (pad));
+
+  tee_srcpad = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+
+  {
+    LOCK_BRANCH;
+
+    gst_element_remove_pad (self->bin, pad);
+    if (tee_srcpad) {
+      gst_element_release_request_pad (self->tee, tee_srcpad);
+    }
+
+    if (--self->n_legs == 0) {
+      /* Nobody is watching anymore; stop encoding. */
+      gaeguli_encode_branch_retire (self);
+    }
+  }
+}
+
+guint
+gaeguli_encode_branch_get_n_legs (GaeguliEncodeBranch * self)
+{
+  LOCK_BRANCH;
+
+  return self->n_legs;
+}
+
+gboolean
+gaeguli_encode_branch_is_shareable (GaeguliEncodeBranch * self)
+{
+  LOCK_BRANCH;
+
+  return self->key != NULL && self->state != ENCODE_BRANCH_STATE_RETIRED;
+}
+
+gboolean
+gaeguli_encode_branch_is_retired (GaeguliEncodeBranch * self)
+{
+  LOCK_BRANCH;
+
+  return self->state == ENCODE_BRANCH_STATE_RETIRED;
+}
+
+gboolean
+gaeguli_encode_branch_accepts_parameters (GaeguliEncodeBranch * self,
+    const GstStructure * params)
+{
+  LOCK_BRANCH;
+
+  /* The first target to configure the encoder sets the parameters the branch
+   * gets shared with. */
+  return self->parameters == NULL ||
+      gst_structure_is_subset (params, self->parameters);
+}
+
+/* Resizes and limits the framerate of the video going into the encoder. The
+ * encoder gets re-initialized with the new format, so lowering the resolution
+ * or framerate lowers its CPU use too. Must be called with the lock held. */
+static void
+_update_output_format (GaeguliEncodeBranch * self)
+{
+  g_autoptr (GstElement) capsfilter = NULL;
+  g_autoptr (GstElement) videorate = NULL;
+  g_autoptr (GstCaps) caps = NULL;
+  g_autoptr (GstCaps) new_caps = NULL;
+  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
+  guint width = 0;
+  guint height = 0;
+  guint framerate = 0;
+  gint default_width, default_height;
+  gint out_width, out_height;
+
+  if (!gst_structure_has_field (self->parameters,
+          GAEGULI_ENCODING_PARAMETER_WIDTH) &&
+      !gst_structure_has_field (self->parameters,
+          GAEGULI_ENCODING_PARAMETER_HEIGHT) &&
+      !gst_structure_has_field (self->parameters,
+          GAEGULI_ENCODING_PARAMETER_FRAMERATE)) {
+    return;
+  }
+
+  capsfilter = gst_bin_get_by_name (GST_BIN (self->bin), "target_caps");
+  videorate = gst_bin_get_by_name (GST_BIN (self->bin), "target_rate");
+  if (capsfilter == NULL || videorate == NULL) {
+    return;
+  }
+
+  gst_structure_get_uint (self->parameters, GAEGULI_ENCODING_PARAMETER_WIDTH,
+      &width);
+  gst_structure_get_uint (self->parameters, GAEGULI_ENCODING_PARAMETER_HEIGHT,
+      &height);
+  gst_structure_get_uint (self->parameters,
+      GAEGULI_ENCODING_PARAMETER_FRAMERATE, &framerate);
+
+  /* 0 stands for what the target got configured with. */
+  g_variant_lookup (self->attributes, "resolution", "i", &resolution);
+  gaeguli_video_resolution_get_size (resolution, &default_width,
+      &default_height);
+
+  out_width = width > 0 ? (gint) width : default_width;
+  out_height = height > 0 ? (gint) height : default_height;
+
+  g_object_get (capsfilter, "caps", &caps, NULL);
+  new_caps = gst_caps_copy (caps);
+  gst_caps_set_simple (new_caps, "width", G_TYPE_INT, out_width,
+      "height", G_TYPE_INT, out_height, NULL);
+
+  if (!gst_caps_is_equal (caps, new_caps)) {
+    g_debug ("encode branch output changes to %dx%d", out_width, out_height);
+    g_object_set (capsfilter, "caps", new_caps, NULL);
+  }
+
+  /* videorate only drops frames, so the limit never exceeds the source. */
+  g_object_set (videorate, "max-rate", framerate > 0 ? (gint) framerate :
+      G_MAXINT, NULL);
+}
+
+void
+gaeguli_encode_branch_store_parameters (GaeguliEncodeBranch * self,
+    const GstStructure * params)
+{
+  guint frame_skip = 0;
+  guint framerate_divisor = 0;
+  gint i;
+
+  LOCK_BRANCH;
+
+  if (self->parameters == NULL) {
+    self->parameters = gst_structure_copy (params);
+  } else {
+    for (i = 0; i < gst_structure_n_fields (params); i++) {
+      const gchar *fname = gst_structure_nth_field_name (params, i);
+
+      gst_structure_set_value (self->parameters, fname,
+          gst_structure_get_value (params, fname));
+    }
+  }
+
+  gst_structure_get_uint (self->parameters,
+      GAEGULI_ENCODING_PARAMETER_FRAME_SKIP, &frame_skip);
+  gst_structure_get_uint (self->parameters,
+      GAEGULI_ENCODING_PARAMETER_FRAMERATE_DIVISOR, &framerate_divisor);
+
+  g_atomic_int_set (&self->frame_skip, frame_skip);
+  g_atomic_int_set (&self->framerate_divisor, framerate_divisor);
+
+  _update_output_format (self);
+}
+
+GstStructure *
+gaeguli_encode_branch_get_parameters (GaeguliEncodeBranch * self)
+{
+  LOCK_BRANCH;
+
+  return self->parameters ? gst_structure_copy (self->parameters) : NULL;
+}
+
+gboolean
+gaeguli_encode_branch_get_encoded_frame_stats (GaeguliEncodeBranch * self,
+    guint64 * frames_encoded, gdouble * average_qp)
+{
+  g_return_val_if_fail (GAEGULI_IS_ENCODE_BRANCH (self), FALSE);
+
+  {
+    LOCK_BRANCH;
+
+    if (self->frames_encoded == 0) {
+      return FALSE;
+    }
+
+    *frames_encoded = self->frames_encoded;
+    *average_qp = self->average_qp;
+  }
+
+  return TRUE;
+}
+
+/* Asks the encoder for an IDR frame. Requests coming sooner than
+ * keyframe-min-interval milliseconds after the previous one get dropped, so
+ * that many receivers joining at once don't turn the stream into IDR frames
+ * only; they all get served by the same keyframe. */
+gboolean
+gaeguli_encode_branch_request_key_unit (GaeguliEncodeBranch * self)
+{
+  g_autoptr (GstPad) tee_sinkpad = NULL;
+  gint64 now = g_get_monotonic_time ();
+
+  {
+    LOCK_BRANCH;
+
+    if (self->state == ENCODE_BRANCH_STATE_RETIRED) {
+      return FALSE;
+    }
+
+    if (self->last_key_unit_time != 0 &&
+        now - self->last_key_unit_time <
+        self->keyframe_min_interval * G_TIME_SPAN_MILLISECOND) {
+      g_debug ("Dropping a keyframe request on branch [%s]; too frequent",
+          self->key);
+      return FALSE;
+    }
+
+    self->last_key_unit_time = now;
+    tee_sinkpad = gst_element_get_static_pad (self->tee, "sink");
+  }
+
+  return gst_pad_push_event (tee_sinkpad,
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE,
+          0));
+}
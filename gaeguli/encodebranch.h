@@ -0,0 +1,138 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_ENCODE_BRANCH_H__
+#define __GAEGULI_ENCODE_BRANCH_H__
+
+#include <gst/gst.h>
+#include "target.h"
+
+G_BEGIN_DECLS
+
+/*
+ * GaeguliEncodeBranch is the encoder and muxer part of a target pipeline,
+ * i.e. everything between the video source tee and the network or file sink.
+ * Targets whose encoding settings are identical attach to the same branch as
+ * lightweight sink legs, so the video gets encoded only once no matter how
+ * many destinations it is sent to.
+ *
+ * A branch can also be a scaling tier which converts the source video to one
+ * output resolution. Software encode branches of that resolution attach to
+ * the scaler instead of the video source tee, so each resolution gets scaled
+ * only once.
+ *
+ * A target with the "renditions" attribute gets a simulcast branch, which
+ * encodes the video once per rendition and muxes the renditions as separate
+ * programs of one MPEG-TS with their IDR frames aligned.
+ */
+
+#define GAEGULI_TYPE_ENCODE_BRANCH   (gaeguli_encode_branch_get_type ())
+G_DECLARE_FINAL_TYPE (GaeguliEncodeBranch, gaeguli_encode_branch, GAEGULI,
+    ENCODE_BRANCH, GObject)
+
+GaeguliEncodeBranch     *gaeguli_encode_branch_new
+                                                (GstPad                 *source_pad,
+                                                 GVariant               *attributes,
+                                                 GError                **error);
+
+GaeguliEncodeBranch     *gaeguli_encode_branch_new_scaler
+                                                (GstPad                 *source_pad,
+                                                 GVariant               *attributes,
+                                                 GError                **error);
+
+GaeguliEncodeBranch     *gaeguli_encode_branch_fork
+                                                (GaeguliEncodeBranch    *self,
+                                                 GError                **error);
+
+GaeguliEncodeBranch     *gaeguli_encode_branch_from_pad
+                                                (GstPad                 *pad);
+
+gchar                   *gaeguli_encode_branch_key_from_attributes
+                                                (GVariant               *attributes);
+
+GVariant                *gaeguli_renditions_from_attributes
+                                                (GVariant               *attributes);
+
+gboolean                 gaeguli_latency_budget_from_attributes
+                                                (GVariant               *attributes,
+                                                 GaeguliLatencyBudget   *budget);
+
+void                     gaeguli_video_resolution_get_size
+                                                (GaeguliVideoResolution  resolution,
+                                                 gint                   *width,
+                                                 gint                   *height);
+
+gchar                   *gaeguli_encode_branch_scaler_key_from_attributes
+                                                (GVariant               *attributes);
+
+const gchar             *gaeguli_encode_branch_get_key
+                                                (GaeguliEncodeBranch    *self);
+
+GstElement              *gaeguli_encode_branch_get_bin
+                                                (GaeguliEncodeBranch    *self);
+
+GstElement              *gaeguli_encode_branch_get_encoder
+                                                (GaeguliEncodeBranch    *self);
+
+guint                    gaeguli_encode_branch_get_n_renditions
+                                                (GaeguliEncodeBranch    *self);
+
+GstElement              *gaeguli_encode_branch_get_rendition_encoder
+                                                (GaeguliEncodeBranch    *self,
+                                                 guint                   index);
+
+void                     gaeguli_encode_branch_start
+                                                (GaeguliEncodeBranch    *self);
+
+GstPad                  *gaeguli_encode_branch_request_pad
+                                                (GaeguliEncodeBranch    *self);
+
+void                     gaeguli_encode_branch_release_pad
+                                                (GaeguliEncodeBranch    *self,
+                                                 GstPad                 *pad);
+
+guint                    gaeguli_encode_branch_get_n_legs
+                                                (GaeguliEncodeBranch    *self);
+
+gboolean                 gaeguli_encode_branch_is_shareable
+                                                (GaeguliEncodeBranch    *self);
+
+gboolean                 gaeguli_encode_branch_is_retired
+                                                (GaeguliEncodeBranch    *self);
+
+gboolean                 gaeguli_encode_branch_accepts_parameters
+                                                (GaeguliEncodeBranch    *self,
+                                                 const GstStructure     *params);
+
+void                     gaeguli_encode_branch_store_parameters
+                                                (GaeguliEncodeBranch    *self,
+                                                 const GstStructure     *params);
+
+GstStructure            *gaeguli_encode_branch_get_parameters
+                                                (GaeguliEncodeBranch    *self);
+
+gboolean                 gaeguli_encode_branch_get_encoded_frame_stats
+                                                (GaeguliEncodeBranch    *self,
+                                                 guint64                *frames_encoded,
+                                                 gdouble                *average_qp);
+
+gboolean                 gaeguli_encode_branch_request_key_unit
+                                                (GaeguliEncodeBranch    *self);
+
+G_END_DECLS
+
+#endif // __GAEGULI_ENCODE_BRANCH_H__
@@ -0,0 +1,99 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "encodedframemeta.h"
+
+GType
+gaeguli_encoded_frame_meta_api_get_type (void)
+{
+  static volatile GType type = 0;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type =
+        gst_meta_api_type_register ("GaeguliEncodedFrameMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+static gboolean
+_encoded_frame_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  GaeguliEncodedFrameMeta *emeta = (GaeguliEncodedFrameMeta *) meta;
+
+  emeta->frame_type = GAEGULI_FRAME_TYPE_UNKNOWN;
+  emeta->average_qp = 0;
+  emeta->encoded_size = 0;
+  emeta->encode_time = GST_CLOCK_TIME_NONE;
+
+  return TRUE;
+}
+
+static gboolean
+_encoded_frame_meta_transform (GstBuffer * dest, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  GaeguliEncodedFrameMeta *smeta = (GaeguliEncodedFrameMeta *) meta;
+  GaeguliEncodedFrameMeta *dmeta;
+
+  /* The statistics describe the whole frame; don't let them end up on
+   * fragments of it. */
+  if (!GST_META_TRANSFORM_IS_COPY (type)) {
+    return FALSE;
+  }
+
+  dmeta = gaeguli_buffer_add_encoded_frame_meta (dest);
+  if (dmeta == NULL) {
+    return FALSE;
+  }
+
+  dmeta->frame_type = smeta->frame_type;
+  dmeta->average_qp = smeta->average_qp;
+  dmeta->encoded_size = smeta->encoded_size;
+  dmeta->encode_time = smeta->encode_time;
+
+  return TRUE;
+}
+
+const GstMetaInfo *
+gaeguli_encoded_frame_meta_get_info (void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter ((GstMetaInfo **) & meta_info)) {
+    const GstMetaInfo *mi =
+        gst_meta_register (GAEGULI_ENCODED_FRAME_META_API_TYPE,
+        "GaeguliEncodedFrameMeta", sizeof (GaeguliEncodedFrameMeta),
+        _encoded_frame_meta_init, NULL, _encoded_frame_meta_transform);
+    g_once_init_leave ((GstMetaInfo **) & meta_info, (GstMetaInfo *) mi);
+  }
+
+  return meta_info;
+}
+
+GaeguliEncodedFrameMeta *
+gaeguli_buffer_add_encoded_frame_meta (GstBuffer * buffer)
+{
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+  return (GaeguliEncodedFrameMeta *) gst_buffer_add_meta (buffer,
+      gaeguli_encoded_frame_meta_get_info (), NULL);
+}
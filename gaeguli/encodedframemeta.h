@@ -0,0 +1,67 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_ENCODED_FRAME_META_H__
+#define __GAEGULI_ENCODED_FRAME_META_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GAEGULI_FRAME_TYPE_UNKNOWN = 0,
+  GAEGULI_FRAME_TYPE_IDR,
+  GAEGULI_FRAME_TYPE_I,
+  GAEGULI_FRAME_TYPE_P,
+  GAEGULI_FRAME_TYPE_B,
+} GaeguliFrameType;
+
+typedef struct _GaeguliEncodedFrameMeta GaeguliEncodedFrameMeta;
+
+/*
+ * Statistics an encoder attaches to each encoded frame, so that stream
+ * adaptors and statistics can see what every frame cost.
+ */
+struct _GaeguliEncodedFrameMeta
+{
+  GstMeta meta;
+
+  GaeguliFrameType frame_type;
+  gdouble average_qp;
+  gsize encoded_size;
+  GstClockTime encode_time;
+};
+
+#define GAEGULI_ENCODED_FRAME_META_API_TYPE \
+  (gaeguli_encoded_frame_meta_api_get_type ())
+
+#define gaeguli_buffer_get_encoded_frame_meta(b) \
+  ((GaeguliEncodedFrameMeta *) gst_buffer_get_meta ((b), \
+      GAEGULI_ENCODED_FRAME_META_API_TYPE))
+
+GType                    gaeguli_encoded_frame_meta_api_get_type
+                                                (void);
+
+const GstMetaInfo       *gaeguli_encoded_frame_meta_get_info
+                                                (void);
+
+GaeguliEncodedFrameMeta *gaeguli_buffer_add_encoded_frame_meta
+                                                (GstBuffer              *buffer);
+
+G_END_DECLS
+
+#endif // __GAEGULI_ENCODED_FRAME_META_H__
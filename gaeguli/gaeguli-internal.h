@@ -20,23 +20,44 @@
 #define __GAEGULI_INTERNAL_H__
 
 #define GAEGULI_PIPELINE_VSRC_STR       "\
-        %s ! capsfilter name=pre_caps ! videorate ! capsfilter name=caps ! %s ! tee name=tee allow-not-linked=1 "
+        %s ! capsfilter name=pre_caps ! videorate ! capsfilter name=caps ! %s \
+        input-selector name=gap_selector sync-streams=0 ! tee name=tee allow-not-linked=1 "
+
+#define GAEGULI_PIPELINE_GAP_SRC_STR    "\
+        appsrc name=gap_src is-live=1 format=time do-timestamp=1 ! gap_selector. "
 
 #define GAEGULI_PIPELINE_IMAGE_STR    "\
         valve name=valve drop=1 ! jpegenc name=jpegenc ! jifmux name=jifmux ! fakesink name=fakesink async=0"
 
+#define GAEGULI_PIPELINE_SCALED_IMAGE_STR    "\
+        valve name=valve drop=1 ! videoscale ! %s ! jpegenc name=jpegenc ! jifmux name=jifmux ! fakesink name=fakesink async=0"
+
+#define GAEGULI_PIPELINE_JPEG_PASSTHROUGH_STR    "\
+        appsrc name=jpegsrc is-live=1 format=time ! jifmux name=passthrough_jifmux ! fakesink name=passthrough_fakesink async=0"
+
 #define GAEGULI_PIPELINE_GENERAL_H264ENC_STR    "\
-        queue name=enc_first ! videoconvert ! videoscale ! capsfilter name=target_caps ! \
+        queue name=enc_first ! videoconvert ! videoscale ! \
+        videorate name=target_rate drop-only=1 ! capsfilter name=target_caps ! \
         x264enc name=enc tune=zerolatency key-int-max=%d ! \
         video/x-h264, profile=baseline ! h264parse config-interval=-1 ! queue "
 
+#define GAEGULI_PIPELINE_GAEGULI_H264ENC_STR    "\
+        queue name=enc_first ! videoconvert ! videoscale ! \
+        videorate name=target_rate drop-only=1 ! capsfilter name=target_caps ! \
+        gaegulix264enc name=enc key-int-max=%d ! \
+        video/x-h264, profile=baseline ! h264parse config-interval=-1 ! queue "
+
 #define GAEGULI_PIPELINE_GENERAL_H265ENC_STR    "\
-        queue name=enc_first ! videoconvert ! videoscale ! capsfilter name=target_caps ! \
+        queue name=enc_first ! videoconvert ! videoscale ! \
+        videorate name=target_rate drop-only=1 ! capsfilter name=target_caps ! \
         x265enc name=enc tune=zerolatency key-int-max=%d ! \
         h265parse ! queue "
 
 #define GAEGULI_PIPELINE_DECODEBIN_STR    "\
-        decodebin name=decodebin ! videoconvert ! clockoverlay name=overlay "
+        decodebin name=decodebin "
+
+#define GAEGULI_PIPELINE_CLOCK_OVERLAY_STR    "\
+        videoconvert ! clockoverlay name=overlay "
 
 #define GAEGULI_PIPELINE_OMXH264ENC_STR     "\
         omxh264enc name=enc insert-sps-pps=true insert-vui=true control-rate=1 periodicity-idr=%d ! queue "
@@ -45,33 +66,66 @@
         omxh265enc name=enc insert-sps-pps=true insert-vui=true control-rate=1 periodicity-idr=%d ! queue "
 
 #define GAEGULI_PIPELINE_NVIDIA_TX1_H264ENC_STR    "\
-        queue name=enc_first ! nvvidconv ! capsfilter name=target_caps ! " \
+        queue name=enc_first ! nvvidconv ! \
+        videorate name=target_rate drop-only=1 ! capsfilter name=target_caps ! " \
         GAEGULI_PIPELINE_OMXH264ENC_STR
 
 #define GAEGULI_PIPELINE_NVIDIA_TX1_H265ENC_STR    "\
-        queue name=enc_first ! nvvidconv ! capsfilter name=target_caps ! " \
+        queue name=enc_first ! nvvidconv ! \
+        videorate name=target_rate drop-only=1 ! capsfilter name=target_caps ! " \
         GAEGULI_PIPELINE_OMXH265ENC_STR
 
 #define GAEGULI_PIPELINE_VAAPI_H264_STR    "\
-        queue name=enc_first ! vaapipostproc ! capsfilter name=target_caps ! \
+        queue name=enc_first ! vaapipostproc ! \
+        videorate name=target_rate drop-only=1 ! capsfilter name=target_caps ! \
         vaapih264enc name=enc target-percentage=100 keyframe-period=%d ! \
         h264parse config-interval=-1 ! queue "
 
 #define GAEGULI_PIPELINE_VAAPI_H265_STR    "\
-        queue name=enc_first ! vaapipostproc ! capsfilter name=target_caps ! \
+        queue name=enc_first ! vaapipostproc ! \
+        videorate name=target_rate drop-only=1 ! capsfilter name=target_caps ! \
         vaapih265enc name=enc target-percentage=100 keyframe-period=%d ! \
         h265parse config-interval=-1 ! queue "
 
-#define GAEGULI_PIPELINE_MPEGTSMUX_SINK_STR    "\
-        mpegtsmux name=muxsink_first ! tsparse set-timestamps=1 smoothing-latency=1000 ! \
-        srtsink name=sink uri=%s wait-for-connection=false sync=false"
+#define GAEGULI_PIPELINE_SCALER_STR    "\
+        queue name=enc_first ! videoconvert ! videoscale ! capsfilter name=target_caps ! \
+        tee name=enc_tee allow-not-linked=1 "
+
+#define GAEGULI_PIPELINE_SIMULCAST_CONVERT_STR    "\
+        queue name=enc_first ! videoconvert ! tee name=convert_tee allow-not-linked=1 "
+
+#define GAEGULI_PIPELINE_SIMULCAST_SCALER_STR    "\
+        convert_tee. ! queue ! videoscale ! capsfilter name=scaler_caps_%u ! \
+        tee name=scaler_tee_%u allow-not-linked=1 "
+
+#define GAEGULI_PIPELINE_SIMULCAST_H264ENC_STR    "\
+        scaler_tee_%u. ! queue ! x264enc name=%s tune=zerolatency key-int-max=%u option-string=\"scenecut=0\" ! \
+        video/x-h264, profile=baseline ! h264parse config-interval=-1 ! queue ! muxsink_first.sink_%u "
+
+#define GAEGULI_PIPELINE_SIMULCAST_GAEGULI_H264ENC_STR    "\
+        scaler_tee_%u. ! queue ! gaegulix264enc name=%s key-int-max=%u scenecut=false ! \
+        video/x-h264, profile=baseline ! h264parse config-interval=-1 ! queue ! muxsink_first.sink_%u "
+
+#define GAEGULI_PIPELINE_SIMULCAST_H265ENC_STR    "\
+        scaler_tee_%u. ! queue ! x265enc name=%s tune=zerolatency key-int-max=%u option-string=\"scenecut=0\" ! \
+        h265parse ! queue ! muxsink_first.sink_%u "
+
+#define GAEGULI_PIPELINE_MPEGTSMUX_STR    "\
+        mpegtsmux name=muxsink_first ! tsparse name=tsparse set-timestamps=1 smoothing-latency=1000 ! \
+        tee name=enc_tee allow-not-linked=1 "
+
+#define GAEGULI_PIPELINE_MPEGTSMUX_LOW_LATENCY_STR    "\
+        mpegtsmux name=muxsink_first alignment=0 ! \
+        tee name=enc_tee allow-not-linked=1 "
+
+#define GAEGULI_PIPELINE_RTPMUX_STR    "\
+        rtpmux name=muxsink_first ! tee name=enc_tee allow-not-linked=1 "
 
-#define GAEGULI_PIPELINE_RTPMUX_SINK_STR    "\
-        rtpmux name=muxsink_first ! queue ! \
+#define GAEGULI_PIPELINE_SRTSINK_STR    "\
+        queue name=leg_first ! \
         srtsink name=sink uri=%s wait-for-connection=false sync=false"
 
-#define GAEGULI_RECORD_PIPELINE_MPEGTSMUX_SINK_STR    "\
-        mpegtsmux name=muxsink_first ! tsparse set-timestamps=1 smoothing-latency=1000 ! \
-        filesink name=recsink location=%s "
+#define GAEGULI_RECORD_PIPELINE_FILESINK_STR    "\
+        queue name=leg_first ! filesink name=recsink location=%s "
 
 #endif // __GAEGULI_INTERNAL_H__
@@ -0,0 +1,664 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "gaegulix264enc.h"
+
+#include "encodedframemeta.h"
+#include "enumtypes.h"
+#include "types.h"
+
+#include <x264.h>
+
+#define DEFAULT_BITRATE                 2048
+#define DEFAULT_QUANTIZER               21
+#define DEFAULT_BITRATE_CONTROL         GAEGULI_VIDEO_BITRATE_CONTROL_CBR
+#define DEFAULT_KEY_INT_MAX             0
+#define DEFAULT_VBV_BUF_CAPACITY        600
+#define DEFAULT_SPEED_PRESET            "medium"
+#define DEFAULT_INTRA_REFRESH           FALSE
+#define DEFAULT_SCENECUT                TRUE
+
+struct _GaeguliX264Enc
+{
+  GstVideoEncoder parent;
+
+  x264_t *x264;
+  x264_param_t param;
+  GstVideoCodecState *input_state;
+
+  /* Protected by the object lock. */
+  guint bitrate;
+  guint quantizer;
+  GaeguliVideoBitrateControl bitrate_control;
+  guint key_int_max;
+  guint vbv_buf_capacity;
+  gchar *speed_preset;
+  gboolean intra_refresh;
+  gboolean scenecut;
+
+  gboolean reconfigure;
+  gboolean reopen;
+};
+
+enum
+{
+  PROP_BITRATE = 1,
+  PROP_QUANTIZER,
+  PROP_BITRATE_CONTROL,
+  PROP_KEY_INT_MAX,
+  PROP_VBV_BUF_CAPACITY,
+  PROP_SPEED_PRESET,
+  PROP_INTRA_REFRESH,
+  PROP_SCENECUT,
+  PROP_LAST
+};
+
+static GParamSpec *properties[PROP_LAST] = { 0 };
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("I420")));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("video/x-h264, "
+        "framerate = (fraction) [0/1, MAX], "
+        "width = (int) [ 16, MAX ], " "height = (int) [ 16, MAX ], "
+        "stream-format = (string) byte-stream, "
+        "alignment = (string) au, " "profile = (string) baseline"));
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (GaeguliX264Enc, gaeguli_x264_enc, GST_TYPE_VIDEO_ENCODER)
+/* *INDENT-ON* */
+
+/* Must be called with the object lock held. */
+static void
+gaeguli_x264_enc_apply_rate_control (GaeguliX264Enc * self,
+    x264_param_t * param)
+{
+  /* x264 wants VBV settings in kbit. The product doesn't fit in 32 bits at
+   * the highest bitrates and capacities. */
+  gint vbv_buffer_size =
+      MIN ((guint64) self->bitrate * self->vbv_buf_capacity / 1000, G_MAXINT);
+
+  switch (self->bitrate_control) {
+    case GAEGULI_VIDEO_BITRATE_CONTROL_CQP:
+      param->rc.i_rc_method = X264_RC_CQP;
+      param->rc.i_qp_constant = self->quantizer;
+      param->rc.i_vbv_max_bitrate = 0;
+      param->rc.i_vbv_buffer_size = 0;
+      break;
+    case GAEGULI_VIDEO_BITRATE_CONTROL_VBR:
+      /* Same as x264enc's "qual" pass: constant quality capped by VBV. */
+      param->rc.i_rc_method = X264_RC_CRF;
+      param->rc.f_rf_constant = self->quantizer;
+      param->rc.i_vbv_max_bitrate = self->bitrate;
+      param->rc.i_vbv_buffer_size = vbv_buffer_size;
+      break;
+    case GAEGULI_VIDEO_BITRATE_CONTROL_CBR:
+    default:
+      param->rc.i_rc_method = X264_RC_ABR;
+      param->rc.i_bitrate = self->bitrate;
+      param->rc.i_vbv_max_bitrate = self->bitrate;
+      param->rc.i_vbv_buffer_size = vbv_buffer_size;
+      break;
+  }
+}
+
+static gboolean
+gaeguli_x264_enc_open (GaeguliX264Enc * self)
+{
+  GstVideoInfo *info = &self->input_state->info;
+  x264_param_t param;
+
+  GST_OBJECT_LOCK (self);
+
+  if (x264_param_default_preset (&param, self->speed_preset,
+          "zerolatency") < 0) {
+    GST_OBJECT_UNLOCK (self);
+    GST_ELEMENT_ERROR (self, STREAM, ENCODE, ("Invalid speed preset"),
+        ("Unknown x264 preset '%s'", self->speed_preset));
+    return FALSE;
+  }
+
+  param.i_log_level = X264_LOG_WARNING;
+  param.i_csp = X264_CSP_I420;
+  param.i_width = GST_VIDEO_INFO_WIDTH (info);
+  param.i_height = GST_VIDEO_INFO_HEIGHT (info);
+  if (GST_VIDEO_INFO_FPS_N (info) > 0) {
+    param.i_fps_num = GST_VIDEO_INFO_FPS_N (info);
+    param.i_fps_den = GST_VIDEO_INFO_FPS_D (info);
+  }
+  param.i_timebase_num = 1;
+  param.i_timebase_den = GST_SECOND;
+  param.b_vfr_input = 1;
+  param.b_annexb = 1;
+  param.b_repeat_headers = 1;
+  if (self->key_int_max > 0) {
+    param.i_keyint_max = self->key_int_max;
+  }
+  param.b_intra_refresh = self->intra_refresh;
+  if (!self->scenecut) {
+    param.i_scenecut_threshold = 0;
+  }
+
+  gaeguli_x264_enc_apply_rate_control (self, &param);
+
+  self->reconfigure = FALSE;
+  self->reopen = FALSE;
+
+  GST_OBJECT_UNLOCK (self);
+
+  x264_param_apply_profile (&param, "baseline");
+
+  self->x264 = x264_encoder_open (&param);
+  if (self->x264 == NULL) {
+    GST_ELEMENT_ERROR (self, STREAM, ENCODE, ("Can't open x264 encoder"),
+        (NULL));
+    return FALSE;
+  }
+
+  self->param = param;
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gaeguli_x264_enc_push_frame (GaeguliX264Enc * self, x264_nal_t * nal,
+    gint frame_size, x264_picture_t * pic_out, GstClockTime encode_time)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
+  GstVideoCodecFrame *frame;
+  GaeguliEncodedFrameMeta *meta;
+
+  frame = gst_video_encoder_get_frame (encoder,
+      GPOINTER_TO_INT (pic_out->opaque));
+  if (frame == NULL) {
+    GST_ELEMENT_ERROR (self, STREAM, ENCODE, (NULL),
+        ("x264 returned an unknown frame"));
+    return GST_FLOW_ERROR;
+  }
+
+  frame->output_buffer =
+      gst_video_encoder_allocate_output_buffer (encoder, frame_size);
+  /* x264 lays out the NAL units of a frame contiguously. */
+  gst_buffer_fill (frame->output_buffer, 0, nal[0].p_payload, frame_size);
+
+  if (pic_out->b_keyframe) {
+    GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
+  }
+
+  meta = gaeguli_buffer_add_encoded_frame_meta (frame->output_buffer);
+  switch (pic_out->i_type) {
+    case X264_TYPE_IDR:
+      meta->frame_type = GAEGULI_FRAME_TYPE_IDR;
+      break;
+    case X264_TYPE_I:
+      meta->frame_type = GAEGULI_FRAME_TYPE_I;
+      break;
+    case X264_TYPE_P:
+      meta->frame_type = GAEGULI_FRAME_TYPE_P;
+      break;
+    case X264_TYPE_B:
+    case X264_TYPE_BREF:
+      meta->frame_type = GAEGULI_FRAME_TYPE_B;
+      break;
+    default:
+      meta->frame_type = GAEGULI_FRAME_TYPE_UNKNOWN;
+      break;
+  }
+  /* On output, x264 reports the frame's average QP in i_qpplus1. */
+  meta->average_qp = pic_out->i_qpplus1 - 1;
+  meta->encoded_size = frame_size;
+  meta->encode_time = encode_time;
+
+  return gst_video_encoder_finish_frame (encoder, frame);
+}
+
+static GstFlowReturn
+gaeguli_x264_enc_encode (GaeguliX264Enc * self, x264_picture_t * pic_in)
+{
+  x264_picture_t pic_out;
+  x264_nal_t *nal = NULL;
+  gint n_nal = 0;
+  gint frame_size;
+  gint64 start_time;
+
+  start_time = g_get_monotonic_time ();
+  frame_size = x264_encoder_encode (self->x264, &nal, &n_nal, pic_in, &pic_out);
+
+  if (frame_size < 0) {
+    GST_ELEMENT_ERROR (self, STREAM, ENCODE, ("Encode x264 frame failed"),
+        ("x264_encoder_encode returned %d", frame_size));
+    return GST_FLOW_ERROR;
+  }
+
+  if (frame_size == 0) {
+    /* Frame got delayed inside the encoder. */
+    return GST_FLOW_OK;
+  }
+
+  return gaeguli_x264_enc_push_frame (self, nal, frame_size, &pic_out,
+      (g_get_monotonic_time () - start_time) * GST_USECOND);
+}
+
+static GstFlowReturn
+gaeguli_x264_enc_drain (GaeguliX264Enc * self)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (self->x264 == NULL) {
+    return GST_FLOW_OK;
+  }
+
+  while (ret == GST_FLOW_OK && x264_encoder_delayed_frames (self->x264) > 0) {
+    ret = gaeguli_x264_enc_encode (self, NULL);
+  }
+
+  return ret;
+}
+
+static void
+gaeguli_x264_enc_close (GaeguliX264Enc * self)
+{
+  if (self->x264) {
+    x264_encoder_close (self->x264);
+    self->x264 = NULL;
+  }
+}
+
+/* Applies property changes made since the previous frame. */
+static gboolean
+gaeguli_x264_enc_update (GaeguliX264Enc * self)
+{
+  x264_param_t param;
+  gboolean reopen;
+
+  GST_OBJECT_LOCK (self);
+
+  reopen = self->reopen;
+
+  if (!reopen && self->reconfigure) {
+    param = self->param;
+    gaeguli_x264_enc_apply_rate_control (self, &param);
+    self->reconfigure = FALSE;
+
+    GST_OBJECT_UNLOCK (self);
+
+    g_debug ("reconfiguring x264 (bitrate %d, rf %f, vbv %d/%d)",
+        param.rc.i_bitrate, param.rc.f_rf_constant,
+        param.rc.i_vbv_max_bitrate, param.rc.i_vbv_buffer_size);
+
+    if (x264_encoder_reconfig (self->x264, &param) < 0) {
+      g_warning ("x264 rejected the new parameters");
+    } else {
+      self->param = param;
+    }
+
+    return TRUE;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+
+  if (reopen) {
+    /* libx264 can't switch rate control method or the constant quantizer on
+     * the fly. Re-open the encoder in place; the next frame becomes an IDR,
+     * but the pipeline keeps running. */
+    g_debug ("re-opening x264 for new rate control");
+
+    if (gaeguli_x264_enc_drain (self) != GST_FLOW_OK) {
+      return FALSE;
+    }
+    gaeguli_x264_enc_close (self);
+
+    return gaeguli_x264_enc_open (self);
+  }
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gaeguli_x264_enc_handle_frame (GstVideoEncoder * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GaeguliX264Enc *self = GAEGULI_X264_ENC (encoder);
+  GstVideoFrame vframe;
+  x264_picture_t pic_in;
+  GstFlowReturn ret;
+  gint i;
+
+  if (self->x264 == NULL) {
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  if (!gaeguli_x264_enc_update (self)) {
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gst_video_frame_map (&vframe, &self->input_state->info,
+          frame->input_buffer, GST_MAP_READ)) {
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_ERROR;
+  }
+
+  x264_picture_init (&pic_in);
+  pic_in.img.i_csp = X264_CSP_I420;
+  pic_in.img.i_plane = GST_VIDEO_FRAME_N_PLANES (&vframe);
+  for (i = 0; i < pic_in.img.i_plane; i++) {
+    pic_in.img.plane[i] = GST_VIDEO_FRAME_COMP_DATA (&vframe, i);
+    pic_in.img.i_stride[i] = GST_VIDEO_FRAME_COMP_STRIDE (&vframe, i);
+  }
+  pic_in.i_pts = frame->pts;
+  pic_in.opaque = GINT_TO_POINTER (frame->system_frame_number);
+
+  if (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)) {
+    /* Emit a real IDR even in intra refresh mode, so that a receiver joining
+     * the stream can start decoding right away. */
+    pic_in.i_type = X264_TYPE_IDR;
+  }
+
+  ret = gaeguli_x264_enc_encode (self, &pic_in);
+
+  gst_video_frame_unmap (&vframe);
+  gst_video_codec_frame_unref (frame);
+
+  return ret;
+}
+
+static gboolean
+gaeguli_x264_enc_set_format (GstVideoEncoder * encoder,
+    GstVideoCodecState * state)
+{
+  GaeguliX264Enc *self = GAEGULI_X264_ENC (encoder);
+  GstVideoCodecState *output_state;
+  GstClockTime latency = 0;
+
+  gaeguli_x264_enc_drain (self);
+  gaeguli_x264_enc_close (self);
+
+  g_clear_pointer (&self->input_state, gst_video_codec_state_unref);
+  self->input_state = gst_video_codec_state_ref (state);
+
+  if (!gaeguli_x264_enc_open (self)) {
+    return FALSE;
+  }
+
+  output_state = gst_video_encoder_set_output_state (encoder,
+      gst_caps_new_simple ("video/x-h264",
+          "stream-format", G_TYPE_STRING, "byte-stream",
+          "alignment", G_TYPE_STRING, "au",
+          "profile", G_TYPE_STRING, "baseline", NULL), state);
+  gst_video_codec_state_unref (output_state);
+
+  if (GST_VIDEO_INFO_FPS_N (&state->info) > 0) {
+    latency = gst_util_uint64_scale_ceil (GST_SECOND *
+        x264_encoder_maximum_delayed_frames (self->x264),
+        GST_VIDEO_INFO_FPS_D (&state->info),
+        GST_VIDEO_INFO_FPS_N (&state->info));
+  }
+  gst_video_encoder_set_latency (encoder, latency, latency);
+
+  return gst_video_encoder_negotiate (encoder);
+}
+
+static GstFlowReturn
+gaeguli_x264_enc_finish (GstVideoEncoder * encoder)
+{
+  return gaeguli_x264_enc_drain (GAEGULI_X264_ENC (encoder));
+}
+
+static gboolean
+gaeguli_x264_enc_flush (GstVideoEncoder * encoder)
+{
+  GaeguliX264Enc *self = GAEGULI_X264_ENC (encoder);
+
+  /* Pending frames are discarded by the base class; start from scratch. */
+  gaeguli_x264_enc_close (self);
+
+  return self->input_state == NULL || gaeguli_x264_enc_open (self);
+}
+
+static gboolean
+gaeguli_x264_enc_stop (GstVideoEncoder * encoder)
+{
+  GaeguliX264Enc *self = GAEGULI_X264_ENC (encoder);
+
+  gaeguli_x264_enc_close (self);
+  g_clear_pointer (&self->input_state, gst_video_codec_state_unref);
+
+  return TRUE;
+}
+
+static gboolean
+gaeguli_x264_enc_propose_allocation (GstVideoEncoder * encoder,
+    GstQuery * query)
+{
+  gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+
+  return GST_VIDEO_ENCODER_CLASS
+      (gaeguli_x264_enc_parent_class)->propose_allocation (encoder, query);
+}
+
+static void
+gaeguli_x264_enc_init (GaeguliX264Enc * self)
+{
+  self->bitrate = DEFAULT_BITRATE;
+  self->quantizer = DEFAULT_QUANTIZER;
+  self->bitrate_control = DEFAULT_BITRATE_CONTROL;
+  self->key_int_max = DEFAULT_KEY_INT_MAX;
+  self->vbv_buf_capacity = DEFAULT_VBV_BUF_CAPACITY;
+  self->speed_preset = g_strdup (DEFAULT_SPEED_PRESET);
+  self->intra_refresh = DEFAULT_INTRA_REFRESH;
+  self->scenecut = DEFAULT_SCENECUT;
+}
+
+static void
+gaeguli_x264_enc_finalize (GObject * object)
+{
+  GaeguliX264Enc *self = GAEGULI_X264_ENC (object);
+
+  gaeguli_x264_enc_close (self);
+  g_clear_pointer (&self->input_state, gst_video_codec_state_unref);
+  g_clear_pointer (&self->speed_preset, g_free);
+
+  G_OBJECT_CLASS (gaeguli_x264_enc_parent_class)->finalize (object);
+}
+
+static void
+gaeguli_x264_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GaeguliX264Enc *self = GAEGULI_X264_ENC (object);
+
+  GST_OBJECT_LOCK (self);
+
+  switch (prop_id) {
+    case PROP_BITRATE:
+      g_value_set_uint (value, self->bitrate);
+      break;
+    case PROP_QUANTIZER:
+      g_value_set_uint (value, self->quantizer);
+      break;
+    case PROP_BITRATE_CONTROL:
+      g_value_set_enum (value, self->bitrate_control);
+      break;
+    case PROP_KEY_INT_MAX:
+      g_value_set_uint (value, self->key_int_max);
+      break;
+    case PROP_VBV_BUF_CAPACITY:
+      g_value_set_uint (value, self->vbv_buf_capacity);
+      break;
+    case PROP_SPEED_PRESET:
+      g_value_set_string (value, self->speed_preset);
+      break;
+    case PROP_INTRA_REFRESH:
+      g_value_set_boolean (value, self->intra_refresh);
+      break;
+    case PROP_SCENECUT:
+      g_value_set_boolean (value, self->scenecut);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gaeguli_x264_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GaeguliX264Enc *self = GAEGULI_X264_ENC (object);
+
+  GST_OBJECT_LOCK (self);
+
+  switch (prop_id) {
+    case PROP_BITRATE:
+      self->bitrate = g_value_get_uint (value);
+      self->reconfigure = TRUE;
+      break;
+    case PROP_QUANTIZER:
+      self->quantizer = g_value_get_uint (value);
+      if (self->bitrate_control == GAEGULI_VIDEO_BITRATE_CONTROL_CQP) {
+        self->reopen = TRUE;
+      } else {
+        self->reconfigure = TRUE;
+      }
+      break;
+    case PROP_BITRATE_CONTROL:{
+      GaeguliVideoBitrateControl bitrate_control = g_value_get_enum (value);
+
+      if (self->bitrate_control != bitrate_control) {
+        self->bitrate_control = bitrate_control;
+        self->reopen = TRUE;
+      }
+      break;
+    }
+    case PROP_KEY_INT_MAX:
+      self->key_int_max = g_value_get_uint (value);
+      break;
+    case PROP_VBV_BUF_CAPACITY:
+      self->vbv_buf_capacity = g_value_get_uint (value);
+      self->reconfigure = TRUE;
+      break;
+    case PROP_SPEED_PRESET:
+      g_free (self->speed_preset);
+      self->speed_preset = g_value_dup_string (value);
+      break;
+    case PROP_INTRA_REFRESH:
+      self->intra_refresh = g_value_get_boolean (value);
+      break;
+    case PROP_SCENECUT:
+      self->scenecut = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gaeguli_x264_enc_class_init (GaeguliX264EncClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstVideoEncoderClass *encoder_class = GST_VIDEO_ENCODER_CLASS (klass);
+
+  gobject_class->get_property = gaeguli_x264_enc_get_property;
+  gobject_class->set_property = gaeguli_x264_enc_set_property;
+  gobject_class->finalize = gaeguli_x264_enc_finalize;
+
+  encoder_class->set_format = gaeguli_x264_enc_set_format;
+  encoder_class->handle_frame = gaeguli_x264_enc_handle_frame;
+  encoder_class->finish = gaeguli_x264_enc_finish;
+  encoder_class->flush = gaeguli_x264_enc_flush;
+  encoder_class->stop = gaeguli_x264_enc_stop;
+  encoder_class->propose_allocation = gaeguli_x264_enc_propose_allocation;
+
+  properties[PROP_BITRATE] =
+      g_param_spec_uint ("bitrate", "Bitrate", "Bitrate in kbit/sec",
+      1, 2000 * 1024, DEFAULT_BITRATE,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_QUANTIZER] =
+      g_param_spec_uint ("quantizer", "Quantizer",
+      "Constant quantizer (CQP) or quality factor (VBR) to apply",
+      0, 50, DEFAULT_QUANTIZER,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_BITRATE_CONTROL] =
+      g_param_spec_enum ("bitrate-control", "Bitrate control",
+      "Rate control method", GAEGULI_TYPE_VIDEO_BITRATE_CONTROL,
+      DEFAULT_BITRATE_CONTROL,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_KEY_INT_MAX] =
+      g_param_spec_uint ("key-int-max", "Key-frame maximal interval",
+      "Maximal distance between two key-frames (0 for automatic)",
+      0, G_MAXINT, DEFAULT_KEY_INT_MAX,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_VBV_BUF_CAPACITY] =
+      g_param_spec_uint ("vbv-buf-capacity", "VBV buffer capacity",
+      "Size of the VBV buffer in milliseconds", 0, 10000,
+      DEFAULT_VBV_BUF_CAPACITY,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_SPEED_PRESET] =
+      g_param_spec_string ("speed-preset", "Speed preset",
+      "x264 preset name", DEFAULT_SPEED_PRESET,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_INTRA_REFRESH] =
+      g_param_spec_boolean ("intra-refresh", "Intra refresh",
+      "Use periodic intra refresh instead of IDR frames",
+      DEFAULT_INTRA_REFRESH,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_SCENECUT] =
+      g_param_spec_boolean ("scenecut", "Scene cut detection",
+      "Insert keyframes at scene changes besides the periodic ones",
+      DEFAULT_SCENECUT,
+      G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, G_N_ELEMENTS (properties),
+      properties);
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+
+  gst_element_class_set_static_metadata (element_class,
+      "Gaeguli x264 encoder", "Codec/Encoder/Video",
+      "H.264 encoder with live rate control reconfiguration",
+      "SK Telecom Co., Ltd.");
+}
+
+gboolean
+gaeguli_x264_enc_register (void)
+{
+  return gst_element_register (NULL, "gaegulix264enc", GST_RANK_NONE,
+      GAEGULI_TYPE_X264_ENC);
+}
@@ -0,0 +1,42 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_X264_ENC_H__
+#define __GAEGULI_X264_ENC_H__
+
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/*
+ * gaegulix264enc is a H.264 encoder built directly on libx264. Unlike
+ * x264enc, it applies bitrate, VBV and quantizer changes to a running
+ * encoder through x264_encoder_reconfig(), so the stream doesn't have to be
+ * interrupted when a stream adaptor adjusts it. Each output buffer carries a
+ * GaeguliEncodedFrameMeta.
+ */
+
+#define GAEGULI_TYPE_X264_ENC   (gaeguli_x264_enc_get_type ())
+G_DECLARE_FINAL_TYPE (GaeguliX264Enc, gaeguli_x264_enc, GAEGULI, X264_ENC,
+    GstVideoEncoder)
+
+gboolean                 gaeguli_x264_enc_register
+                                                (void);
+
+G_END_DECLS
+
+#endif // __GAEGULI_X264_ENC_H__
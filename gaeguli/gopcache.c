@@ -0,0 +1,231 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "gopcache.h"
+
+#include <srt/srt.h>
+
+#define TS_PACKET_SIZE          188
+/* srtsink sends 7 TS packets per SRT message in live mode. */
+#define SRT_PAYLOAD_SIZE        (7 * TS_PACKET_SIZE)
+
+struct _GaeguliGopCache
+{
+  GMutex lock;
+
+  GQueue buffers;
+  gsize size;
+  gsize max_size;
+  /* The cache doesn't start with a random access point. */
+  gboolean incomplete;
+};
+
+GaeguliGopCache *
+gaeguli_gop_cache_new (gsize max_size)
+{
+  GaeguliGopCache *self = g_new0 (GaeguliGopCache, 1);
+
+  g_mutex_init (&self->lock);
+  g_queue_init (&self->buffers);
+  self->max_size = max_size;
+  self->incomplete = TRUE;
+
+  return self;
+}
+
+static void
+gaeguli_gop_cache_clear (GaeguliGopCache * self)
+{
+  g_queue_clear_full (&self->buffers, (GDestroyNotify) gst_buffer_unref);
+  self->size = 0;
+}
+
+void
+gaeguli_gop_cache_free (GaeguliGopCache * self)
+{
+  gaeguli_gop_cache_clear (self);
+  g_mutex_clear (&self->lock);
+
+  g_free (self);
+}
+
+/* Looks for a TS packet with random_access_indicator set, which mpegtsmux
+ * puts on the first packet of every video keyframe. */
+gboolean
+gaeguli_ts_buffer_has_random_access_point (GstBuffer * buffer)
+{
+  GstMapInfo map;
+  gboolean result = FALSE;
+  gsize offset;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    return FALSE;
+  }
+
+  for (offset = 0; offset + TS_PACKET_SIZE <= map.size;
+      offset += TS_PACKET_SIZE) {
+    const guint8 *packet = map.data + offset;
+
+    if (packet[0] != 0x47) {
+      /* Lost sync; we can't tell. */
+      break;
+    }
+
+    /* adaptation_field_control has an adaptation field, which isn't empty
+     * and has random_access_indicator set. */
+    if ((packet[3] & 0x20) && packet[4] > 0 && (packet[5] & 0x40)) {
+      result = TRUE;
+      break;
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  return result;
+}
+
+/* Sends buffer to an SRT socket in the chunks srtsink would use. On a socket
+ * with SRTO_SNDSYN off, fails with SRT_EASYNCSND rather than blocking once
+ * the send buffer is full, possibly after some of the chunks went out. */
+gboolean
+gaeguli_srt_socket_send_buffer (gint srtsocket, GstBuffer * buffer)
+{
+  GstMapInfo map;
+  gsize offset;
+  gboolean result = TRUE;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    return FALSE;
+  }
+
+  for (offset = 0; offset < map.size; offset += SRT_PAYLOAD_SIZE) {
+    gsize len = MIN (map.size - offset, SRT_PAYLOAD_SIZE);
+
+    if (srt_sendmsg2 (srtsocket, (const char *) map.data + offset, len,
+            NULL) == SRT_ERROR) {
+      g_debug ("Failed to send to socket %d (%s)", srtsocket,
+          srt_getlasterror_str ());
+      result = FALSE;
+      break;
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  return result;
+}
+
+static gboolean
+gaeguli_gop_cache_send (GaeguliGopCache * self, gint srtsocket)
+{
+  SRT_TRACEBSTATS perf;
+  gint sndbuf = 0;
+  gint optlen = sizeof (sndbuf);
+  gint blocking;
+  gboolean result = TRUE;
+  GList *l;
+
+  if (self->incomplete || g_queue_is_empty (&self->buffers)) {
+    return FALSE;
+  }
+
+  /* Once srtsink wrote live data to the socket, the older cached packets
+   * would take the receiver's timestamps back. */
+  if (srt_bstats (srtsocket, &perf, 0) == SRT_ERROR || perf.pktSentTotal > 0) {
+    g_debug ("Socket %d already got live data; not sending GOP cache",
+        srtsocket);
+    return FALSE;
+  }
+
+  /* A burst that doesn't fit in the send buffer would be cut off somewhere
+   * in the middle of the GOP. */
+  if (srt_getsockflag (srtsocket, SRTO_SNDBUF, &sndbuf, &optlen) == SRT_ERROR
+      || self->size > (gsize) sndbuf) {
+    g_debug ("GOP cache of %" G_GSIZE_FORMAT " bytes doesn't fit the send "
+        "buffer of socket %d", self->size, srtsocket);
+    return FALSE;
+  }
+
+  g_debug ("Sending %" G_GSIZE_FORMAT " bytes of GOP cache to socket %d",
+      self->size, srtsocket);
+
+  /* Live data waits for the burst, so nobody else writes to the socket
+   * meanwhile. A congested caller mustn't hold up srtsink's accept thread;
+   * it gets a keyframe instead. */
+  blocking = FALSE;
+  srt_setsockflag (srtsocket, SRTO_SNDSYN, &blocking, sizeof (blocking));
+
+  for (l = self->buffers.head; l; l = l->next) {
+    if (!gaeguli_srt_socket_send_buffer (srtsocket, l->data)) {
+      result = FALSE;
+      break;
+    }
+  }
+
+  blocking = TRUE;
+  srt_setsockflag (srtsocket, SRTO_SNDSYN, &blocking, sizeof (blocking));
+
+  return result;
+}
+
+/*
+ * Sends the cache to a caller that just joined. Call it from srtsink's
+ * "caller-added" handler, before the sink writes any live data to the
+ * socket. Live data waits in gaeguli_gop_cache_push() until the burst is
+ * out, so the caller's stream continues seamlessly with the next buffer.
+ *
+ * Returns: %TRUE if the caller got the cache, %FALSE when it needs a new
+ * keyframe instead.
+ */
+gboolean
+gaeguli_gop_cache_add_caller (GaeguliGopCache * self, gint srtsocket)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  return gaeguli_gop_cache_send (self, srtsocket);
+}
+
+/* Must be called from the streaming thread for each buffer before the sink
+ * gets it. */
+void
+gaeguli_gop_cache_push (GaeguliGopCache * self, GstBuffer * buffer)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  if (self->max_size == 0) {
+    return;
+  }
+
+  if (gaeguli_ts_buffer_has_random_access_point (buffer)) {
+    gaeguli_gop_cache_clear (self);
+    self->incomplete = FALSE;
+  } else if (self->incomplete) {
+    return;
+  }
+
+  if (self->size + gst_buffer_get_size (buffer) > self->max_size) {
+    /* Too long since the last keyframe; new callers will ask for one. */
+    gaeguli_gop_cache_clear (self);
+    self->incomplete = TRUE;
+    return;
+  }
+
+  g_queue_push_tail (&self->buffers, gst_buffer_ref (buffer));
+  self->size += gst_buffer_get_size (buffer);
+}
@@ -0,0 +1,56 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_GOP_CACHE_H__
+#define __GAEGULI_GOP_CACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * GaeguliGopCache keeps the MPEG-TS packets a listener target sent since the
+ * last random access point. A caller that joins the listener gets the cache
+ * sent straight to its socket, so it can start decoding without waiting for
+ * the next keyframe.
+ */
+
+typedef struct _GaeguliGopCache GaeguliGopCache;
+
+GaeguliGopCache         *gaeguli_gop_cache_new  (gsize                   max_size);
+
+void                     gaeguli_gop_cache_free (GaeguliGopCache        *self);
+
+gboolean                 gaeguli_gop_cache_add_caller
+                                                (GaeguliGopCache        *self,
+                                                 gint                    srtsocket);
+
+void                     gaeguli_gop_cache_push (GaeguliGopCache        *self,
+                                                 GstBuffer              *buffer);
+
+gboolean                 gaeguli_ts_buffer_has_random_access_point
+                                                (GstBuffer              *buffer);
+
+gboolean                 gaeguli_srt_socket_send_buffer
+                                                (gint                    srtsocket,
+                                                 GstBuffer              *buffer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GaeguliGopCache, gaeguli_gop_cache_free)
+
+G_END_DECLS
+
+#endif // __GAEGULI_GOP_CACHE_H__
@@ -19,10 +19,17 @@
 
 #include "config.h"
 
+#include "encodebranch.h"
 #include "gaeguli-internal.h"
+#include "statspoller.h"
 #include "adaptors/nulladaptor.h"
+#ifdef HAVE_X264
+#include "gaegulix264enc.h"
+#endif
 
 #include <gio/gio.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
 
 /* *INDENT-OFF* */
 #if !GLIB_CHECK_VERSION(2,57,1)
@@ -32,6 +39,31 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(GEnumClass, g_type_class_unref)
 
 static guint gaeguli_init_refcnt = 0;
 
+/* Give up filling in frames when the source doesn't resume in this time. */
+#define SOURCE_SWITCH_TIMEOUT_US        (5 * G_USEC_PER_SEC)
+/* Scaled snapshot branches unused for this long get removed. */
+#define SNAPSHOT_BRANCH_IDLE_TIMEOUT_S  30
+
+/* Encodes snapshots of one size. The source-sized branch is part of the
+ * source pipeline, scaled ones are added on demand. */
+typedef struct
+{
+  GaeguliPipeline *pipeline;
+  gint width;
+  gint height;
+
+  GstElement *bin;
+  GstPad *tee_pad;
+
+  GstElement *valve;
+  GstElement *jpegenc;
+  GstElement *jifmux;
+  guint num_pending;
+  /* GPtrArrays of tasks waiting for a frame that passed the valve. */
+  GQueue batches;
+  gint64 last_used;
+} SnapshotBranch;
+
 struct _GaeguliPipeline
 {
   GObject parent;
@@ -45,25 +77,54 @@ struct _GaeguliPipeline
 
   GHashTable *targets;
   guint num_active_targets;
+  GHashTable *encode_branches;
+  /* Branches without a key, which no other target can share. */
+  GPtrArray *unshared_branches;
 
   GstElement *pipeline;
   GstElement *vsrc;
 
-  GstElement *snapshot_valve;
-  GstElement *snapshot_jpegenc;
-  GstElement *snapshot_jifmux;
+  /* kv: "<width>x<height>", SnapshotBranch */
+  GHashTable *snapshot_branches;
+  SnapshotBranch *snapshot_branch;
+  guint snapshot_eviction_id;
   GQueue *snapshot_tasks;
   guint num_snapshots_to_encode;
   guint snapshot_quality;
   GaeguliIDCTMethod snapshot_idct_method;
 
+  /* JPEG passthrough for sources that already produce JPEG frames */
+  gboolean snapshot_jpeg_passthrough;
+  gboolean source_is_jpeg;
+  GstElement *snapshot_jpegsrc;
+  GstElement *snapshot_passthrough_jifmux;
+  GQueue *snapshot_passthrough_batches;
+
   GstElement *overlay;
   gboolean show_overlay;
 
+  /* Resolution and framerate switches of a running source. The source output
+   * links to source_sinkpad of an input-selector, which switches to gap_src
+   * for repeating the last frame while the source is reconfigured. */
+  GstPad *source_sinkpad;
+  GstElement *gap_src;
+  GstPad *gap_sinkpad;
+  GMutex source_lock;
+  GstBuffer *last_frame;
+  gint64 last_frame_time;
+  gint64 source_switch_start;
+  gboolean source_switch_caps_changed;
+  guint64 source_switch_time;
+  guint source_filler_id;
+
   guint benchmark_interval_ms;
   guint benchmark_timeout_id;
   GHashTable *srtsocket_to_peer_addr;
   GHashTable *benchmarks;
+  GArray *benchmark_callers;
+
+  GHashTable *stats_subscriptions;
+  guint last_stats_subscription_id;
 
   gboolean prefer_hw_decoding;
 
@@ -93,6 +154,8 @@ typedef enum
   PROP_BENCHMARK_INTERVAL,
   PROP_SNAPSHOT_QUALITY,
   PROP_SNAPSHOT_IDCT_METHOD,
+  PROP_SNAPSHOT_JPEG_PASSTHROUGH,
+  PROP_SOURCE_SWITCH_TIME,
   PROP_ATTRIBUTES,
 
   /*< private > */
@@ -119,6 +182,22 @@ G_DEFINE_TYPE (GaeguliPipeline, gaeguli_pipeline, G_TYPE_OBJECT)
   g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock)
 
 static void gaeguli_pipeline_update_vsrc_caps (GaeguliPipeline * self);
+static GstPad *gaeguli_pipeline_request_source_tee_pad (GaeguliPipeline *
+    self);
+static void gaeguli_pipeline_set_clock_overlay (GaeguliPipeline * self,
+    gboolean show);
+
+static void
+snapshot_branch_free (SnapshotBranch * branch)
+{
+  g_queue_clear_full (&branch->batches, (GDestroyNotify) g_ptr_array_unref);
+  gst_clear_object (&branch->valve);
+  gst_clear_object (&branch->jpegenc);
+  gst_clear_object (&branch->jifmux);
+  gst_clear_object (&branch->tee_pad);
+  gst_clear_object (&branch->bin);
+  g_free (branch);
+}
 
 typedef struct
 {
@@ -128,7 +207,7 @@ typedef struct
 
 static void
 gaeguli_pipeline_collect_benchmark_for_socket (GaeguliPipeline * self,
-    GaeguliTarget * target, GVariantDict * d)
+    GaeguliTarget * target, const GaeguliTargetStats * stats)
 {
   Benchmark *benchmark;
   const gchar *peer_address = NULL;
@@ -136,16 +215,12 @@ gaeguli_pipeline_collect_benchmark_for_socket (GaeguliPipeline * self,
   if (gaeguli_target_get_srt_mode (target) == GAEGULI_SRT_MODE_CALLER) {
     peer_address = gaeguli_target_get_peer_address (target);
   } else {
-    int srtsocket = 0;
-
-    g_variant_dict_lookup (d, "socket", "i", &srtsocket);
-
-    if (srtsocket == 0) {
+    if (stats->socket == 0) {
       return;
     }
 
     peer_address = g_hash_table_lookup (self->srtsocket_to_peer_addr,
-        GUINT_TO_POINTER (srtsocket));
+        GUINT_TO_POINTER (stats->socket));
   }
 
   if (!peer_address) {
@@ -159,8 +234,8 @@ gaeguli_pipeline_collect_benchmark_for_socket (GaeguliPipeline * self,
     g_hash_table_insert (self->benchmarks, g_strdup (peer_address), benchmark);
   }
 
-  g_variant_dict_lookup (d, "bandwidth-mbps", "d", &benchmark->bw_mbps);
-  g_variant_dict_lookup (d, "rtt-ms", "d", &benchmark->rtt_ms);
+  benchmark->bw_mbps = stats->bandwidth_mbps;
+  benchmark->rtt_ms = stats->rtt_ms;
 }
 
 static gboolean
@@ -172,38 +247,277 @@ gaeguli_pipeline_collect_benchmark (GaeguliPipeline * self)
   g_hash_table_iter_init (&it, self->targets);
 
   while (g_hash_table_iter_next (&it, NULL, (gpointer *) & target)) {
-    g_autoptr (GVariant) stats = NULL;
-    GVariantDict d;
+    GaeguliTargetStats stats;
+    guint i;
 
-    stats = gaeguli_target_get_stats (target);
+    if (!gaeguli_target_get_stats_into (target, &stats,
+            self->benchmark_callers)) {
+      continue;
+    }
 
-    g_variant_dict_init (&d, stats);
+    if (gaeguli_target_get_srt_mode (target) == GAEGULI_SRT_MODE_LISTENER) {
+      for (i = 0; i != self->benchmark_callers->len; ++i) {
+        gaeguli_pipeline_collect_benchmark_for_socket (self, target,
+            &g_array_index (self->benchmark_callers, GaeguliTargetStats, i));
+      }
+    } else {
+      gaeguli_pipeline_collect_benchmark_for_socket (self, target, &stats);
+    }
+  }
 
-    if (g_variant_dict_contains (&d, "callers")) {
-      /* Target is a listener. */
-      GVariant *array;
-      GVariant *caller;
-      GVariantIter it;
+  return G_SOURCE_CONTINUE;
+}
 
-      array = g_variant_dict_lookup_value (&d, "callers", G_VARIANT_TYPE_ARRAY);
+typedef struct
+{
+  GaeguliTargetStats stats;
+  guint64 bytes_encoded;
+  gint64 time;
+} StatsSample;
 
-      g_variant_iter_init (&it, array);
+typedef struct
+{
+  gint ref_count;
+  gint removed;
+
+  guint id;
+  guint interval_ms;
+  GMainContext *context;
+  GWeakRef pipeline;
+  GaeguliStatsUpdateFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  /* kv: target id, stats poller entry id */
+  GHashTable *polls;
+} StatsSubscription;
+
+/* A target polled for a subscription. Once registered with the stats poller,
+ * it's only touched from the subscription's context. */
+typedef struct
+{
+  StatsSubscription *sub;
+  GaeguliTarget *target;
+  gboolean has_previous;
+  StatsSample previous;
+} StatsPoll;
 
-      while ((caller = g_variant_iter_next_value (&it))) {
-        g_variant_dict_clear (&d);
-        g_variant_dict_init (&d, caller);
+static StatsSubscription *
+stats_subscription_ref (StatsSubscription * sub)
+{
+  g_atomic_int_inc (&sub->ref_count);
 
-        gaeguli_pipeline_collect_benchmark_for_socket (self, target, &d);
-      }
-    } else {
-      /* Target is a caller. */
-      gaeguli_pipeline_collect_benchmark_for_socket (self, target, &d);
+  return sub;
+}
+
+static void
+stats_subscription_unref (StatsSubscription * sub)
+{
+  if (g_atomic_int_dec_and_test (&sub->ref_count)) {
+    if (sub->notify) {
+      sub->notify (sub->user_data);
     }
+    g_weak_ref_clear (&sub->pipeline);
+    g_hash_table_unref (sub->polls);
+    g_main_context_unref (sub->context);
+    g_free (sub);
+  }
+}
+
+/* Stops polling for a subscription no longer reachable from the pipeline,
+ * and drops the pipeline's reference. */
+static void
+stats_subscription_cancel (StatsSubscription * sub)
+{
+  GHashTableIter it;
+  gpointer poll_id;
+
+  g_atomic_int_set (&sub->removed, TRUE);
 
-    g_variant_dict_clear (&d);
+  g_hash_table_iter_init (&it, sub->polls);
+  while (g_hash_table_iter_next (&it, NULL, &poll_id)) {
+    gaeguli_stats_poller_remove (GPOINTER_TO_UINT (poll_id));
   }
+  g_hash_table_remove_all (sub->polls);
 
-  return G_SOURCE_CONTINUE;
+  stats_subscription_unref (sub);
+}
+
+static void
+stats_poll_free (StatsPoll * poll)
+{
+  stats_subscription_unref (poll->sub);
+  g_object_unref (poll->target);
+  g_free (poll);
+}
+
+static guint64
+_counter_delta (guint64 current, guint64 previous)
+{
+  /* Counters restart from zero when a connection gets re-established. */
+  return current >= previous ? current - previous : current;
+}
+
+static void
+gaeguli_pipeline_deliver_stats (GaeguliPipeline * self,
+    StatsSubscription * sub, GaeguliTarget * target,
+    const StatsSample * sample, const StatsSample * prev)
+{
+  GaeguliTargetStatsUpdate update = { 0 };
+  guint64 bytes_sent;
+  guint64 bytes_encoded;
+
+  update.target = target;
+  update.stats = &sample->stats;
+  update.interval = (gdouble) (sample->time - prev->time) / G_USEC_PER_SEC;
+
+  if (update.interval <= 0) {
+    return;
+  }
+
+  update.packets_sent = _counter_delta (sample->stats.packets_sent,
+      prev->stats.packets_sent);
+  update.packets_sent_lost = _counter_delta (sample->stats.packets_sent_lost,
+      prev->stats.packets_sent_lost);
+  update.packets_retransmitted =
+      _counter_delta (sample->stats.packets_retransmitted,
+      prev->stats.packets_retransmitted);
+  bytes_sent = _counter_delta (sample->stats.bytes_sent,
+      prev->stats.bytes_sent);
+  bytes_encoded = sample->bytes_encoded - prev->bytes_encoded;
+
+  update.packets_per_second = update.packets_sent / update.interval;
+  if (update.packets_sent > 0) {
+    update.retransmit_ratio =
+        (gdouble) update.packets_retransmitted / update.packets_sent;
+    update.loss_ratio = (gdouble) update.packets_sent_lost / update.packets_sent;
+  }
+  update.send_bitrate = bytes_sent * 8 / update.interval;
+  update.encoder_bitrate = bytes_encoded * 8 / update.interval;
+
+  sub->func (self, &update, sub->user_data);
+}
+
+/* Runs in the subscription's context with a snapshot the stats poller read
+ * on its thread. */
+static void
+_on_target_stats (const GstStructure * s, gpointer user_data)
+{
+  StatsPoll *poll = user_data;
+  g_autoptr (GaeguliPipeline) self = NULL;
+  StatsSample sample = { 0 };
+  StatsSample prev;
+
+  if (g_atomic_int_get (&poll->sub->removed)) {
+    return;
+  }
+
+  self = g_weak_ref_get (&poll->sub->pipeline);
+  if (!self) {
+    return;
+  }
+
+  gaeguli_target_fill_stats (poll->target, s, &sample.stats, NULL);
+  sample.bytes_encoded = gaeguli_target_get_bytes_encoded (poll->target);
+  sample.time = g_get_monotonic_time ();
+
+  prev = poll->previous;
+  poll->previous = sample;
+
+  if (poll->has_previous) {
+    gaeguli_pipeline_deliver_stats (self, poll->sub, poll->target, &sample,
+        &prev);
+  }
+  poll->has_previous = TRUE;
+}
+
+/* Call with the pipeline lock held. */
+static void
+gaeguli_pipeline_poll_target_stats (GaeguliPipeline * self,
+    StatsSubscription * sub, GaeguliTarget * target)
+{
+  StatsPoll *poll = g_new0 (StatsPoll, 1);
+  guint poll_id;
+
+  poll->sub = stats_subscription_ref (sub);
+  poll->target = g_object_ref (target);
+
+  /* All subscriptions poll the same srtsink, so whenever several of them fall
+   * due together, the poller reads its statistics only once. */
+  poll_id = gaeguli_target_add_stats_poll (target, sub->interval_ms,
+      sub->context, _on_target_stats, poll, (GDestroyNotify) stats_poll_free);
+
+  if (poll_id == 0) {
+    /* Recording targets have no SRT statistics. */
+    stats_poll_free (poll);
+    return;
+  }
+
+  g_hash_table_insert (sub->polls, GUINT_TO_POINTER (target->id),
+      GUINT_TO_POINTER (poll_id));
+}
+
+guint
+gaeguli_pipeline_subscribe_stats (GaeguliPipeline * self, guint interval_ms,
+    GaeguliStatsUpdateFunc func, gpointer user_data, GDestroyNotify notify)
+{
+  StatsSubscription *sub;
+  GHashTableIter it;
+  GaeguliTarget *target;
+  guint id;
+
+  g_return_val_if_fail (GAEGULI_IS_PIPELINE (self), 0);
+  g_return_val_if_fail (interval_ms > 0, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  sub = g_new0 (StatsSubscription, 1);
+  sub->ref_count = 1;
+  sub->interval_ms = interval_ms;
+  sub->context = g_main_context_ref_thread_default ();
+  g_weak_ref_init (&sub->pipeline, self);
+  sub->func = func;
+  sub->user_data = user_data;
+  sub->notify = notify;
+  sub->polls = g_hash_table_new (NULL, NULL);
+
+  {
+    LOCK_PIPELINE;
+
+    id = sub->id = ++self->last_stats_subscription_id;
+    g_hash_table_insert (self->stats_subscriptions, GUINT_TO_POINTER (id),
+        sub);
+
+    /* The poller takes the first samples right away. */
+    g_hash_table_iter_init (&it, self->targets);
+    while (g_hash_table_iter_next (&it, NULL, (gpointer *) & target)) {
+      gaeguli_pipeline_poll_target_stats (self, sub, target);
+    }
+  }
+
+  return id;
+}
+
+void
+gaeguli_pipeline_unsubscribe_stats (GaeguliPipeline * self, guint id)
+{
+  StatsSubscription *sub;
+
+  g_return_if_fail (GAEGULI_IS_PIPELINE (self));
+
+  {
+    LOCK_PIPELINE;
+
+    sub = g_hash_table_lookup (self->stats_subscriptions,
+        GUINT_TO_POINTER (id));
+    if (!sub) {
+      return;
+    }
+
+    g_hash_table_steal (self->stats_subscriptions, GUINT_TO_POINTER (id));
+  }
+
+  /* Removing the poller entries may free user data; not under the lock. */
+  stats_subscription_cancel (sub);
 }
 
 static void
@@ -232,13 +546,21 @@ gaeguli_pipeline_finalize (GObject * object)
   }
 
   g_clear_pointer (&self->targets, g_hash_table_unref);
+  g_clear_pointer (&self->encode_branches, g_hash_table_unref);
+  g_clear_pointer (&self->unshared_branches, g_ptr_array_unref);
   g_clear_pointer (&self->srtsocket_to_peer_addr, g_hash_table_unref);
   g_clear_pointer (&self->benchmarks, g_hash_table_unref);
+  g_clear_pointer (&self->benchmark_callers, g_array_unref);
+  g_clear_pointer (&self->stats_subscriptions, g_hash_table_unref);
   g_clear_pointer (&self->device, g_free);
   g_clear_pointer (&self->snapshot_tasks, g_queue_free);
+  g_clear_pointer (&self->snapshot_branches, g_hash_table_unref);
+  g_clear_pointer (&self->snapshot_passthrough_batches, g_queue_free);
   g_clear_handle_id (&self->benchmark_timeout_id, g_source_remove);
+  g_clear_handle_id (&self->snapshot_eviction_id, g_source_remove);
 
   g_mutex_clear (&self->lock);
+  g_mutex_clear (&self->source_lock);
 
   if (g_atomic_int_dec_and_test (&gaeguli_init_refcnt)) {
     g_debug ("Cleaning up GStreamer");
@@ -287,6 +609,14 @@ gaeguli_pipeline_get_property (GObject * object,
     case PROP_SNAPSHOT_IDCT_METHOD:
       g_value_set_enum (value, self->snapshot_idct_method);
       break;
+    case PROP_SNAPSHOT_JPEG_PASSTHROUGH:
+      g_value_set_boolean (value, self->snapshot_jpeg_passthrough);
+      break;
+    case PROP_SOURCE_SWITCH_TIME:
+      g_mutex_lock (&self->source_lock);
+      g_value_set_uint64 (value, self->source_switch_time);
+      g_mutex_unlock (&self->source_lock);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -317,10 +647,7 @@ gaeguli_pipeline_set_property (GObject * object,
       gaeguli_pipeline_update_vsrc_caps (self);
       break;
     case PROP_CLOCK_OVERLAY:
-      self->show_overlay = g_value_get_boolean (value);
-      if (self->overlay) {
-        g_object_set (self->overlay, "silent", !self->show_overlay, NULL);
-      }
+      gaeguli_pipeline_set_clock_overlay (self, g_value_get_boolean (value));
       break;
     case PROP_STREAM_ADAPTOR:
       self->adaptor_type = g_value_get_gtype (value);
@@ -333,18 +660,24 @@ gaeguli_pipeline_set_property (GObject * object,
       break;
     case PROP_SNAPSHOT_QUALITY:
       self->snapshot_quality = g_value_get_uint (value);
-      if (self->snapshot_jpegenc) {
-        g_object_set (self->snapshot_jpegenc, "quality", self->snapshot_quality,
-            NULL);
-      }
       break;
-    case PROP_SNAPSHOT_IDCT_METHOD:
+    case PROP_SNAPSHOT_IDCT_METHOD:{
+      LOCK_PIPELINE;
+      GHashTableIter it;
+      SnapshotBranch *branch;
+
       self->snapshot_idct_method = g_value_get_enum (value);
-      if (self->snapshot_jpegenc) {
-        g_object_set (self->snapshot_jpegenc, "idct-method",
+
+      g_hash_table_iter_init (&it, self->snapshot_branches);
+      while (g_hash_table_iter_next (&it, NULL, (gpointer *) & branch)) {
+        g_object_set (branch->jpegenc, "idct-method",
             self->snapshot_idct_method, NULL);
       }
       break;
+    }
+    case PROP_SNAPSHOT_JPEG_PASSTHROUGH:
+      self->snapshot_jpeg_passthrough = g_value_get_boolean (value);
+      break;
     case PROP_ATTRIBUTES:
       self->attributes = g_value_dup_variant (value);
       break;
@@ -417,6 +750,21 @@ gaeguli_pipeline_class_init (GaeguliPipelineClass * klass)
       GAEGULI_TYPE_IDCT_METHOD, GAEGULI_IDCT_METHOD_IFAST,
       G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_SNAPSHOT_JPEG_PASSTHROUGH] =
+      g_param_spec_boolean ("snapshot-jpeg-passthrough",
+      "Pass JPEG source frames through to snapshots",
+      "When the video source produces JPEG and the clock overlay is hidden, "
+      "make snapshots from the source frames without decoding and encoding "
+      "them again", TRUE,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_SOURCE_SWITCH_TIME] =
+      g_param_spec_uint64 ("source-switch-time",
+      "Duration of the last source switch",
+      "Time in microseconds the last change of resolution or framerate took "
+      "until the source produced a frame with the new settings", 0,
+      G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
   properties[PROP_ATTRIBUTES] =
       g_param_spec_variant ("attributes",
       "The unified attriutes to set device-specific parameters",
@@ -448,6 +796,10 @@ static void
 gaeguli_init_once (void)
 {
   gst_init (NULL, NULL);
+
+#ifdef HAVE_X264
+  gaeguli_x264_enc_register ();
+#endif
 }
 
 static void
@@ -460,19 +812,32 @@ gaeguli_pipeline_init (GaeguliPipeline * self)
   g_atomic_int_inc (&gaeguli_init_refcnt);
 
   g_mutex_init (&self->lock);
+  g_mutex_init (&self->source_lock);
 
   /* kv: hash(fifo-path), target_pipeline */
   self->targets = g_hash_table_new_full (g_direct_hash, g_direct_equal,
       NULL, g_object_unref);
 
+  /* kv: encoding settings or scaler resolution key, encode branch */
+  self->encode_branches = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_object_unref);
+  self->unshared_branches = g_ptr_array_new_with_free_func (g_object_unref);
+
   self->srtsocket_to_peer_addr =
       g_hash_table_new_full (NULL, NULL, NULL, g_free);
   self->benchmarks =
       g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->benchmark_callers =
+      g_array_new (FALSE, FALSE, sizeof (GaeguliTargetStats));
+  self->stats_subscriptions = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) stats_subscription_cancel);
 
   self->adaptor_type = GAEGULI_TYPE_NULL_STREAM_ADAPTOR;
 
   self->snapshot_tasks = g_queue_new ();
+  self->snapshot_branches = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) snapshot_branch_free);
+  self->snapshot_passthrough_batches = g_queue_new ();
 }
 
 GaeguliPipeline *
@@ -523,17 +888,22 @@ gaeguli_pipeline_new (GVariant * attributes)
 }
 
 static void
-gaeguli_pipeline_set_snapshot_tags (GaeguliPipeline * self, GVariant * tags)
+gaeguli_pipeline_set_snapshot_tags (GaeguliPipeline * self,
+    GstElement * jifmux, GVariant * tags)
 {
   GVariantIter it;
   gchar *tag_name;
   GVariant *val_variant;
-  GstTagSetter *tag_setter = GST_TAG_SETTER (self->snapshot_jifmux);
-
-  g_return_if_fail (g_variant_is_of_type (tags, G_VARIANT_TYPE_VARDICT));
+  GstTagSetter *tag_setter = GST_TAG_SETTER (jifmux);
 
   gst_tag_setter_reset_tags (tag_setter);
 
+  if (!tags) {
+    return;
+  }
+
+  g_return_if_fail (g_variant_is_of_type (tags, G_VARIANT_TYPE_VARDICT));
+
   g_variant_iter_init (&it, tags);
   while (g_variant_iter_next (&it, "{sv}", &tag_name, &val_variant)) {
     GValue val = G_VALUE_INIT;
@@ -554,22 +924,109 @@ gaeguli_pipeline_set_snapshot_tags (GaeguliPipeline * self, GVariant * tags)
   }
 }
 
+typedef struct
+{
+  GVariant *tags;
+  /* 0 keeps the source dimension */
+  gint width;
+  gint height;
+  /* 0 uses the snapshot-quality property */
+  guint quality;
+} SnapshotRequest;
+
+static void
+snapshot_request_free (SnapshotRequest * request)
+{
+  g_clear_pointer (&request->tags, g_variant_unref);
+  g_free (request);
+}
+
+static gboolean
+_snapshot_tags_equal (GVariant * tags1, GVariant * tags2)
+{
+  if (tags1 == NULL || tags2 == NULL) {
+    return tags1 == tags2;
+  }
+
+  return g_variant_equal (tags1, tags2);
+}
+
+static SnapshotRequest *
+_snapshot_batch_get_request (GPtrArray * batch)
+{
+  return g_task_get_task_data (g_ptr_array_index (batch, 0));
+}
+
+/* Takes the oldest snapshot request for the branch together with all the
+ * other pending requests that can be served by the same image. Passthrough
+ * only serves requests that leave the quality up to the pipeline. Called with
+ * the lock held. */
+static GPtrArray *
+gaeguli_pipeline_take_snapshot_batch (GaeguliPipeline * self,
+    SnapshotBranch * branch, gboolean passthrough)
+{
+  GPtrArray *batch = NULL;
+  SnapshotRequest *first = NULL;
+  GList *l;
+
+  for (l = self->snapshot_tasks->head; l;) {
+    GList *next = l->next;
+    SnapshotRequest *request = g_task_get_task_data (l->data);
+
+    if (request->width != branch->width || request->height != branch->height
+        || (passthrough && request->quality != 0)) {
+      goto next;
+    }
+
+    if (!batch) {
+      batch = g_ptr_array_new_with_free_func (g_object_unref);
+      first = request;
+    }
+
+    if (request->quality == first->quality &&
+        _snapshot_tags_equal (request->tags, first->tags)) {
+      g_ptr_array_add (batch, l->data);
+      g_queue_delete_link (self->snapshot_tasks, l);
+    }
+
+  next:
+    l = next;
+  }
+
+  if (!batch) {
+    return NULL;
+  }
+
+  branch->num_pending -= batch->len;
+  self->num_snapshots_to_encode -= batch->len;
+
+  return batch;
+}
+
 static GstPadProbeReturn
-_on_valve_buffer (GstPad * pad, GstPadProbeInfo * info, GaeguliPipeline * self)
+_on_valve_buffer (GstPad * pad, GstPadProbeInfo * info, SnapshotBranch * branch)
 {
-  GTask *task;
+  GaeguliPipeline *self = branch->pipeline;
+  SnapshotRequest *request;
+  GPtrArray *batch;
 
   LOCK_PIPELINE;
 
-  task = g_queue_peek_head (self->snapshot_tasks);
-  if (task) {
-    GVariant *tags = g_task_get_task_data (task);
-    if (tags) {
-      gaeguli_pipeline_set_snapshot_tags (self, tags);
-    }
+  batch = gaeguli_pipeline_take_snapshot_batch (self, branch, FALSE);
+  if (!batch) {
+    g_object_set (GST_PAD_PARENT (pad), "drop", TRUE, NULL);
+    return GST_PAD_PROBE_DROP;
   }
 
-  if (--self->num_snapshots_to_encode == 0) {
+  request = _snapshot_batch_get_request (batch);
+
+  g_object_set (branch->jpegenc, "quality",
+      request->quality ? request->quality : self->snapshot_quality, NULL);
+  gaeguli_pipeline_set_snapshot_tags (self, branch->jifmux, request->tags);
+
+  g_queue_push_tail (&branch->batches, batch);
+
+  if (branch->num_pending == 0) {
     /* No pending snapshot requests, close the valve. */
     g_object_set (GST_PAD_PARENT (pad), "drop", TRUE, NULL);
   }
@@ -577,6 +1034,91 @@ _on_valve_buffer (GstPad * pad, GstPadProbeInfo * info, GaeguliPipeline * self)
   return GST_PAD_PROBE_OK;
 }
 
+/* Called with the lock held. */
+static gboolean
+gaeguli_pipeline_can_pass_jpeg_through (GaeguliPipeline * self)
+{
+  return self->snapshot_jpeg_passthrough && self->source_is_jpeg &&
+      self->snapshot_jpegsrc && !self->show_overlay;
+}
+
+/* Watches the source output ahead of the decoder. When it is JPEG, snapshot
+ * requests for source-sized images get served with the source frames. */
+static GstPadProbeReturn
+_on_source_data (GstPad * pad, GstPadProbeInfo * info, GaeguliPipeline * self)
+{
+  GPtrArray *batch = NULL;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstCaps *caps;
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      LOCK_PIPELINE;
+
+      gst_event_parse_caps (event, &caps);
+      self->source_is_jpeg = gst_structure_has_name
+          (gst_caps_get_structure (caps, 0), "image/jpeg");
+
+      if (self->source_is_jpeg && self->snapshot_jpegsrc) {
+        g_object_set (self->snapshot_jpegsrc, "caps", caps, NULL);
+      }
+    }
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* Don't take the lock for every frame when there's nothing to do. */
+  if (g_atomic_int_get (&self->num_snapshots_to_encode) == 0) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  {
+    LOCK_PIPELINE;
+    SnapshotBranch *branch = self->snapshot_branch;
+
+    if (branch->num_pending == 0) {
+      return GST_PAD_PROBE_OK;
+    }
+
+    if (gaeguli_pipeline_can_pass_jpeg_through (self)) {
+      batch = gaeguli_pipeline_take_snapshot_batch (self, branch, TRUE);
+      if (batch) {
+        g_queue_push_tail (self->snapshot_passthrough_batches, batch);
+      }
+    }
+
+    /* Requests for a particular quality still go through the encoder. */
+    g_object_set (branch->valve, "drop", branch->num_pending == 0, NULL);
+  }
+
+  if (batch) {
+    gst_app_src_push_buffer (GST_APP_SRC (self->snapshot_jpegsrc),
+        gst_buffer_ref (GST_PAD_PROBE_INFO_BUFFER (info)));
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+_on_passthrough_buffer (GstPad * pad, GstPadProbeInfo * info,
+    GaeguliPipeline * self)
+{
+  GPtrArray *batch;
+
+  LOCK_PIPELINE;
+
+  /* Buffers and batches are queued in the same order. */
+  batch = g_queue_peek_head (self->snapshot_passthrough_batches);
+  if (batch) {
+    gaeguli_pipeline_set_snapshot_tags (self,
+        self->snapshot_passthrough_jifmux,
+        _snapshot_batch_get_request (batch)->tags);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
 static GstPadProbeReturn
 _drop_reconfigure_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
 {
@@ -619,49 +1161,197 @@ _get_vsrc_pipeline_string (GaeguliPipeline * self)
 {
   g_autofree gchar *source = _get_source_description (self);
 
+  if (self->source == GAEGULI_VIDEO_SOURCE_NVARGUSCAMERASRC) {
+    return g_strdup_printf
+        (GAEGULI_PIPELINE_VSRC_STR " ! " GAEGULI_PIPELINE_IMAGE_STR " "
+        GAEGULI_PIPELINE_GAP_SRC_STR, source, "");
+  }
+
   return g_strdup_printf
-      (GAEGULI_PIPELINE_VSRC_STR " ! " GAEGULI_PIPELINE_IMAGE_STR, source,
-      self->source == GAEGULI_VIDEO_SOURCE_NVARGUSCAMERASRC ? "" :
-      GAEGULI_PIPELINE_DECODEBIN_STR);
+      (GAEGULI_PIPELINE_VSRC_STR " ! " GAEGULI_PIPELINE_IMAGE_STR " "
+      GAEGULI_PIPELINE_GAP_SRC_STR " " GAEGULI_PIPELINE_JPEG_PASSTHROUGH_STR,
+      source, GAEGULI_PIPELINE_DECODEBIN_STR);
+}
+
+/* Links the decoder output to the tee, through the clock overlay when it is
+ * shown. Called with the lock held. */
+static void
+gaeguli_pipeline_link_decoder (GaeguliPipeline * self, GstPad * decoder_pad)
+{
+  g_autoptr (GstPad) overlay_sink = NULL;
+  g_autoptr (GstPad) overlay_src = NULL;
+
+  if (self->overlay == NULL) {
+    gst_pad_link (decoder_pad, self->source_sinkpad);
+    return;
+  }
+
+  overlay_sink = gst_element_get_static_pad (self->overlay, "sink");
+  overlay_src = gst_element_get_static_pad (self->overlay, "src");
+
+  gst_pad_link (decoder_pad, overlay_sink);
+  if (!gst_pad_is_linked (overlay_src)) {
+    gst_pad_link (overlay_src, self->source_sinkpad);
+  }
 }
 
 static void
-_decodebin_pad_added (GstElement * decodebin, GstPad * pad, gpointer user_data)
+_decodebin_pad_added (GstElement * decodebin, GstPad * pad,
+    GaeguliPipeline * self)
 {
   if (GST_PAD_PEER (pad) == NULL) {
-    GstElement *overlay = GST_ELEMENT (user_data);
-    g_autoptr (GstPad) sinkpad =
-        gst_element_get_static_pad (overlay, "video_sink");
+    LOCK_PIPELINE;
 
-    gst_pad_link (pad, sinkpad);
+    if (self->source_sinkpad) {
+      gaeguli_pipeline_link_decoder (self, pad);
+    }
   }
 }
 
+/* The overlay is added to the pipeline only while it's shown, so frames don't
+ * go through it at all otherwise. clockoverlay attaches
+ * GstVideoOverlayCompositionMeta instead of blending in system memory
+ * whenever the elements downstream negotiate the meta. Called with the lock
+ * held. */
 static gboolean
-_bus_watch (GstBus * bus, GstMessage * message, gpointer user_data)
+gaeguli_pipeline_add_clock_overlay (GaeguliPipeline * self)
 {
-  GaeguliPipeline *self = user_data;
+  g_autoptr (GError) error = NULL;
+  GstElement *overlay;
 
-  switch (message->type) {
-    case GST_MESSAGE_WARNING:{
-      gpointer target_id;
-      GaeguliTarget *target;
-      g_autoptr (GError) error = NULL;
+  overlay = gst_parse_bin_from_description (GAEGULI_PIPELINE_CLOCK_OVERLAY_STR,
+      TRUE, &error);
+  if (overlay == NULL) {
+    g_warning ("failed to create clock overlay (%s)", error->message);
+    return FALSE;
+  }
 
-      if (!message->src) {
-        break;
-      }
+  gst_bin_add (GST_BIN (self->vsrc), overlay);
+  gst_element_sync_state_with_parent (overlay);
 
-      target_id = g_object_get_data (G_OBJECT (message->src),
-          "gaeguli-target-id");
+  self->overlay = gst_object_ref (overlay);
 
-      g_mutex_lock (&self->lock);
-      target = g_hash_table_lookup (self->targets, target_id);
-      g_mutex_unlock (&self->lock);
+  return TRUE;
+}
 
-      if (!target) {
-        break;
-      }
+/* Called with the lock held. */
+static void
+gaeguli_pipeline_remove_clock_overlay (GaeguliPipeline * self,
+    GstElement * overlay)
+{
+  g_autoptr (GstPad) overlay_src = gst_element_get_static_pad (overlay, "src");
+
+  gst_pad_unlink (overlay_src, self->source_sinkpad);
+  gst_element_set_state (overlay, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN (self->vsrc), overlay);
+}
+
+/* Runs when no data is flowing from the decoder and relinks it according to
+ * whether the clock overlay is shown. */
+static GstPadProbeReturn
+_relink_decoder_cb (GstPad * decoder_pad, GstPadProbeInfo * info,
+    GaeguliPipeline * self)
+{
+  g_autoptr (GstPad) peer = gst_pad_get_peer (decoder_pad);
+  g_autoptr (GstElement) old_overlay = NULL;
+
+  LOCK_PIPELINE;
+
+  if (self->source_sinkpad == NULL) {
+    /* The pipeline has been stopped. */
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  if (peer) {
+    if (peer != self->source_sinkpad) {
+      old_overlay = gst_pad_get_parent_element (peer);
+    }
+    gst_pad_unlink (decoder_pad, peer);
+  }
+
+  if (old_overlay && old_overlay != self->overlay) {
+    gaeguli_pipeline_remove_clock_overlay (self, old_overlay);
+  }
+
+  gaeguli_pipeline_link_decoder (self, decoder_pad);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+gaeguli_pipeline_set_clock_overlay (GaeguliPipeline * self, gboolean show)
+{
+  g_autoptr (GstElement) decodebin = NULL;
+  g_autoptr (GstPad) decoder_pad = NULL;
+
+  {
+    LOCK_PIPELINE;
+
+    if (self->show_overlay == show) {
+      return;
+    }
+
+    self->show_overlay = show;
+
+    if (self->vsrc == NULL) {
+      return;
+    }
+
+    decodebin = gst_bin_get_by_name (GST_BIN (self->vsrc), "decodebin");
+    if (decodebin == NULL) {
+      /* The source frames don't get decoded, e.g. from nvarguscamerasrc. */
+      return;
+    }
+
+    if (show) {
+      if (!gaeguli_pipeline_add_clock_overlay (self)) {
+        return;
+      }
+      decoder_pad = gst_pad_get_peer (self->source_sinkpad);
+    } else if (self->overlay) {
+      g_autoptr (GstPad) overlay_sink =
+          gst_element_get_static_pad (self->overlay, "sink");
+
+      decoder_pad = gst_pad_get_peer (overlay_sink);
+      if (decoder_pad == NULL) {
+        gaeguli_pipeline_remove_clock_overlay (self, self->overlay);
+      }
+      gst_clear_object (&self->overlay);
+    }
+  }
+
+  /* With no decoder output yet, _decodebin_pad_added() links the overlay. */
+  if (decoder_pad) {
+    gst_pad_add_probe (decoder_pad, GST_PAD_PROBE_TYPE_IDLE,
+        (GstPadProbeCallback) _relink_decoder_cb, self, NULL);
+  }
+}
+
+static gboolean
+_bus_watch (GstBus * bus, GstMessage * message, gpointer user_data)
+{
+  GaeguliPipeline *self = user_data;
+
+  switch (message->type) {
+    case GST_MESSAGE_WARNING:{
+      gpointer target_id;
+      GaeguliTarget *target;
+      g_autoptr (GError) error = NULL;
+
+      if (!message->src) {
+        break;
+      }
+
+      target_id = g_object_get_data (G_OBJECT (message->src),
+          "gaeguli-target-id");
+
+      g_mutex_lock (&self->lock);
+      target = g_hash_table_lookup (self->targets, target_id);
+      g_mutex_unlock (&self->lock);
+
+      if (!target) {
+        break;
+      }
 
       gst_message_parse_warning (message, &error, NULL);
       if (error && error->domain == GST_RESOURCE_ERROR) {
@@ -676,29 +1366,339 @@ _bus_watch (GstBus * bus, GstMessage * message, gpointer user_data)
   return G_SOURCE_CONTINUE;
 }
 
-static void
-gaeguli_pipeline_create_snapshot (GaeguliPipeline * self, GstBuffer * buffer)
+typedef struct
 {
-  g_autoptr (GTask) task = NULL;
+  GstBuffer *buffer;
   GstMapInfo info;
+} SnapshotMapping;
 
-  g_return_if_fail (!g_queue_is_empty (self->snapshot_tasks));
+static void
+_snapshot_mapping_free (SnapshotMapping * mapping)
+{
+  gst_buffer_unmap (mapping->buffer, &mapping->info);
+  gst_buffer_unref (mapping->buffer);
+  g_free (mapping);
+}
+
+static void
+gaeguli_pipeline_return_snapshot (GaeguliPipeline * self, GQueue * batches,
+    GstBuffer * buffer)
+{
+  g_autoptr (GPtrArray) batch = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  SnapshotMapping *mapping;
+  guint i;
 
   {
     LOCK_PIPELINE;
-    task = g_queue_pop_head (self->snapshot_tasks);
+    batch = g_queue_pop_head (batches);
   }
 
-  if (g_task_return_error_if_cancelled (task)) {
+  g_return_if_fail (batch != NULL);
+
+  /* The JPEG image is handed out without copying; the bytes keep the buffer
+   * mapped until the last of the requesters releases them. */
+  mapping = g_new0 (SnapshotMapping, 1);
+
+  if (!gst_buffer_map (buffer, &mapping->info, GST_MAP_READ)) {
+    g_free (mapping);
+
+    for (i = 0; i != batch->len; ++i) {
+      g_task_return_new_error (g_ptr_array_index (batch, i), G_IO_ERROR,
+          G_IO_ERROR_FAILED, "Couldn't map the snapshot buffer");
+    }
     return;
   }
 
-  gst_buffer_map (buffer, &info, GST_MAP_READ);
+  mapping->buffer = gst_buffer_ref (buffer);
+  bytes = g_bytes_new_with_free_func (mapping->info.data, mapping->info.size,
+      (GDestroyNotify) _snapshot_mapping_free, mapping);
+
+  for (i = 0; i != batch->len; ++i) {
+    GTask *task = g_ptr_array_index (batch, i);
+
+    if (!g_task_return_error_if_cancelled (task)) {
+      g_task_return_pointer (task, g_bytes_ref (bytes),
+          (GDestroyNotify) g_bytes_unref);
+    }
+  }
+}
+
+static void
+_on_snapshot_handoff (GstElement * fakesink, GstBuffer * buffer, GstPad * pad,
+    SnapshotBranch * branch)
+{
+  gaeguli_pipeline_return_snapshot (branch->pipeline, &branch->batches, buffer);
+}
+
+static void
+gaeguli_pipeline_create_passthrough_snapshot (GaeguliPipeline * self,
+    GstBuffer * buffer)
+{
+  gaeguli_pipeline_return_snapshot (self, self->snapshot_passthrough_batches,
+      buffer);
+}
+
+/* Sets up a snapshot branch from the valve, jpegenc, jifmux and fakesink in
+ * bin. */
+static SnapshotBranch *
+gaeguli_pipeline_add_snapshot_branch (GaeguliPipeline * self, GstBin * bin,
+    gint width, gint height)
+{
+  g_autoptr (GstElement) fakesink = NULL;
+  g_autoptr (GstPad) valve_src = NULL;
+  SnapshotBranch *branch = g_new0 (SnapshotBranch, 1);
+
+  branch->pipeline = self;
+  branch->width = width;
+  branch->height = height;
+  g_queue_init (&branch->batches);
+
+  branch->valve = gst_bin_get_by_name (bin, "valve");
+  valve_src = gst_element_get_static_pad (branch->valve, "src");
+  gst_pad_add_probe (valve_src, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) _on_valve_buffer, branch, NULL);
+
+  branch->jpegenc = gst_bin_get_by_name (bin, "jpegenc");
+  g_object_set (branch->jpegenc, "idct-method", self->snapshot_idct_method,
+      NULL);
+
+  branch->jifmux = gst_bin_get_by_name (bin, "jifmux");
+
+  fakesink = gst_bin_get_by_name (bin, "fakesink");
+  g_object_set (fakesink, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (fakesink, "handoff", G_CALLBACK (_on_snapshot_handoff),
+      branch);
+
+  g_hash_table_replace (self->snapshot_branches,
+      g_strdup_printf ("%dx%d", width, height), branch);
+
+  return branch;
+}
+
+static gboolean
+_finish_snapshot_branch_removal (SnapshotBranch * branch)
+{
+  gst_element_set_state (branch->bin, GST_STATE_NULL);
+  snapshot_branch_free (branch);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_snapshot_branch_unlinked (SnapshotBranch * branch)
+{
+  /* The state change has to happen in the main thread. */
+  g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+      (GSourceFunc) _finish_snapshot_branch_removal, branch, NULL);
+}
+
+static GstPadProbeReturn
+_unlink_snapshot_branch_cb (GstPad * pad, GstPadProbeInfo * info,
+    SnapshotBranch * branch)
+{
+  g_autoptr (GstPad) sinkpad = gst_element_get_static_pad (branch->bin,
+      "sink");
+  g_autoptr (GstObject) parent = gst_object_get_parent (GST_OBJECT
+      (branch->bin));
+
+  gst_pad_unlink (branch->tee_pad, sinkpad);
+  gst_element_release_request_pad (GST_PAD_PARENT (branch->tee_pad),
+      branch->tee_pad);
+  if (parent) {
+    gst_bin_remove (GST_BIN (parent), branch->bin);
+  }
+
+  g_debug ("snapshot branch [%dx%d] removed", branch->width, branch->height);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Removes scaled snapshot branches nobody asked for in a while, so that
+ * requests for many different sizes don't leave scalers behind on the
+ * source tee. */
+static gboolean
+_evict_idle_snapshot_branches (GaeguliPipeline * self)
+{
+  gint64 deadline = g_get_monotonic_time () -
+      SNAPSHOT_BRANCH_IDLE_TIMEOUT_S * G_USEC_PER_SEC;
+  gboolean scaled_branches_left = FALSE;
+  GHashTableIter it;
+  SnapshotBranch *branch;
+
+  LOCK_PIPELINE;
+
+  g_hash_table_iter_init (&it, self->snapshot_branches);
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & branch)) {
+    if (branch == self->snapshot_branch) {
+      continue;
+    }
+
+    if (branch->num_pending > 0 || !g_queue_is_empty (&branch->batches) ||
+        branch->last_used > deadline) {
+      scaled_branches_left = TRUE;
+      continue;
+    }
+
+    g_hash_table_iter_steal (&it);
+    gst_pad_add_probe (branch->tee_pad, GST_PAD_PROBE_TYPE_IDLE,
+        (GstPadProbeCallback) _unlink_snapshot_branch_cb, branch,
+        (GDestroyNotify) _snapshot_branch_unlinked);
+  }
+
+  if (!scaled_branches_left) {
+    self->snapshot_eviction_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Returns the branch producing snapshots of the given size. A scaler for the
+ * size gets linked to the source tee on the first request and is then shared
+ * by all requests for that size until it stays unused for a while. Called with
+ * the lock held. */
+static SnapshotBranch *
+gaeguli_pipeline_get_snapshot_branch (GaeguliPipeline * self, gint width,
+    gint height, GError ** error)
+{
+  g_autofree gchar *key = NULL;
+  g_autofree gchar *bin_str = NULL;
+  g_autoptr (GString) caps_str = NULL;
+  g_autoptr (GstPad) sinkpad = NULL;
+  GstElement *bin;
+  SnapshotBranch *branch;
+
+  key = g_strdup_printf ("%dx%d", width, height);
+
+  branch = g_hash_table_lookup (self->snapshot_branches, key);
+  if (branch) {
+    return branch;
+  }
+
+  caps_str = g_string_new ("video/x-raw");
+  if (width > 0) {
+    g_string_append_printf (caps_str, ",width=%d", width);
+  }
+  if (height > 0) {
+    g_string_append_printf (caps_str, ",height=%d", height);
+  }
+
+  bin_str = g_strdup_printf (GAEGULI_PIPELINE_SCALED_IMAGE_STR, caps_str->str);
+
+  g_debug ("adding snapshot branch [%s] (%s)", key, bin_str);
+
+  bin = gst_parse_bin_from_description (bin_str, TRUE, error);
+  if (bin == NULL) {
+    return NULL;
+  }
+
+  gst_bin_add (GST_BIN (self->vsrc), bin);
+
+  branch = gaeguli_pipeline_add_snapshot_branch (self, GST_BIN (bin), width,
+      height);
+  branch->bin = gst_object_ref (bin);
 
-  g_task_return_pointer (task, g_bytes_new (info.data, info.size),
-      (GDestroyNotify) g_bytes_unref);
+  gst_element_sync_state_with_parent (bin);
+
+  branch->tee_pad = gaeguli_pipeline_request_source_tee_pad (self);
+  sinkpad = gst_element_get_static_pad (bin, "sink");
+
+  if (gst_pad_link (branch->tee_pad, sinkpad) != GST_PAD_LINK_OK) {
+    g_set_error (error, GAEGULI_RESOURCE_ERROR,
+        GAEGULI_RESOURCE_ERROR_UNSUPPORTED,
+        "Can't scale snapshots of the source to %dx%d", width, height);
+
+    gst_element_release_request_pad (GST_PAD_PARENT (branch->tee_pad),
+        branch->tee_pad);
+    gst_element_set_state (bin, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self->vsrc), bin);
+    g_hash_table_remove (self->snapshot_branches, key);
+
+    return NULL;
+  }
 
-  gst_buffer_unmap (buffer, &info);
+  if (self->snapshot_eviction_id == 0) {
+    self->snapshot_eviction_id =
+        g_timeout_add_seconds (SNAPSHOT_BRANCH_IDLE_TIMEOUT_S,
+        (GSourceFunc) _evict_idle_snapshot_branches, self);
+  }
+
+  return branch;
+}
+
+static gboolean
+_notify_source_switch_time (GaeguliPipeline * self)
+{
+  g_object_notify_by_pspec (G_OBJECT (self),
+      properties[PROP_SOURCE_SWITCH_TIME]);
+  g_object_unref (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Makes the input-selector pass on either the source output or the frames
+ * filled in during a source switch. Called with the source lock held. */
+static void
+gaeguli_pipeline_select_gap_src (GaeguliPipeline * self, gboolean gap)
+{
+  g_object_set (GST_PAD_PARENT (self->gap_sinkpad), "active-pad",
+      gap ? self->gap_sinkpad : self->source_sinkpad, NULL);
+}
+
+/* Remembers the last frame the source produced and detects the end of a
+ * source switch. */
+static GstPadProbeReturn
+_on_source_output (GstPad * pad, GstPadProbeInfo * info,
+    GaeguliPipeline * self)
+{
+  GstBuffer *buffer;
+  gboolean switched = FALSE;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEventType type = GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info));
+
+    if (type == GST_EVENT_CAPS || type == GST_EVENT_STREAM_START) {
+      g_mutex_lock (&self->source_lock);
+      if (self->source_switch_start != 0) {
+        /* Frames of the old size mustn't follow the new caps downstream.
+         * Fillers still queued in gap_src get dropped by the input-selector
+         * once the source is selected again. */
+        self->source_switch_caps_changed = TRUE;
+        gaeguli_pipeline_select_gap_src (self, FALSE);
+      }
+      g_mutex_unlock (&self->source_lock);
+    }
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  g_mutex_lock (&self->source_lock);
+  gst_buffer_replace (&self->last_frame, buffer);
+  self->last_frame_time = g_get_monotonic_time ();
+
+  if (self->source_switch_start != 0 && self->source_switch_caps_changed) {
+    self->source_switch_time =
+        self->last_frame_time - self->source_switch_start;
+    self->source_switch_start = 0;
+    switched = TRUE;
+
+    g_debug ("source switch took %" G_GUINT64_FORMAT " us",
+        self->source_switch_time);
+  }
+  g_mutex_unlock (&self->source_lock);
+
+  if (switched) {
+    /* Have the encoders start the new picture with a keyframe. */
+    gst_pad_send_event (pad,
+        gst_video_event_new_downstream_force_key_unit (GST_CLOCK_TIME_NONE,
+            GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, TRUE, 0));
+    g_idle_add ((GSourceFunc) _notify_source_switch_time, g_object_ref (self));
+  }
+
+  return GST_PAD_PROBE_OK;
 }
 
 static gboolean
@@ -709,9 +1709,10 @@ _build_vsrc_pipeline (GaeguliPipeline * self, GError ** error)
   g_autoptr (GstBus) bus = NULL;
   g_autoptr (GstElement) decodebin = NULL;
   g_autoptr (GstElement) tee = NULL;
-  g_autoptr (GstElement) fakesink = NULL;
-  g_autoptr (GstPad) tee_sink = NULL;
-  g_autoptr (GstPad) valve_src = NULL;
+  g_autoptr (GstElement) capsfilter = NULL;
+  g_autoptr (GstElement) gap_selector = NULL;
+  g_autoptr (GstPad) tee_sinkpad = NULL;
+  g_autoptr (GstPad) gap_srcpad = NULL;
   g_autoptr (GstPluginFeature) feature = NULL;
 
   /* FIXME: what if zero-copy */
@@ -732,41 +1733,74 @@ _build_vsrc_pipeline (GaeguliPipeline * self, GError ** error)
   bus = gst_element_get_bus (self->pipeline);
   gst_bus_add_watch (bus, _bus_watch, self);
 
-  self->overlay = gst_bin_get_by_name (GST_BIN (self->pipeline), "overlay");
-  if (self->overlay)
-    g_object_set (self->overlay, "silent", !self->show_overlay, NULL);
-
-  self->snapshot_valve = gst_bin_get_by_name (GST_BIN (self->pipeline),
-      "valve");
-  valve_src = gst_element_get_static_pad (self->snapshot_valve, "src");
-  gst_pad_add_probe (valve_src, GST_PAD_PROBE_TYPE_BUFFER,
-      (GstPadProbeCallback) _on_valve_buffer, self, NULL);
-
-  self->snapshot_jpegenc = gst_bin_get_by_name (GST_BIN (self->pipeline),
-      "jpegenc");
-  g_object_set (self->snapshot_jpegenc, "quality", self->snapshot_quality,
-      "idct-method", self->snapshot_idct_method, NULL);
-
-  self->snapshot_jifmux = gst_bin_get_by_name (GST_BIN (self->pipeline),
-      "jifmux");
-
-  fakesink = gst_bin_get_by_name (GST_BIN (self->pipeline), "fakesink");
-  g_object_set (fakesink, "signal-handoffs", TRUE, NULL);
-  g_signal_connect_swapped (fakesink, "handoff",
-      G_CALLBACK (gaeguli_pipeline_create_snapshot), self);
+  self->snapshot_branch = gaeguli_pipeline_add_snapshot_branch (self,
+      GST_BIN (self->pipeline), 0, 0);
+
+  self->snapshot_jpegsrc = gst_bin_get_by_name (GST_BIN (self->pipeline),
+      "jpegsrc");
+  if (self->snapshot_jpegsrc) {
+    g_autoptr (GstElement) passthrough_fakesink = NULL;
+    g_autoptr (GstPad) jpegsrc_src = NULL;
+    g_autoptr (GstPad) capsfilter_src = NULL;
+
+    self->snapshot_passthrough_jifmux =
+        gst_bin_get_by_name (GST_BIN (self->pipeline), "passthrough_jifmux");
+
+    jpegsrc_src = gst_element_get_static_pad (self->snapshot_jpegsrc, "src");
+    gst_pad_add_probe (jpegsrc_src, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) _on_passthrough_buffer, self, NULL);
+
+    passthrough_fakesink = gst_bin_get_by_name (GST_BIN (self->pipeline),
+        "passthrough_fakesink");
+    g_object_set (passthrough_fakesink, "signal-handoffs", TRUE, NULL);
+    g_signal_connect_swapped (passthrough_fakesink, "handoff",
+        G_CALLBACK (gaeguli_pipeline_create_passthrough_snapshot), self);
+
+    capsfilter = gst_bin_get_by_name (GST_BIN (self->pipeline), "caps");
+    capsfilter_src = gst_element_get_static_pad (capsfilter, "src");
+    gst_pad_add_probe (capsfilter_src, GST_PAD_PROBE_TYPE_BUFFER |
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        (GstPadProbeCallback) _on_source_data, self, NULL);
+  }
 
   /* Caps of the video source are determined by the caps filter in vsrc pipeline
    * and don't need to be renegotiated when a new target pipeline links to
    * the tee. Thus, ignore reconfigure events coming from downstream. */
   tee = gst_bin_get_by_name (GST_BIN (self->vsrc), "tee");
-  tee_sink = gst_element_get_static_pad (tee, "sink");
-  gst_pad_add_probe (tee_sink, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+  tee_sinkpad = gst_element_get_static_pad (tee, "sink");
+  gst_pad_add_probe (tee_sinkpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
       _drop_reconfigure_cb, NULL, NULL);
 
+  self->gap_src = gst_bin_get_by_name (GST_BIN (self->vsrc), "gap_src");
+  gap_srcpad = gst_element_get_static_pad (self->gap_src, "src");
+  self->gap_sinkpad = gst_pad_get_peer (gap_srcpad);
+
   decodebin = gst_bin_get_by_name (GST_BIN (self->pipeline), "decodebin");
+  gap_selector = gst_bin_get_by_name (GST_BIN (self->vsrc), "gap_selector");
   if (decodebin) {
+    /* The decoder output gets linked once decodebin exposes it. */
+    self->source_sinkpad = gst_element_request_pad (gap_selector,
+        gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS
+            (gap_selector), "sink_%u"), NULL, NULL);
+  } else {
+    g_autoptr (GstElement) source_caps =
+        gst_bin_get_by_name (GST_BIN (self->vsrc), "caps");
+    g_autoptr (GstPad) caps_srcpad =
+        gst_element_get_static_pad (source_caps, "src");
+
+    self->source_sinkpad = gst_pad_get_peer (caps_srcpad);
+  }
+  gaeguli_pipeline_select_gap_src (self, FALSE);
+  gst_pad_add_probe (self->source_sinkpad, GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) _on_source_output, self, NULL);
+
+  if (decodebin) {
+    if (self->show_overlay) {
+      gaeguli_pipeline_add_clock_overlay (self);
+    }
     g_signal_connect (decodebin, "pad-added",
-        G_CALLBACK (_decodebin_pad_added), self->overlay);
+        G_CALLBACK (_decodebin_pad_added), self);
   }
 
   if (self->prefer_hw_decoding) {
@@ -787,10 +1821,177 @@ _build_vsrc_pipeline (GaeguliPipeline * self, GError ** error)
 failed:
   gst_clear_object (&self->vsrc);
   gst_clear_object (&self->pipeline);
+  gst_clear_object (&self->source_sinkpad);
+  gst_clear_object (&self->gap_src);
+  gst_clear_object (&self->gap_sinkpad);
 
   return FALSE;
 }
 
+/* Pushes copies of the last frame to the targets while the source is being
+ * reconfigured, so the receivers don't see the stream stall. The copies go
+ * through gap_src, which timestamps them and pushes them from its own
+ * streaming thread. */
+static gboolean
+_fill_source_gap (GaeguliPipeline * self)
+{
+  GstBuffer *filler = NULL;
+  gint64 now = g_get_monotonic_time ();
+
+  g_mutex_lock (&self->source_lock);
+
+  if (self->source_switch_start != 0 &&
+      now - self->source_switch_start > SOURCE_SWITCH_TIMEOUT_US) {
+    g_warning ("Video source didn't resume after changing its settings");
+    self->source_switch_start = 0;
+  }
+
+  if (self->source_switch_start == 0) {
+    gaeguli_pipeline_select_gap_src (self, FALSE);
+    self->source_filler_id = 0;
+    g_mutex_unlock (&self->source_lock);
+    return G_SOURCE_REMOVE;
+  }
+
+  /* Once the source has sent its new caps, only its own frames go on. */
+  if (self->last_frame && !self->source_switch_caps_changed &&
+      now - self->last_frame_time >= G_USEC_PER_SEC / self->fps) {
+    filler = gst_buffer_copy (self->last_frame);
+    GST_BUFFER_PTS (filler) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DTS (filler) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION (filler) = GST_CLOCK_TIME_NONE;
+
+    gaeguli_pipeline_select_gap_src (self, TRUE);
+  }
+
+  g_mutex_unlock (&self->source_lock);
+
+  if (filler) {
+    gst_app_src_push_buffer (GST_APP_SRC (self->gap_src), filler);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+gaeguli_pipeline_begin_source_switch (GaeguliPipeline * self)
+{
+  g_autoptr (GstCaps) caps = gst_pad_get_current_caps (self->source_sinkpad);
+
+  g_mutex_lock (&self->source_lock);
+
+  self->source_switch_start = g_get_monotonic_time ();
+  self->source_switch_caps_changed = FALSE;
+
+  /* The fillers repeat a frame of the current settings. */
+  g_object_set (self->gap_src, "caps", caps, NULL);
+
+  if (self->source_filler_id == 0) {
+    self->source_filler_id = g_timeout_add (MAX (1000 / self->fps, 1),
+        (GSourceFunc) _fill_source_gap, self);
+  }
+
+  g_mutex_unlock (&self->source_lock);
+}
+
+/* Checks whether the source can deliver the given size in its current
+ * format. Only the size of the stream then changes, which
+ * the elements downstream handle without getting restarted. */
+static gboolean
+_source_can_renegotiate (GaeguliPipeline * self, gint width, gint height)
+{
+  g_autoptr (GstElement) pre_capsfilter = NULL;
+  g_autoptr (GstPad) sinkpad = NULL;
+  g_autoptr (GstPad) srcpad = NULL;
+  g_autoptr (GstCaps) current_caps = NULL;
+  g_autoptr (GstCaps) wanted_caps = NULL;
+  g_autoptr (GstCaps) supported_caps = NULL;
+  GstStructure *s;
+
+  pre_capsfilter = gst_bin_get_by_name (GST_BIN (self->pipeline), "pre_caps");
+  sinkpad = gst_element_get_static_pad (pre_capsfilter, "sink");
+  srcpad = gst_pad_get_peer (sinkpad);
+  if (srcpad == NULL) {
+    return FALSE;
+  }
+
+  current_caps = gst_pad_get_current_caps (srcpad);
+  if (current_caps == NULL) {
+    return FALSE;
+  }
+
+  wanted_caps = gst_caps_copy (current_caps);
+  s = gst_caps_get_structure (wanted_caps, 0);
+  /* videorate converts the framerate. */
+  gst_structure_remove_field (s, "framerate");
+  if (width > 0 && height > 0) {
+    gst_structure_set (s, "width", G_TYPE_INT, width, "height", G_TYPE_INT,
+        height, NULL);
+  }
+
+  supported_caps = gst_pad_query_caps (srcpad, NULL);
+
+  return gst_caps_can_intersect (wanted_caps, supported_caps);
+}
+
+static GstPad *
+_get_linked_sink_pad (GstElement * element)
+{
+  static const gchar *const names[] = { "sink", "video_sink", NULL };
+  gint i;
+
+  for (i = 0; names[i] != NULL; i++) {
+    GstPad *pad = gst_element_get_static_pad (element, names[i]);
+
+    if (pad && gst_pad_is_linked (pad)) {
+      return pad;
+    }
+    gst_clear_object (&pad);
+  }
+
+  return NULL;
+}
+
+/* Cycles the elements from the source up to the gap selector through READY.
+ * The selector, the tee and the encode branches behind them keep running, so
+ * the targets stay connected. */
+static void
+gaeguli_pipeline_restart_source (GaeguliPipeline * self)
+{
+  g_autoptr (GPtrArray) elements =
+      g_ptr_array_new_with_free_func (gst_object_unref);
+  GstPad *sinkpad = gst_object_ref (self->source_sinkpad);
+  GstState cur_state;
+  guint i;
+
+  gst_element_get_state (self->vsrc, &cur_state, NULL, 0);
+  if (cur_state <= GST_STATE_READY) {
+    gst_object_unref (sinkpad);
+    return;
+  }
+
+  while (sinkpad) {
+    g_autoptr (GstPad) peer = gst_pad_get_peer (sinkpad);
+    GstElement *element = peer ? gst_pad_get_parent_element (peer) : NULL;
+
+    gst_object_unref (sinkpad);
+    sinkpad = NULL;
+
+    if (element) {
+      g_ptr_array_add (elements, element);
+      sinkpad = _get_linked_sink_pad (element);
+    }
+  }
+
+  /* Elements are ordered from the selector towards the source. */
+  for (i = 0; i != elements->len; ++i) {
+    gst_element_set_state (g_ptr_array_index (elements, i), GST_STATE_READY);
+  }
+  for (i = 0; i != elements->len; ++i) {
+    gst_element_set_state (g_ptr_array_index (elements, i), cur_state);
+  }
+}
+
 static void
 gaeguli_pipeline_update_vsrc_caps (GaeguliPipeline * self)
 {
@@ -799,6 +2000,8 @@ gaeguli_pipeline_update_vsrc_caps (GaeguliPipeline * self)
   gint i;
   g_autoptr (GstElement) capsfilter = NULL;
   g_autoptr (GstCaps) caps = NULL;
+  g_autoptr (GstCaps) current_caps = NULL;
+  g_autoptr (GstPad) capsfilter_src = NULL;
   GVariantDict attr;
 
   if (!self->vsrc) {
@@ -850,6 +2053,9 @@ gaeguli_pipeline_update_vsrc_caps (GaeguliPipeline * self)
   }
 
   capsfilter = gst_bin_get_by_name (GST_BIN (self->pipeline), "caps");
+  capsfilter_src = gst_element_get_static_pad (capsfilter, "src");
+  current_caps = gst_pad_get_current_caps (capsfilter_src);
+
   g_object_set (capsfilter, "caps", caps, NULL);
 
   /* Setting device-specific parameters */
@@ -879,22 +2085,29 @@ gaeguli_pipeline_update_vsrc_caps (GaeguliPipeline * self)
     g_object_set (pre_capsfilter, "caps", pre_caps, NULL);
   }
 
-  /* Cycling vsrc through READY state prods decodebin into re-discovery of input
-   * stream format and rebuilding its decoding pipeline. This is needed when
-   * a switch is made between two resolutions that the connected camera can only
-   * produce in different output formats, e.g. a change from raw 640x480 stream
-   * to MJPEG 1920x1080.
+  if (current_caps == NULL || gst_caps_can_intersect (current_caps, caps)) {
+    /* Not streaming yet, or the settings haven't changed. */
+    return;
+  }
+
+  gaeguli_pipeline_begin_source_switch (self);
+
+  /* The new caps on the capsfilter make the source renegotiate in place when
+   * it can produce the new size in its current format. Until its first frame
+   * with the new settings, the targets get the last frame repeated.
+   *
+   * Otherwise, cycling the source through READY state prods decodebin into
+   * re-discovery of input stream format and rebuilding its decoding pipeline.
+   * This is needed when a switch is made between two resolutions that the
+   * connected camera can only produce in different output formats, e.g.
+   * a change from raw 640x480 stream to MJPEG 1920x1080.
    *
    * NVARGUS Camera src doesn't support this.
    */
-  if (self->source != GAEGULI_VIDEO_SOURCE_NVARGUSCAMERASRC) {
-    GstState cur_state;
-
-    gst_element_get_state (self->vsrc, &cur_state, NULL, 0);
-    if (cur_state > GST_STATE_READY) {
-      gst_element_set_state (self->vsrc, GST_STATE_READY);
-      gst_element_set_state (self->vsrc, cur_state);
-    }
+  if (self->source != GAEGULI_VIDEO_SOURCE_NVARGUSCAMERASRC &&
+      !_source_can_renegotiate (self, width, height)) {
+    g_debug ("restarting the video source to change its format");
+    gaeguli_pipeline_restart_source (self);
   }
 }
 
@@ -1032,6 +2245,11 @@ GaeguliReturn
 gaeguli_pipeline_remove_target (GaeguliPipeline * self, GaeguliTarget * target,
     GError ** error)
 {
+  g_autoptr (GArray) poll_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  GHashTableIter it;
+  StatsSubscription *sub;
+  guint i;
+
   g_return_val_if_fail (GAEGULI_IS_PIPELINE (self), GAEGULI_RETURN_FAIL);
   g_return_val_if_fail (target != NULL, GAEGULI_RETURN_FAIL);
   g_return_val_if_fail (error == NULL || *error == NULL, GAEGULI_RETURN_FAIL);
@@ -1043,6 +2261,19 @@ gaeguli_pipeline_remove_target (GaeguliPipeline * self, GaeguliTarget * target,
     goto out;
   }
 
+  g_hash_table_iter_init (&it, self->stats_subscriptions);
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & sub)) {
+    gpointer poll_id;
+
+    if (g_hash_table_lookup_extended (sub->polls,
+            GUINT_TO_POINTER (target->id), NULL, &poll_id)) {
+      guint id = GPOINTER_TO_UINT (poll_id);
+
+      g_array_append_val (poll_ids, id);
+      g_hash_table_remove (sub->polls, GUINT_TO_POINTER (target->id));
+    }
+  }
+
   gaeguli_target_unlink (target);
   if (gaeguli_target_get_state (target) == GAEGULI_TARGET_STATE_STOPPING) {
     /* Target removal will happen asynchronously. Keep the pipeline alive
@@ -1054,6 +2285,10 @@ gaeguli_pipeline_remove_target (GaeguliPipeline * self, GaeguliTarget * target,
 out:
   g_mutex_unlock (&self->lock);
 
+  for (i = 0; i != poll_ids->len; ++i) {
+    gaeguli_stats_poller_remove (g_array_index (poll_ids, guint, i));
+  }
+
   return GAEGULI_RETURN_OK;
 }
 
@@ -1061,33 +2296,66 @@ void
 gaeguli_pipeline_create_snapshot_async (GaeguliPipeline * self, GVariant * tags,
     GCancellable * cancellable, GAsyncReadyCallback callback,
     gpointer user_data)
+{
+  gaeguli_pipeline_create_snapshot_full_async (self, tags, 0, 0, 0,
+      cancellable, callback, user_data);
+}
+
+void
+gaeguli_pipeline_create_snapshot_full_async (GaeguliPipeline * self,
+    GVariant * tags, gint width, gint height, guint quality,
+    GCancellable * cancellable, GAsyncReadyCallback callback,
+    gpointer user_data)
 {
   g_autoptr (GVariant) tags_autoptr = tags;
   g_autoptr (GTask) task = NULL;
+  SnapshotRequest *request;
+  SnapshotBranch *branch;
   GError *error = NULL;
 
   LOCK_PIPELINE;
 
   task = g_task_new (self, cancellable, callback, user_data);
 
-  if (self->vsrc == NULL && !_build_vsrc_pipeline (self, &error)) {
-    g_task_return_error (task, error);
+  if (tags && !g_variant_is_of_type (tags, G_VARIANT_TYPE_VARDICT)) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "Tags must be NULL or of variant type 'a{sv}'");
     return;
   }
 
-  if (tags && !g_variant_is_of_type (tags, G_VARIANT_TYPE_VARDICT)) {
+  if (width < 0 || height < 0 || quality > 100) {
     g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
-        "Tags must be NULL or of variant type 'a{sv}'");
+        "Invalid snapshot size %dx%d or quality %u", width, height, quality);
+    return;
   }
 
-  if (tags) {
-    g_task_set_task_data (task, g_steal_pointer (&tags_autoptr),
-        (GDestroyNotify) g_variant_unref);
+  if (self->vsrc == NULL && !_build_vsrc_pipeline (self, &error)) {
+    g_task_return_error (task, error);
+    return;
   }
 
+  branch = gaeguli_pipeline_get_snapshot_branch (self, width, height, &error);
+  if (branch == NULL) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  branch->last_used = g_get_monotonic_time ();
+
+  request = g_new0 (SnapshotRequest, 1);
+  request->tags = g_steal_pointer (&tags_autoptr);
+  request->width = width;
+  request->height = height;
+  request->quality = quality;
+  g_task_set_task_data (task, request, (GDestroyNotify) snapshot_request_free);
+
   g_queue_push_tail (self->snapshot_tasks, g_steal_pointer (&task));
-  if (self->num_snapshots_to_encode++ == 0) {
-    g_object_set (self->snapshot_valve, "drop", FALSE, NULL);
+  self->num_snapshots_to_encode++;
+  branch->num_pending++;
+
+  if (branch != self->snapshot_branch || quality != 0 ||
+      !gaeguli_pipeline_can_pass_jpeg_through (self)) {
+    g_object_set (branch->valve, "drop", FALSE, NULL);
   }
 }
 
@@ -1100,10 +2368,28 @@ gaeguli_pipeline_create_snapshot_finish (GaeguliPipeline * self,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
+static void
+_fail_snapshot_batches (GQueue * batches)
+{
+  while (!g_queue_is_empty (batches)) {
+    g_autoptr (GPtrArray) batch = g_queue_pop_head (batches);
+    guint i;
+
+    for (i = 0; i != batch->len; ++i) {
+      g_task_return_new_error (g_ptr_array_index (batch, i),
+          GAEGULI_RESOURCE_ERROR, GAEGULI_RESOURCE_ERROR_STOPPED,
+          "The pipeline has been stopped");
+    }
+  }
+}
+
 /* Must be called from the main thread. */
 void
 gaeguli_pipeline_stop (GaeguliPipeline * self)
 {
+  GHashTableIter it;
+  SnapshotBranch *branch;
+
   g_return_if_fail (GAEGULI_IS_PIPELINE (self));
 
   g_debug ("clear internal pipeline");
@@ -1120,11 +2406,32 @@ gaeguli_pipeline_stop (GaeguliPipeline * self)
         GAEGULI_RESOURCE_ERROR_STOPPED, "The pipeline has been stopped");
   }
 
+  g_hash_table_iter_init (&it, self->snapshot_branches);
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & branch)) {
+    _fail_snapshot_batches (&branch->batches);
+  }
+  _fail_snapshot_batches (self->snapshot_passthrough_batches);
+  self->num_snapshots_to_encode = 0;
+  self->source_is_jpeg = FALSE;
+
+  g_hash_table_remove_all (self->encode_branches);
+  g_ptr_array_set_size (self->unshared_branches, 0);
   g_clear_pointer (&self->vsrc, gst_object_unref);
   g_clear_pointer (&self->overlay, gst_object_unref);
-  gst_clear_object (&self->snapshot_valve);
-  gst_clear_object (&self->snapshot_jpegenc);
-  gst_clear_object (&self->snapshot_jifmux);
+  g_hash_table_remove_all (self->snapshot_branches);
+  self->snapshot_branch = NULL;
+  g_clear_handle_id (&self->snapshot_eviction_id, g_source_remove);
+  gst_clear_object (&self->source_sinkpad);
+  gst_clear_object (&self->gap_src);
+  gst_clear_object (&self->gap_sinkpad);
+
+  g_mutex_lock (&self->source_lock);
+  g_clear_handle_id (&self->source_filler_id, g_source_remove);
+  gst_clear_buffer (&self->last_frame);
+  self->source_switch_start = 0;
+  g_mutex_unlock (&self->source_lock);
+  gst_clear_object (&self->snapshot_jpegsrc);
+  gst_clear_object (&self->snapshot_passthrough_jifmux);
   gst_clear_object (&self->pipeline);
 
   g_mutex_unlock (&self->lock);
@@ -1137,6 +2444,143 @@ gaeguli_pipeline_dump_to_dot_file (GaeguliPipeline * self)
       GST_DEBUG_GRAPH_SHOW_ALL, g_get_prgname ());
 }
 
+static gboolean
+_encode_branch_is_retired (gpointer key, GaeguliEncodeBranch * branch,
+    gpointer user_data)
+{
+  return gaeguli_encode_branch_is_retired (branch);
+}
+
+static void
+_remove_retired_unshared_branches (GaeguliPipeline * self)
+{
+  guint i = 0;
+
+  while (i < self->unshared_branches->len) {
+    if (gaeguli_encode_branch_is_retired (g_ptr_array_index
+            (self->unshared_branches, i))) {
+      g_ptr_array_remove_index_fast (self->unshared_branches, i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+static GaeguliEncodeBranch *
+gaeguli_pipeline_lookup_encode_branch (GaeguliPipeline * self,
+    const gchar * key)
+{
+  GaeguliEncodeBranch *branch;
+
+  if (key == NULL) {
+    return NULL;
+  }
+
+  branch = g_hash_table_lookup (self->encode_branches, key);
+  if (branch == NULL || !gaeguli_encode_branch_is_shareable (branch)) {
+    return NULL;
+  }
+
+  g_debug ("sharing encode branch [%s]", key);
+
+  return g_object_ref (branch);
+}
+
+static GstPad *
+gaeguli_pipeline_request_source_tee_pad (GaeguliPipeline * self)
+{
+  g_autoptr (GstElement) tee = NULL;
+
+  tee = gst_bin_get_by_name (GST_BIN (self->vsrc), "tee");
+
+  return gst_element_request_pad (tee,
+      gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS (tee),
+          "src_%u"), NULL, NULL);
+}
+
+/* Returns a pad with raw video for an encode branch. Software encoders get
+ * it from a scaler shared by all branches of the same resolution. */
+static GstPad *
+gaeguli_pipeline_request_raw_pad (GaeguliPipeline * self,
+    GVariant * attributes, GaeguliEncodeBranch ** scaler, GError ** error)
+{
+  g_autofree gchar *key = NULL;
+  g_autoptr (GstPad) tee_srcpad = NULL;
+
+  key = gaeguli_encode_branch_scaler_key_from_attributes (attributes);
+  if (key == NULL) {
+    *scaler = NULL;
+    return gaeguli_pipeline_request_source_tee_pad (self);
+  }
+
+  *scaler = gaeguli_pipeline_lookup_encode_branch (self, key);
+  if (*scaler == NULL) {
+    tee_srcpad = gaeguli_pipeline_request_source_tee_pad (self);
+
+    *scaler = gaeguli_encode_branch_new_scaler (tee_srcpad, attributes, error);
+    if (*scaler == NULL) {
+      gst_element_release_request_pad (GST_PAD_PARENT (tee_srcpad),
+          tee_srcpad);
+      return NULL;
+    }
+
+    g_hash_table_replace (self->encode_branches, g_strdup (key),
+        g_object_ref (*scaler));
+  }
+
+  return gaeguli_encode_branch_request_pad (*scaler);
+}
+
+/* Returns a pad on an encode branch producing the stream described by
+ * attributes. Targets with identical encoding settings share one branch. */
+static GstPad *
+gaeguli_pipeline_request_encoded_pad (GaeguliPipeline * self,
+    GVariant * attributes, GError ** error)
+{
+  g_autoptr (GaeguliEncodeBranch) branch = NULL;
+  g_autofree gchar *key = NULL;
+
+  g_hash_table_foreach_remove (self->encode_branches,
+      (GHRFunc) _encode_branch_is_retired, NULL);
+  _remove_retired_unshared_branches (self);
+
+  key = gaeguli_encode_branch_key_from_attributes (attributes);
+
+  branch = gaeguli_pipeline_lookup_encode_branch (self, key);
+
+  if (!branch) {
+    g_autoptr (GaeguliEncodeBranch) scaler = NULL;
+    g_autoptr (GstPad) raw_pad = NULL;
+
+    raw_pad = gaeguli_pipeline_request_raw_pad (self, attributes, &scaler,
+        error);
+    if (raw_pad == NULL) {
+      return NULL;
+    }
+
+    branch = gaeguli_encode_branch_new (raw_pad, attributes, error);
+    if (branch == NULL) {
+      if (scaler) {
+        gaeguli_encode_branch_release_pad (scaler, raw_pad);
+      } else {
+        gst_element_release_request_pad (GST_PAD_PARENT (raw_pad), raw_pad);
+      }
+      return NULL;
+    }
+
+    /* The pipeline keeps every branch alive until it retires; the target
+     * finds it through the pad it gets. */
+    if (key) {
+      g_hash_table_replace (self->encode_branches, g_strdup (key),
+          g_object_ref (branch));
+    } else {
+      g_ptr_array_add (self->unshared_branches, g_object_ref (branch));
+    }
+  }
+
+  return gaeguli_encode_branch_request_pad (branch);
+}
+
 GaeguliTarget *
 gaeguli_pipeline_add_target_full (GaeguliPipeline * self,
     GVariant * attributes, GError ** error)
@@ -1147,6 +2591,7 @@ gaeguli_pipeline_add_target_full (GaeguliPipeline * self,
   gboolean is_record = FALSE;
   const gchar *location = NULL;
   GaeguliVideoResolution resolution;
+  g_autoptr (GVariant) renditions = NULL;
 
   guint target_id = 0;
 
@@ -1165,6 +2610,17 @@ gaeguli_pipeline_add_target_full (GaeguliPipeline * self,
     g_variant_dict_insert (&attr, "resolution", "i", self->resolution);
   }
 
+  /* The target's own settings describe the first rendition of a simulcast,
+   * which is the one the target controls. */
+  renditions = gaeguli_renditions_from_attributes (attributes);
+  if (renditions) {
+    guint bitrate;
+
+    g_variant_get_child (renditions, 0, "(iu)", &resolution, &bitrate);
+    g_variant_dict_insert (&attr, "resolution", "i", resolution);
+    g_variant_dict_insert (&attr, "bitrate", "u", bitrate);
+  }
+
   if (location == NULL) {
     g_set_error (error, GAEGULI_TRANSMIT_ERROR,
         GAEGULI_TRANSMIT_ERROR_FAILED,
@@ -1174,8 +2630,9 @@ gaeguli_pipeline_add_target_full (GaeguliPipeline * self,
 
   g_mutex_lock (&self->lock);
 
-  /* assume that it's first target */
-  if (self->vsrc == NULL && !is_record && !_build_vsrc_pipeline (self, error)) {
+  /* assume that it's first target; recording targets need the video source
+   * as much as streaming ones do. */
+  if (self->vsrc == NULL && !_build_vsrc_pipeline (self, error)) {
     goto failed;
   }
 
@@ -1183,20 +2640,25 @@ gaeguli_pipeline_add_target_full (GaeguliPipeline * self,
   target = g_hash_table_lookup (self->targets, GINT_TO_POINTER (target_id));
 
   if (!target) {
-    g_autoptr (GstElement) tee = NULL;
-    g_autoptr (GstPad) tee_srcpad = NULL;
+    g_autoptr (GVariant) target_attributes = NULL;
+    g_autoptr (GstPad) peer_pad = NULL;
     g_autoptr (GError) internal_err = NULL;
 
     g_debug ("no target pipeline mapped with [%x]", target_id);
 
-    tee = gst_bin_get_by_name (GST_BIN (self->vsrc), "tee");
-    tee_srcpad = gst_element_request_pad (tee,
-        gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS (tee),
-            "src_%u"), NULL, NULL);
+    target_attributes = g_variant_ref_sink (g_variant_dict_end (&attr));
+
+    peer_pad = gaeguli_pipeline_request_encoded_pad (self, target_attributes,
+        &internal_err);
+    if (peer_pad == NULL) {
+      g_propagate_error (error, internal_err);
+      internal_err = NULL;
+      goto failed;
+    }
 
     target =
-        gaeguli_target_new_full (tee_srcpad, target_id,
-        g_variant_dict_end (&attr), &internal_err);
+        gaeguli_target_new_full (peer_pad, target_id, target_attributes,
+        &internal_err);
 
     if (target == NULL) {
       g_propagate_error (error, internal_err);
@@ -1231,6 +2693,16 @@ gaeguli_pipeline_add_target_full (GaeguliPipeline * self,
           G_CALLBACK (gaeguli_pipeline_on_caller_removed), self);
     }
     g_hash_table_insert (self->targets, GINT_TO_POINTER (target_id), target);
+
+    {
+      GHashTableIter it;
+      StatsSubscription *sub;
+
+      g_hash_table_iter_init (&it, self->stats_subscriptions);
+      while (g_hash_table_iter_next (&it, NULL, (gpointer *) & sub)) {
+        gaeguli_pipeline_poll_target_stats (self, sub, target);
+      }
+    }
   } else {
     if (is_record) {
       g_warning ("Record target already exists for given location %s",
@@ -28,6 +28,7 @@
 #include <gaeguli/types.h>
 
 typedef struct _GaeguliTarget GaeguliTarget;
+typedef struct _GaeguliTargetStats GaeguliTargetStats;
 
 /**
  * SECTION: pipeline
@@ -181,7 +182,8 @@ GaeguliReturn           gaeguli_pipeline_remove_target
  * @user_data: arbitrary data passed to @callback
  *
  * Asynchronously saves a single video frame as JPEG image and passes it to
- * @callback.
+ * @callback. Requests with equal @tags made before the next frame gets
+ * encoded are served by the same JPEG image.
  */
 void                    gaeguli_pipeline_create_snapshot_async
                                                 (GaeguliPipeline       *self,
@@ -190,21 +192,131 @@ void                    gaeguli_pipeline_create_snapshot_async
                                                  GAsyncReadyCallback    callback,
                                                  gpointer               user_data);
 
+/**
+ * gaeguli_pipeline_create_snapshot_full_async:
+ * @self: a #GaeguliPipeline object
+ * @tags: a #GVariant of type #G_VARIANT_TYPE_VARDICT with tags to insert
+ * into the snapshot in EXIF format.
+ * @width: width of the image, or 0 to derive it from @height or the source
+ * @height: height of the image, or 0 to derive it from @width or the source
+ * @quality: JPEG encoding quality, or 0 to use #GaeguliPipeline:snapshot-quality
+ * @cancellable: a #GCancellable object
+ * @callback: a #GAsyncReadyCallback to call when the request is fulfilled
+ * @user_data: arbitrary data passed to @callback
+ *
+ * Like gaeguli_pipeline_create_snapshot_async(), but the frame gets scaled
+ * to the given size before encoding, which makes small thumbnails cheap to
+ * produce. One scaler is kept for each requested size; requests for the same
+ * size, @quality and @tags share the image.
+ */
+void                    gaeguli_pipeline_create_snapshot_full_async
+                                                (GaeguliPipeline       *self,
+                                                 GVariant              *tags,
+                                                 gint                   width,
+                                                 gint                   height,
+                                                 guint                  quality,
+                                                 GCancellable          *cancellable,
+                                                 GAsyncReadyCallback    callback,
+                                                 gpointer               user_data);
+
 /**
  * gaeguli_pipeline_create_snapshot_finish:
  * @self: a #GaeguliPipeline object
  * @result: a #GAsyncResult obtained from the GAsyncReadyCallback passed to gaeguli_pipeline_create_snapshot_async()
  * @error: Return location for error or %NULL.
  *
- * Finishes an operation started with gaeguli_pipeline_create_snapshot_async().
+ * Finishes an operation started with gaeguli_pipeline_create_snapshot_async()
+ * or gaeguli_pipeline_create_snapshot_full_async().
  *
- * Returns: #GBytes with JPEG image data. On error returns %NULL and sets @error.
+ * Returns: #GBytes with JPEG image data, which may be shared with other
+ * snapshot requests. On error returns %NULL and sets @error.
  */
 GBytes                 *gaeguli_pipeline_create_snapshot_finish
                                                 (GaeguliPipeline       *self,
                                                  GAsyncResult          *result,
                                                  GError               **error);
 
+/**
+ * GaeguliTargetStatsUpdate:
+ * @target: the #GaeguliTarget the update is for
+ * @stats: current statistics of @target; totals over all callers for listeners
+ * @interval: time since the previous update of the subscription in seconds
+ * @packets_sent: packets sent during @interval, including retransmissions
+ * @packets_sent_lost: packets reported lost during @interval
+ * @packets_retransmitted: packets retransmitted during @interval
+ * @packets_per_second: rate of sent packets
+ * @retransmit_ratio: portion of the packets sent that were retransmissions
+ * @loss_ratio: packets reported lost per packet sent
+ * @send_bitrate: bits per second sent to the network
+ * @encoder_bitrate: bits per second of encoded stream the target received
+ *
+ * Statistics of one target, with deltas and rates computed since the
+ * previous update delivered to the same subscription.
+ */
+typedef struct
+{
+  GaeguliTarget *target;
+  const GaeguliTargetStats *stats;
+  gdouble interval;
+
+  guint64 packets_sent;
+  guint64 packets_sent_lost;
+  guint64 packets_retransmitted;
+
+  gdouble packets_per_second;
+  gdouble retransmit_ratio;
+  gdouble loss_ratio;
+  gdouble send_bitrate;
+  gdouble encoder_bitrate;
+} GaeguliTargetStatsUpdate;
+
+/**
+ * GaeguliStatsUpdateFunc:
+ * @pipeline: the #GaeguliPipeline
+ * @update: statistics of a target
+ * @user_data: data passed to gaeguli_pipeline_subscribe_stats()
+ *
+ * Receives statistics updates, once per target and subscription interval.
+ */
+typedef void (*GaeguliStatsUpdateFunc) (GaeguliPipeline * pipeline,
+    const GaeguliTargetStatsUpdate * update, gpointer user_data);
+
+/**
+ * gaeguli_pipeline_subscribe_stats:
+ * @self: a #GaeguliPipeline object
+ * @interval_ms: how often to deliver updates, in milliseconds
+ * @func: the function to call with each update
+ * @user_data: data to pass to @func
+ * @notify: (nullable): function to free @user_data when unsubscribed
+ *
+ * Starts delivering statistics of the pipeline's SRT targets to @func in the
+ * thread-default main context of the caller. The statistics get collected on
+ * the library's stats thread, once for all subscriptions due at the same
+ * time, so each subscription adds only the cost of its callbacks. A target's
+ * first update arrives one @interval_ms after it was first sampled, when
+ * there's something to compute the rates from.
+ *
+ * Returns: the subscription id to pass to gaeguli_pipeline_unsubscribe_stats()
+ */
+guint                   gaeguli_pipeline_subscribe_stats
+                                                (GaeguliPipeline       *self,
+                                                 guint                  interval_ms,
+                                                 GaeguliStatsUpdateFunc func,
+                                                 gpointer               user_data,
+                                                 GDestroyNotify         notify);
+
+/**
+ * gaeguli_pipeline_unsubscribe_stats:
+ * @self: a #GaeguliPipeline object
+ * @id: a subscription id returned by gaeguli_pipeline_subscribe_stats()
+ *
+ * Stops delivering statistics to a subscription. Can be called from the
+ * subscription's callback.
+ */
+void                    gaeguli_pipeline_unsubscribe_stats
+                                                (GaeguliPipeline       *self,
+                                                 guint                  id);
+
 /**
  * gaeguli_pipeline_stop:
  * @self: a #GaeguliPipeline object
@@ -0,0 +1,545 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+/* GValueArray is deprecated since GLib 2.32 but srtsink returns it in "stats"
+ * structure. */
+#define GLIB_DISABLE_DEPRECATION_WARNINGS
+
+#include "renditionrouter.h"
+
+#include "gopcache.h"
+#include "streamsplicer.h"
+
+#include <srt/srt.h>
+
+#define MAX_RENDITIONS          8
+
+/* Same headroom over SRT's estimate as the bandwidth adaptor takes. */
+#define BANDWIDTH_FACTOR        1.2
+/* Weight of a new sample in a caller's bitrate estimate. */
+#define SMOOTHING               0.3
+/* Callers down to this fraction of the fastest one in a group share its
+ * rendition rather than opening a new one. */
+#define GROUP_RATIO             0.6
+/* Smaller bitrate changes aren't worth reconfiguring an encoder. */
+#define BITRATE_TOLERANCE       0.1
+
+typedef struct
+{
+  gint ref_count;
+
+  gint srtsocket;
+  /* The bitrate the caller's connection sustains; 0 until measured. */
+  gdouble bitrate;
+  guint rendition;
+  /* The rendition to switch to at its next random access point, or -1. */
+  gint pending;
+  gboolean key_unit_requested;
+  /* The stream headers of the rendition go out before its data. */
+  gboolean needs_headers;
+  /* The caller's send buffer overflowed; its data resumes at the next random
+   * access point of its rendition. */
+  gboolean behind;
+  /* Continues the caller's MPEG-TS across renditions. */
+  GaeguliStreamSplicer *splicer;
+
+  /* Buffers for the caller in the order they must go out. The threads of
+   * other renditions may add to it while a send is in progress. */
+  GQueue queue;
+  /* Held while sending, so the queue goes out in order. */
+  GMutex send_lock;
+} Caller;
+
+struct _GaeguliRenditionRouter
+{
+  GMutex lock;
+
+  guint max_renditions;
+  guint n_renditions;
+  guint bitrates[MAX_RENDITIONS];
+  /* PAT and PMT of each rendition, from the "streamheader" of its caps. */
+  GstBuffer *headers[MAX_RENDITIONS];
+
+  GPtrArray *callers;
+
+  GaeguliRenditionRouterSendFunc send_func;
+  gpointer send_data;
+};
+
+static Caller *
+_caller_ref (Caller * caller)
+{
+  g_atomic_int_inc (&caller->ref_count);
+
+  return caller;
+}
+
+static void
+_caller_unref (Caller * caller)
+{
+  if (g_atomic_int_dec_and_test (&caller->ref_count)) {
+    g_queue_clear_full (&caller->queue, (GDestroyNotify) gst_buffer_unref);
+    gaeguli_stream_splicer_free (caller->splicer);
+    g_mutex_clear (&caller->send_lock);
+
+    g_free (caller);
+  }
+}
+
+static gboolean
+_send_buffer (gint srtsocket, GstBuffer * buffer, gpointer user_data)
+{
+  return gaeguli_srt_socket_send_buffer (srtsocket, buffer);
+}
+
+GaeguliRenditionRouter *
+gaeguli_rendition_router_new (guint max_renditions)
+{
+  GaeguliRenditionRouter *self = g_new0 (GaeguliRenditionRouter, 1);
+
+  g_mutex_init (&self->lock);
+  self->max_renditions = CLAMP (max_renditions, 1, MAX_RENDITIONS);
+  self->n_renditions = 1;
+  self->callers = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      _caller_unref);
+  self->send_func = _send_buffer;
+
+  return self;
+}
+
+void
+gaeguli_rendition_router_free (GaeguliRenditionRouter * self)
+{
+  guint i;
+
+  for (i = 0; i < MAX_RENDITIONS; ++i) {
+    gst_clear_buffer (&self->headers[i]);
+  }
+  g_ptr_array_unref (self->callers);
+  g_mutex_clear (&self->lock);
+
+  g_free (self);
+}
+
+/* Must be called with the lock held. */
+static Caller *
+_find_caller (GaeguliRenditionRouter * self, gint srtsocket, guint * index)
+{
+  guint i;
+
+  for (i = 0; i < self->callers->len; ++i) {
+    Caller *caller = g_ptr_array_index (self->callers, i);
+
+    if (caller->srtsocket == srtsocket) {
+      if (index) {
+        *index = i;
+      }
+      return caller;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Replaces sending to the SRT sockets of the callers, e.g. in tests. @func
+ * returns %FALSE when the socket couldn't take the buffer.
+ */
+void
+gaeguli_rendition_router_set_send_func (GaeguliRenditionRouter * self,
+    GaeguliRenditionRouterSendFunc func, gpointer user_data)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  self->send_func = func ? func : _send_buffer;
+  self->send_data = func ? user_data : NULL;
+}
+
+void
+gaeguli_rendition_router_add_caller (GaeguliRenditionRouter * self,
+    gint srtsocket)
+{
+  Caller *caller = g_new0 (Caller, 1);
+  gint blocking = FALSE;
+
+  /* The router writes the caller's data itself; a congested caller must not
+   * stall the streaming thread of its rendition. */
+  srt_setsockflag (srtsocket, SRTO_SNDSYN, &blocking, sizeof (blocking));
+
+  /* Until its bandwidth is known, a caller gets the best rendition. */
+  caller->ref_count = 1;
+  caller->srtsocket = srtsocket;
+  caller->pending = -1;
+  caller->needs_headers = TRUE;
+  caller->splicer =
+      gaeguli_stream_splicer_new (GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_queue_init (&caller->queue);
+  g_mutex_init (&caller->send_lock);
+
+  {
+    g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+    g_ptr_array_add (self->callers, caller);
+  }
+}
+
+void
+gaeguli_rendition_router_remove_caller (GaeguliRenditionRouter * self,
+    gint srtsocket)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+  guint index;
+
+  if (_find_caller (self, srtsocket, &index)) {
+    g_ptr_array_remove_index_fast (self->callers, index);
+  }
+}
+
+static gint
+_compare_bitrate (gconstpointer a, gconstpointer b)
+{
+  const Caller *caller_a = *(const Caller **) a;
+  const Caller *caller_b = *(const Caller **) b;
+
+  /* Fastest first. */
+  return (caller_a->bitrate < caller_b->bitrate) -
+      (caller_a->bitrate > caller_b->bitrate);
+}
+
+static void
+_assign_rendition (Caller * caller, guint rendition)
+{
+  if (caller->rendition == rendition) {
+    caller->pending = -1;
+  } else if (caller->pending != (gint) rendition) {
+    g_debug ("Caller %d moves from rendition %u to %u", caller->srtsocket,
+        caller->rendition, rendition);
+    caller->pending = rendition;
+    caller->key_unit_requested = FALSE;
+  }
+}
+
+/* Must be called with the lock held. */
+static void
+_update_caller_bitrates (GaeguliRenditionRouter * self,
+    const GstStructure * stats, guint max_bitrate)
+{
+  const GValue *value = gst_structure_get_value (stats, "callers");
+  GValueArray *array;
+  guint i;
+
+  if (!value || !G_VALUE_HOLDS (value, G_TYPE_VALUE_ARRAY)) {
+    return;
+  }
+
+  array = g_value_get_boxed (value);
+
+  for (i = 0; array && i < array->n_values; ++i) {
+    GstStructure *s = g_value_get_boxed (&array->values[i]);
+    Caller *caller;
+    gint srtsocket;
+    gdouble bandwidth;
+    gdouble estimate;
+
+    if (!s || !gst_structure_get_int (s, "socket", &srtsocket) ||
+        !gst_structure_get_double (s, "bandwidth-mbps", &bandwidth)) {
+      continue;
+    }
+
+    caller = _find_caller (self, srtsocket, NULL);
+    if (!caller) {
+      continue;
+    }
+
+    estimate = MIN (bandwidth * 1e6 * BANDWIDTH_FACTOR, max_bitrate);
+    caller->bitrate = caller->bitrate > 0 ?
+        caller->bitrate * (1 - SMOOTHING) + estimate * SMOOTHING : estimate;
+  }
+}
+
+/*
+ * Feeds the per-caller statistics of a listener srtsink into the callers'
+ * adaptation state, then regroups the callers. Groups start at the fastest
+ * caller and take in everyone down to GROUP_RATIO of its bitrate; the last
+ * allowed group takes whoever is left.
+ */
+void
+gaeguli_rendition_router_update (GaeguliRenditionRouter * self,
+    const GstStructure * stats, guint max_bitrate)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+  g_autoptr (GPtrArray) measured = g_ptr_array_new ();
+  guint bitrates[MAX_RENDITIONS];
+  gdouble group_top = 0;
+  guint n_groups = 0;
+  guint i;
+
+  _update_caller_bitrates (self, stats, max_bitrate);
+
+  for (i = 0; i < self->callers->len; ++i) {
+    Caller *caller = g_ptr_array_index (self->callers, i);
+
+    if (caller->bitrate > 0) {
+      g_ptr_array_add (measured, caller);
+    } else {
+      _assign_rendition (caller, 0);
+    }
+  }
+
+  g_ptr_array_sort (measured, _compare_bitrate);
+
+  for (i = 0; i < measured->len; ++i) {
+    Caller *caller = g_ptr_array_index (measured, i);
+
+    if (n_groups == 0 || (caller->bitrate < group_top * GROUP_RATIO &&
+            n_groups < self->max_renditions)) {
+      group_top = caller->bitrate;
+      ++n_groups;
+    }
+
+    /* Every member of the group must be able to receive it. */
+    bitrates[n_groups - 1] = caller->bitrate;
+    _assign_rendition (caller, n_groups - 1);
+  }
+
+  if (n_groups == 0) {
+    bitrates[0] = max_bitrate;
+    n_groups = 1;
+  }
+
+  for (i = 0; i < n_groups; ++i) {
+    guint old = i < self->n_renditions ? self->bitrates[i] : 0;
+
+    if (ABS ((gdouble) bitrates[i] - old) > old * BITRATE_TOLERANCE ||
+        (bitrates[i] == max_bitrate && old != max_bitrate)) {
+      self->bitrates[i] = bitrates[i];
+    }
+  }
+
+  /* Renditions beyond the groups live on while callers still watch them. */
+  self->n_renditions = n_groups;
+  for (i = 0; i < self->callers->len; ++i) {
+    Caller *caller = g_ptr_array_index (self->callers, i);
+
+    self->n_renditions = MAX (self->n_renditions, caller->rendition + 1);
+  }
+}
+
+/* Lowers the number of renditions, e.g. when the encoder can't run more
+ * instances. Callers bound for the dropped renditions stay where they are. */
+void
+gaeguli_rendition_router_limit (GaeguliRenditionRouter * self,
+    guint n_renditions)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+  guint i;
+
+  self->max_renditions = CLAMP (n_renditions, 1, self->max_renditions);
+  self->n_renditions = MIN (self->n_renditions, self->max_renditions);
+
+  for (i = 0; i < self->callers->len; ++i) {
+    Caller *caller = g_ptr_array_index (self->callers, i);
+
+    if (caller->pending >= (gint) self->max_renditions) {
+      caller->pending = -1;
+    }
+  }
+}
+
+guint
+gaeguli_rendition_router_get_n_renditions (GaeguliRenditionRouter * self)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  return self->n_renditions;
+}
+
+guint
+gaeguli_rendition_router_get_bitrate (GaeguliRenditionRouter * self,
+    guint rendition)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  g_return_val_if_fail (rendition < MAX_RENDITIONS, 0);
+
+  return self->bitrates[rendition];
+}
+
+/*
+ * Keeps the stream headers in @caps of @rendition. srtsink would send the
+ * headers to a caller only after the router sent it live data, so the router
+ * sends them itself: to new callers, and to callers switching to @rendition
+ * right before its random access point.
+ */
+void
+gaeguli_rendition_router_set_caps (GaeguliRenditionRouter * self,
+    guint rendition, const GstCaps * caps)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+  const GValue *streamheader;
+  GstBuffer *headers = NULL;
+  guint i;
+
+  g_return_if_fail (rendition < MAX_RENDITIONS);
+
+  streamheader = gst_structure_get_value (gst_caps_get_structure (caps, 0),
+      "streamheader");
+
+  if (streamheader && GST_VALUE_HOLDS_ARRAY (streamheader)) {
+    for (i = 0; i < gst_value_array_get_size (streamheader); ++i) {
+      const GValue *v = gst_value_array_get_value (streamheader, i);
+
+      if (G_VALUE_HOLDS (v, GST_TYPE_BUFFER)) {
+        GstBuffer *header = g_value_get_boxed (v);
+
+        headers = headers ? gst_buffer_append (headers,
+            gst_buffer_ref (header)) : gst_buffer_ref (header);
+      }
+    }
+  }
+
+  gst_clear_buffer (&self->headers[rendition]);
+  self->headers[rendition] = headers;
+}
+
+/*
+ * Sends out what's queued for @caller. Whichever thread gets the send lock
+ * first sends what the other renditions queued meanwhile as well. When the
+ * caller's socket can't take more, drops its data up to the next random
+ * access point rather than waiting for the connection to catch up.
+ */
+static void
+_caller_flush (GaeguliRenditionRouter * self, Caller * caller)
+{
+  g_autoptr (GMutexLocker) send_locker =
+      g_mutex_locker_new (&caller->send_lock);
+
+  for (;;) {
+    GQueue queue = G_QUEUE_INIT;
+    GaeguliRenditionRouterSendFunc send_func;
+    gpointer send_data;
+    GstBuffer *buffer;
+    gboolean failed = FALSE;
+
+    {
+      g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+      queue = caller->queue;
+      g_queue_init (&caller->queue);
+      send_func = self->send_func;
+      send_data = self->send_data;
+    }
+
+    if (g_queue_is_empty (&queue)) {
+      break;
+    }
+
+    while ((buffer = g_queue_pop_head (&queue))) {
+      if (!failed && !send_func (caller->srtsocket, buffer, send_data)) {
+        failed = TRUE;
+      }
+      gst_buffer_unref (buffer);
+    }
+
+    if (failed) {
+      g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+      g_debug ("Caller %d falls behind; skipping to a random access point",
+          caller->srtsocket);
+      caller->behind = TRUE;
+      caller->key_unit_requested = FALSE;
+      g_queue_clear_full (&caller->queue, (GDestroyNotify) gst_buffer_unref);
+    }
+  }
+}
+
+/*
+ * Must be called from the streaming thread of @rendition for each of its
+ * buffers. Sends the buffer to the callers watching the rendition, and lets
+ * the callers waiting for it switch over at a random access point.
+ *
+ * Returns: %TRUE when some caller started waiting for a keyframe of
+ * @rendition.
+ */
+gboolean
+gaeguli_rendition_router_push (GaeguliRenditionRouter * self,
+    guint rendition, GstBuffer * buffer)
+{
+  g_autoptr (GPtrArray) receivers =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) _caller_unref);
+  gpointer source = GUINT_TO_POINTER (rendition + 1);
+  gboolean need_key_unit = FALSE;
+  gint random_access = -1;
+  guint i;
+
+  {
+    g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+    for (i = 0; i < self->callers->len; ++i) {
+      Caller *caller = g_ptr_array_index (self->callers, i);
+      GstBuffer *headers = self->headers[rendition];
+
+      if (caller->pending == (gint) rendition || (caller->behind &&
+              caller->rendition == rendition)) {
+        if (random_access < 0) {
+          random_access = gaeguli_ts_buffer_has_random_access_point (buffer);
+        }
+
+        if (random_access) {
+          if (caller->pending == (gint) rendition) {
+            g_debug ("Caller %d switched to rendition %u", caller->srtsocket,
+                rendition);
+            caller->rendition = rendition;
+            caller->pending = -1;
+          }
+          caller->behind = FALSE;
+          caller->needs_headers = TRUE;
+        } else if (!caller->key_unit_requested) {
+          caller->key_unit_requested = TRUE;
+          need_key_unit = TRUE;
+        }
+      }
+
+      if (caller->rendition != rendition || caller->behind) {
+        continue;
+      }
+
+      /* The splicer carries the caller's CCs over from its previous
+       * rendition to the headers, and from them to the live packets. */
+      if (caller->needs_headers && headers) {
+        g_queue_push_tail (&caller->queue,
+            gaeguli_stream_splicer_process (caller->splicer, headers,
+                gst_buffer_ref (headers)));
+      }
+      caller->needs_headers = FALSE;
+
+      g_queue_push_tail (&caller->queue,
+          gaeguli_stream_splicer_process (caller->splicer, source,
+              gst_buffer_ref (buffer)));
+      g_ptr_array_add (receivers, _caller_ref (caller));
+    }
+  }
+
+  /* Don't hold up the other renditions while sending. */
+  for (i = 0; i < receivers->len; ++i) {
+    _caller_flush (self, g_ptr_array_index (receivers, i));
+  }
+
+  return need_key_unit;
+}
@@ -0,0 +1,100 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_RENDITION_ROUTER_H__
+#define __GAEGULI_RENDITION_ROUTER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * GaeguliRenditionRouter lets a listener target serve callers of different
+ * bandwidth from a few encodes of the same video, called renditions. It keeps
+ * an adaptation state for every caller and groups the callers by the bitrate
+ * their connection sustains; each group gets a rendition encoded at the
+ * bitrate of its slowest member. Rendition 0 serves the fastest group.
+ *
+ * The router sends the MPEG-TS of each rendition straight to the sockets of
+ * its callers. A caller moving to another rendition keeps getting the old one
+ * until the new one reaches a random access point, so its stream switches on
+ * a keyframe. The router sends the PAT and PMT of the new rendition first and
+ * keeps the continuity counters of every caller's stream running across
+ * switches. Each caller's data goes out in order, whichever rendition's
+ * thread sends it.
+ *
+ * Sends don't block. A caller whose send buffer is full falls behind: it
+ * gets no data until the next random access point of its rendition, so that
+ * it can't stall the other callers.
+ */
+
+typedef struct _GaeguliRenditionRouter GaeguliRenditionRouter;
+
+typedef gboolean (*GaeguliRenditionRouterSendFunc) (gint srtsocket,
+    GstBuffer * buffer, gpointer user_data);
+
+GaeguliRenditionRouter  *gaeguli_rendition_router_new
+                                                (guint                   max_renditions);
+
+void                     gaeguli_rendition_router_free
+                                                (GaeguliRenditionRouter *self);
+
+void                     gaeguli_rendition_router_add_caller
+                                                (GaeguliRenditionRouter *self,
+                                                 gint                    srtsocket);
+
+void                     gaeguli_rendition_router_remove_caller
+                                                (GaeguliRenditionRouter *self,
+                                                 gint                    srtsocket);
+
+void                     gaeguli_rendition_router_update
+                                                (GaeguliRenditionRouter *self,
+                                                 const GstStructure     *stats,
+                                                 guint                   max_bitrate);
+
+void                     gaeguli_rendition_router_limit
+                                                (GaeguliRenditionRouter *self,
+                                                 guint                   n_renditions);
+
+guint                    gaeguli_rendition_router_get_n_renditions
+                                                (GaeguliRenditionRouter *self);
+
+guint                    gaeguli_rendition_router_get_bitrate
+                                                (GaeguliRenditionRouter *self,
+                                                 guint                   rendition);
+
+void                     gaeguli_rendition_router_set_caps
+                                                (GaeguliRenditionRouter *self,
+                                                 guint                   rendition,
+                                                 const GstCaps          *caps);
+
+gboolean                 gaeguli_rendition_router_push
+                                                (GaeguliRenditionRouter *self,
+                                                 guint                   rendition,
+                                                 GstBuffer              *buffer);
+
+void                     gaeguli_rendition_router_set_send_func
+                                                (GaeguliRenditionRouter *self,
+                                                 GaeguliRenditionRouterSendFunc func,
+                                                 gpointer                user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GaeguliRenditionRouter,
+    gaeguli_rendition_router_free)
+
+G_END_DECLS
+
+#endif // __GAEGULI_RENDITION_ROUTER_H__
@@ -0,0 +1,396 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "statspoller.h"
+
+#include <srt/srt.h>
+
+/* Sinks due within this many microseconds are read in the same batch. */
+#define BATCH_SLACK_US          1000
+
+typedef struct
+{
+  gint ref_count;
+
+  guint id;
+  GstElement *srtsink;
+  guint interval_ms;
+  gint64 next_poll;
+
+  GMainContext *context;
+  GaeguliStatsPollerFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  /* Delivery scheduled in context, but not dispatched yet. */
+  GSource *pending;
+  GstStructure *snapshot;
+} PollEntry;
+
+typedef struct
+{
+  guint id;
+  GstElement *srtsink;
+  GstStructure *stats;
+} PollResult;
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  GThread *thread;
+
+  GHashTable *entries;
+  guint last_id;
+} GaeguliStatsPoller;
+
+static GaeguliStatsPoller poller;
+
+static PollEntry *
+_poll_entry_ref (PollEntry * entry)
+{
+  g_atomic_int_inc (&entry->ref_count);
+
+  return entry;
+}
+
+static void
+_poll_entry_unref (PollEntry * entry)
+{
+  if (g_atomic_int_dec_and_test (&entry->ref_count)) {
+    if (entry->notify) {
+      entry->notify (entry->user_data);
+    }
+    gst_clear_structure (&entry->snapshot);
+    gst_object_unref (entry->srtsink);
+    g_main_context_unref (entry->context);
+
+    g_free (entry);
+  }
+}
+
+static void
+_poll_entry_cancel (PollEntry * entry)
+{
+  if (entry->pending) {
+    g_source_destroy (entry->pending);
+    g_clear_pointer (&entry->pending, g_source_unref);
+  }
+  gst_clear_structure (&entry->snapshot);
+}
+
+static gboolean
+_deliver_snapshot (gpointer user_data)
+{
+  guint id = GPOINTER_TO_UINT (user_data);
+  g_autoptr (GstStructure) snapshot = NULL;
+  PollEntry *entry;
+
+  g_mutex_lock (&poller.lock);
+  entry = g_hash_table_lookup (poller.entries, user_data);
+  if (entry) {
+    snapshot = g_steal_pointer (&entry->snapshot);
+    g_clear_pointer (&entry->pending, g_source_unref);
+    /* Keeps user_data alive should the entry get removed from another
+     * thread during the callback. */
+    _poll_entry_ref (entry);
+  }
+  g_mutex_unlock (&poller.lock);
+
+  if (!entry) {
+    g_debug ("Stats poll entry %u removed before delivery", id);
+    return G_SOURCE_REMOVE;
+  }
+
+  if (snapshot) {
+    entry->func (snapshot, entry->user_data);
+  }
+
+  _poll_entry_unref (entry);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * srtsink doesn't report how much data waits in the sockets' send buffers.
+ * Asks SRT directly and adds "send-buffer-ms", "send-buffer-bytes" and
+ * "send-buffer-packets" to the stats of each connected socket in @stats.
+ */
+void
+gaeguli_srt_stats_add_send_buffer (GstStructure * stats)
+{
+  const GValue *callers = gst_structure_get_value (stats, "callers");
+  gint socket;
+
+  if (gst_structure_get_int (stats, "socket", &socket) && socket > 0) {
+    SRT_TRACEBSTATS perf;
+
+    if (srt_bstats (socket, &perf, 0) != SRT_ERROR) {
+      gst_structure_set (stats,
+          "send-buffer-ms", G_TYPE_INT, MAX (perf.msSndBuf, 0),
+          "send-buffer-bytes", G_TYPE_INT, MAX (perf.byteSndBuf, 0),
+          "send-buffer-packets", G_TYPE_INT, MAX (perf.pktSndBuf, 0), NULL);
+    }
+  }
+
+  if (callers && G_VALUE_HOLDS (callers, G_TYPE_VALUE_ARRAY)) {
+    GValueArray *array = g_value_get_boxed (callers);
+    guint i;
+
+    for (i = 0; array && i < array->n_values; ++i) {
+      GstStructure *caller = g_value_get_boxed (&array->values[i]);
+
+      if (caller) {
+        gaeguli_srt_stats_add_send_buffer (caller);
+      }
+    }
+  }
+}
+
+/* Called with the lock held. */
+static void
+_schedule_delivery (PollEntry * entry, GstStructure * stats)
+{
+  if (entry->pending) {
+    /* The previous snapshot hasn't been dispatched yet; replace it. */
+    gst_structure_free (entry->snapshot);
+    entry->snapshot = stats;
+    return;
+  }
+
+  entry->snapshot = stats;
+  entry->pending = g_idle_source_new ();
+  g_source_set_priority (entry->pending, G_PRIORITY_DEFAULT);
+  g_source_set_callback (entry->pending, _deliver_snapshot,
+      GUINT_TO_POINTER (entry->id), NULL);
+  g_source_attach (entry->pending, entry->context);
+}
+
+static gpointer
+_poller_thread_func (gpointer data)
+{
+  g_mutex_lock (&poller.lock);
+
+  for (;;) {
+    g_autoptr (GArray) batch = g_array_new (FALSE, FALSE, sizeof (PollResult));
+    gint64 now = g_get_monotonic_time ();
+    gint64 next_poll = G_MAXINT64;
+    GHashTableIter it;
+    PollEntry *entry;
+    guint i;
+
+    g_hash_table_iter_init (&it, poller.entries);
+    while (g_hash_table_iter_next (&it, NULL, (gpointer *) & entry)) {
+      if (entry->next_poll <= now + BATCH_SLACK_US) {
+        PollResult result = { 0 };
+
+        result.id = entry->id;
+        result.srtsink = gst_object_ref (entry->srtsink);
+        g_array_append_val (batch, result);
+        entry->next_poll = MAX (entry->next_poll +
+            entry->interval_ms * G_TIME_SPAN_MILLISECOND, now);
+      }
+      next_poll = MIN (next_poll, entry->next_poll);
+    }
+
+    if (batch->len == 0) {
+      if (next_poll == G_MAXINT64) {
+        g_cond_wait (&poller.cond, &poller.lock);
+      } else {
+        g_cond_wait_until (&poller.cond, &poller.lock, next_poll);
+      }
+      continue;
+    }
+
+    /* Reading the stats locks the sink's SRT sockets; don't block
+     * registrations meanwhile. */
+    g_mutex_unlock (&poller.lock);
+
+    for (i = 0; i < batch->len; ++i) {
+      PollResult *result = &g_array_index (batch, PollResult, i);
+      guint j;
+
+      /* Entries of the same sink due in this batch share one reading. */
+      for (j = 0; j < i; ++j) {
+        PollResult *other = &g_array_index (batch, PollResult, j);
+
+        if (other->srtsink == result->srtsink) {
+          if (other->stats) {
+            result->stats = gst_structure_copy (other->stats);
+          }
+          break;
+        }
+      }
+
+      if (j == i) {
+        g_object_get (result->srtsink, "stats", &result->stats, NULL);
+        /* Off the main thread, the extra SRT calls don't hurt anyone. */
+        if (result->stats) {
+          gaeguli_srt_stats_add_send_buffer (result->stats);
+        }
+      }
+    }
+
+    for (i = 0; i < batch->len; ++i) {
+      gst_object_unref (g_array_index (batch, PollResult, i).srtsink);
+    }
+
+    g_mutex_lock (&poller.lock);
+
+    for (i = 0; i < batch->len; ++i) {
+      PollResult *result = &g_array_index (batch, PollResult, i);
+
+      entry = g_hash_table_lookup (poller.entries,
+          GUINT_TO_POINTER (result->id));
+
+      if (entry && result->stats && gst_structure_n_fields (result->stats)) {
+        _schedule_delivery (entry, g_steal_pointer (&result->stats));
+      } else {
+        gst_clear_structure (&result->stats);
+      }
+    }
+  }
+
+  g_mutex_unlock (&poller.lock);
+
+  return NULL;
+}
+
+static void
+gaeguli_stats_poller_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    g_mutex_init (&poller.lock);
+    g_cond_init (&poller.cond);
+    poller.entries = g_hash_table_new (NULL, NULL);
+    /* The thread lives as long as the library; it sleeps while there's
+     * nothing to poll. */
+    poller.thread = g_thread_new ("gaeguli-stats", _poller_thread_func, NULL);
+
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+/*
+ * Starts polling @srtsink every @interval_ms milliseconds. @func is invoked in
+ * @context with a snapshot of the stats, which is owned by the poller and
+ * must not be modified.
+ *
+ * Returns: an id to pass to gaeguli_stats_poller_remove().
+ */
+guint
+gaeguli_stats_poller_add (GstElement * srtsink, guint interval_ms,
+    GMainContext * context, GaeguliStatsPollerFunc func, gpointer user_data)
+{
+  return gaeguli_stats_poller_add_full (srtsink, interval_ms, context, func,
+      user_data, NULL);
+}
+
+/*
+ * Like gaeguli_stats_poller_add(), but calls @notify on @user_data once the
+ * entry is removed and no callback runs anymore, whichever thread removed it.
+ */
+guint
+gaeguli_stats_poller_add_full (GstElement * srtsink, guint interval_ms,
+    GMainContext * context, GaeguliStatsPollerFunc func, gpointer user_data,
+    GDestroyNotify notify)
+{
+  PollEntry *entry;
+
+  g_return_val_if_fail (GST_IS_ELEMENT (srtsink), 0);
+  g_return_val_if_fail (interval_ms > 0, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  gaeguli_stats_poller_init ();
+
+  entry = g_new0 (PollEntry, 1);
+  entry->ref_count = 1;
+  entry->srtsink = gst_object_ref (srtsink);
+  entry->interval_ms = interval_ms;
+  entry->next_poll = g_get_monotonic_time ();
+  entry->context = context ? g_main_context_ref (context) :
+      g_main_context_ref_thread_default ();
+  entry->func = func;
+  entry->user_data = user_data;
+  entry->notify = notify;
+
+  g_mutex_lock (&poller.lock);
+
+  do {
+    entry->id = ++poller.last_id;
+  } while (entry->id == 0 ||
+      g_hash_table_contains (poller.entries, GUINT_TO_POINTER (entry->id)));
+
+  g_hash_table_insert (poller.entries, GUINT_TO_POINTER (entry->id), entry);
+  g_cond_signal (&poller.cond);
+
+  g_mutex_unlock (&poller.lock);
+
+  return entry->id;
+}
+
+void
+gaeguli_stats_poller_set_interval (guint id, guint interval_ms)
+{
+  PollEntry *entry;
+
+  g_return_if_fail (interval_ms > 0);
+
+  gaeguli_stats_poller_init ();
+
+  g_mutex_lock (&poller.lock);
+
+  entry = g_hash_table_lookup (poller.entries, GUINT_TO_POINTER (id));
+  if (entry) {
+    entry->interval_ms = interval_ms;
+    entry->next_poll = MIN (entry->next_poll,
+        g_get_monotonic_time () + interval_ms * G_TIME_SPAN_MILLISECOND);
+    g_cond_signal (&poller.cond);
+  }
+
+  g_mutex_unlock (&poller.lock);
+}
+
+/*
+ * Stops polling. Once this returns, the entry's callback won't be invoked
+ * again, provided it's called from the thread owning the delivery context.
+ */
+void
+gaeguli_stats_poller_remove (guint id)
+{
+  PollEntry *entry;
+
+  gaeguli_stats_poller_init ();
+
+  g_mutex_lock (&poller.lock);
+  entry = g_hash_table_lookup (poller.entries, GUINT_TO_POINTER (id));
+  if (entry) {
+    g_hash_table_remove (poller.entries, GUINT_TO_POINTER (id));
+    _poll_entry_cancel (entry);
+  }
+  g_mutex_unlock (&poller.lock);
+
+  /* The destroy notify runs outside the lock; it may well remove other
+   * entries. */
+  if (entry) {
+    _poll_entry_unref (entry);
+  }
+}
@@ -0,0 +1,84 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_STATS_POLLER_H__
+#define __GAEGULI_STATS_POLLER_H__
+
+#include <gst/gst.h>
+#include <gaeguli/target.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The stats poller reads "stats" of registered SRT sinks from a single
+ * library-owned thread, so that collecting statistics of many targets doesn't
+ * load the application's main loop. Sinks due at the same tick are read in
+ * one batch. Each snapshot is then handed to its callback in the main context
+ * given at registration. When the context doesn't keep up, only the latest
+ * pending snapshot is delivered. Entries of the same sink that fall due
+ * together share a single reading.
+ *
+ * Besides srtsink's own fields, the snapshots of connected sockets carry
+ * "send-buffer-ms", "send-buffer-bytes" and "send-buffer-packets", the
+ * amount of data waiting in SRT's send buffer.
+ */
+
+typedef void (*GaeguliStatsPollerFunc) (const GstStructure * stats,
+    gpointer user_data);
+
+guint                    gaeguli_stats_poller_add
+                                                (GstElement             *srtsink,
+                                                 guint                   interval_ms,
+                                                 GMainContext           *context,
+                                                 GaeguliStatsPollerFunc  func,
+                                                 gpointer                user_data);
+
+guint                    gaeguli_stats_poller_add_full
+                                                (GstElement             *srtsink,
+                                                 guint                   interval_ms,
+                                                 GMainContext           *context,
+                                                 GaeguliStatsPollerFunc  func,
+                                                 gpointer                user_data,
+                                                 GDestroyNotify          notify);
+
+void                     gaeguli_stats_poller_set_interval
+                                                (guint                   id,
+                                                 guint                   interval_ms);
+
+void                     gaeguli_stats_poller_remove
+                                                (guint                   id);
+
+void                     gaeguli_srt_stats_add_send_buffer
+                                                (GstStructure           *stats);
+
+guint                    gaeguli_target_add_stats_poll
+                                                (GaeguliTarget          *self,
+                                                 guint                   interval_ms,
+                                                 GMainContext           *context,
+                                                 GaeguliStatsPollerFunc  func,
+                                                 gpointer                user_data,
+                                                 GDestroyNotify          notify);
+
+void                     gaeguli_target_fill_stats
+                                                (GaeguliTarget          *self,
+                                                 const GstStructure     *s,
+                                                 GaeguliTargetStats     *stats,
+                                                 GArray                 *callers);
+
+G_END_DECLS
+
+#endif // __GAEGULI_STATS_POLLER_H__
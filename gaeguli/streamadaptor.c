@@ -17,6 +17,8 @@
  */
 
 #include "streamadaptor.h"
+#include "enumtypes.h"
+#include "statspoller.h"
 
 #include <gst/gstelement.h>
 
@@ -25,8 +27,9 @@ typedef struct
   GstElement *srtsink;
   GstStructure *baseline_parameters;
   guint stats_interval;
-  guint stats_timeout_id;
-  gboolean stream_quality_dropped;
+  guint stats_poll_id;
+  GMainContext *context;
+  GaeguliStreamQualityReason quality_drop_reason;
 } GaeguliStreamAdaptorPrivate;
 
 /* *INDENT-OFF* */
@@ -39,6 +42,7 @@ enum
   PROP_SRTSINK = 1,
   PROP_BASELINE_PARAMETERS,
   PROP_STATS_INTERVAL,
+  PROP_MAIN_CONTEXT,
   PROP_ENABLED,
 };
 
@@ -54,27 +58,12 @@ enum
 static guint signals[LAST_SIGNAL] = { 0 };
 
 static void
-gaeguli_stream_adaptor_collect_stats (GaeguliStreamAdaptor * self)
+_stats_collected (const GstStructure * stats, gpointer user_data)
 {
-  GaeguliStreamAdaptorPrivate *priv =
-      gaeguli_stream_adaptor_get_instance_private (self);
-  GaeguliStreamAdaptorClass *klass = GAEGULI_STREAM_ADAPTOR_GET_CLASS (self);
-
-  g_autoptr (GstStructure) s = NULL;
-
-  g_object_get (priv->srtsink, "stats", &s, NULL);
+  GaeguliStreamAdaptor *self = user_data;
 
-  if (gst_structure_n_fields (s) != 0) {
-    klass->on_stats (self, s);
-  }
-}
-
-gboolean
-_stats_collection_timeout (gpointer user_data)
-{
-  gaeguli_stream_adaptor_collect_stats (user_data);
-
-  return G_SOURCE_CONTINUE;
+  GAEGULI_STREAM_ADAPTOR_GET_CLASS (self)->on_stats (self,
+      (GstStructure *) stats);
 }
 
 static void
@@ -83,9 +72,17 @@ gaeguli_stream_adaptor_start_timer (GaeguliStreamAdaptor * self)
   GaeguliStreamAdaptorPrivate *priv =
       gaeguli_stream_adaptor_get_instance_private (self);
 
+  if (priv->stats_poll_id != 0) {
+    return;
+  }
+
   if (GAEGULI_STREAM_ADAPTOR_GET_CLASS (self)->on_stats) {
-    priv->stats_timeout_id =
-        g_timeout_add (priv->stats_interval, _stats_collection_timeout, self);
+    if (!priv->context) {
+      priv->context = g_main_context_ref_thread_default ();
+    }
+
+    priv->stats_poll_id = gaeguli_stats_poller_add (priv->srtsink,
+        priv->stats_interval, priv->context, _stats_collected, self);
   }
 }
 
@@ -95,7 +92,7 @@ gaeguli_stream_adaptor_stop_timer (GaeguliStreamAdaptor * self)
   GaeguliStreamAdaptorPrivate *priv =
       gaeguli_stream_adaptor_get_instance_private (self);
 
-  g_clear_handle_id (&priv->stats_timeout_id, g_source_remove);
+  g_clear_handle_id (&priv->stats_poll_id, gaeguli_stats_poller_remove);
 }
 
 static gboolean
@@ -143,6 +140,80 @@ _check_quality_drop (const GstStructure * base_params,
   return FALSE;
 }
 
+static gboolean
+_check_frame_drop (const GstStructure * params, const gchar * name,
+    guint min_dropping)
+{
+  guint val;
+
+  return gst_structure_get_uint (params, name, &val) && val >= min_dropping;
+}
+
+static gboolean
+_check_resolution_drop (const GstStructure * base_params,
+    const GstStructure * params)
+{
+  guint base_width, base_height;
+  guint width, height;
+
+  if (gst_structure_get_uint (base_params, GAEGULI_ENCODING_PARAMETER_WIDTH,
+          &base_width)
+      && gst_structure_get_uint (base_params,
+          GAEGULI_ENCODING_PARAMETER_HEIGHT, &base_height)
+      && gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_WIDTH,
+          &width)
+      && gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_HEIGHT,
+          &height)) {
+    return width > 0 && height > 0 &&
+        (guint64) width * height < (guint64) base_width * base_height;
+  }
+  return FALSE;
+}
+
+static gboolean
+_check_framerate_drop (const GstStructure * base_params,
+    const GstStructure * params)
+{
+  guint base_framerate = 0;
+  guint framerate;
+
+  if (!gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_FRAMERATE,
+          &framerate) || framerate == 0) {
+    return FALSE;
+  }
+
+  /* Any limit is lower than following the source. */
+  gst_structure_get_uint (base_params, GAEGULI_ENCODING_PARAMETER_FRAMERATE,
+      &base_framerate);
+
+  return base_framerate == 0 || framerate < base_framerate;
+}
+
+/* The most severe way params degrade the stream compared to the baseline. */
+static GaeguliStreamQualityReason
+_get_quality_drop_reason (const GstStructure * base_params,
+    const GstStructure * params)
+{
+  if (_check_frame_drop (params, GAEGULI_ENCODING_PARAMETER_FRAMERATE_DIVISOR,
+          2) || _check_framerate_drop (base_params, params)) {
+    return GAEGULI_STREAM_QUALITY_REASON_FRAMERATE;
+  }
+  if (_check_frame_drop (params, GAEGULI_ENCODING_PARAMETER_FRAME_SKIP, 1)) {
+    return GAEGULI_STREAM_QUALITY_REASON_FRAME_SKIP;
+  }
+  if (_check_resolution_drop (base_params, params)) {
+    return GAEGULI_STREAM_QUALITY_REASON_RESOLUTION;
+  }
+  if (_check_quality_drop (base_params, params)) {
+    return GAEGULI_STREAM_QUALITY_REASON_QUANTIZER;
+  }
+  if (_check_bitrate_drop (base_params, params)) {
+    return GAEGULI_STREAM_QUALITY_REASON_BITRATE;
+  }
+
+  return GAEGULI_STREAM_QUALITY_REASON_NONE;
+}
+
 static void
 _notify_stream_quality_changes (GaeguliStreamAdaptor
     * self, const GstStructure * params)
@@ -151,21 +222,23 @@ _notify_stream_quality_changes (GaeguliStreamAdaptor
       gaeguli_stream_adaptor_get_instance_private (self);
   const GstStructure *base_params =
       gaeguli_stream_adaptor_get_baseline_parameters (self);
+  GaeguliStreamQualityReason reason;
+  GaeguliStreamQualityReason previous;
 
   if (!base_params || !params)
     return;
 
-  if (_check_bitrate_drop (base_params, params) ||
-      (_check_quality_drop (base_params, params))) {
-    if (!priv->stream_quality_dropped) {
-      priv->stream_quality_dropped = !priv->stream_quality_dropped;
-      g_signal_emit (self, signals[SIG_STREAM_QUALITY_DROPPED], 0, params);
-    }
-  } else {
-    if (priv->stream_quality_dropped) {
-      priv->stream_quality_dropped = !priv->stream_quality_dropped;
-      g_signal_emit (self, signals[SIG_STREAM_QUALITY_REGAINED], 0, params);
-    }
+  reason = _get_quality_drop_reason (base_params, params);
+  previous = priv->quality_drop_reason;
+  priv->quality_drop_reason = reason;
+
+  if (reason > previous) {
+    /* Also when the stream degrades further, e.g. from a lower bitrate to
+     * dropping frames. */
+    g_signal_emit (self, signals[SIG_STREAM_QUALITY_DROPPED], 0, reason);
+  } else if (reason == GAEGULI_STREAM_QUALITY_REASON_NONE &&
+      previous != GAEGULI_STREAM_QUALITY_REASON_NONE) {
+    g_signal_emit (self, signals[SIG_STREAM_QUALITY_REGAINED], 0);
   }
 }
 
@@ -186,7 +259,27 @@ gaeguli_stream_adaptor_set_stats_interval (GaeguliStreamAdaptor * self,
 
   priv->stats_interval = ms;
 
-  if (priv->stats_timeout_id != 0) {
+  if (priv->stats_poll_id != 0) {
+    gaeguli_stats_poller_set_interval (priv->stats_poll_id, ms);
+  }
+}
+
+static void
+gaeguli_stream_adaptor_set_main_context (GaeguliStreamAdaptor * self,
+    GMainContext * context)
+{
+  GaeguliStreamAdaptorPrivate *priv =
+      gaeguli_stream_adaptor_get_instance_private (self);
+
+  if (!context) {
+    return;
+  }
+
+  g_clear_pointer (&priv->context, g_main_context_unref);
+  priv->context = g_main_context_ref (context);
+
+  /* "enabled" may have been set first; deliver into the new context. */
+  if (priv->stats_poll_id != 0) {
     gaeguli_stream_adaptor_stop_timer (self);
     gaeguli_stream_adaptor_start_timer (self);
   }
@@ -198,7 +291,7 @@ gaeguli_stream_adaptor_is_enabled (GaeguliStreamAdaptor * self)
   GaeguliStreamAdaptorPrivate *priv =
       gaeguli_stream_adaptor_get_instance_private (self);
 
-  return priv->stats_timeout_id != 0;
+  return priv->stats_poll_id != 0;
 }
 
 const GstStructure *
@@ -270,6 +363,9 @@ gaeguli_stream_adaptor_set_property (GObject * object, guint property_id,
       gaeguli_stream_adaptor_set_stats_interval (self,
           g_value_get_uint (value));
       break;
+    case PROP_MAIN_CONTEXT:
+      gaeguli_stream_adaptor_set_main_context (self, g_value_get_boxed (value));
+      break;
     case PROP_ENABLED:
       if (g_value_get_boolean (value)) {
         GaeguliStreamAdaptorClass *klass =
@@ -280,7 +376,7 @@ gaeguli_stream_adaptor_set_property (GObject * object, guint property_id,
         if (klass->on_enabled) {
           klass->on_enabled (self);
         }
-      } else if (priv->stats_timeout_id) {
+      } else if (priv->stats_poll_id) {
         gaeguli_stream_adaptor_stop_timer (self);
 
         /* Revert encoder settings into their initial state. */
@@ -311,6 +407,9 @@ gaeguli_stream_adaptor_get_property (GObject * object, guint property_id,
     case PROP_STATS_INTERVAL:
       g_value_set_uint (value, priv->stats_interval);
       break;
+    case PROP_MAIN_CONTEXT:
+      g_value_set_boxed (value, priv->context);
+      break;
     case PROP_ENABLED:
       g_value_set_boolean (value, gaeguli_stream_adaptor_is_enabled (self));
       break;
@@ -329,6 +428,7 @@ gaeguli_stream_adaptor_dispose (GObject * object)
   gaeguli_stream_adaptor_stop_timer (self);
   gst_clear_object (&priv->srtsink);
   gst_clear_structure (&priv->baseline_parameters);
+  g_clear_pointer (&priv->context, g_main_context_unref);
 
   G_OBJECT_CLASS (gaeguli_stream_adaptor_parent_class)->dispose (object);
 }
@@ -358,6 +458,13 @@ gaeguli_stream_adaptor_class_init (GaeguliStreamAdaptorClass * klass)
           "Statistics collection interval in milliseconds", 1, G_MAXUINT, 10,
           G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_MAIN_CONTEXT,
+      g_param_spec_boxed ("main-context", "Main context",
+          "Main context in which the adaptor receives statistics collected by "
+          "the library's stats thread. Defaults to the thread-default main "
+          "context at the time the adaptor gets enabled", G_TYPE_MAIN_CONTEXT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (gobject_class, PROP_ENABLED,
       g_param_spec_boolean ("enabled", "Turns stream adaptor on or off",
           "Turns stream adaptor on or off", TRUE,
@@ -370,7 +477,8 @@ gaeguli_stream_adaptor_class_init (GaeguliStreamAdaptorClass * klass)
 
   signals[SIG_STREAM_QUALITY_DROPPED] =
       g_signal_new ("stream-quality-dropped", G_TYPE_FROM_CLASS (klass),
-      G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 1,
+      GAEGULI_TYPE_STREAM_QUALITY_REASON);
 
   signals[SIG_STREAM_QUALITY_REGAINED] =
       g_signal_new ("stream-quality-regained", G_TYPE_FROM_CLASS (klass),
@@ -33,6 +33,15 @@ G_BEGIN_DECLS
 #define GAEGULI_ENCODING_PARAMETER_QUANTIZER "quantizer"
 /* Rate control mode from GaeguliRateControlMode */
 #define GAEGULI_ENCODING_PARAMETER_RATECTRL "bitrate-control"
+/* Encoded picture size in pixels */
+#define GAEGULI_ENCODING_PARAMETER_WIDTH "width"
+#define GAEGULI_ENCODING_PARAMETER_HEIGHT "height"
+/* Maximum frames per second to encode; 0 follows the video source */
+#define GAEGULI_ENCODING_PARAMETER_FRAMERATE "framerate"
+/* Drop one of every N frames before the encoder; 0 keeps all frames */
+#define GAEGULI_ENCODING_PARAMETER_FRAME_SKIP "frame-skip"
+/* Encode only every Nth frame; 0 or 1 keeps the full framerate */
+#define GAEGULI_ENCODING_PARAMETER_FRAMERATE_DIVISOR "framerate-divisor"
 
 #define GAEGULI_TYPE_STREAM_ADAPTOR   (gaeguli_stream_adaptor_get_type ())
 G_DECLARE_DERIVABLE_TYPE (GaeguliStreamAdaptor, gaeguli_stream_adaptor, GAEGULI,
@@ -0,0 +1,366 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+
+#include "streamsplicer.h"
+
+#define TS_PACKET_SIZE          188
+#define TS_NULL_PID             0x1fff
+#define RTP_HEADER_SIZE         12
+#define RTP_CLOCK_RATE          90000
+
+typedef struct
+{
+  guint16 pid;
+  guint8 last_cc;
+  guint8 offset;
+  /* The next packet comes from a new source. */
+  gboolean resync;
+  gboolean seen_pcr;
+  gboolean mark_pcr;
+} PidState;
+
+struct _GaeguliStreamSplicer
+{
+  GMutex lock;
+
+  GaeguliVideoStreamType stream_type;
+  gconstpointer source;
+
+  /* MPEG-TS */
+  GArray *pids;
+
+  /* RTP */
+  gboolean have_rtp;
+  gboolean rtp_resync;
+  guint32 ssrc;
+  guint16 last_seq;
+  guint16 seq_offset;
+  guint32 last_ts;
+  guint32 ts_offset;
+  GstClockTime last_pts;
+
+  GstCaps *caps;
+  gconstpointer caps_source;
+};
+
+/* Caps fields that change with every muxer instance. */
+static const gchar *spliced_caps_fields[] = {
+  "streamheader", "ssrc", "timestamp-offset", "seqnum-offset", NULL
+};
+
+GaeguliStreamSplicer *
+gaeguli_stream_splicer_new (GaeguliVideoStreamType stream_type)
+{
+  GaeguliStreamSplicer *self = g_new0 (GaeguliStreamSplicer, 1);
+
+  g_mutex_init (&self->lock);
+  self->stream_type = stream_type;
+  self->pids = g_array_new (FALSE, FALSE, sizeof (PidState));
+  self->last_pts = GST_CLOCK_TIME_NONE;
+
+  return self;
+}
+
+void
+gaeguli_stream_splicer_free (GaeguliStreamSplicer * self)
+{
+  g_array_unref (self->pids);
+  gst_clear_caps (&self->caps);
+  g_mutex_clear (&self->lock);
+
+  g_free (self);
+}
+
+static PidState *
+_get_pid_state (GaeguliStreamSplicer * self, guint16 pid)
+{
+  PidState state = { 0 };
+  guint i;
+
+  for (i = 0; i < self->pids->len; ++i) {
+    PidState *s = &g_array_index (self->pids, PidState, i);
+
+    if (s->pid == pid) {
+      return s;
+    }
+  }
+
+  /* A PID first seen after a switch has nothing to continue. */
+  state.pid = pid;
+  g_array_append_val (self->pids, state);
+
+  return &g_array_index (self->pids, PidState, self->pids->len - 1);
+}
+
+static void
+_set_source (GaeguliStreamSplicer * self, gconstpointer source)
+{
+  guint i;
+
+  if (source == self->source) {
+    return;
+  }
+
+  if (self->source) {
+    for (i = 0; i < self->pids->len; ++i) {
+      PidState *s = &g_array_index (self->pids, PidState, i);
+
+      s->resync = TRUE;
+      s->mark_pcr = s->seen_pcr;
+    }
+    self->rtp_resync = self->have_rtp;
+  }
+
+  self->source = source;
+}
+
+static GstBuffer *
+_splice_ts (GaeguliStreamSplicer * self, GstBuffer * buffer)
+{
+  GstMapInfo map;
+  gboolean writable = FALSE;
+  gsize offset;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    return buffer;
+  }
+
+  for (offset = 0; offset + TS_PACKET_SIZE <= map.size;
+      offset += TS_PACKET_SIZE) {
+    const guint8 *packet = map.data + offset;
+    guint16 pid = ((packet[1] & 0x1f) << 8) | packet[2];
+    guint8 cc = packet[3] & 0x0f;
+    gboolean has_payload = packet[3] & 0x10;
+    gboolean has_pcr = (packet[3] & 0x20) && packet[4] > 0 &&
+        (packet[5] & 0x10);
+    gboolean mark;
+    PidState *state;
+
+    if (packet[0] != 0x47) {
+      /* Lost sync; leave the rest as it is. */
+      break;
+    }
+
+    if (pid == TS_NULL_PID) {
+      continue;
+    }
+
+    state = _get_pid_state (self, pid);
+    if (state->resync) {
+      guint8 expected = has_payload ? state->last_cc + 1 : state->last_cc;
+
+      state->offset = (expected - cc) & 0x0f;
+      state->resync = FALSE;
+    }
+    state->last_cc = (cc + state->offset) & 0x0f;
+
+    mark = has_pcr && state->mark_pcr;
+    if (has_pcr) {
+      state->seen_pcr = TRUE;
+      state->mark_pcr = FALSE;
+    }
+
+    if (state->last_cc == cc && !mark) {
+      continue;
+    }
+
+    if (!writable) {
+      /* Other branches of a tee hold the same buffer. */
+      gst_buffer_unmap (buffer, &map);
+      buffer = gst_buffer_make_writable (buffer);
+      if (!gst_buffer_map (buffer, &map, GST_MAP_READWRITE)) {
+        return buffer;
+      }
+      writable = TRUE;
+    }
+
+    map.data[offset + 3] = (map.data[offset + 3] & 0xf0) | state->last_cc;
+    if (mark) {
+      map.data[offset + 5] |= 0x80;
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+static GstBuffer *
+_splice_rtp (GaeguliStreamSplicer * self, GstBuffer * buffer)
+{
+  GstMapInfo map;
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  guint32 ssrc;
+  guint16 seq;
+  guint32 ts;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    return buffer;
+  }
+
+  if (map.size < RTP_HEADER_SIZE || (map.data[0] >> 6) != 2) {
+    gst_buffer_unmap (buffer, &map);
+    return buffer;
+  }
+
+  seq = GST_READ_UINT16_BE (map.data + 2);
+  ts = GST_READ_UINT32_BE (map.data + 4);
+  ssrc = GST_READ_UINT32_BE (map.data + 8);
+
+  gst_buffer_unmap (buffer, &map);
+
+  if (!self->have_rtp) {
+    self->ssrc = ssrc;
+    self->have_rtp = TRUE;
+  } else if (self->rtp_resync) {
+    self->seq_offset = self->last_seq + 1 - seq;
+    /* Timestamps advance with the time that passed since the last packet of
+     * the previous source. */
+    self->ts_offset = self->last_ts - ts;
+    if (GST_CLOCK_TIME_IS_VALID (pts) &&
+        GST_CLOCK_TIME_IS_VALID (self->last_pts) && pts > self->last_pts) {
+      self->ts_offset += gst_util_uint64_scale_int (pts - self->last_pts,
+          RTP_CLOCK_RATE, GST_SECOND);
+    }
+    self->rtp_resync = FALSE;
+  }
+
+  self->last_seq = seq + self->seq_offset;
+  self->last_ts = ts + self->ts_offset;
+  if (GST_CLOCK_TIME_IS_VALID (pts)) {
+    self->last_pts = pts;
+  }
+
+  if (ssrc == self->ssrc && self->last_seq == seq && self->last_ts == ts) {
+    return buffer;
+  }
+
+  buffer = gst_buffer_make_writable (buffer);
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READWRITE)) {
+    return buffer;
+  }
+
+  GST_WRITE_UINT16_BE (map.data + 2, self->last_seq);
+  GST_WRITE_UINT32_BE (map.data + 4, self->last_ts);
+  GST_WRITE_UINT32_BE (map.data + 8, self->ssrc);
+
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+static GstBuffer *
+gaeguli_stream_splicer_process_unlocked (GaeguliStreamSplicer * self,
+    gconstpointer source, GstBuffer * buffer)
+{
+  _set_source (self, source);
+
+  switch (self->stream_type) {
+    case GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS:
+      return _splice_ts (self, buffer);
+    case GAEGULI_VIDEO_STREAM_TYPE_RTP:
+      return _splice_rtp (self, buffer);
+    default:
+      return buffer;
+  }
+}
+
+/*
+ * Takes ownership of @buffer coming from @source and returns it with its
+ * headers rewritten to continue the spliced stream. The result may be a
+ * copy.
+ */
+GstBuffer *
+gaeguli_stream_splicer_process (GaeguliStreamSplicer * self,
+    gconstpointer source, GstBuffer * buffer)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  return gaeguli_stream_splicer_process_unlocked (self, source, buffer);
+}
+
+/* Like gaeguli_stream_splicer_process(), for each buffer of @list. */
+GstBufferList *
+gaeguli_stream_splicer_process_list (GaeguliStreamSplicer * self,
+    gconstpointer source, GstBufferList * list)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+  guint i;
+
+  for (i = 0; i < gst_buffer_list_length (list); ++i) {
+    GstBuffer *buffer = gst_buffer_list_get (list, i);
+    GstBuffer *result;
+
+    result = gaeguli_stream_splicer_process_unlocked (self, source,
+        gst_buffer_ref (buffer));
+
+    if (result == buffer) {
+      gst_buffer_unref (result);
+      continue;
+    }
+
+    list = gst_buffer_list_make_writable (list);
+    gst_buffer_list_remove (list, i, 1);
+    gst_buffer_list_insert (list, i, result);
+  }
+
+  return list;
+}
+
+/*
+ * Takes ownership of @caps coming from @source. Caps of any source but the
+ * first one get the fields specific to a muxer instance replaced with those
+ * of the first source.
+ */
+GstCaps *
+gaeguli_stream_splicer_process_caps (GaeguliStreamSplicer * self,
+    gconstpointer source, GstCaps * caps)
+{
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+  const GstStructure *first;
+  GstStructure *s;
+  guint i;
+
+  if (self->caps == NULL || source == self->caps_source) {
+    gst_caps_replace (&self->caps, caps);
+    self->caps_source = source;
+    return caps;
+  }
+
+  if (gst_caps_get_size (self->caps) == 0 || gst_caps_get_size (caps) == 0) {
+    return caps;
+  }
+
+  first = gst_caps_get_structure (self->caps, 0);
+  caps = gst_caps_make_writable (caps);
+  s = gst_caps_get_structure (caps, 0);
+
+  for (i = 0; spliced_caps_fields[i]; ++i) {
+    const GValue *value = gst_structure_get_value (first,
+        spliced_caps_fields[i]);
+
+    if (value) {
+      gst_structure_set_value (s, spliced_caps_fields[i], value);
+    } else {
+      gst_structure_remove_field (s, spliced_caps_fields[i]);
+    }
+  }
+
+  return caps;
+}
@@ -0,0 +1,70 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __GAEGULI_STREAM_SPLICER_H__
+#define __GAEGULI_STREAM_SPLICER_H__
+
+#include <gst/gst.h>
+#include <gaeguli/types.h>
+
+G_BEGIN_DECLS
+
+/*
+ * GaeguliStreamSplicer joins the outputs of several muxers into one stream a
+ * receiver takes for the output of a single muxer. Every buffer comes tagged
+ * with its source; whenever the source changes, the splicer carries on from
+ * where the previous source left off:
+ *
+ *  - MPEG-TS: the continuity counters of each PID keep counting, and the
+ *    first PCR of the new source gets discontinuity_indicator set, as its
+ *    muxer runs its own clock.
+ *  - RTP: the SSRC stays the one of the first source, and sequence numbers
+ *    and timestamps continue those of the previous source.
+ *
+ * Caps from later sources keep the stream headers and RTP fields of the
+ * first source's caps, so that downstream sees no renegotiation.
+ */
+
+typedef struct _GaeguliStreamSplicer GaeguliStreamSplicer;
+
+GaeguliStreamSplicer    *gaeguli_stream_splicer_new
+                                                (GaeguliVideoStreamType  stream_type);
+
+void                     gaeguli_stream_splicer_free
+                                                (GaeguliStreamSplicer   *self);
+
+GstBuffer               *gaeguli_stream_splicer_process
+                                                (GaeguliStreamSplicer   *self,
+                                                 gconstpointer           source,
+                                                 GstBuffer              *buffer);
+
+GstBufferList           *gaeguli_stream_splicer_process_list
+                                                (GaeguliStreamSplicer   *self,
+                                                 gconstpointer           source,
+                                                 GstBufferList          *list);
+
+GstCaps                 *gaeguli_stream_splicer_process_caps
+                                                (GaeguliStreamSplicer   *self,
+                                                 gconstpointer           source,
+                                                 GstCaps                *caps);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GaeguliStreamSplicer,
+    gaeguli_stream_splicer_free)
+
+G_END_DECLS
+
+#endif // __GAEGULI_STREAM_SPLICER_H__
@@ -25,13 +25,19 @@
 
 #include "target.h"
 
+#include "encodebranch.h"
 #include "enumtypes.h"
 #include "gaeguli-internal.h"
+#include "gopcache.h"
 #include "pipeline.h"
+#include "renditionrouter.h"
+#include "statspoller.h"
+#include "streamsplicer.h"
 #include "adaptors/nulladaptor.h"
 
 #include <gio/gio.h>
 #include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
 
 typedef struct
 {
@@ -46,11 +52,36 @@ typedef struct
   GstPad *peer_pad;
   GstPad *sinkpad;
   gulong pending_pad_probe;
+  GaeguliEncodeBranch *branch;
+  GaeguliEncodeBranch *pending_branch;
+  GstPad *pending_peer_pad;
+  gint64 switch_start_time;
+  gulong reconfigure_probe;
+  GstClockTime reconfiguration_latency;
   GaeguliStreamAdaptor *adaptor;
+  GaeguliGopCache *gop_cache;
+  gulong gop_cache_probe;
+  GaeguliRenditionRouter *rendition_router;
+  gulong rendition_probe;
+  guint rendition_poll_id;
+  GPtrArray *renditions;
+  guint64 bytes_encoded;
+  GaeguliStreamSplicer *splicer;
+
+  GaeguliQueueDropMode queue_drop_mode;
+  GstElement *queue;
+  gulong queue_probe;
+  gulong queue_overrun_handler;
+  gboolean dropping_until_keyframe;
+  guint64 buffers_dropped;
+
+  gboolean has_latency_budget;
+  GaeguliLatencyBudget latency_budget;
 
   GaeguliVideoCodec codec;
   GaeguliVideoBitrateControl bitrate_control;
   GaeguliVideoStreamType stream_type;
+  GaeguliVideoRefreshMode refresh_mode;
   guint bitrate;
   guint quantizer;
   guint idr_period;
@@ -93,7 +124,9 @@ enum
   PROP_TARGET_IS_RECORDING,
   PROP_LOCATION,
   PROP_STREAM_TYPE,
+  PROP_REFRESH_MODE,
   PROP_ATTRIBUTES,
+  PROP_RECONFIGURATION_LATENCY,
   PROP_LAST
 };
 
@@ -122,6 +155,9 @@ G_DEFINE_TYPE_WITH_CODE (GaeguliTarget, gaeguli_target, G_TYPE_OBJECT,
 #define LOCK_TARGET \
   g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&priv->lock)
 
+#define DEFAULT_GOP_CACHE_SIZE  (1024 * 1024)
+#define RENDITION_POLL_INTERVAL_MS      1000
+
 static void
 gaeguli_target_init (GaeguliTarget * self)
 {
@@ -133,115 +169,19 @@ gaeguli_target_init (GaeguliTarget * self)
   priv->stream_type = GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS;
 }
 
-typedef struct _pipeline_format_params PipelineFormatParams;
-
-typedef GString *(*PipelineFormatFunc) (PipelineFormatParams * params,
-    gboolean is_recording, guint idr_period, const gchar * location);
-
-struct _pipeline_format_params
-{
-  const gchar *enc_str;
-  GaeguliVideoCodec codec;
-  GaeguliVideoStreamType stream_type;
-  PipelineFormatFunc format_func;
-};
-
-static GString *
-_format_general_pipeline (PipelineFormatParams * params, gboolean is_recording,
-    guint idr_period, const gchar * location)
-{
-  g_autoptr (GString) str = g_string_new (NULL);
-
-  g_string_printf (str, params->enc_str, idr_period);
-  g_string_append_printf (str, " ! ");
-  g_string_append_printf (str,
-      is_recording ?
-      GAEGULI_RECORD_PIPELINE_MPEGTSMUX_SINK_STR :
-      GAEGULI_PIPELINE_MPEGTSMUX_SINK_STR, location);
-
-  g_debug ("format general pipeline[%s]", str->str);
-
-  return g_steal_pointer (&str);
-}
-
-static GString *
-_format_rtp_over_srt_pipeline (PipelineFormatParams * params,
-    gboolean is_recording, guint idr_period, const gchar * location)
+static GstElement *
+_build_pipeline (gboolean is_recording, const gchar * location,
+    GError ** error)
 {
-  g_autoptr (GString) str = g_string_new (NULL);
-  const gchar *payloader = NULL;
-
-  g_string_printf (str, params->enc_str, idr_period);
+  g_autofree gchar *pipeline_str = NULL;
 
-  /* append rtp payloader */
-  switch (params->codec) {
-    case GAEGULI_VIDEO_CODEC_H264_X264:
-    case GAEGULI_VIDEO_CODEC_H264_VAAPI:
-    case GAEGULI_VIDEO_CODEC_H264_OMX:
-      payloader = "rtph264pay";
-      break;
-    case GAEGULI_VIDEO_CODEC_H265_X265:
-    case GAEGULI_VIDEO_CODEC_H265_VAAPI:
-    case GAEGULI_VIDEO_CODEC_H265_OMX:
-      payloader = "rtph265pay";
-      break;
-    default:
-      return NULL;
-  }
-
-  /* FIXME: We might want to set properties. */
-  g_string_append_printf (str, " ! %s mtu=1316 config-interval=-1 ", payloader);
-  g_string_append_printf (str,
-      " ! application/x-rtp, payload=96, rate=9000 ! muxsink_first.sink_0 ");
-  g_string_append_printf (str,
-      " appsrc name=appsrc format=time is-live=true do-timestamp=true caps=text/x-raw");
-  g_string_append_printf (str,
-      " ! queue ! rtpgstpay pt=99 mtu=1316 config-interval=1 ! application/x-rtp, payload=99, rate=9000 ! muxsink_first.sink_1 ");
-  g_string_append_printf (str, GAEGULI_PIPELINE_RTPMUX_SINK_STR, location);
-
-  g_debug ("format rtp-over-srt pipeline[%s]", str->str);
-
-  return g_steal_pointer (&str);
-}
-
-static PipelineFormatParams pipeline_format_params[] = {
-  {GAEGULI_PIPELINE_GENERAL_H264ENC_STR, GAEGULI_VIDEO_CODEC_H264_X264,
-        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
-      _format_general_pipeline},
-  {GAEGULI_PIPELINE_GENERAL_H265ENC_STR, GAEGULI_VIDEO_CODEC_H265_X265,
-        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
-      _format_general_pipeline},
-  {GAEGULI_PIPELINE_VAAPI_H264_STR, GAEGULI_VIDEO_CODEC_H264_VAAPI,
-        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
-      _format_general_pipeline},
-  {GAEGULI_PIPELINE_VAAPI_H265_STR, GAEGULI_VIDEO_CODEC_H265_VAAPI,
-        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
-      _format_general_pipeline},
-  {GAEGULI_PIPELINE_NVIDIA_TX1_H264ENC_STR, GAEGULI_VIDEO_CODEC_H264_OMX,
-        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
-      _format_general_pipeline},
-  {GAEGULI_PIPELINE_NVIDIA_TX1_H265ENC_STR, GAEGULI_VIDEO_CODEC_H265_OMX,
-        GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
-      _format_general_pipeline},
-  {GAEGULI_PIPELINE_GENERAL_H264ENC_STR, GAEGULI_VIDEO_CODEC_H264_X264,
-        GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT,
-      _format_rtp_over_srt_pipeline},
-  {NULL, 0, 0},
-};
-
-static GString *
-_get_pipeline_string (GaeguliVideoCodec codec,
-    GaeguliVideoStreamType stream_type, gboolean is_recording, guint idr_period,
-    const gchar * location)
-{
-  PipelineFormatParams *params = pipeline_format_params;
+  pipeline_str = g_strdup_printf (is_recording ?
+      GAEGULI_RECORD_PIPELINE_FILESINK_STR : GAEGULI_PIPELINE_SRTSINK_STR,
+      location);
 
-  for (; params->enc_str != NULL; params++) {
-    if (params->codec == codec && params->stream_type == stream_type)
-      return params->format_func (params, is_recording, idr_period, location);
-  }
+  g_debug ("format sink pipeline[%s]", pipeline_str);
 
-  return NULL;
+  return gst_parse_launch (pipeline_str, error);
 }
 
 static GstBusSyncReply
@@ -287,6 +227,7 @@ _get_encoding_parameter_uint (GstElement * encoder, const gchar * param)
 
   if (g_str_equal (param, GAEGULI_ENCODING_PARAMETER_BITRATE)) {
     if (g_str_equal (encoder_type, "x264enc") ||
+        g_str_equal (encoder_type, "gaegulix264enc") ||
         g_str_equal (encoder_type, "x265enc") ||
         g_str_equal (encoder_type, "vaapih264enc") ||
         g_str_equal (encoder_type, "vaapih265enc")) {
@@ -297,7 +238,8 @@ _get_encoding_parameter_uint (GstElement * encoder, const gchar * param)
       g_object_get (encoder, "target-bitrate", &result, NULL);
     }
   } else if (g_str_equal (param, GAEGULI_ENCODING_PARAMETER_QUANTIZER)) {
-    if (g_str_equal (encoder_type, "x264enc")) {
+    if (g_str_equal (encoder_type, "x264enc") ||
+        g_str_equal (encoder_type, "gaegulix264enc")) {
       g_object_get (encoder, "quantizer", &result, NULL);
     } else if (g_str_equal (encoder_type, "x265enc")) {
       g_object_get (encoder, "qp", &result, NULL);
@@ -339,6 +281,8 @@ _get_encoding_parameter_enum (GstElement * encoder, const gchar * param)
         default:
           g_warning ("Unknown x264enc pass %d", pass);
       }
+    } else if (g_str_equal (encoder_type, "gaegulix264enc")) {
+      g_object_get (encoder, "bitrate-control", &result, NULL);
     } else if (g_str_equal (encoder_type, "x265enc")) {
       gint qp;
 
@@ -426,6 +370,17 @@ static void
 _x265_update_in_ready_state (GstElement * encoder, GstStructure * params)
 {
   GaeguliVideoBitrateControl bitrate_control;
+  g_autofree gchar *cur_option_str = NULL;
+  const gchar *branch_option_str = "";
+
+  /* Keep the intra refresh or, in a simulcast, the disabled scene cuts set
+   * up by the encode branch. */
+  g_object_get (encoder, "option-string", &cur_option_str, NULL);
+  if (cur_option_str && strstr (cur_option_str, "intra-refresh=1")) {
+    branch_option_str = "intra-refresh=1";
+  } else if (cur_option_str && strstr (cur_option_str, "scenecut=0")) {
+    branch_option_str = "scenecut=0";
+  }
 
   bitrate_control = _get_encoding_parameter_enum (encoder,
       GAEGULI_ENCODING_PARAMETER_RATECTRL);
@@ -440,11 +395,13 @@ _x265_update_in_ready_state (GstElement * encoder, GstStructure * params)
       g_object_get (encoder, "qp", &qp, NULL);
       gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_QUANTIZER,
           &qp);
-      g_object_set (encoder, "option-string", "", "qp", qp, NULL);
+      g_object_set (encoder, "option-string", branch_option_str, "qp", qp,
+          NULL);
       break;
     }
     case GAEGULI_VIDEO_BITRATE_CONTROL_VBR:
-      g_object_set (encoder, "option-string", "", "qp", -1, NULL);
+      g_object_set (encoder, "option-string", branch_option_str, "qp", -1,
+          NULL);
       break;
     case GAEGULI_VIDEO_BITRATE_CONTROL_CBR:
     default:{
@@ -453,7 +410,8 @@ _x265_update_in_ready_state (GstElement * encoder, GstStructure * params)
 
       g_object_get (encoder, "bitrate", &bitrate, NULL);
 
-      option_str = g_strdup_printf ("strict-cbr=1:vbv-bufsize=%d", bitrate);
+      option_str = g_strdup_printf ("strict-cbr=1:vbv-bufsize=%d%s%s", bitrate,
+          *branch_option_str ? ":" : "", branch_option_str);
       g_object_set (encoder, "option-string", option_str, "qp", -1, NULL);
     }
   }
@@ -551,7 +509,9 @@ out:
   return GST_PAD_PROBE_REMOVE;
 }
 
-static void
+/* Applies what can be changed on the fly and returns the callback that has
+ * to run in READY state for the rest, or NULL if nothing is left to do. */
+static ReadyStateCallback
 _set_encoding_parameters (GstElement * encoder, GstStructure * params)
 {
   guint val;
@@ -595,6 +555,22 @@ _set_encoding_parameters (GstElement * encoder, GstStructure * params)
         must_go_to_ready_state = TRUE;
       }
     }
+  } else if (g_str_equal (encoder_type, "gaegulix264enc")) {
+    /* Everything can be changed while encoding. */
+    if (gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_BITRATE,
+            &val)) {
+      g_object_set (encoder, "bitrate", val / 1000, NULL);
+    }
+
+    if (gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_QUANTIZER,
+            &val)) {
+      g_object_set (encoder, "quantizer", val, NULL);
+    }
+
+    if (gst_structure_get_enum (params, GAEGULI_ENCODING_PARAMETER_RATECTRL,
+            GAEGULI_TYPE_VIDEO_BITRATE_CONTROL, (gint *) & bitrate_control)) {
+      g_object_set (encoder, "bitrate-control", bitrate_control, NULL);
+    }
   } else if (g_str_equal (encoder_type, "x265enc")) {
     GaeguliVideoBitrateControl cur_bitrate_control;
 
@@ -665,17 +641,400 @@ _set_encoding_parameters (GstElement * encoder, GstStructure * params)
     g_warning ("Unsupported encoder '%s'", encoder_type);
   }
 
-  if (must_go_to_ready_state && ready_state_cb) {
-    g_autoptr (GstPad) sinkpad = gst_element_get_static_pad (encoder, "sink");
+  return must_go_to_ready_state ? ready_state_cb : NULL;
+}
 
-    GstStructure *probe_data = gst_structure_copy (params);
+static gboolean
+_encoder_is_running (GstElement * encoder)
+{
+  GstState cur_state;
+
+  gst_element_get_state (encoder, &cur_state, NULL, 0);
+
+  return cur_state > GST_STATE_READY;
+}
+
+/* Configures an encoder that doesn't process any data yet. */
+static void
+_configure_idle_encoder (GstElement * encoder, GstStructure * params)
+{
+  ReadyStateCallback ready_state_cb;
+
+  ready_state_cb = _set_encoding_parameters (encoder, params);
+  if (ready_state_cb) {
+    ready_state_cb (encoder, params);
+  }
+}
+
+/* Last resort when a shadow encoder can't be created; stalls the stream. */
+static void
+_restart_encoder (GstElement * encoder, ReadyStateCallback ready_state_cb,
+    GstStructure * params)
+{
+  g_autoptr (GstPad) sinkpad = gst_element_get_static_pad (encoder, "sink");
+
+  GstStructure *probe_data = gst_structure_copy (params);
+
+  gst_structure_set (probe_data, "probe-cb", G_TYPE_POINTER, ready_state_cb,
+      NULL);
+
+  gst_pad_add_probe (GST_PAD_PEER (sinkpad), GST_PAD_PROBE_TYPE_BLOCK,
+      _do_in_ready_state, probe_data, (GDestroyNotify) gst_structure_free);
+}
+
+static GstPadProbeReturn _link_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data);
+
+static void
+_on_encoder_notify (GstElement * encoder, GParamSpec * pspec,
+    GaeguliTarget * self)
+{
+  const gchar *name = g_param_spec_get_name (pspec);
+
+  if (g_str_equal (name, "bitrate")) {
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_BITRATE_ACTUAL]);
+  } else if (g_str_equal (name, "quantizer") ||
+      /* vaapienc */
+      g_str_equal (name, "init-qp")) {
+    g_object_notify_by_pspec (G_OBJECT (self),
+        properties[PROP_QUANTIZER_ACTUAL]);
+  } else if (
+      /* x264enc */
+      g_str_equal (name, "pass") ||
+      /* gaegulix264enc */
+      g_str_equal (name, "bitrate-control") ||
+      /* x265enc */
+      g_str_equal (name, "qp") || g_str_equal (name, "option-string") ||
+      /* vaapienc */
+      g_str_equal (name, "rate-control")) {
+    g_object_notify_by_pspec (G_OBJECT (self),
+        properties[PROP_BITRATE_CONTROL_ACTUAL]);
+  }
+}
+
+static void
+gaeguli_target_set_encoder (GaeguliTarget * self, GstElement * encoder)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  if (priv->encoder) {
+    g_signal_handlers_disconnect_by_func (priv->encoder, _on_encoder_notify,
+        self);
+    if (priv->reconfigure_probe) {
+      g_autoptr (GstPad) srcpad =
+          gst_element_get_static_pad (priv->encoder, "src");
+
+      gst_pad_remove_probe (srcpad, priv->reconfigure_probe);
+      priv->reconfigure_probe = 0;
+    }
+    gst_clear_object (&priv->encoder);
+  }
+
+  if (encoder) {
+    priv->encoder = gst_object_ref (encoder);
+    g_signal_connect (priv->encoder, "notify",
+        G_CALLBACK (_on_encoder_notify), self);
+  }
+}
+
+static GstPadProbeReturn
+_release_leg_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GaeguliEncodeBranch *branch = GAEGULI_ENCODE_BRANCH (user_data);
+
+  /* Remove the probe first. See _link_probe_cb() for details. */
+  gst_pad_remove_probe (pad, info->id);
+
+  gaeguli_encode_branch_release_pad (branch, pad);
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static GstPadProbeReturn
+_switch_branch_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GaeguliTarget *self = GAEGULI_TARGET (user_data);
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GstPad) old_pad = NULL;
+  g_autoptr (GaeguliEncodeBranch) old_branch = NULL;
+
+  /* Remove the probe first. See _link_probe_cb() for details. */
+  gst_pad_remove_probe (pad, info->id);
 
-    gst_structure_set (probe_data, "probe-cb", G_TYPE_POINTER, ready_state_cb,
+  {
+    LOCK_TARGET;
+
+    if (priv->pending_pad_probe == info->id) {
+      priv->pending_pad_probe = 0;
+    }
+
+    if (priv->pending_peer_pad != pad) {
+      /* The switch got cancelled or superseded in the meantime. */
+      return GST_PAD_PROBE_DROP;
+    }
+
+    /* A freshly started encoder opens with an IDR frame, so this first buffer
+     * is a clean entry point. The old encoder stays linked up to here. */
+    if (!gst_pad_unlink (priv->peer_pad, priv->sinkpad)) {
+      g_error ("failed to unlink target from its encode branch");
+    }
+
+    old_pad = g_steal_pointer (&priv->peer_pad);
+    old_branch = g_steal_pointer (&priv->branch);
+
+    priv->peer_pad = g_steal_pointer (&priv->pending_peer_pad);
+    priv->branch = g_steal_pointer (&priv->pending_branch);
+
+    if (gst_pad_link (priv->peer_pad, priv->sinkpad) != GST_PAD_LINK_OK) {
+      g_error ("failed to link target to its new encode branch");
+    }
+
+    priv->reconfiguration_latency =
+        (g_get_monotonic_time () - priv->switch_start_time) * GST_USECOND;
+
+    g_debug ("target [%x] switched encoders in %" GST_TIME_FORMAT, self->id,
+        GST_TIME_ARGS (priv->reconfiguration_latency));
+  }
+
+  /* The old leg may still be busy in its own streaming thread; let that
+   * thread give it back to the branch. */
+  gst_pad_add_probe (old_pad, GST_PAD_PROBE_TYPE_BLOCK, _release_leg_probe_cb,
+      g_object_ref (old_branch), g_object_unref);
+
+  g_object_notify_by_pspec (G_OBJECT (self),
+      properties[PROP_RECONFIGURATION_LATENCY]);
+
+  /* Let the buffer through to the freshly linked leg. */
+  return GST_PAD_PROBE_OK;
+}
+
+/* Sets up the encoders of a simulcast's other renditions with their own
+ * bitrates. They follow the target's rate control, but only the first
+ * rendition changes with the target's parameters afterwards. */
+static void
+gaeguli_target_configure_renditions (GaeguliTarget * self,
+    GaeguliEncodeBranch * branch)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GVariant) renditions = NULL;
+  GVariantIter iter;
+  guint bitrate;
+  guint i;
+
+  renditions = gaeguli_renditions_from_attributes (priv->attributes);
+  if (renditions == NULL) {
+    return;
+  }
+
+  g_variant_iter_init (&iter, renditions);
+  for (i = 0; g_variant_iter_next (&iter, "(iu)", NULL, &bitrate); ++i) {
+    g_autoptr (GstStructure) params = NULL;
+    GstElement *encoder;
+
+    if (i == 0 || i >= gaeguli_encode_branch_get_n_renditions (branch)) {
+      continue;
+    }
+
+    encoder = gaeguli_encode_branch_get_rendition_encoder (branch, i);
+    if (_encoder_is_running (encoder)) {
+      /* A shared branch is already set up the same way. */
+      continue;
+    }
+
+    params = gst_structure_new ("application/x-gaeguli-encoding-parameters",
+        GAEGULI_ENCODING_PARAMETER_RATECTRL,
+        GAEGULI_TYPE_VIDEO_BITRATE_CONTROL, priv->bitrate_control,
+        GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, bitrate,
+        GAEGULI_ENCODING_PARAMETER_QUANTIZER, G_TYPE_UINT, priv->quantizer,
         NULL);
 
-    gst_pad_add_probe (GST_PAD_PEER (sinkpad), GST_PAD_PROBE_TYPE_BLOCK,
-        _do_in_ready_state, probe_data, (GDestroyNotify) gst_structure_free);
+    _configure_idle_encoder (encoder, params);
+  }
+}
+
+/* Moves the target onto a new encode branch configured with params. While the
+ * target is streaming, the current encoder keeps feeding it until the new one
+ * delivers its first IDR frame, so receivers see neither a stall nor a gap. */
+static gboolean
+gaeguli_target_switch_branch (GaeguliTarget * self, GstStructure * params)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GaeguliEncodeBranch) branch = NULL;
+  g_autoptr (GstPad) pad = NULL;
+  g_autoptr (GstStructure) branch_params = NULL;
+  g_autoptr (GError) error = NULL;
+  GstElement *encoder;
+
+  branch = gaeguli_encode_branch_fork (priv->pending_branch ?
+      priv->pending_branch : priv->branch, &error);
+  if (branch == NULL) {
+    g_warning ("Failed to fork encode branch for target [%x] (%s)", self->id,
+        error->message);
+    return FALSE;
+  }
+
+  gaeguli_encode_branch_store_parameters (branch, params);
+  branch_params = gaeguli_encode_branch_get_parameters (branch);
+
+  encoder = gaeguli_encode_branch_get_encoder (branch);
+  _configure_idle_encoder (encoder, branch_params);
+  gaeguli_target_configure_renditions (self, branch);
+
+  pad = gaeguli_encode_branch_request_pad (branch);
+
+  g_debug ("target [%x] moves to a new encode branch", self->id);
+
+  {
+    LOCK_TARGET;
+
+    if (priv->pending_peer_pad) {
+      /* A previous switch hasn't completed yet; the new one supersedes it. */
+      gst_pad_remove_probe (priv->pending_peer_pad, priv->pending_pad_probe);
+      priv->pending_pad_probe = 0;
+      gaeguli_encode_branch_release_pad (priv->pending_branch,
+          priv->pending_peer_pad);
+      gst_clear_object (&priv->pending_peer_pad);
+      g_clear_object (&priv->pending_branch);
+    }
+
+    switch (priv->state) {
+      case GAEGULI_TARGET_STATE_NEW:
+        gaeguli_encode_branch_release_pad (priv->branch, priv->peer_pad);
+        gst_object_unref (priv->peer_pad);
+        g_object_unref (priv->branch);
+        priv->peer_pad = g_steal_pointer (&pad);
+        priv->branch = g_object_ref (branch);
+        break;
+      case GAEGULI_TARGET_STATE_STARTING:
+        /* Not linked yet; just re-target the pending link. */
+        gst_pad_remove_probe (priv->peer_pad, priv->pending_pad_probe);
+        gaeguli_encode_branch_release_pad (priv->branch, priv->peer_pad);
+        gst_object_unref (priv->peer_pad);
+        g_object_unref (priv->branch);
+        priv->peer_pad = g_steal_pointer (&pad);
+        priv->branch = g_object_ref (branch);
+
+        gaeguli_encode_branch_start (priv->branch);
+        priv->pending_pad_probe = gst_pad_add_probe (priv->peer_pad,
+            GST_PAD_PROBE_TYPE_BLOCK, _link_probe_cb, self, NULL);
+        break;
+      case GAEGULI_TARGET_STATE_RUNNING:
+        gaeguli_encode_branch_start (branch);
+        priv->pending_peer_pad = g_steal_pointer (&pad);
+        priv->pending_branch = g_object_ref (branch);
+        priv->switch_start_time = g_get_monotonic_time ();
+        /* Sticky events pass so the new branch can negotiate; the first
+         * buffer triggers the switch. */
+        priv->pending_pad_probe = gst_pad_add_probe (priv->pending_peer_pad,
+            GST_PAD_PROBE_TYPE_BLOCKING | GST_PAD_PROBE_TYPE_BUFFER |
+            GST_PAD_PROBE_TYPE_BUFFER_LIST, _switch_branch_probe_cb, self,
+            NULL);
+        break;
+      default:
+        gaeguli_encode_branch_release_pad (branch, pad);
+        return FALSE;
+    }
+  }
+
+  gaeguli_target_set_encoder (self, encoder);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_BITRATE_ACTUAL]);
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_QUANTIZER_ACTUAL]);
+  g_object_notify_by_pspec (G_OBJECT (self),
+      properties[PROP_BITRATE_CONTROL_ACTUAL]);
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+_reconfigured_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GaeguliTarget *self = GAEGULI_TARGET (user_data);
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  {
+    LOCK_TARGET;
+
+    if (priv->reconfigure_probe != info->id) {
+      return GST_PAD_PROBE_REMOVE;
+    }
+
+    priv->reconfigure_probe = 0;
+    priv->reconfiguration_latency =
+        (g_get_monotonic_time () - priv->switch_start_time) * GST_USECOND;
+
+    g_debug ("target [%x] reconfigured its encoder in %" GST_TIME_FORMAT,
+        self->id, GST_TIME_ARGS (priv->reconfiguration_latency));
+  }
+
+  g_object_notify_by_pspec (G_OBJECT (self),
+      properties[PROP_RECONFIGURATION_LATENCY]);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Measures how long a running encoder takes to deliver a frame after its
+ * parameters got changed in place. */
+static void
+gaeguli_target_watch_reconfiguration (GaeguliTarget * self)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GstPad) srcpad = gst_element_get_static_pad (priv->encoder, "src");
+
+  LOCK_TARGET;
+
+  priv->switch_start_time = g_get_monotonic_time ();
+
+  if (priv->reconfigure_probe == 0) {
+    priv->reconfigure_probe = gst_pad_add_probe (srcpad,
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+        _reconfigured_probe_cb, g_object_ref (self), g_object_unref);
+  }
+}
+
+static void
+gaeguli_target_apply_encoding_parameters (GaeguliTarget * self,
+    GstStructure * params)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+  GaeguliEncodeBranch *branch;
+  ReadyStateCallback ready_state_cb;
+
+  branch = priv->pending_branch ? priv->pending_branch : priv->branch;
+
+  if (!gaeguli_encode_branch_accepts_parameters (branch, params) &&
+      gaeguli_encode_branch_get_n_legs (branch) > 1) {
+    /* Other targets share the encoder with us; get one of our own rather
+     * than changing their stream. Without one, keep the old parameters. */
+    if (!gaeguli_target_switch_branch (self, params)) {
+      g_debug ("target [%x] keeps its encoding parameters", self->id);
+    }
+    return;
   }
+
+  ready_state_cb = _set_encoding_parameters (priv->encoder, params);
+
+  if (ready_state_cb) {
+    if (!_encoder_is_running (priv->encoder)) {
+      ready_state_cb (priv->encoder, params);
+    } else if (gaeguli_target_switch_branch (self, params)) {
+      /* Pre-rolled a shadow encoder instead of cycling through READY. */
+      return;
+    } else {
+      _restart_encoder (priv->encoder, ready_state_cb, params);
+    }
+  } else if (_encoder_is_running (priv->encoder)) {
+    gaeguli_target_watch_reconfiguration (self);
+  }
+
+  gaeguli_encode_branch_store_parameters (branch, params);
 }
 
 static void
@@ -685,196 +1044,663 @@ gaeguli_target_update_baseline_parameters (GaeguliTarget * self,
   GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
   g_autoptr (GstStructure) params = NULL;
+  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
+  gint width, height;
 
   if (!priv->encoder) {
     /* We're not initialized yet. */
     return;
   }
 
-  params = gst_structure_new ("application/x-gaeguli-encoding-parameters",
-      GAEGULI_ENCODING_PARAMETER_RATECTRL,
-      GAEGULI_TYPE_VIDEO_BITRATE_CONTROL, priv->bitrate_control,
-      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, priv->bitrate,
-      GAEGULI_ENCODING_PARAMETER_QUANTIZER, G_TYPE_UINT, priv->quantizer, NULL);
+  g_variant_lookup (priv->attributes, "resolution", "i", &resolution);
+  gaeguli_video_resolution_get_size (resolution, &width, &height);
+
+  params = gst_structure_new ("application/x-gaeguli-encoding-parameters",
+      GAEGULI_ENCODING_PARAMETER_RATECTRL,
+      GAEGULI_TYPE_VIDEO_BITRATE_CONTROL, priv->bitrate_control,
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, priv->bitrate,
+      GAEGULI_ENCODING_PARAMETER_QUANTIZER, G_TYPE_UINT, priv->quantizer,
+      GAEGULI_ENCODING_PARAMETER_WIDTH, G_TYPE_UINT, MAX (width, 0),
+      GAEGULI_ENCODING_PARAMETER_HEIGHT, G_TYPE_UINT, MAX (height, 0),
+      GAEGULI_ENCODING_PARAMETER_FRAMERATE, G_TYPE_UINT, 0,
+      /* Adaptors may drop frames; the baseline encodes all of them. */
+      GAEGULI_ENCODING_PARAMETER_FRAME_SKIP, G_TYPE_UINT, 0,
+      GAEGULI_ENCODING_PARAMETER_FRAMERATE_DIVISOR, G_TYPE_UINT, 0, NULL);
+
+  g_object_set (self, "video-params", params, NULL);
+
+  if (priv->adaptor) {
+    g_object_set (priv->adaptor, "baseline-parameters", params, NULL);
+  }
+
+  if (priv->adaptor == NULL
+      || !gaeguli_stream_adaptor_is_enabled (priv->adaptor)
+      || force_on_encoder) {
+    /* Apply directly on the encoder */
+    gaeguli_target_apply_encoding_parameters (self, params);
+  }
+}
+
+static GstPadProbeReturn
+_gop_cache_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GaeguliTarget *self = GAEGULI_TARGET (user_data);
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    gaeguli_gop_cache_push (priv->gop_cache, GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    guint i;
+
+    for (i = 0; i < gst_buffer_list_length (list); ++i) {
+      gaeguli_gop_cache_push (priv->gop_cache, gst_buffer_list_get (list, i));
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* An encode branch serving the callers of one rendition besides the target's
+ * own branch, which serves rendition 0. */
+typedef struct
+{
+  GaeguliTarget *target;
+  guint index;
+  guint bitrate;
+  /* The encoder can't change its bitrate without a restart. */
+  gboolean fixed_bitrate;
+  GaeguliEncodeBranch *branch;
+  GstPad *pad;
+  gulong probe;
+} RenditionLeg;
+
+static void
+rendition_leg_free (RenditionLeg * leg)
+{
+  gst_object_unref (leg->pad);
+  g_object_unref (leg->branch);
+  g_free (leg);
+}
+
+static GstBuffer *
+_empty_buffer_like (GstBuffer * buffer)
+{
+  GstBuffer *empty = gst_buffer_new ();
+
+  GST_BUFFER_PTS (empty) = GST_BUFFER_PTS (buffer);
+  GST_BUFFER_DTS (empty) = GST_BUFFER_DTS (buffer);
+  GST_BUFFER_DURATION (empty) = GST_BUFFER_DURATION (buffer);
+
+  return empty;
+}
+
+/* With renditions, srtsink only accepts callers and reports their statistics.
+ * The data goes to the callers through the rendition router; the sink gets
+ * buffers without payload, which keep it prerolled and in sync. The router
+ * sends the stream headers as well, so the sink gets caps without them. */
+static GstPadProbeReturn
+_rendition_sink_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GaeguliTarget *self = GAEGULI_TARGET (user_data);
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+  gboolean need_key_unit = FALSE;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstCaps *caps;
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      g_autoptr (GstCaps) stripped = NULL;
+
+      gst_event_parse_caps (event, &caps);
+      gaeguli_rendition_router_set_caps (priv->rendition_router, 0, caps);
+
+      stripped = gst_caps_copy (caps);
+      gst_structure_remove_field (gst_caps_get_structure (stripped, 0),
+          "streamheader");
+
+      GST_PAD_PROBE_INFO_DATA (info) = gst_event_new_caps (stripped);
+      gst_event_unref (event);
+    }
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    need_key_unit = gaeguli_rendition_router_push (priv->rendition_router, 0,
+        buffer);
+
+    GST_PAD_PROBE_INFO_DATA (info) = _empty_buffer_like (buffer);
+    gst_buffer_unref (buffer);
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    GstBufferList *empty_list;
+    guint i;
+
+    if (gst_buffer_list_length (list) == 0) {
+      return GST_PAD_PROBE_OK;
+    }
+
+    for (i = 0; i < gst_buffer_list_length (list); ++i) {
+      if (gaeguli_rendition_router_push (priv->rendition_router, 0,
+              gst_buffer_list_get (list, i))) {
+        need_key_unit = TRUE;
+      }
+    }
+
+    empty_list = gst_buffer_list_new_sized (1);
+    gst_buffer_list_add (empty_list,
+        _empty_buffer_like (gst_buffer_list_get (list, 0)));
+
+    GST_PAD_PROBE_INFO_DATA (info) = empty_list;
+    gst_buffer_list_unref (list);
+  }
+
+  if (need_key_unit) {
+    gaeguli_target_request_keyframe (self);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+_rendition_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  RenditionLeg *leg = user_data;
+  GaeguliTargetPrivate *priv =
+      gaeguli_target_get_instance_private (leg->target);
+  gboolean need_key_unit = FALSE;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstCaps *caps;
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      gst_event_parse_caps (event, &caps);
+      gaeguli_rendition_router_set_caps (priv->rendition_router, leg->index,
+          caps);
+    }
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    need_key_unit = gaeguli_rendition_router_push (priv->rendition_router,
+        leg->index, GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    guint i;
+
+    for (i = 0; i < gst_buffer_list_length (list); ++i) {
+      if (gaeguli_rendition_router_push (priv->rendition_router, leg->index,
+              gst_buffer_list_get (list, i))) {
+        need_key_unit = TRUE;
+      }
+    }
+  }
+
+  if (need_key_unit) {
+    gaeguli_encode_branch_request_key_unit (leg->branch);
+  }
+
+  /* The leg isn't linked anywhere; the router has sent the data. */
+  return GST_PAD_PROBE_DROP;
+}
+
+static RenditionLeg *
+gaeguli_target_add_rendition (GaeguliTarget * self, guint index)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GaeguliEncodeBranch) branch = NULL;
+  g_autoptr (GstStructure) params = NULL;
+  g_autoptr (GstStructure) branch_params = NULL;
+  g_autoptr (GError) error = NULL;
+  RenditionLeg *leg;
+  guint bitrate;
+
+  branch = gaeguli_encode_branch_fork (priv->branch, &error);
+  if (branch == NULL) {
+    g_warning ("Failed to fork encode branch for rendition %u of target [%x] "
+        "(%s)", index, self->id, error->message);
+    return NULL;
+  }
+
+  bitrate = gaeguli_rendition_router_get_bitrate (priv->rendition_router,
+      index);
+  params = gst_structure_new ("application/x-gaeguli-encoding-parameters",
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, bitrate, NULL);
+
+  gaeguli_encode_branch_store_parameters (branch, params);
+  branch_params = gaeguli_encode_branch_get_parameters (branch);
+  _configure_idle_encoder (gaeguli_encode_branch_get_encoder (branch),
+      branch_params);
+
+  g_debug ("target [%x] adds rendition %u at %u bps", self->id, index,
+      bitrate);
+
+  leg = g_new0 (RenditionLeg, 1);
+  leg->target = self;
+  leg->index = index;
+  leg->bitrate = bitrate;
+  leg->branch = g_steal_pointer (&branch);
+  leg->pad = gaeguli_encode_branch_request_pad (leg->branch);
+  leg->probe = gst_pad_add_probe (leg->pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, _rendition_probe_cb, leg,
+      (GDestroyNotify) rendition_leg_free);
+
+  gaeguli_encode_branch_start (leg->branch);
+
+  return leg;
+}
+
+static void
+_release_rendition (RenditionLeg * leg)
+{
+  g_autoptr (GstPad) pad = gst_object_ref (leg->pad);
+  GaeguliEncodeBranch *branch = g_object_ref (leg->branch);
+
+  g_debug ("target [%x] releases rendition %u", leg->target->id, leg->index);
+
+  /* Frees the leg. */
+  gst_pad_remove_probe (pad, leg->probe);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BLOCK, _release_leg_probe_cb,
+      branch, g_object_unref);
+}
+
+/* Returns FALSE when the encoder of the rendition can't change its bitrate
+ * while running. Restarting it would stall the callers watching the
+ * rendition, so it keeps the old bitrate instead. */
+static gboolean
+_set_rendition_bitrate (RenditionLeg * leg, guint bitrate)
+{
+  g_autoptr (GstStructure) params = NULL;
+  GstElement *encoder = gaeguli_encode_branch_get_encoder (leg->branch);
+  ReadyStateCallback ready_state_cb;
+
+  params = gst_structure_new ("application/x-gaeguli-encoding-parameters",
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, bitrate, NULL);
+
+  ready_state_cb = _set_encoding_parameters (encoder, params);
+  if (ready_state_cb) {
+    if (_encoder_is_running (encoder)) {
+      g_autoptr (GstStructure) old_params =
+          gst_structure_new ("application/x-gaeguli-encoding-parameters",
+          GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, leg->bitrate, NULL);
+
+      /* Take back what got applied on the fly. */
+      _set_encoding_parameters (encoder, old_params);
+      return FALSE;
+    }
+
+    ready_state_cb (encoder, params);
+  }
+
+  gaeguli_encode_branch_store_parameters (leg->branch, params);
+  leg->bitrate = bitrate;
+
+  return TRUE;
+}
+
+static void
+gaeguli_target_on_rendition_stats (const GstStructure * stats,
+    gpointer user_data)
+{
+  GaeguliTarget *self = GAEGULI_TARGET (user_data);
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GstStructure) branch_params = NULL;
+  GaeguliRenditionRouter *router = priv->rendition_router;
+  guint n_renditions;
+  guint bitrate;
+  guint current_bitrate = 0;
+  guint i;
+
+  if (priv->state != GAEGULI_TARGET_STATE_RUNNING) {
+    return;
+  }
+
+  gaeguli_rendition_router_update (router, stats, priv->bitrate);
+  n_renditions = gaeguli_rendition_router_get_n_renditions (router);
+
+  /* Renditions nobody watches anymore stop encoding. */
+  while (priv->renditions->len + 1 > n_renditions) {
+    g_ptr_array_remove_index (priv->renditions, priv->renditions->len - 1);
+  }
+
+  while (priv->renditions->len + 1 < n_renditions) {
+    RenditionLeg *leg =
+        gaeguli_target_add_rendition (self, priv->renditions->len + 1);
+
+    if (leg == NULL) {
+      gaeguli_rendition_router_limit (router, priv->renditions->len + 1);
+      break;
+    }
+
+    g_ptr_array_add (priv->renditions, leg);
+  }
+
+  for (i = 0; i < priv->renditions->len; ++i) {
+    RenditionLeg *leg = g_ptr_array_index (priv->renditions, i);
+
+    bitrate = gaeguli_rendition_router_get_bitrate (router, leg->index);
+    if (bitrate != leg->bitrate && !leg->fixed_bitrate &&
+        !_set_rendition_bitrate (leg, bitrate)) {
+      g_debug ("target [%x] keeps rendition %u at %u bps", self->id,
+          leg->index, leg->bitrate);
+      leg->fixed_bitrate = TRUE;
+    }
+  }
+
+  branch_params = gaeguli_encode_branch_get_parameters (priv->pending_branch ?
+      priv->pending_branch : priv->branch);
+  if (branch_params) {
+    gst_structure_get_uint (branch_params, GAEGULI_ENCODING_PARAMETER_BITRATE,
+        &current_bitrate);
+  }
+
+  bitrate = gaeguli_rendition_router_get_bitrate (router, 0);
+  if (bitrate != current_bitrate) {
+    g_autoptr (GstStructure) params =
+        gst_structure_new ("application/x-gaeguli-encoding-parameters",
+        GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, bitrate, NULL);
+
+    gaeguli_target_apply_encoding_parameters (self, params);
+  }
+}
+
+/* Each encode branch has a muxer of its own. Makes the stream continue across
+ * switches of the branch as if it came from a single muxer. */
+static GstPadProbeReturn
+_splice_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GaeguliTarget *self = GAEGULI_TARGET (user_data);
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GstPad) source = gst_pad_get_peer (pad);
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GST_PAD_PROBE_INFO_DATA (info) =
+        gaeguli_stream_splicer_process (priv->splicer, source,
+        GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GST_PAD_PROBE_INFO_DATA (info) =
+        gaeguli_stream_splicer_process_list (priv->splicer, source,
+        GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+  } else if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) ==
+      GST_EVENT_CAPS) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstCaps *caps;
+    GstCaps *spliced;
+
+    gst_event_parse_caps (event, &caps);
+    spliced = gaeguli_stream_splicer_process_caps (priv->splicer, source,
+        gst_caps_ref (caps));
+    if (spliced != caps) {
+      GST_PAD_PROBE_INFO_DATA (info) = gst_event_new_caps (spliced);
+      gst_event_unref (event);
+    }
+    gst_caps_unref (spliced);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+_count_bytes_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GaeguliTarget *self = GAEGULI_TARGET (user_data);
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+  gsize size = 0;
+
+  LOCK_TARGET;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    size = gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    size = gst_buffer_list_calculate_size (GST_PAD_PROBE_INFO_BUFFER_LIST
+        (info));
+  }
+
+  priv->bytes_encoded += size;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+_queue_is_full (GstElement * queue)
+{
+  guint buffers, max_buffers;
+  guint bytes, max_bytes;
+  guint64 time, max_time;
+
+  g_object_get (queue, "current-level-buffers", &buffers, "max-size-buffers",
+      &max_buffers, "current-level-bytes", &bytes, "max-size-bytes",
+      &max_bytes, "current-level-time", &time, "max-size-time", &max_time,
+      NULL);
+
+  return (max_buffers != 0 && buffers >= max_buffers) ||
+      (max_bytes != 0 && bytes >= max_bytes) ||
+      (max_time != 0 && time >= max_time);
+}
+
+static gboolean
+gaeguli_target_is_random_access_point (GaeguliTarget * self,
+    GstBuffer * buffer)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  if (priv->stream_type == GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS) {
+    return gaeguli_ts_buffer_has_random_access_point (buffer);
+  }
+
+  return !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+/* Once the queue fills up, drops everything up to the next keyframe, so the
+ * receiver doesn't get a stream with missing references. */
+static GstPadProbeReturn
+_drop_until_keyframe_probe_cb (GstPad * pad, GstPadProbeInfo * info,
+    GWeakRef * target_ref)
+{
+  g_autoptr (GaeguliTarget) self = g_weak_ref_get (target_ref);
+  GaeguliTargetPrivate *priv;
+  gboolean random_access = FALSE;
+  guint n_buffers = 1;
+
+  if (self == NULL) {
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  priv = gaeguli_target_get_instance_private (self);
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    random_access = gaeguli_target_is_random_access_point (self,
+        GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    guint i;
+
+    n_buffers = gst_buffer_list_length (list);
+    for (i = 0; i < n_buffers && !random_access; ++i) {
+      random_access = gaeguli_target_is_random_access_point (self,
+          gst_buffer_list_get (list, i));
+    }
+  }
+
+  if (!priv->dropping_until_keyframe) {
+    if (!_queue_is_full (GST_PAD_PARENT (pad))) {
+      return GST_PAD_PROBE_OK;
+    }
 
-  g_object_set (self, "video-params", params, NULL);
+    g_debug ("queue of target [%x] is full, dropping until the next keyframe",
+        self->id);
 
-  if (priv->adaptor) {
-    g_object_set (priv->adaptor, "baseline-parameters", params, NULL);
+    priv->dropping_until_keyframe = TRUE;
+    gaeguli_target_request_keyframe (self);
+  } else if (random_access && !_queue_is_full (GST_PAD_PARENT (pad))) {
+    priv->dropping_until_keyframe = FALSE;
+    return GST_PAD_PROBE_OK;
   }
 
-  if (priv->adaptor == NULL
-      || !gaeguli_stream_adaptor_is_enabled (priv->adaptor)
-      || force_on_encoder) {
-    /* Apply directly on the encoder */
-    _set_encoding_parameters (priv->encoder, params);
+  {
+    LOCK_TARGET;
+    priv->buffers_dropped += n_buffers;
   }
-}
-
-typedef struct
-{
-  GObject *target;
-  GParamSpec *pspec;
-} NotifyData;
 
-static void
-_notify_encoder_change (NotifyData * data)
-{
-  g_object_notify_by_pspec (data->target, data->pspec);
+  return GST_PAD_PROBE_DROP;
 }
 
 static void
-gaeguli_target_on_caller_added (GaeguliTarget * self, gint srtsocket,
-    GSocketAddress * address)
+_weak_ref_free (GWeakRef * ref)
 {
-  g_signal_emit (self, signals[SIG_CALLER_ADDED], 0, srtsocket, address);
+  g_weak_ref_clear (ref);
+  g_free (ref);
 }
 
 static void
-gaeguli_target_on_caller_removed (GaeguliTarget * self, gint srtsocket,
-    GSocketAddress * address)
+gaeguli_target_on_queue_overrun (GaeguliTarget * self)
 {
-  g_signal_emit (self, signals[SIG_CALLER_REMOVED], 0, srtsocket, address);
-}
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
-static gboolean
-_is_compatible (GaeguliVideoCodec codec, GaeguliVideoStreamType stream_type)
-{
-  if ((stream_type == GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS ||
-          stream_type == GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT) &&
-      ((codec == GAEGULI_VIDEO_CODEC_H264_X264) ||
-          (codec == GAEGULI_VIDEO_CODEC_H264_VAAPI) ||
-          (codec == GAEGULI_VIDEO_CODEC_H264_OMX) ||
-          (codec == GAEGULI_VIDEO_CODEC_H265_X265) ||
-          (codec == GAEGULI_VIDEO_CODEC_H265_VAAPI) ||
-          (codec == GAEGULI_VIDEO_CODEC_H265_OMX))) {
-    return TRUE;
-  }
+  LOCK_TARGET;
 
-  return FALSE;
+  /* A leaky queue drops its oldest buffer to make room for the new one. */
+  ++priv->buffers_dropped;
 }
 
-static GstElement *
-_build_pipeline (GVariant * attributes, GError ** error)
+/* Takes the drop mode set up by gaeguli_target_configure_queue() off the
+ * queue. Called with the lock held. */
+static void
+gaeguli_target_reset_queue (GaeguliTarget * self)
 {
-  g_autoptr (GString) pipeline_str = NULL;
-  g_autoptr (GstElement) pipeline = NULL;
-  g_autoptr (GstElement) target_capsfilter = NULL;
-  g_autoptr (GstCaps) caps = NULL;
-  GstCaps *target_caps = NULL;
-  GVariantDict attr;
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
-  GaeguliVideoCodec codec;
-  GaeguliVideoResolution resolution = GAEGULI_VIDEO_RESOLUTION_UNKNOWN;
-  GaeguliVideoStreamType stream_type;
-  gboolean is_record;
-  guint idr_period = 10;
-  const gchar *location = NULL;
-  guint target_height, target_width;
+  if (priv->queue == NULL) {
+    return;
+  }
 
-  g_variant_dict_init (&attr, attributes);
+  if (priv->queue_probe) {
+    g_autoptr (GstPad) sinkpad = gst_element_get_static_pad (priv->queue,
+        "sink");
 
-  g_variant_dict_lookup (&attr, "codec", "i", &codec);
-  g_variant_dict_lookup (&attr, "stream-type", "i", &stream_type);
-  if (!g_variant_dict_lookup (&attr, "idr-period", "u", &idr_period)) {
-    guint framerate = 15;
-    if (!g_variant_dict_lookup (&attr, "framerate", "u", &framerate)) {
-      idr_period = framerate > 6 ? framerate / 2 : framerate;
-    }
+    gst_pad_remove_probe (sinkpad, priv->queue_probe);
+    priv->queue_probe = 0;
   }
-  g_variant_dict_lookup (&attr, "is-record", "b", &is_record);
-  if (!g_variant_dict_lookup (&attr, "location", "s", &location)) {
-    g_variant_dict_lookup (&attr, "uri", "s", &location);
+
+  if (priv->queue_overrun_handler) {
+    g_signal_handler_disconnect (priv->queue, priv->queue_overrun_handler);
+    priv->queue_overrun_handler = 0;
   }
 
-  g_variant_dict_lookup (&attr, "resolution", "i", &resolution);
+  priv->dropping_until_keyframe = FALSE;
+  gst_clear_object (&priv->queue);
+}
 
-  if (resolution == GAEGULI_VIDEO_RESOLUTION_UNKNOWN) {
-    g_set_error (error, GAEGULI_RESOURCE_ERROR,
-        GAEGULI_RESOURCE_ERROR_UNSUPPORTED,
-        "Not found target resolution parameter");
-    return NULL;
+/* Each target has its own queue after the encode branch's tee. With a drop
+ * mode set, the queue drops data when the sink can't keep up, instead of
+ * blocking the encoder and the video source for every other target. */
+static void
+gaeguli_target_configure_queue (GaeguliTarget * self, GstElement * queue)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+  guint max_time_ms;
+  guint max_buffers;
+  g_autoptr (GstPad) sinkpad = NULL;
+  GWeakRef *target_ref;
+
+  LOCK_TARGET;
+
+  gaeguli_target_reset_queue (self);
+  priv->queue = gst_object_ref (queue);
+
+  if (priv->attributes) {
+    if (g_variant_lookup (priv->attributes, "queue-max-time", "u",
+            &max_time_ms)) {
+      g_object_set (queue, "max-size-time", max_time_ms * GST_MSECOND, NULL);
+    } else if (priv->has_latency_budget) {
+      /* Let only time limit the queue, so it holds no more than its share
+       * of the latency budget. */
+      g_object_set (queue, "max-size-time",
+          priv->latency_budget.queue_ms * GST_MSECOND, "max-size-buffers", 0,
+          "max-size-bytes", 0, NULL);
+    }
+    if (g_variant_lookup (priv->attributes, "queue-max-buffers", "u",
+            &max_buffers)) {
+      g_object_set (queue, "max-size-buffers", max_buffers, NULL);
+    }
+    g_variant_lookup (priv->attributes, "queue-drop-mode", "i",
+        &priv->queue_drop_mode);
   }
 
-  switch (resolution) {
-    case GAEGULI_VIDEO_RESOLUTION_640X480:
-      target_width = 640;
-      target_height = 480;
+  switch (priv->queue_drop_mode) {
+    case GAEGULI_QUEUE_DROP_MODE_OLDEST:
+      /* leaky=downstream */
+      g_object_set (queue, "leaky", 2, NULL);
+      priv->queue_overrun_handler = g_signal_connect_swapped (queue,
+          "overrun", G_CALLBACK (gaeguli_target_on_queue_overrun), self);
       break;
-    case GAEGULI_VIDEO_RESOLUTION_1280X720:
-      target_width = 1280;
-      target_height = 720;
-      break;
-    case GAEGULI_VIDEO_RESOLUTION_1920X1080:
-      target_width = 1920;
-      target_height = 1080;
-      break;
-    case GAEGULI_VIDEO_RESOLUTION_3840X2160:
-      target_width = 3840;
-      target_height = 2160;
+    case GAEGULI_QUEUE_DROP_MODE_UNTIL_KEYFRAME:
+      /* The probe may outlive the target while the queue is shutting down. */
+      target_ref = g_new0 (GWeakRef, 1);
+      g_weak_ref_init (target_ref, self);
+
+      sinkpad = gst_element_get_static_pad (queue, "sink");
+      priv->queue_probe = gst_pad_add_probe (sinkpad,
+          GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+          (GstPadProbeCallback) _drop_until_keyframe_probe_cb, target_ref,
+          (GDestroyNotify) _weak_ref_free);
       break;
     default:
-      target_width = -1;
-      target_height = -1;
       break;
   }
+}
 
-  g_debug ("stream type is %d", stream_type);
-  g_debug ("codec is %d", codec);
-
-  pipeline_str =
-      _get_pipeline_string (codec, stream_type, is_record, idr_period,
-      location);
+static void
+gaeguli_target_on_caller_added (GaeguliTarget * self, gint srtsocket,
+    GSocketAddress * address)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
-  if (pipeline_str == NULL) {
-    g_set_error (error, GAEGULI_RESOURCE_ERROR,
-        GAEGULI_RESOURCE_ERROR_UNSUPPORTED, "Can't determine encoding method");
-    return NULL;
+  /* srtsink calls this from its accept thread, so the cache goes out before
+   * the caller gets any live data. */
+  if (!priv->gop_cache ||
+      !gaeguli_gop_cache_add_caller (priv->gop_cache, srtsocket)) {
+    gaeguli_target_request_keyframe (self);
   }
 
-  pipeline = gst_parse_launch (pipeline_str->str, error);
+  if (priv->rendition_router) {
+    gaeguli_rendition_router_add_caller (priv->rendition_router, srtsocket);
+  }
 
-  target_capsfilter = gst_bin_get_by_name (GST_BIN (pipeline), "target_caps");
-  if (target_capsfilter == NULL)
-    goto bailout;
+  g_signal_emit (self, signals[SIG_CALLER_ADDED], 0, srtsocket, address);
+}
 
-  caps = gst_caps_new_empty ();
+static void
+gaeguli_target_on_caller_removed (GaeguliTarget * self, gint srtsocket,
+    GSocketAddress * address)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
-  switch (codec) {
-    case GAEGULI_VIDEO_CODEC_H264_X264:
-    case GAEGULI_VIDEO_CODEC_H265_X265:{
-      target_caps = gst_caps_from_string ("video/x-raw");
-      gst_caps_set_simple (target_caps, "width", G_TYPE_INT, target_width,
-          "height", G_TYPE_INT, target_height, NULL);
-      break;
-    }
-    case GAEGULI_VIDEO_CODEC_H264_VAAPI:
-    case GAEGULI_VIDEO_CODEC_H265_VAAPI:{
-      target_caps = gst_caps_from_string ("video/x-raw(memory:VASurface)");
-      gst_caps_set_simple (target_caps, "width", G_TYPE_INT, target_width,
-          "height", G_TYPE_INT, target_height, NULL);
-      break;
-    }
-    case GAEGULI_VIDEO_CODEC_H264_OMX:
-    case GAEGULI_VIDEO_CODEC_H265_OMX:{
-      /* FIXME: We maynot assume that omx comes only from nvidia. */
-      target_caps = gst_caps_from_string ("video/x-raw(memory:NVMM)");
-      gst_caps_set_simple (target_caps, "width", G_TYPE_INT, target_width,
-          "height", G_TYPE_INT, target_height, "format", G_TYPE_STRING, "I420",
-          NULL);
-    }
-    default:
-      break;
+  if (priv->rendition_router) {
+    gaeguli_rendition_router_remove_caller (priv->rendition_router,
+        srtsocket);
   }
 
-  if (target_caps != NULL) {
-    gst_caps_append (caps, target_caps);
-  }
+  g_signal_emit (self, signals[SIG_CALLER_REMOVED], 0, srtsocket, address);
+}
 
-  g_object_set (target_capsfilter, "caps", caps, NULL);
+/* Renditions adapt to each of the callers and simulcast receivers pick the
+ * program they can take, so neither needs the stream adaptor. */
+static gboolean
+gaeguli_target_wants_adaptor (GaeguliTarget * self)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
-bailout:
-  return g_steal_pointer (&pipeline);
+  return priv->adaptive_streaming && !priv->rendition_router &&
+      gaeguli_encode_branch_get_n_renditions (priv->branch) <= 1;
 }
 
 static gboolean
@@ -885,20 +1711,29 @@ gaeguli_target_initable_init (GInitable * initable, GCancellable * cancellable,
   GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
   g_autoptr (GaeguliPipeline) owner = NULL;
-  g_autoptr (GstElement) enc_first = NULL;
-  g_autoptr (GstPad) enc_sinkpad = NULL;
+  g_autoptr (GstElement) leg_first = NULL;
+  g_autoptr (GstPad) leg_sinkpad = NULL;
   g_autoptr (GError) internal_err = NULL;
-  NotifyData *notify_data;
 
-  /* Check if the stream type is compatible with codec */
-  if (!_is_compatible (priv->codec, priv->stream_type)) {
-    g_set_error (error, GAEGULI_TRANSMIT_ERROR,
-        GAEGULI_TRANSMIT_ERROR_MISMATCHED_CODEC,
-        "Mismatched codec and stream type");
-    return FALSE;
+  priv->branch = gaeguli_encode_branch_from_pad (priv->peer_pad);
+  if (priv->branch) {
+    g_object_ref (priv->branch);
+  } else {
+    /* The peer pad comes straight from the video source; build a private
+     * encode branch on top of it. */
+    priv->branch = gaeguli_encode_branch_new (priv->peer_pad, priv->attributes,
+        &internal_err);
+    if (priv->branch == NULL) {
+      g_warning ("failed to build encode branch(%s)", internal_err->message);
+      goto failed;
+    }
+
+    gst_object_unref (priv->peer_pad);
+    priv->peer_pad = gaeguli_encode_branch_request_pad (priv->branch);
   }
 
-  self->pipeline = _build_pipeline (priv->attributes, &internal_err);
+  self->pipeline = _build_pipeline (priv->is_recording, priv->location,
+      &internal_err);
 
   if (self->pipeline == NULL) {
     g_warning ("failed to build internal pipeline(%s)", internal_err->message);
@@ -907,17 +1742,6 @@ gaeguli_target_initable_init (GInitable * initable, GCancellable * cancellable,
 
   gst_object_ref_sink (self->pipeline);
 
-  if (priv->stream_type == GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS) {
-    g_autoptr (GstElement) muxsink_first = NULL;
-    muxsink_first =
-        gst_bin_get_by_name (GST_BIN (self->pipeline), "muxsink_first");
-    if (g_object_class_find_property (G_OBJECT_GET_CLASS (muxsink_first),
-            "pcr-interval")) {
-      g_info ("set pcr-interval to 360");
-      g_object_set (G_OBJECT (muxsink_first), "pcr-interval", 360, NULL);
-    }
-  }
-
   if (!priv->is_recording) {
     priv->srtsink = gst_bin_get_by_name (GST_BIN (self->pipeline), "sink");
     g_object_set_data (G_OBJECT (priv->srtsink), "gaeguli-target-id",
@@ -926,64 +1750,98 @@ gaeguli_target_initable_init (GInitable * initable, GCancellable * cancellable,
         G_CALLBACK (gaeguli_target_on_caller_added), self);
     g_signal_connect_swapped (priv->srtsink, "caller-removed",
         G_CALLBACK (gaeguli_target_on_caller_removed), self);
+    if (priv->attributes) {
+      gboolean sink_pacing = FALSE;
+
+      /* Sends buffers at the pace of their timestamps rather than as soon
+       * as they arrive, so muxer bursts don't overflow the SRT send rate. */
+      g_variant_lookup (priv->attributes, "sink-pacing", "b", &sink_pacing);
+      if (sink_pacing) {
+        g_object_set (priv->srtsink, "sync", TRUE, NULL);
+      }
+    }
     if (gaeguli_target_get_srt_mode (self) == GAEGULI_SRT_MODE_CALLER) {
       g_autoptr (GstUri) uri = gst_uri_from_string (priv->uri);
 
       priv->peer_address = g_strdup (gst_uri_get_host (uri));
+    } else if (gaeguli_target_get_srt_mode (self) ==
+        GAEGULI_SRT_MODE_LISTENER) {
+      g_autoptr (GstPad) srtsink_pad =
+          gst_element_get_static_pad (priv->srtsink, "sink");
+      guint gop_cache_size = DEFAULT_GOP_CACHE_SIZE;
+      guint max_renditions = 1;
+
+      /* A size of 0 always requests a keyframe for new callers instead. */
+      if (priv->attributes) {
+        g_variant_lookup (priv->attributes, "gop-cache-size", "u",
+            &gop_cache_size);
+        g_variant_lookup (priv->attributes, "max-renditions", "u",
+            &max_renditions);
+      }
+
+      priv->gop_cache = gaeguli_gop_cache_new (gop_cache_size);
+      priv->gop_cache_probe = gst_pad_add_probe (srtsink_pad,
+          GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+          _gop_cache_probe_cb, self, NULL);
+
+      /* Callers get grouped by bandwidth and served from up to this many
+       * encodes. Callers switch between them at random access points, which
+       * only MPEG-TS marks. */
+      if (max_renditions > 1 &&
+          priv->stream_type != GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS) {
+        g_warning ("Target [%x] can't use renditions with this stream type",
+            self->id);
+      } else if (max_renditions > 1 &&
+          gaeguli_encode_branch_get_n_renditions (priv->branch) > 1) {
+        g_warning ("Target [%x] already sends a simulcast; ignoring "
+            "max-renditions", self->id);
+      } else if (max_renditions > 1) {
+        priv->rendition_router = gaeguli_rendition_router_new (max_renditions);
+        priv->renditions = g_ptr_array_new_with_free_func ((GDestroyNotify)
+            _release_rendition);
+        priv->rendition_probe = gst_pad_add_probe (srtsink_pad,
+            GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+            GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, _rendition_sink_probe_cb,
+            self, NULL);
+      }
     }
   } else {
     priv->srtsink = gst_bin_get_by_name (GST_BIN (self->pipeline), "recsink");
   }
 
-  priv->encoder = gst_bin_get_by_name (GST_BIN (self->pipeline), "enc");
-
-  notify_data = g_new (NotifyData, 1);
-  notify_data->target = G_OBJECT (self);
-  notify_data->pspec = properties[PROP_BITRATE_ACTUAL];
-  g_signal_connect_closure (priv->encoder, "notify::bitrate",
-      g_cclosure_new_swap (G_CALLBACK (_notify_encoder_change), notify_data,
-          (GClosureNotify) g_free), FALSE);
-
-  notify_data = g_new (NotifyData, 1);
-  notify_data->target = G_OBJECT (self);
-  notify_data->pspec = properties[PROP_QUANTIZER_ACTUAL];
-  g_signal_connect_closure (priv->encoder, "notify::quantizer",
-      g_cclosure_new_swap (G_CALLBACK (_notify_encoder_change), notify_data,
-          (GClosureNotify) g_free), FALSE);
-  /* vaapienc */
-  g_signal_connect_closure (priv->encoder, "notify::init-qp",
-      g_cclosure_new_swap (G_CALLBACK (_notify_encoder_change), notify_data,
-          NULL), FALSE);
-
-  notify_data = g_new (NotifyData, 1);
-  notify_data->target = G_OBJECT (self);
-  notify_data->pspec = properties[PROP_BITRATE_CONTROL_ACTUAL];
-  /* x264enc */
-  g_signal_connect_closure (priv->encoder, "notify::pass",
-      g_cclosure_new_swap (G_CALLBACK (_notify_encoder_change), notify_data,
-          (GClosureNotify) g_free), FALSE);
-  /* x265enc */
-  g_signal_connect_closure (priv->encoder, "notify::qp",
-      g_cclosure_new_swap (G_CALLBACK (_notify_encoder_change), notify_data,
-          NULL), FALSE);
-  g_signal_connect_closure (priv->encoder, "notify::option-string",
-      g_cclosure_new_swap (G_CALLBACK (_notify_encoder_change), notify_data,
-          NULL), FALSE);
-  /* vaapienc */
-  g_signal_connect_closure (priv->encoder, "notify::rate-control",
-      g_cclosure_new_swap (G_CALLBACK (_notify_encoder_change), notify_data,
-          NULL), FALSE);
-
-  enc_first = gst_bin_get_by_name (GST_BIN (self->pipeline), "enc_first");
-  enc_sinkpad = gst_element_get_static_pad (enc_first, "sink");
-
-  priv->sinkpad = gst_ghost_pad_new (NULL, enc_sinkpad);
+  gaeguli_target_set_encoder (self,
+      gaeguli_encode_branch_get_encoder (priv->branch));
+  gaeguli_target_configure_renditions (self, priv->branch);
+
+  priv->has_latency_budget =
+      gaeguli_latency_budget_from_attributes (priv->attributes,
+      &priv->latency_budget);
+
+  leg_first = gst_bin_get_by_name (GST_BIN (self->pipeline), "leg_first");
+  gaeguli_target_configure_queue (self, leg_first);
+  leg_sinkpad = gst_element_get_static_pad (leg_first, "sink");
+
+  priv->sinkpad = gst_ghost_pad_new (NULL, leg_sinkpad);
   gst_object_ref_sink (priv->sinkpad);
   gst_element_add_pad (self->pipeline, priv->sinkpad);
 
+  /* The ghost pad stays in place when the target switches encode branches. */
+  priv->splicer = gaeguli_stream_splicer_new (priv->stream_type);
+  gst_pad_add_probe (priv->sinkpad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, _splice_probe_cb, self, NULL);
+  gst_pad_add_probe (priv->sinkpad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      _count_bytes_probe_cb, self, NULL);
+
   return TRUE;
 
 failed:
+  if (priv->branch) {
+    gaeguli_encode_branch_release_pad (priv->branch, priv->peer_pad);
+    g_clear_object (&priv->branch);
+  }
+
   if (internal_err) {
     g_propagate_error (error, internal_err);
     internal_err = NULL;
@@ -1048,6 +1906,12 @@ gaeguli_target_get_property (GObject * object,
     case PROP_STREAM_TYPE:
       g_value_set_enum (value, priv->stream_type);
       break;
+    case PROP_REFRESH_MODE:
+      g_value_set_enum (value, priv->refresh_mode);
+      break;
+    case PROP_RECONFIGURATION_LATENCY:
+      g_value_set_uint64 (value, priv->reconfiguration_latency);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1123,8 +1987,8 @@ gaeguli_target_set_property (GObject * object,
       if (priv->adaptive_streaming != new_adaptive_streaming) {
         priv->adaptive_streaming = new_adaptive_streaming;
         if (priv->adaptor) {
-          g_object_set (priv->adaptor, "enabled", priv->adaptive_streaming,
-              NULL);
+          g_object_set (priv->adaptor, "enabled",
+              gaeguli_target_wants_adaptor (self), NULL);
         }
         g_object_notify_by_pspec (object, pspec);
       }
@@ -1146,6 +2010,9 @@ gaeguli_target_set_property (GObject * object,
     case PROP_STREAM_TYPE:
       priv->stream_type = g_value_get_enum (value);
       break;
+    case PROP_REFRESH_MODE:
+      priv->refresh_mode = g_value_get_enum (value);
+      break;
     case PROP_ATTRIBUTES:
       priv->attributes = g_value_dup_variant (value);
       g_debug ("set attributes!!!");
@@ -1162,11 +2029,41 @@ gaeguli_target_dispose (GObject * object)
   GaeguliTarget *self = GAEGULI_TARGET (object);
   GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
 
+  if (priv->gop_cache_probe) {
+    g_autoptr (GstPad) srtsink_pad =
+        gst_element_get_static_pad (priv->srtsink, "sink");
+
+    gst_pad_remove_probe (srtsink_pad, priv->gop_cache_probe);
+    priv->gop_cache_probe = 0;
+  }
+
+  if (priv->rendition_probe) {
+    g_autoptr (GstPad) srtsink_pad =
+        gst_element_get_static_pad (priv->srtsink, "sink");
+
+    gst_pad_remove_probe (srtsink_pad, priv->rendition_probe);
+    priv->rendition_probe = 0;
+  }
+
+  if (priv->rendition_poll_id) {
+    gaeguli_stats_poller_remove (priv->rendition_poll_id);
+    priv->rendition_poll_id = 0;
+  }
+
+  gaeguli_target_reset_queue (self);
+
   gst_clear_object (&self->pipeline);
-  gst_clear_object (&priv->encoder);
+  gaeguli_target_set_encoder (self, NULL);
   gst_clear_object (&priv->srtsink);
+  g_clear_pointer (&priv->gop_cache, gaeguli_gop_cache_free);
+  g_clear_pointer (&priv->splicer, gaeguli_stream_splicer_free);
+  g_clear_pointer (&priv->renditions, g_ptr_array_unref);
+  g_clear_pointer (&priv->rendition_router, gaeguli_rendition_router_free);
   gst_clear_object (&priv->peer_pad);
+  gst_clear_object (&priv->pending_peer_pad);
   gst_clear_object (&priv->sinkpad);
+  g_clear_object (&priv->branch);
+  g_clear_object (&priv->pending_branch);
 
   g_clear_object (&priv->adaptor);
 
@@ -1314,6 +2211,12 @@ gaeguli_target_class_init (GaeguliTargetClass * klass)
       GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_REFRESH_MODE] =
+      g_param_spec_enum ("refresh-mode", "refresh mode",
+      "How the encoder refreshes the picture", GAEGULI_TYPE_VIDEO_REFRESH_MODE,
+      GAEGULI_VIDEO_REFRESH_MODE_IDR,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
   properties[PROP_ATTRIBUTES] =
       g_param_spec_variant ("attributes",
       "The unified attriutes to set target-specific parameters",
@@ -1321,6 +2224,12 @@ gaeguli_target_class_init (GaeguliTargetClass * klass)
       G_VARIANT_TYPE_VARDICT, NULL,
       G_PARAM_WRITABLE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_RECONFIGURATION_LATENCY] =
+      g_param_spec_uint64 ("reconfiguration-latency",
+      "Encoder reconfiguration latency",
+      "Time in nanoseconds the last encoder reconfiguration took until the "
+      "first frame encoded with the new parameters",
+      0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
   g_object_class_install_properties (gobject_class, G_N_ELEMENTS (properties),
       properties);
@@ -1361,6 +2270,7 @@ gaeguli_target_new_full (GstPad * peer_pad, guint id,
   GaeguliVideoCodec codec = GAEGULI_VIDEO_CODEC_H264_X264;
   GaeguliVideoStreamType stream_type =
       GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS_OVER_SRT;
+  GaeguliVideoRefreshMode refresh_mode = GAEGULI_VIDEO_REFRESH_MODE_IDR;
   guint bitrate = 512;
   guint idr_period = 10;
   const gchar *location = NULL;
@@ -1388,6 +2298,7 @@ gaeguli_target_new_full (GstPad * peer_pad, guint id,
 
   g_variant_dict_lookup (&attr, "codec", "i", &codec);
   g_variant_dict_lookup (&attr, "stream-type", "i", &stream_type);
+  g_variant_dict_lookup (&attr, "refresh-mode", "i", &refresh_mode);
   g_variant_dict_lookup (&attr, "bitrate", "u", &bitrate);
   g_variant_dict_lookup (&attr, "idr-period", "u", &idr_period);
   g_variant_dict_lookup (&attr, "username", "s", &username);
@@ -1396,8 +2307,9 @@ gaeguli_target_new_full (GstPad * peer_pad, guint id,
 
   return g_initable_new (GAEGULI_TYPE_TARGET, NULL, error, "id", id,
       "peer-pad", peer_pad, "codec", codec, "stream-type", stream_type,
-      "bitrate", bitrate, "idr-period", idr_period, "uri", location, "username",
-      username, "is-recording", is_record, "location", location,
+      "refresh-mode", refresh_mode, "bitrate", bitrate, "idr-period",
+      idr_period, "uri", location, "username", username, "is-recording",
+      is_record, "location", location,
       "attributes", g_variant_dict_end (&attr), NULL);
 }
 
@@ -1464,6 +2376,14 @@ _link_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
     g_debug ("finished link target [%x]", self->id);
   }
 
+  /* The encoder may be running for other targets already; don't make the
+   * receiver wait for the next GOP. Listeners get their keyframe once a
+   * caller shows up. */
+  if (priv->is_recording ||
+      gaeguli_target_get_srt_mode (self) != GAEGULI_SRT_MODE_LISTENER) {
+    gaeguli_target_request_keyframe (self);
+  }
+
   g_signal_emit (self, signals[SIG_STREAM_STARTED], 0);
 
   g_debug ("emitted \"stream-started\" for [%x]", self->id);
@@ -1554,13 +2474,24 @@ gaeguli_target_start (GaeguliTarget * self, GError ** error)
     g_object_set (priv->srtsink, "passphrase", priv->passphrase, "pbkeylen",
         pbkeylen, "streamid", streamid, NULL);
 
+    if (priv->has_latency_budget) {
+      g_object_set (priv->srtsink, "latency", priv->latency_budget.srt_ms,
+          NULL);
+    }
+
     priv->adaptor = g_object_new (priv->adaptor_type, "srtsink", priv->srtsink,
-        "enabled", priv->adaptive_streaming, NULL);
+        "enabled", gaeguli_target_wants_adaptor (self), NULL);
 
     gaeguli_target_update_baseline_parameters (self, TRUE);
 
     g_signal_connect_swapped (priv->adaptor, "encoding-parameters",
-        (GCallback) _set_encoding_parameters, priv->encoder);
+        (GCallback) gaeguli_target_apply_encoding_parameters, self);
+
+    if (priv->rendition_router) {
+      priv->rendition_poll_id = gaeguli_stats_poller_add (priv->srtsink,
+          RENDITION_POLL_INTERVAL_MS, NULL, gaeguli_target_on_rendition_stats,
+          self);
+    }
 
     bus = gst_element_get_bus (self->pipeline);
     gst_bus_set_sync_handler (bus, _bus_sync_srtsink_error_handler,
@@ -1581,6 +2512,8 @@ gaeguli_target_start (GaeguliTarget * self, GError ** error)
     goto failed;
   }
 
+  gaeguli_encode_branch_start (priv->branch);
+
   gst_bin_add (GST_BIN (GST_ELEMENT_PARENT (GST_PAD_PARENT (priv->peer_pad))),
       self->pipeline);
 
@@ -1641,8 +2574,7 @@ _unlink_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
     g_error ("failed to unlink");
   }
 
-  gst_element_release_request_pad (GST_PAD_PARENT (priv->peer_pad),
-      priv->peer_pad);
+  gaeguli_encode_branch_release_pad (priv->branch, priv->peer_pad);
 
   topmost_pipeline =
       GST_ELEMENT (gst_object_get_parent (GST_OBJECT (self->pipeline)));
@@ -1667,29 +2599,77 @@ void
 gaeguli_target_unlink (GaeguliTarget * self)
 {
   GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+  g_autoptr (GstElement) srtsink = NULL;
 
-  LOCK_TARGET;
+  {
+    LOCK_TARGET;
+
+    if (priv->rendition_poll_id) {
+      gaeguli_stats_poller_remove (priv->rendition_poll_id);
+      priv->rendition_poll_id = 0;
+    }
+
+    if (priv->renditions) {
+      g_ptr_array_set_size (priv->renditions, 0);
+    }
 
-  priv->state = GAEGULI_TARGET_STATE_STOPPING;
+    gaeguli_target_reset_queue (self);
 
-  if (priv->pending_pad_probe != 0) {
-    /* Target removed before its link pad probe got called. */
-    gst_pad_remove_probe (priv->peer_pad, priv->pending_pad_probe);
-    priv->pending_pad_probe = 0;
-    priv->state = GAEGULI_TARGET_STATE_STOPPED;
-  } else {
-    g_autoptr (GstPad) pad = NULL;
+    if (priv->pending_peer_pad) {
+      /* Target removed while switching encode branches; stay on the old
+       * one. */
+      gst_pad_remove_probe (priv->pending_peer_pad, priv->pending_pad_probe);
+      priv->pending_pad_probe = 0;
+      gaeguli_encode_branch_release_pad (priv->pending_branch,
+          priv->pending_peer_pad);
+      gst_clear_object (&priv->pending_peer_pad);
+      g_clear_object (&priv->pending_branch);
+    }
+
+    if (priv->state == GAEGULI_TARGET_STATE_NEW) {
+      /* Target never started; just give the encode branch leg back. */
+      gaeguli_encode_branch_release_pad (priv->branch, priv->peer_pad);
+      priv->state = GAEGULI_TARGET_STATE_STOPPED;
+      return;
+    }
 
-    gst_pad_add_probe (priv->peer_pad, GST_PAD_PROBE_TYPE_BLOCK,
-        _unlink_probe_cb, g_object_ref (self), (GDestroyNotify) g_object_unref);
-    /* Immediately closes SRT connection. Dropping buffers in the pad probe
-     * prevents srtsink in NULL state from returning GST_FLOW_FLUSHING, which
-     * could disturb video source pipeline. */
-    pad = gst_element_get_static_pad (priv->srtsink, "sink");
-    gst_pad_add_probe (GST_PAD_PEER (pad), GST_PAD_PROBE_TYPE_BLOCK,
-        _drop_buffers_cb, NULL, NULL);
-    gst_element_set_state (priv->srtsink, GST_STATE_NULL);
+    priv->state = GAEGULI_TARGET_STATE_STOPPING;
+
+    if (priv->pending_pad_probe != 0) {
+      g_autoptr (GstElement) topmost_pipeline = NULL;
+
+      /* Target removed before its link pad probe got called. */
+      gst_pad_remove_probe (priv->peer_pad, priv->pending_pad_probe);
+      priv->pending_pad_probe = 0;
+      gaeguli_encode_branch_release_pad (priv->branch, priv->peer_pad);
+
+      topmost_pipeline =
+          GST_ELEMENT (gst_object_get_parent (GST_OBJECT (self->pipeline)));
+      gst_bin_remove (GST_BIN (topmost_pipeline), self->pipeline);
+
+      priv->state = GAEGULI_TARGET_STATE_STOPPED;
+      return;
+    } else {
+      g_autoptr (GstPad) pad = NULL;
+
+      gst_pad_add_probe (priv->peer_pad, GST_PAD_PROBE_TYPE_BLOCK,
+          _unlink_probe_cb, g_object_ref (self),
+          (GDestroyNotify) g_object_unref);
+      /* Dropping buffers in the pad probe prevents srtsink in NULL state
+       * from returning GST_FLOW_FLUSHING, which could disturb video source
+       * pipeline. */
+      pad = gst_element_get_static_pad (priv->srtsink, "sink");
+      gst_pad_add_probe (GST_PAD_PEER (pad), GST_PAD_PROBE_TYPE_BLOCK,
+          _drop_buffers_cb, NULL, NULL);
+
+      srtsink = gst_object_ref (priv->srtsink);
+    }
   }
+
+  /* Immediately closes SRT connection. The state change waits for the
+   * sink's streaming and accept threads, whose callbacks may take the target
+   * lock to request keyframes, so it must not be held here. */
+  gst_element_set_state (srtsink, GST_STATE_NULL);
 }
 
 static GVariant *_convert_gst_structure_to (GstStructure * s);
@@ -1805,6 +2785,198 @@ gaeguli_target_get_stats (GaeguliTarget * self)
   return NULL;
 }
 
+static guint64
+_get_stats_counter (const GstStructure * s, const gchar * fieldname)
+{
+  const GValue *v = gst_structure_get_value (s, fieldname);
+
+  if (!v) {
+    return 0;
+  }
+
+  switch (G_VALUE_TYPE (v)) {
+    case G_TYPE_INT:
+      return MAX (g_value_get_int (v), 0);
+    case G_TYPE_UINT:
+      return g_value_get_uint (v);
+    case G_TYPE_INT64:
+      return MAX (g_value_get_int64 (v), 0);
+    case G_TYPE_UINT64:
+      return g_value_get_uint64 (v);
+    default:
+      return 0;
+  }
+}
+
+static void
+_fill_stats (GaeguliTargetStats * stats, const GstStructure * s)
+{
+  memset (stats, 0, sizeof (GaeguliTargetStats));
+
+  gst_structure_get_int (s, "socket", &stats->socket);
+  gst_structure_get_double (s, "bandwidth-mbps", &stats->bandwidth_mbps);
+  gst_structure_get_double (s, "send-rate-mbps", &stats->send_rate_mbps);
+  gst_structure_get_double (s, "rtt-ms", &stats->rtt_ms);
+
+  stats->packets_sent = _get_stats_counter (s, "packets-sent");
+  stats->packets_sent_lost = _get_stats_counter (s, "packets-sent-lost");
+  stats->packets_retransmitted =
+      _get_stats_counter (s, "packets-retransmitted");
+  stats->packets_sent_dropped = _get_stats_counter (s, "packets-sent-dropped");
+  stats->bytes_sent = _get_stats_counter (s, "bytes-sent");
+  stats->bytes_retransmitted = _get_stats_counter (s, "bytes-retransmitted");
+  stats->bytes_sent_dropped = _get_stats_counter (s, "bytes-sent-dropped");
+
+  stats->send_buffer_ms = _get_stats_counter (s, "send-buffer-ms");
+  stats->send_buffer_bytes = _get_stats_counter (s, "send-buffer-bytes");
+}
+
+static void
+_add_stats (GaeguliTargetStats * total, const GaeguliTargetStats * stats,
+    gboolean first)
+{
+  total->bandwidth_mbps = first ? stats->bandwidth_mbps :
+      MIN (total->bandwidth_mbps, stats->bandwidth_mbps);
+  total->send_rate_mbps += stats->send_rate_mbps;
+  total->rtt_ms = MAX (total->rtt_ms, stats->rtt_ms);
+
+  total->packets_sent += stats->packets_sent;
+  total->packets_sent_lost += stats->packets_sent_lost;
+  total->packets_retransmitted += stats->packets_retransmitted;
+  total->packets_sent_dropped += stats->packets_sent_dropped;
+
+  total->bytes_sent += stats->bytes_sent;
+  total->bytes_retransmitted += stats->bytes_retransmitted;
+  total->bytes_sent_dropped += stats->bytes_sent_dropped;
+
+  total->send_buffer_ms = MAX (total->send_buffer_ms, stats->send_buffer_ms);
+  total->send_buffer_bytes += stats->send_buffer_bytes;
+}
+
+/*
+ * Fills @stats and @callers from @s, the "stats" of the target's srtsink with
+ * the send buffer fields added, like the stats poller hands them out.
+ */
+void
+gaeguli_target_fill_stats (GaeguliTarget * self, const GstStructure * s,
+    GaeguliTargetStats * stats, GArray * callers)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+  const GValue *callers_value;
+
+  if (callers) {
+    g_array_set_size (callers, 0);
+  }
+
+  callers_value = gst_structure_get_value (s, "callers");
+
+  if (callers_value && G_VALUE_HOLDS (callers_value, G_TYPE_VALUE_ARRAY)) {
+    /* Target is a listener. */
+    GValueArray *a = g_value_get_boxed (callers_value);
+    guint i;
+
+    memset (stats, 0, sizeof (GaeguliTargetStats));
+
+    for (i = 0; i != a->n_values; ++i) {
+      const GstStructure *caller_s =
+          g_value_get_boxed (g_value_array_get_nth (a, i));
+      GaeguliTargetStats caller_stats;
+
+      _fill_stats (&caller_stats, caller_s);
+      _add_stats (stats, &caller_stats, i == 0);
+
+      if (callers) {
+        g_array_append_val (callers, caller_stats);
+      }
+    }
+  } else {
+    _fill_stats (stats, s);
+  }
+
+  stats->latency_budget = priv->latency_budget;
+
+  {
+    LOCK_TARGET;
+
+    stats->buffers_dropped = priv->buffers_dropped;
+
+    if (priv->branch) {
+      gaeguli_encode_branch_get_encoded_frame_stats (priv->branch,
+          &stats->frames_encoded, &stats->encoder_qp);
+    }
+  }
+}
+
+gboolean
+gaeguli_target_get_stats_into (GaeguliTarget * self,
+    GaeguliTargetStats * stats, GArray * callers)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_autoptr (GstStructure) s = NULL;
+
+  g_return_val_if_fail (GAEGULI_IS_TARGET (self), FALSE);
+  g_return_val_if_fail (stats != NULL, FALSE);
+  g_return_val_if_fail (callers == NULL ||
+      g_array_get_element_size (callers) == sizeof (GaeguliTargetStats), FALSE);
+
+  if (callers) {
+    g_array_set_size (callers, 0);
+  }
+
+  if (!priv->srtsink) {
+    return FALSE;
+  }
+
+  g_object_get (priv->srtsink, "stats", &s, NULL);
+  if (!s) {
+    return FALSE;
+  }
+
+  gaeguli_srt_stats_add_send_buffer (s);
+  gaeguli_target_fill_stats (self, s, stats, callers);
+
+  return TRUE;
+}
+
+/*
+ * Registers the target's srtsink with the stats poller; see
+ * gaeguli_stats_poller_add_full(). @func gets snapshots to pass to
+ * gaeguli_target_fill_stats().
+ *
+ * Returns: the poller entry id, or 0 if the target doesn't stream over SRT
+ */
+guint
+gaeguli_target_add_stats_poll (GaeguliTarget * self, guint interval_ms,
+    GMainContext * context, GaeguliStatsPollerFunc func, gpointer user_data,
+    GDestroyNotify notify)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_return_val_if_fail (GAEGULI_IS_TARGET (self), 0);
+
+  if (!priv->srtsink || priv->is_recording) {
+    return 0;
+  }
+
+  return gaeguli_stats_poller_add_full (priv->srtsink, interval_ms, context,
+      func, user_data, notify);
+}
+
+guint64
+gaeguli_target_get_bytes_encoded (GaeguliTarget * self)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+
+  g_return_val_if_fail (GAEGULI_IS_TARGET (self), 0);
+
+  {
+    LOCK_TARGET;
+
+    return priv->bytes_encoded;
+  }
+}
+
 GaeguliStreamAdaptor *
 gaeguli_target_get_stream_adaptor (GaeguliTarget * self)
 {
@@ -1831,7 +3003,8 @@ gaeguli_target_push_text (GaeguliTarget * self, const gchar * text)
   g_return_val_if_fail (priv->stream_type ==
       GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT, FALSE);
 
-  appsrc = gst_bin_get_by_name (GST_BIN (self->pipeline), "appsrc");
+  appsrc = gst_bin_get_by_name (GST_BIN (gaeguli_encode_branch_get_bin
+          (priv->branch)), "appsrc");
 
   caps = gst_caps_from_string ("text/x-raw");
 
@@ -1852,3 +3025,26 @@ gaeguli_target_push_text (GaeguliTarget * self, const gchar * text)
 
   return ret == GST_FLOW_OK;
 }
+
+gboolean
+gaeguli_target_request_keyframe (GaeguliTarget * self)
+{
+  GaeguliTargetPrivate *priv = gaeguli_target_get_instance_private (self);
+  g_autoptr (GaeguliEncodeBranch) branch = NULL;
+
+  g_return_val_if_fail (GAEGULI_IS_TARGET (self), FALSE);
+
+  {
+    LOCK_TARGET;
+
+    if (priv->branch == NULL) {
+      return FALSE;
+    }
+
+    branch = g_object_ref (priv->branch);
+  }
+
+  g_debug ("target [%x] requests a keyframe", self->id);
+
+  return gaeguli_encode_branch_request_key_unit (branch);
+}
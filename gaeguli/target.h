@@ -52,6 +52,83 @@ struct _GaeguliTarget
   GstElement *pipeline;
 };
 
+/**
+ * GaeguliLatencyBudget:
+ * @total_ms: the "latency-budget-ms" attribute of the target, 0 if it has none
+ * @encoder_ms: time reserved for encoding a frame
+ * @mux_ms: time reserved for muxing and timestamp smoothing
+ * @queue_ms: the longest time the target's queue holds data
+ * @srt_ms: SRT latency, i.e. time left for retransmissions
+ *
+ * How a target split its latency budget among the stages of its pipeline.
+ * The stages may add up to more than @total_ms when the budget is too small
+ * to fit their minimums.
+ */
+typedef struct _GaeguliLatencyBudget GaeguliLatencyBudget;
+
+struct _GaeguliLatencyBudget
+{
+  guint total_ms;
+  guint encoder_ms;
+  guint mux_ms;
+  guint queue_ms;
+  guint srt_ms;
+};
+
+/**
+ * GaeguliTargetStats:
+ * @socket: SRT socket of a listener's caller, 0 if unknown
+ * @bandwidth_mbps: estimated link bandwidth
+ * @send_rate_mbps: current sending rate
+ * @rtt_ms: smoothed round trip time
+ * @packets_sent: data packets sent, including retransmissions
+ * @packets_sent_lost: packets reported lost by the receiver
+ * @packets_retransmitted: packets retransmitted
+ * @packets_sent_dropped: packets dropped as too late to send
+ * @bytes_sent: bytes sent, including retransmissions
+ * @bytes_retransmitted: bytes retransmitted
+ * @bytes_sent_dropped: bytes dropped as too late to send
+ * @send_buffer_ms: timespan of data waiting in the SRT send buffer
+ * @send_buffer_bytes: size of data waiting in the SRT send buffer
+ * @buffers_dropped: buffers the target's queue dropped to keep up with the
+ *     source; always counted for the whole target
+ * @frames_encoded: frames the target's encoder reported statistics for; 0
+ *     if the encoder doesn't report any
+ * @encoder_qp: smoothed average quantizer of the encoded frames
+ * @latency_budget: the target's latency budget breakdown
+ *
+ * Statistics of a SRT connection, filled by gaeguli_target_get_stats_into().
+ */
+typedef struct _GaeguliTargetStats GaeguliTargetStats;
+
+struct _GaeguliTargetStats
+{
+  gint socket;
+
+  gdouble bandwidth_mbps;
+  gdouble send_rate_mbps;
+  gdouble rtt_ms;
+
+  guint64 packets_sent;
+  guint64 packets_sent_lost;
+  guint64 packets_retransmitted;
+  guint64 packets_sent_dropped;
+
+  guint64 bytes_sent;
+  guint64 bytes_retransmitted;
+  guint64 bytes_sent_dropped;
+
+  guint send_buffer_ms;
+  guint64 send_buffer_bytes;
+
+  guint64 buffers_dropped;
+
+  guint64 frames_encoded;
+  gdouble encoder_qp;
+
+  GaeguliLatencyBudget latency_budget;
+};
+
 GaeguliTarget          *gaeguli_target_new_full      (GstPad                *peer_pad,
                                                       guint                  id,
                                                       GVariant              *attributes,
@@ -85,12 +162,57 @@ const gchar            *gaeguli_target_get_peer_address
 
 GVariant               *gaeguli_target_get_stats      (GaeguliTarget       *self);
 
+/**
+ * gaeguli_target_get_stats_into:
+ * @self: a #GaeguliTarget object
+ * @stats: (out caller-allocates): a #GaeguliTargetStats to fill
+ * @callers: (nullable): a #GArray of #GaeguliTargetStats, resized to the
+ *     number of callers connected to a listener target
+ *
+ * A cheaper alternative to gaeguli_target_get_stats() for frequent polling.
+ * The caller may reuse @stats and @callers between calls, so reading the
+ * statistics doesn't need any allocations beyond those of srtsink. For
+ * listener targets, @stats holds the sums over all callers, except for
+ * @rtt_ms and @send_buffer_ms, which are the maxima, and @bandwidth_mbps,
+ * which is the minimum.
+ *
+ * Returns: %TRUE if the statistics were read
+ */
+gboolean                gaeguli_target_get_stats_into (GaeguliTarget       *self,
+                                                       GaeguliTargetStats  *stats,
+                                                       GArray              *callers);
+
+/**
+ * gaeguli_target_get_bytes_encoded:
+ * @self: a #GaeguliTarget object
+ *
+ * Returns: the number of bytes of encoded stream the target received from
+ * its encoder since it was created
+ */
+guint64                 gaeguli_target_get_bytes_encoded
+                                                     (GaeguliTarget        *self);
+
 GaeguliStreamAdaptor   *gaeguli_target_get_stream_adaptor
                                                      (GaeguliTarget *self);
 
 gboolean                gaeguli_target_push_text    (GaeguliTarget         *self,
                                                      const gchar           *text);
 
+/**
+ * gaeguli_target_request_keyframe:
+ * @self: a #GaeguliTarget object
+ *
+ * Asks the target's encoder for an IDR frame, so that a receiver doesn't have
+ * to wait for the next GOP to start decoding. Targets request keyframes
+ * themselves when they start streaming and when a caller joins a listener.
+ * Requests following the previous one sooner than the "keyframe-min-interval"
+ * attribute (in milliseconds, 1000 by default) are ignored.
+ *
+ * Returns: %TRUE if the request was sent to the encoder
+ */
+gboolean                gaeguli_target_request_keyframe
+                                                    (GaeguliTarget         *self);
+
 G_END_DECLS
 
 #endif // __GAEGULI_TARGET_H__
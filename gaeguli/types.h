@@ -80,6 +80,11 @@ typedef enum {
   GAEGULI_VIDEO_BITRATE_CONTROL_VBR,
 } GaeguliVideoBitrateControl;
 
+typedef enum {
+  GAEGULI_VIDEO_REFRESH_MODE_IDR = 0,
+  GAEGULI_VIDEO_REFRESH_MODE_INTRA_REFRESH,
+} GaeguliVideoRefreshMode;
+
 typedef enum {
   GAEGULI_VIDEO_RESOLUTION_UNKNOWN = 0,
   GAEGULI_VIDEO_RESOLUTION_640X480,
@@ -104,6 +109,26 @@ typedef enum {
   GAEGULI_TARGET_STATE_ERROR
 } GaeguliTargetState;
 
+typedef enum {
+  GAEGULI_QUEUE_DROP_MODE_NONE,
+  GAEGULI_QUEUE_DROP_MODE_OLDEST,
+  GAEGULI_QUEUE_DROP_MODE_UNTIL_KEYFRAME
+} GaeguliQueueDropMode;
+
+typedef enum {
+  GAEGULI_MPEG_TS_MODE_SMOOTHED = 0,
+  GAEGULI_MPEG_TS_MODE_LOW_LATENCY,
+} GaeguliMpegTsMode;
+
+typedef enum {
+  GAEGULI_STREAM_QUALITY_REASON_NONE = 0,
+  GAEGULI_STREAM_QUALITY_REASON_BITRATE,
+  GAEGULI_STREAM_QUALITY_REASON_QUANTIZER,
+  GAEGULI_STREAM_QUALITY_REASON_RESOLUTION,
+  GAEGULI_STREAM_QUALITY_REASON_FRAME_SKIP,
+  GAEGULI_STREAM_QUALITY_REASON_FRAMERATE,
+} GaeguliStreamQualityReason;
+
 typedef enum {
   GAEGULI_IDCT_METHOD_ISLOW = 0,
   GAEGULI_IDCT_METHOD_IFAST = 1,
@@ -0,0 +1,203 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "latency.h"
+
+#include <gst/video/video.h>
+
+#define STAMP_BITS      32
+#define STAMP_BLOCK     16
+#define STAMP_HIGH      224
+#define STAMP_LOW       32
+
+static gboolean
+_can_stamp (const GstVideoInfo * info)
+{
+  const GstVideoFormatInfo *finfo = info->finfo;
+
+  return GST_VIDEO_FORMAT_INFO_DEPTH (finfo, 0) == 8 &&
+      !GST_VIDEO_FORMAT_INFO_IS_COMPLEX (finfo) &&
+      !GST_VIDEO_FORMAT_INFO_HAS_PALETTE (finfo) &&
+      GST_VIDEO_INFO_WIDTH (info) >= STAMP_BITS * STAMP_BLOCK &&
+      GST_VIDEO_INFO_HEIGHT (info) >= 2 * STAMP_BLOCK;
+}
+
+/* Only the luma of YUV formats; all color components of RGB ones. */
+static guint
+_get_n_stamp_components (GstVideoFrame * frame)
+{
+  return GST_VIDEO_FORMAT_INFO_IS_RGB (frame->info.finfo) ? 3 : 1;
+}
+
+static void
+_draw_block (GstVideoFrame * frame, guint x, guint y, guint8 value)
+{
+  guint n_components = _get_n_stamp_components (frame);
+  guint c;
+
+  for (c = 0; c < n_components; ++c) {
+    guint8 *data = GST_VIDEO_FRAME_COMP_DATA (frame, c);
+    gint stride = GST_VIDEO_FRAME_COMP_STRIDE (frame, c);
+    gint pstride = GST_VIDEO_FRAME_COMP_PSTRIDE (frame, c);
+    guint i, j;
+
+    for (j = y; j < y + STAMP_BLOCK; ++j) {
+      for (i = x; i < x + STAMP_BLOCK; ++i) {
+        data[j * stride + i * pstride] = value;
+      }
+    }
+  }
+}
+
+static gboolean
+_read_block (GstVideoFrame * frame, guint x, guint y)
+{
+  guint8 *data = GST_VIDEO_FRAME_COMP_DATA (frame, 0);
+  gint stride = GST_VIDEO_FRAME_COMP_STRIDE (frame, 0);
+  gint pstride = GST_VIDEO_FRAME_COMP_PSTRIDE (frame, 0);
+
+  /* The middle of the block is the least affected by compression. */
+  x += STAMP_BLOCK / 2;
+  y += STAMP_BLOCK / 2;
+
+  return data[y * stride + x * pstride] > (STAMP_HIGH + STAMP_LOW) / 2;
+}
+
+static GstPadProbeReturn
+_stamp_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  g_autoptr (GstCaps) caps = gst_pad_get_current_caps (pad);
+  /* Microseconds of the monotonic clock; the receiver subtracts it modulo
+   * 2^32, so the wraparound doesn't matter. */
+  guint32 stamp = g_get_monotonic_time ();
+  GstVideoInfo vinfo;
+  GstVideoFrame frame;
+  GstBuffer *buffer;
+  guint i;
+
+  if (!caps || !gst_video_info_from_caps (&vinfo, caps) ||
+      !_can_stamp (&vinfo)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+
+  if (!gst_video_frame_map (&frame, &vinfo, buffer, GST_MAP_WRITE)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  for (i = 0; i < STAMP_BITS; ++i) {
+    gboolean bit = (stamp >> i) & 1;
+
+    _draw_block (&frame, i * STAMP_BLOCK, 0, bit ? STAMP_HIGH : STAMP_LOW);
+    _draw_block (&frame, i * STAMP_BLOCK, STAMP_BLOCK,
+        bit ? STAMP_LOW : STAMP_HIGH);
+  }
+
+  gst_video_frame_unmap (&frame);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gint
+_is_videotestsrc (const GValue * value, gconstpointer user_data)
+{
+  GstElement *element = g_value_get_object (value);
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (factory && g_str_equal (GST_OBJECT_NAME (factory), "videotestsrc")) {
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Starts stamping the frames of the videotestsrc @target streams from. The
+ * target must have been started.
+ */
+gboolean
+gaeguli_tests_stamp_capture_time (GaeguliTarget * target)
+{
+  g_autoptr (GstIterator) it = NULL;
+  g_autoptr (GstPad) srcpad = NULL;
+  GstObject *top = gst_object_ref (target->pipeline);
+  GstObject *parent;
+  GValue value = G_VALUE_INIT;
+  gboolean found;
+
+  while ((parent = gst_object_get_parent (top))) {
+    gst_object_unref (top);
+    top = parent;
+  }
+
+  it = gst_bin_iterate_recurse (GST_BIN (top));
+  found = gst_iterator_find_custom (it, _is_videotestsrc, &value, NULL);
+  gst_object_unref (top);
+
+  if (!found) {
+    return FALSE;
+  }
+
+  srcpad = gst_element_get_static_pad (g_value_get_object (&value), "src");
+  g_value_unset (&value);
+
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER, _stamp_probe_cb,
+      NULL, NULL);
+
+  return TRUE;
+}
+
+/*
+ * Reads the stamp from a decoded frame. Returns %FALSE when the frame has
+ * none or it got damaged.
+ */
+gboolean
+gaeguli_tests_read_capture_latency (GstBuffer * buffer, GstCaps * caps,
+    GstClockTime * latency)
+{
+  guint32 now = g_get_monotonic_time ();
+  guint32 stamp = 0;
+  GstVideoInfo vinfo;
+  GstVideoFrame frame;
+  guint i;
+
+  if (!gst_video_info_from_caps (&vinfo, caps) || !_can_stamp (&vinfo)) {
+    return FALSE;
+  }
+
+  if (!gst_video_frame_map (&frame, &vinfo, buffer, GST_MAP_READ)) {
+    return FALSE;
+  }
+
+  for (i = 0; i < STAMP_BITS; ++i) {
+    gboolean bit = _read_block (&frame, i * STAMP_BLOCK, 0);
+
+    if (bit == _read_block (&frame, i * STAMP_BLOCK, STAMP_BLOCK)) {
+      gst_video_frame_unmap (&frame);
+      return FALSE;
+    }
+
+    stamp |= (guint32) bit << i;
+  }
+
+  gst_video_frame_unmap (&frame);
+
+  *latency = (guint32) (now - stamp) * GST_USECOND;
+
+  return TRUE;
+}
@@ -0,0 +1,43 @@
+/**
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __GAEGULI_TESTS_LATENCY_H__
+#define __GAEGULI_TESTS_LATENCY_H__
+
+#include "gaeguli/gaeguli.h"
+
+/*
+ * Glass-to-glass latency measurement. The sender draws the time each frame
+ * leaves the video test source into the top of the picture as two rows of
+ * 16x16 blocks, the second one inverted to detect damaged stamps. A receiver
+ * in the same process decodes the video and compares the stamp with the
+ * current time. The blocks survive any reasonable encoding, so this works
+ * with every codec and stream type; the picture must be at least 512 pixels
+ * wide.
+ */
+
+typedef void    (*GaeguliTestsLatencyFunc)      (GstClockTime latency,
+                                                 gpointer data);
+
+gboolean          gaeguli_tests_stamp_capture_time
+                                                (GaeguliTarget *target);
+
+gboolean          gaeguli_tests_read_capture_latency
+                                                (GstBuffer *buffer,
+                                                 GstCaps *caps,
+                                                 GstClockTime *latency);
+
+#endif // __GAEGULI_TESTS_LATENCY_H__
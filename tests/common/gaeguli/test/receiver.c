@@ -37,6 +37,72 @@ gaeguli_tests_create_receiver (GaeguliSRTMode mode, guint port)
   return g_steal_pointer (&receiver);
 }
 
+typedef struct
+{
+  GaeguliTestsLatencyFunc func;
+  gpointer data;
+} LatencyReceiverData;
+
+static void
+_latency_handoff_cb (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    LatencyReceiverData * receiver_data)
+{
+  g_autoptr (GstCaps) caps = gst_pad_get_current_caps (pad);
+  GstClockTime latency;
+
+  if (caps && gaeguli_tests_read_capture_latency (buffer, caps, &latency)) {
+    receiver_data->func (latency, receiver_data->data);
+  }
+}
+
+/* Decodes the received video and calls @func with the latency of every frame
+ * stamped by gaeguli_tests_stamp_capture_time(). The receiver asks for
+ * @srt_latency milliseconds of SRT latency; SRT uses the larger of the
+ * sender's and the receiver's. */
+GstElement *
+gaeguli_tests_create_latency_receiver (GaeguliSRTMode mode, guint port,
+    GaeguliVideoStreamType stream_type, guint srt_latency,
+    GaeguliTestsLatencyFunc func, gpointer data)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GstElement) sink = NULL;
+  g_autofree gchar *pipeline_str = NULL;
+  gchar *mode_str = mode == GAEGULI_SRT_MODE_CALLER ? "caller" : "listener";
+  const gchar *depay_str = "";
+  LatencyReceiverData *receiver_data;
+
+  /* Each SRT message carries a single RTP packet. The text stream next to
+   * the video stays silent unless the sender pushes some. */
+  if (stream_type == GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT) {
+    depay_str = "application/x-rtp, media=video, clock-rate=90000, "
+        "encoding-name=H264, payload=96 ! rtph264depay ! ";
+  }
+
+  pipeline_str =
+      g_strdup_printf ("srtsrc uri=\"srt://127.0.0.1:%d?mode=%s&latency=%u\" "
+      "name=src ! %sdecodebin ! videoconvert ! video/x-raw, format=GRAY8 ! "
+      "fakesink name=sink signal-handoffs=1 sync=0", port, mode_str,
+      srt_latency, depay_str);
+
+  receiver = gst_parse_launch (pipeline_str, &error);
+  g_assert_no_error (error);
+
+  receiver_data = g_new0 (LatencyReceiverData, 1);
+  receiver_data->func = func;
+  receiver_data->data = data;
+  g_object_set_data_full (G_OBJECT (receiver), "latency-receiver-data",
+      receiver_data, g_free);
+
+  sink = gst_bin_get_by_name (GST_BIN (receiver), "sink");
+  g_signal_connect (sink, "handoff", G_CALLBACK (_latency_handoff_cb),
+      receiver_data);
+
+  gst_element_set_state (receiver, GST_STATE_PLAYING);
+
+  return g_steal_pointer (&receiver);
+}
+
 void
 gaeguli_tests_receiver_set_handoff_callback (GstElement * receiver,
     GCallback callback, gpointer data)
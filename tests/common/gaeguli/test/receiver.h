@@ -16,10 +16,19 @@
  */
 
 #include "gaeguli/gaeguli.h"
+#include "gaeguli/test/latency.h"
 
 GstElement       *gaeguli_tests_create_receiver (GaeguliSRTMode mode,
                                                  guint port);
 
+GstElement       *gaeguli_tests_create_latency_receiver
+                                                (GaeguliSRTMode mode,
+                                                 guint port,
+                                                 GaeguliVideoStreamType stream_type,
+                                                 guint srt_latency,
+                                                 GaeguliTestsLatencyFunc func,
+                                                 gpointer data);
+
 void              gaeguli_tests_receiver_set_handoff_callback
                                                 (GstElement *receiver,
                                                  GCallback handoff_callback,
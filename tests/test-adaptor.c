@@ -23,6 +23,13 @@
 
 #include <adaptors/nulladaptor.h>
 #include <adaptors/bandwidthadaptor.h>
+#include <adaptors/delaygradientadaptor.h>
+#include <adaptors/sendbufferadaptor.h>
+#include <adaptors/ladderadaptor.h>
+#include <renditionrouter.h>
+#include <statspoller.h>
+
+#include <string.h>
 
 GMainLoop *loop = NULL;
 
@@ -54,14 +61,16 @@ G_DEFINE_TYPE (GaeguliTestAdaptor, gaeguli_test_adaptor,
 /* *INDENT-ON* */
 
 static void
-_on_encoder_property_change (GObject * encoder, GParamSpec * pspec,
+_on_target_encoding_change (GaeguliTarget * target, GParamSpec * pspec,
     gpointer user_data)
 {
   guint bitrate, quantizer;
 
-  g_object_get (encoder, "bitrate", &bitrate, "quantizer", &quantizer, NULL);
+  g_object_get (target, "bitrate-actual", &bitrate, "quantizer-actual",
+      &quantizer, NULL);
   /* x264enc takes bitrate in kbps */
-  if (bitrate == TEST_BITRATE1 / 1000 && quantizer == TEST_QUANTIZATION) {
+  if (bitrate == TEST_BITRATE1 - TEST_BITRATE1 % 1000 &&
+      quantizer == TEST_QUANTIZATION) {
     g_debug ("Stopping the main loop");
     g_main_loop_quit (loop);
   }
@@ -121,20 +130,8 @@ gaeguli_test_adaptor_on_stats (GaeguliStreamAdaptor * self,
   test_adaptor->last_callback = now;
 
   if (--test_adaptor->callbacks_left == 0) {
-    g_autoptr (GstElement) srtsink = NULL;
-    g_autoptr (GstElement) encoder = NULL;
-
     g_debug ("Invoking change of encoding parameters");
 
-    g_object_get (self, "srtsink", &srtsink, NULL);
-
-    encoder = gst_bin_get_by_name (GST_BIN (GST_ELEMENT_PARENT (srtsink)),
-        "enc");
-    g_assert_nonnull (encoder);
-
-    g_signal_connect (encoder, "notify",
-        G_CALLBACK (_on_encoder_property_change), NULL);
-
     gaeguli_stream_adaptor_signal_encoding_parameters (self,
         GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, TEST_BITRATE1,
         GAEGULI_ENCODING_PARAMETER_QUANTIZER, G_TYPE_UINT, TEST_QUANTIZATION,
@@ -210,7 +207,14 @@ struct _GaeguliDummySrtSink
 {
   GstElement parent;
 
+  GMutex lock;
+  GCond cond;
   GstStructure *stats;
+  /* Reading "stats" blocks while set, so tests can act during a poll. */
+  gboolean hold_polls;
+  gboolean polled;
+  /* Numbers the readings, in the "reading" field of "stats". */
+  guint n_reads;
 };
 
 /* *INDENT-OFF* */
@@ -229,14 +233,52 @@ gaeguli_dummy_srtsink_set_stats (GaeguliDummySrtSink * self, const gchar * name,
 {
   va_list varargs;
 
+  g_mutex_lock (&self->lock);
   va_start (varargs, name);
   gst_structure_set_valist (self->stats, name, varargs);
   va_end (varargs);
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gaeguli_dummy_srtsink_hold_polls (GaeguliDummySrtSink * self, gboolean hold)
+{
+  g_mutex_lock (&self->lock);
+  self->hold_polls = hold;
+  if (hold) {
+    self->polled = FALSE;
+  }
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gaeguli_dummy_srtsink_wait_for_poll (GaeguliDummySrtSink * self)
+{
+  g_mutex_lock (&self->lock);
+  while (!self->polled) {
+    g_cond_wait (&self->cond, &self->lock);
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static guint
+gaeguli_dummy_srtsink_get_n_reads (GaeguliDummySrtSink * self)
+{
+  guint n_reads;
+
+  g_mutex_lock (&self->lock);
+  n_reads = self->n_reads;
+  g_mutex_unlock (&self->lock);
+
+  return n_reads;
 }
 
 static void
 gaeguli_dummy_srtsink_init (GaeguliDummySrtSink * self)
 {
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
   self->stats = gst_structure_new_empty ("application/x-srt-statistics");
 }
 
@@ -248,7 +290,16 @@ gaeguli_dummy_srtsink_get_property (GObject * object, guint property_id,
 
   switch (property_id) {
     case PROP_STATS:
+      g_mutex_lock (&self->lock);
+      self->polled = TRUE;
+      g_cond_broadcast (&self->cond);
+      while (self->hold_polls) {
+        g_cond_wait (&self->cond, &self->lock);
+      }
+      gst_structure_set (self->stats, "reading", G_TYPE_UINT, ++self->n_reads,
+          NULL);
       g_value_set_boxed (value, self->stats);
+      g_mutex_unlock (&self->lock);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -263,6 +314,17 @@ gaeguli_dummy_srtsink_dispose (GObject * object)
   gst_clear_structure (&self->stats);
 }
 
+static void
+gaeguli_dummy_srtsink_finalize (GObject * object)
+{
+  GaeguliDummySrtSink *self = GAEGULI_DUMMY_SRTSINK (object);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (gaeguli_dummy_srtsink_parent_class)->finalize (object);
+}
+
 static void
 gaeguli_dummy_srtsink_class_init (GaeguliDummySrtSinkClass * klass)
 {
@@ -270,6 +332,7 @@ gaeguli_dummy_srtsink_class_init (GaeguliDummySrtSinkClass * klass)
 
   gobject_class->get_property = gaeguli_dummy_srtsink_get_property;
   gobject_class->dispose = gaeguli_dummy_srtsink_dispose;
+  gobject_class->finalize = gaeguli_dummy_srtsink_finalize;
 
   g_object_class_install_property (gobject_class, PROP_STATS,
       g_param_spec_boxed ("stats", "Statistics",
@@ -306,6 +369,11 @@ test_gaeguli_adaptor_stats ()
       TEST_BITRATE2, "srt://127.0.0.1:1111", NULL, &error);
   g_assert_no_error (error);
 
+  /* A quantizer change makes the target switch to a reconfigured encoder, so
+   * follow the target rather than any particular encoder element. */
+  g_signal_connect (target, "notify::quantizer-actual",
+      G_CALLBACK (_on_target_encoding_change), NULL);
+
   gaeguli_target_start (target, &error);
   g_assert_no_error (error);
 
@@ -417,6 +485,858 @@ test_gaeguli_adaptor_bandwidth ()
   g_assert_true (data.params_change_triggered);
 }
 
+typedef struct
+{
+  guint bitrate;
+  guint changes;
+} DelayGradientTestData;
+
+static void
+_delay_gradient_on_encoding_parameters (DelayGradientTestData * data,
+    GstStructure * params)
+{
+  if (gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_BITRATE,
+          &data->bitrate)) {
+    ++data->changes;
+  }
+}
+
+/* Hands the adaptor a stats structure directly, without the stats poller, so
+ * that the test doesn't depend on timing. */
+static void
+_delay_gradient_feed (GaeguliStreamAdaptor * adaptor, gdouble rtt_ms,
+    gint send_buffer_ms)
+{
+  g_autoptr (GstStructure) stats =
+      gst_structure_new ("application/x-srt-statistics",
+      "rtt-ms", G_TYPE_DOUBLE, rtt_ms,
+      "send-buffer-ms", G_TYPE_INT, send_buffer_ms, NULL);
+
+  GAEGULI_STREAM_ADAPTOR_GET_CLASS (adaptor)->on_stats (adaptor, stats);
+}
+
+/* Like _delay_gradient_feed(), but with the stats of a listener that has two
+ * callers, only the first of which has data waiting in its send buffer. */
+static void
+_delay_gradient_feed_callers (GaeguliStreamAdaptor * adaptor,
+    gint send_buffer_ms)
+{
+  g_autoptr (GstStructure) stats =
+      gst_structure_new_empty ("application/x-srt-statistics");
+  const gint caller_send_buffer_ms[] = { send_buffer_ms, 0 };
+  GValue value = G_VALUE_INIT;
+  GValueArray *callers;
+  guint i;
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  callers = g_value_array_new (G_N_ELEMENTS (caller_send_buffer_ms));
+
+  for (i = 0; i < G_N_ELEMENTS (caller_send_buffer_ms); ++i) {
+    GValue caller = G_VALUE_INIT;
+
+    g_value_init (&caller, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&caller,
+        gst_structure_new ("application/x-srt-statistics",
+            "rtt-ms", G_TYPE_DOUBLE, 40.0,
+            "send-buffer-ms", G_TYPE_INT, caller_send_buffer_ms[i], NULL));
+    g_value_array_append (callers, &caller);
+    g_value_unset (&caller);
+  }
+  G_GNUC_END_IGNORE_DEPRECATIONS
+
+  g_value_init (&value, G_TYPE_VALUE_ARRAY);
+  g_value_take_boxed (&value, callers);
+  gst_structure_take_value (stats, "callers", &value);
+
+  GAEGULI_STREAM_ADAPTOR_GET_CLASS (adaptor)->on_stats (adaptor, stats);
+}
+
+static void
+test_gaeguli_adaptor_delay_gradient ()
+{
+  g_autoptr (GaeguliStreamAdaptor) adaptor = NULL;
+  g_autoptr (GaeguliDummySrtSink) dummysrt = NULL;
+  g_autoptr (GstStructure) initial_params = NULL;
+  DelayGradientTestData data = { 0 };
+  /* With 100 ms between stats, the 500 ms window spans 5 samples. */
+  const guint window = 5;
+  guint i;
+
+  dummysrt = gaeguli_dummy_srtsink_new ();
+  initial_params =
+      gst_structure_new ("application/x-gaeguli-encoding-parameters",
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, 2000000, NULL);
+
+  adaptor = gaeguli_delay_gradient_stream_adaptor_new (GST_ELEMENT (dummysrt),
+      initial_params);
+  g_object_set (adaptor, "stats-interval", 100, NULL);
+  g_signal_connect_swapped (adaptor, "encoding-parameters",
+      (GCallback) _delay_gradient_on_encoding_parameters, &data);
+
+  /* Flat delay at the baseline bitrate - nothing to probe for. */
+  for (i = 0; i < 2 * window; ++i) {
+    _delay_gradient_feed (adaptor, 40, 0);
+  }
+  g_assert_cmpuint (data.changes, ==, 0);
+
+  /* The send buffer starts to fill up while the RTT hasn't moved yet - the
+   * adaptor should back off within a window. */
+  for (i = 1; i <= window && data.changes == 0; ++i) {
+    _delay_gradient_feed (adaptor, 40, i * 10);
+  }
+  g_assert_cmpuint (data.changes, ==, 1);
+  g_assert_cmpuint (data.bitrate, ==, 1700000);
+
+  /* Queues stop growing - no change until a whole new window is flat. */
+  for (i = 0; i < window - 1; ++i) {
+    _delay_gradient_feed (adaptor, 40, 50);
+  }
+  g_assert_cmpuint (data.changes, ==, 1);
+
+  /* Then probe upwards by 8% per window, up to the baseline. */
+  _delay_gradient_feed (adaptor, 40, 50);
+  g_assert_cmpuint (data.changes, ==, 2);
+  g_assert_cmpuint (data.bitrate, ==, 1836000);
+
+  for (i = 0; i < window; ++i) {
+    _delay_gradient_feed (adaptor, 40, 50);
+  }
+  g_assert_cmpuint (data.changes, ==, 3);
+  g_assert_cmpuint (data.bitrate, ==, 1982880);
+
+  for (i = 0; i < window; ++i) {
+    _delay_gradient_feed (adaptor, 40, 50);
+  }
+  g_assert_cmpuint (data.changes, ==, 4);
+  g_assert_cmpuint (data.bitrate, ==, 2000000);
+
+  /* Rising RTT alone triggers a back-off too. */
+  for (i = 1; i <= window && data.changes == 4; ++i) {
+    _delay_gradient_feed (adaptor, 40 + i * 10, 50);
+  }
+  g_assert_cmpuint (data.changes, ==, 5);
+  g_assert_cmpuint (data.bitrate, ==, 1700000);
+
+  /* While the delay falls as the queues drain, hold the bitrate. */
+  for (i = 0; i < 2 * window; ++i) {
+    _delay_gradient_feed (adaptor, 100 - i * 5, 50);
+  }
+  g_assert_cmpuint (data.changes, ==, 5);
+}
+
+static void
+test_gaeguli_adaptor_delay_gradient_callers ()
+{
+  g_autoptr (GaeguliStreamAdaptor) adaptor = NULL;
+  g_autoptr (GaeguliDummySrtSink) dummysrt = NULL;
+  g_autoptr (GstStructure) initial_params = NULL;
+  DelayGradientTestData data = { 0 };
+  const guint window = 5;
+  guint i;
+
+  dummysrt = gaeguli_dummy_srtsink_new ();
+  initial_params =
+      gst_structure_new ("application/x-gaeguli-encoding-parameters",
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, 2000000, NULL);
+
+  adaptor = gaeguli_delay_gradient_stream_adaptor_new (GST_ELEMENT (dummysrt),
+      initial_params);
+  g_object_set (adaptor, "stats-interval", 100, NULL);
+  g_signal_connect_swapped (adaptor, "encoding-parameters",
+      (GCallback) _delay_gradient_on_encoding_parameters, &data);
+
+  for (i = 0; i < window; ++i) {
+    _delay_gradient_feed_callers (adaptor, 0);
+  }
+  g_assert_cmpuint (data.changes, ==, 0);
+
+  /* The congested caller decides, even though the other one is fine. */
+  for (i = 1; i <= window && data.changes == 0; ++i) {
+    _delay_gradient_feed_callers (adaptor, i * 10);
+  }
+  g_assert_cmpuint (data.changes, ==, 1);
+  g_assert_cmpuint (data.bitrate, ==, 1700000);
+}
+
+typedef struct
+{
+  guint bitrate;
+  guint frame_skip;
+  guint framerate_divisor;
+  GaeguliStreamQualityReason reason;
+  guint drops;
+  guint regains;
+} SendBufferTestData;
+
+static void
+_send_buffer_on_encoding_parameters (SendBufferTestData * data,
+    GstStructure * params)
+{
+  gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_BITRATE,
+      &data->bitrate);
+  gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_FRAME_SKIP,
+      &data->frame_skip);
+  gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_FRAMERATE_DIVISOR,
+      &data->framerate_divisor);
+}
+
+static void
+_send_buffer_on_quality_dropped (SendBufferTestData * data,
+    GaeguliStreamQualityReason reason)
+{
+  data->reason = reason;
+  ++data->drops;
+}
+
+static void
+_send_buffer_on_quality_regained (SendBufferTestData * data)
+{
+  data->reason = GAEGULI_STREAM_QUALITY_REASON_NONE;
+  ++data->regains;
+}
+
+static void
+_send_buffer_feed (GaeguliStreamAdaptor * adaptor, gint send_buffer_ms,
+    guint times)
+{
+  g_autoptr (GstStructure) stats =
+      gst_structure_new ("application/x-srt-statistics",
+      "send-buffer-ms", G_TYPE_INT, send_buffer_ms, NULL);
+
+  while (times--) {
+    GAEGULI_STREAM_ADAPTOR_GET_CLASS (adaptor)->on_stats (adaptor, stats);
+  }
+}
+
+static void
+test_gaeguli_adaptor_send_buffer ()
+{
+  g_autoptr (GaeguliStreamAdaptor) adaptor = NULL;
+  g_autoptr (GaeguliDummySrtSink) dummysrt = NULL;
+  g_autoptr (GstStructure) initial_params = NULL;
+  SendBufferTestData data = { 0 };
+
+  dummysrt = gaeguli_dummy_srtsink_new ();
+  initial_params =
+      gst_structure_new ("application/x-gaeguli-encoding-parameters",
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, 2000000, NULL);
+
+  adaptor = gaeguli_send_buffer_stream_adaptor_new (GST_ELEMENT (dummysrt),
+      initial_params);
+  /* The dummy sink has no "latency", so the target is a quarter of srtsink's
+   * default 125 ms. Escalating takes 2 samples, recovering 20. */
+  g_object_set (adaptor, "stats-interval", 100, NULL);
+  g_signal_connect_swapped (adaptor, "encoding-parameters",
+      (GCallback) _send_buffer_on_encoding_parameters, &data);
+  g_signal_connect_swapped (adaptor, "stream-quality-dropped",
+      (GCallback) _send_buffer_on_quality_dropped, &data);
+  g_signal_connect_swapped (adaptor, "stream-quality-regained",
+      (GCallback) _send_buffer_on_quality_regained, &data);
+
+  /* Below the target - nothing happens. */
+  _send_buffer_feed (adaptor, 20, 10);
+  g_assert_cmpuint (data.drops, ==, 0);
+
+  /* A single spike isn't enough. */
+  _send_buffer_feed (adaptor, 50, 1);
+  _send_buffer_feed (adaptor, 20, 1);
+  g_assert_cmpuint (data.drops, ==, 0);
+
+  /* Stage 1 lowers the bitrate. */
+  _send_buffer_feed (adaptor, 50, 2);
+  g_assert_cmpuint (data.drops, ==, 1);
+  g_assert_cmpint (data.reason, ==, GAEGULI_STREAM_QUALITY_REASON_BITRATE);
+  g_assert_cmpuint (data.bitrate, ==, 1500000);
+  g_assert_cmpuint (data.frame_skip, ==, 0);
+  g_assert_cmpuint (data.framerate_divisor, ==, 0);
+
+  /* Stage 2 skips frames before the encoder. */
+  _send_buffer_feed (adaptor, 50, 2);
+  g_assert_cmpuint (data.drops, ==, 2);
+  g_assert_cmpint (data.reason, ==, GAEGULI_STREAM_QUALITY_REASON_FRAME_SKIP);
+  g_assert_cmpuint (data.bitrate, ==, 1500000);
+  g_assert_cmpuint (data.frame_skip, ==, 3);
+  g_assert_cmpuint (data.framerate_divisor, ==, 0);
+
+  /* Stage 3 halves the framerate. */
+  _send_buffer_feed (adaptor, 50, 2);
+  g_assert_cmpuint (data.drops, ==, 3);
+  g_assert_cmpint (data.reason, ==, GAEGULI_STREAM_QUALITY_REASON_FRAMERATE);
+  g_assert_cmpuint (data.frame_skip, ==, 0);
+  g_assert_cmpuint (data.framerate_divisor, ==, 2);
+
+  /* There's no further stage. */
+  _send_buffer_feed (adaptor, 50, 10);
+  g_assert_cmpuint (data.drops, ==, 3);
+
+  /* Between half the target and the target - hold. */
+  _send_buffer_feed (adaptor, 20, 40);
+  g_assert_cmpuint (data.framerate_divisor, ==, 2);
+
+  /* Once drained, the stages get reverted one by one. */
+  _send_buffer_feed (adaptor, 5, 20);
+  g_assert_cmpuint (data.frame_skip, ==, 3);
+  g_assert_cmpuint (data.framerate_divisor, ==, 0);
+
+  _send_buffer_feed (adaptor, 5, 20);
+  g_assert_cmpuint (data.frame_skip, ==, 0);
+  g_assert_cmpuint (data.bitrate, ==, 1500000);
+  g_assert_cmpuint (data.regains, ==, 0);
+
+  _send_buffer_feed (adaptor, 5, 20);
+  g_assert_cmpuint (data.bitrate, ==, 2000000);
+  g_assert_cmpuint (data.regains, ==, 1);
+  g_assert_cmpuint (data.drops, ==, 3);
+}
+
+typedef struct
+{
+  guint bitrate;
+  guint width;
+  guint height;
+  guint framerate;
+  guint changes;
+  GaeguliStreamQualityReason reason;
+  guint regains;
+} LadderTestData;
+
+static void
+_ladder_on_encoding_parameters (LadderTestData * data, GstStructure * params)
+{
+  if (!gst_structure_get_uint (params, GAEGULI_ENCODING_PARAMETER_BITRATE,
+          &data->bitrate)) {
+    /* Rate control mode. */
+    return;
+  }
+
+  g_assert_true (gst_structure_get_uint (params,
+          GAEGULI_ENCODING_PARAMETER_WIDTH, &data->width));
+  g_assert_true (gst_structure_get_uint (params,
+          GAEGULI_ENCODING_PARAMETER_HEIGHT, &data->height));
+  g_assert_true (gst_structure_get_uint (params,
+          GAEGULI_ENCODING_PARAMETER_FRAMERATE, &data->framerate));
+  ++data->changes;
+}
+
+static void
+_ladder_on_quality_dropped (LadderTestData * data,
+    GaeguliStreamQualityReason reason)
+{
+  data->reason = reason;
+}
+
+static void
+_ladder_on_quality_regained (LadderTestData * data)
+{
+  data->reason = GAEGULI_STREAM_QUALITY_REASON_NONE;
+  ++data->regains;
+}
+
+static void
+_ladder_feed (GaeguliStreamAdaptor * adaptor, gdouble bandwidth_mbps,
+    guint times)
+{
+  g_autoptr (GstStructure) stats =
+      gst_structure_new ("application/x-srt-statistics",
+      "bandwidth-mbps", G_TYPE_DOUBLE, bandwidth_mbps, NULL);
+
+  while (times--) {
+    GAEGULI_STREAM_ADAPTOR_GET_CLASS (adaptor)->on_stats (adaptor, stats);
+  }
+}
+
+static void
+test_gaeguli_adaptor_ladder ()
+{
+  g_autoptr (GaeguliStreamAdaptor) adaptor = NULL;
+  g_autoptr (GaeguliDummySrtSink) dummysrt = NULL;
+  g_autoptr (GstStructure) initial_params = NULL;
+  LadderTestData data = { 0 };
+
+  dummysrt = gaeguli_dummy_srtsink_new ();
+  initial_params =
+      gst_structure_new ("application/x-gaeguli-encoding-parameters",
+      GAEGULI_ENCODING_PARAMETER_BITRATE, G_TYPE_UINT, 4000000,
+      GAEGULI_ENCODING_PARAMETER_WIDTH, G_TYPE_UINT, 1920,
+      GAEGULI_ENCODING_PARAMETER_HEIGHT, G_TYPE_UINT, 1080,
+      GAEGULI_ENCODING_PARAMETER_FRAMERATE, G_TYPE_UINT, 0, NULL);
+
+  adaptor = gaeguli_ladder_stream_adaptor_new (GST_ELEMENT (dummysrt),
+      initial_params);
+  /* Stepping up takes 3 samples. */
+  g_object_set (adaptor, "stats-interval", 1000, NULL);
+  g_signal_connect_swapped (adaptor, "encoding-parameters",
+      (GCallback) _ladder_on_encoding_parameters, &data);
+  g_signal_connect_swapped (adaptor, "stream-quality-dropped",
+      (GCallback) _ladder_on_quality_dropped, &data);
+  g_signal_connect_swapped (adaptor, "stream-quality-regained",
+      (GCallback) _ladder_on_quality_regained, &data);
+
+  /* Enough bandwidth for the top rung - nothing changes. */
+  _ladder_feed (adaptor, 5.0, 3);
+  g_assert_cmpuint (data.changes, ==, 0);
+
+  /* Stepping down skips rungs the bandwidth can't carry. */
+  _ladder_feed (adaptor, 1.5, 1);
+  g_assert_cmpuint (data.changes, ==, 1);
+  g_assert_cmpuint (data.bitrate, ==, 1800000);
+  g_assert_cmpuint (data.width, ==, 1280);
+  g_assert_cmpuint (data.height, ==, 720);
+  g_assert_cmpuint (data.framerate, ==, 15);
+  g_assert_cmpint (data.reason, ==, GAEGULI_STREAM_QUALITY_REASON_FRAMERATE);
+
+  /* Below every rung's minimum, stay on the lowest one. */
+  _ladder_feed (adaptor, 0.3, 1);
+  g_assert_cmpuint (data.changes, ==, 2);
+  g_assert_cmpuint (data.bitrate, ==, 360000);
+  g_assert_cmpuint (data.width, ==, 640);
+  g_assert_cmpuint (data.height, ==, 480);
+  g_assert_cmpuint (data.framerate, ==, 15);
+
+  /* The bitrate follows right away, the resolution only after a while. */
+  _ladder_feed (adaptor, 1.5, 2);
+  g_assert_cmpuint (data.changes, ==, 3);
+  g_assert_cmpuint (data.bitrate, ==, 1800000);
+  g_assert_cmpuint (data.width, ==, 640);
+
+  _ladder_feed (adaptor, 1.5, 1);
+  g_assert_cmpuint (data.changes, ==, 4);
+  g_assert_cmpuint (data.width, ==, 1280);
+  g_assert_cmpuint (data.height, ==, 720);
+  g_assert_cmpuint (data.framerate, ==, 15);
+
+  /* Back to the baseline. */
+  _ladder_feed (adaptor, 5.0, 3);
+  g_assert_cmpuint (data.changes, ==, 6);
+  g_assert_cmpuint (data.bitrate, ==, 4000000);
+  g_assert_cmpuint (data.width, ==, 1920);
+  g_assert_cmpuint (data.height, ==, 1080);
+  g_assert_cmpuint (data.framerate, ==, 0);
+  g_assert_cmpuint (data.regains, ==, 1);
+  g_assert_cmpint (data.reason, ==, GAEGULI_STREAM_QUALITY_REASON_NONE);
+}
+
+static void
+_count_stats_cb (const GstStructure * stats, guint * count)
+{
+  ++*count;
+}
+
+static void
+_iterate_main_context (guint ms)
+{
+  gint64 deadline = g_get_monotonic_time () + ms * G_TIME_SPAN_MILLISECOND;
+
+  while (g_get_monotonic_time () < deadline) {
+    g_main_context_iteration (NULL, FALSE);
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+}
+
+static void
+test_gaeguli_stats_poller_idle ()
+{
+  g_autoptr (GaeguliDummySrtSink) dummysrt = gaeguli_dummy_srtsink_new ();
+  guint count = 0;
+  guint id;
+
+  /* Unknown ids are fine, even before anything got registered. */
+  gaeguli_stats_poller_set_interval (G_MAXUINT, STATS_INTERVAL_MS);
+  gaeguli_stats_poller_remove (G_MAXUINT);
+
+  gaeguli_dummy_srtsink_set_stats (dummysrt, "packets-sent", G_TYPE_UINT64,
+      G_GUINT64_CONSTANT (0), NULL);
+
+  /* Nothing gets delivered once the entry is gone, even if the thread has
+   * already polled it. */
+  id = gaeguli_stats_poller_add (GST_ELEMENT (dummysrt), STATS_INTERVAL_MS,
+      NULL, (GaeguliStatsPollerFunc) _count_stats_cb, &count);
+  g_assert_cmpuint (id, !=, 0);
+  gaeguli_dummy_srtsink_wait_for_poll (dummysrt);
+  gaeguli_stats_poller_remove (id);
+
+  _iterate_main_context (5 * STATS_INTERVAL_MS);
+  g_assert_cmpuint (count, ==, 0);
+
+  /* With nothing left to poll, the thread sleeps until a new entry comes. */
+  id = gaeguli_stats_poller_add (GST_ELEMENT (dummysrt), STATS_INTERVAL_MS,
+      NULL, (GaeguliStatsPollerFunc) _count_stats_cb, &count);
+  _iterate_main_context (5 * STATS_INTERVAL_MS);
+  gaeguli_stats_poller_remove (id);
+  g_assert_cmpuint (count, >, 0);
+}
+
+static void
+test_gaeguli_stats_poller_remove_during_poll ()
+{
+  g_autoptr (GaeguliDummySrtSink) dummysrt = gaeguli_dummy_srtsink_new ();
+  g_autoptr (GaeguliDummySrtSink) othersrt = gaeguli_dummy_srtsink_new ();
+  guint count = 0;
+  guint other_count = 0;
+  guint other_id;
+  guint id;
+
+  gaeguli_dummy_srtsink_set_stats (dummysrt, "packets-sent", G_TYPE_UINT64,
+      G_GUINT64_CONSTANT (0), NULL);
+  gaeguli_dummy_srtsink_set_stats (othersrt, "packets-sent", G_TYPE_UINT64,
+      G_GUINT64_CONSTANT (0), NULL);
+
+  gaeguli_dummy_srtsink_hold_polls (dummysrt, TRUE);
+
+  id = gaeguli_stats_poller_add (GST_ELEMENT (dummysrt), STATS_INTERVAL_MS,
+      NULL, (GaeguliStatsPollerFunc) _count_stats_cb, &count);
+  gaeguli_dummy_srtsink_wait_for_poll (dummysrt);
+
+  /* The thread is reading the sink's stats right now. Neither removing the
+   * entry nor registering another one may wait for it. */
+  gaeguli_stats_poller_remove (id);
+  other_id = gaeguli_stats_poller_add (GST_ELEMENT (othersrt),
+      STATS_INTERVAL_MS, NULL, (GaeguliStatsPollerFunc) _count_stats_cb,
+      &other_count);
+
+  gaeguli_dummy_srtsink_hold_polls (dummysrt, FALSE);
+
+  _iterate_main_context (5 * STATS_INTERVAL_MS);
+  gaeguli_stats_poller_remove (other_id);
+
+  /* The removed entry's snapshot is discarded, the other one keeps going. */
+  g_assert_cmpuint (count, ==, 0);
+  g_assert_cmpuint (other_count, >, 0);
+}
+
+static void
+_last_reading_cb (const GstStructure * stats, guint * last_reading)
+{
+  g_assert_true (gst_structure_get_uint (stats, "reading", last_reading));
+}
+
+static void
+_count_notify_cb (guint * count)
+{
+  ++*count;
+}
+
+static void
+test_gaeguli_stats_poller_shared_reading ()
+{
+  g_autoptr (GaeguliDummySrtSink) dummysrt = gaeguli_dummy_srtsink_new ();
+  g_autoptr (GaeguliDummySrtSink) othersrt = gaeguli_dummy_srtsink_new ();
+  guint last_reading[2] = { 0 };
+  guint other_count = 0;
+  guint n_notified = 0;
+  guint other_id;
+  guint ids[2];
+
+  gaeguli_dummy_srtsink_set_stats (dummysrt, "packets-sent", G_TYPE_UINT64,
+      G_GUINT64_CONSTANT (0), NULL);
+  gaeguli_dummy_srtsink_set_stats (othersrt, "packets-sent", G_TYPE_UINT64,
+      G_GUINT64_CONSTANT (0), NULL);
+
+  /* Registers two entries of the same sink while the thread is busy with
+   * another one, so that they fall due together. */
+  gaeguli_dummy_srtsink_hold_polls (othersrt, TRUE);
+  other_id = gaeguli_stats_poller_add (GST_ELEMENT (othersrt),
+      STATS_INTERVAL_MS, NULL, (GaeguliStatsPollerFunc) _count_stats_cb,
+      &other_count);
+  gaeguli_dummy_srtsink_wait_for_poll (othersrt);
+
+  ids[0] = gaeguli_stats_poller_add (GST_ELEMENT (dummysrt), STATS_INTERVAL_MS,
+      NULL, (GaeguliStatsPollerFunc) _last_reading_cb, &last_reading[0]);
+  ids[1] = gaeguli_stats_poller_add_full (GST_ELEMENT (dummysrt),
+      STATS_INTERVAL_MS, NULL, (GaeguliStatsPollerFunc) _last_reading_cb,
+      &last_reading[1], (GDestroyNotify) _count_notify_cb);
+
+  gaeguli_dummy_srtsink_hold_polls (othersrt, FALSE);
+  _iterate_main_context (20 * STATS_INTERVAL_MS);
+
+  /* Freezes the thread in the middle of a reading, then lets everything
+   * read before it get delivered. */
+  gaeguli_dummy_srtsink_hold_polls (dummysrt, TRUE);
+  gaeguli_dummy_srtsink_wait_for_poll (dummysrt);
+  _iterate_main_context (5 * STATS_INTERVAL_MS);
+
+  /* Both entries got every reading there was. */
+  g_assert_cmpuint (last_reading[0], >, 1);
+  g_assert_cmpuint (last_reading[0], ==, last_reading[1]);
+  g_assert_cmpuint (gaeguli_dummy_srtsink_get_n_reads (dummysrt), ==,
+      last_reading[0]);
+
+  /* The destroy notify doesn't wait for the reading in progress. */
+  gaeguli_stats_poller_remove (ids[0]);
+  gaeguli_stats_poller_remove (ids[1]);
+  g_assert_cmpuint (n_notified, ==, 1);
+
+  gaeguli_dummy_srtsink_hold_polls (dummysrt, FALSE);
+  gaeguli_stats_poller_remove (other_id);
+  g_assert_cmpuint (other_count, >, 0);
+}
+
+#define ROUTER_TEST_SOCKET 101
+#define ROUTER_TEST_MAX_BITRATE 20000000
+
+/* Stats of a listener whose callers, from socket ROUTER_TEST_SOCKET on, have
+ * the given bandwidths. */
+static GstStructure *
+_router_stats_new (const gdouble * bandwidths_mbps, guint n_callers)
+{
+  GstStructure *stats =
+      gst_structure_new_empty ("application/x-srt-statistics");
+  GValue value = G_VALUE_INIT;
+  GValueArray *callers;
+  guint i;
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  callers = g_value_array_new (n_callers);
+
+  for (i = 0; i < n_callers; ++i) {
+    GValue caller = G_VALUE_INIT;
+
+    g_value_init (&caller, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&caller,
+        gst_structure_new ("application/x-srt-statistics",
+            "socket", G_TYPE_INT, ROUTER_TEST_SOCKET + i,
+            "bandwidth-mbps", G_TYPE_DOUBLE, bandwidths_mbps[i], NULL));
+    g_value_array_append (callers, &caller);
+    g_value_unset (&caller);
+  }
+  G_GNUC_END_IGNORE_DEPRECATIONS
+
+  g_value_init (&value, G_TYPE_VALUE_ARRAY);
+  g_value_take_boxed (&value, callers);
+  gst_structure_take_value (stats, "callers", &value);
+
+  return stats;
+}
+
+static void
+_router_update (GaeguliRenditionRouter * router,
+    const gdouble * bandwidths_mbps, guint n_callers)
+{
+  g_autoptr (GstStructure) stats =
+      _router_stats_new (bandwidths_mbps, n_callers);
+
+  gaeguli_rendition_router_update (router, stats, ROUTER_TEST_MAX_BITRATE);
+}
+
+static void
+test_gaeguli_rendition_router_update ()
+{
+  g_autoptr (GaeguliRenditionRouter) router = gaeguli_rendition_router_new (3);
+  const gdouble bandwidths[] = { 10, 9, 2 };
+  const gdouble close_bandwidths[] = { 10, 9.5, 2 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (bandwidths); ++i) {
+    gaeguli_rendition_router_add_caller (router, ROUTER_TEST_SOCKET + i);
+  }
+
+  /* Nobody measured yet; everyone gets the best rendition. */
+  _router_update (router, NULL, 0);
+  g_assert_cmpuint (gaeguli_rendition_router_get_n_renditions (router), ==, 1);
+  g_assert_cmpuint (gaeguli_rendition_router_get_bitrate (router, 0), ==,
+      ROUTER_TEST_MAX_BITRATE);
+
+  /* The two fast callers share a rendition at the slower one's bitrate,
+   * with some headroom. */
+  _router_update (router, bandwidths, G_N_ELEMENTS (bandwidths));
+  g_assert_cmpuint (gaeguli_rendition_router_get_n_renditions (router), ==, 2);
+  g_assert_cmpuint (gaeguli_rendition_router_get_bitrate (router, 0), ==,
+      10800000);
+  g_assert_cmpuint (gaeguli_rendition_router_get_bitrate (router, 1), ==,
+      2400000);
+
+  /* Small changes don't reconfigure encoders. */
+  _router_update (router, close_bandwidths, G_N_ELEMENTS (close_bandwidths));
+  g_assert_cmpuint (gaeguli_rendition_router_get_n_renditions (router), ==, 2);
+  g_assert_cmpuint (gaeguli_rendition_router_get_bitrate (router, 0), ==,
+      10800000);
+
+  gaeguli_rendition_router_limit (router, 1);
+  g_assert_cmpuint (gaeguli_rendition_router_get_n_renditions (router), ==, 1);
+
+  /* Nor does the slow caller open a new one past the limit. */
+  _router_update (router, bandwidths, G_N_ELEMENTS (bandwidths));
+  g_assert_cmpuint (gaeguli_rendition_router_get_n_renditions (router), ==, 1);
+  g_assert_cmpuint (gaeguli_rendition_router_get_bitrate (router, 0), <=,
+      2400000);
+}
+
+typedef struct
+{
+  gint fail_socket;
+  GString *sent[2];
+} RouterTestData;
+
+/* Writes down the PID and CC of every packet sent to a caller, with '!' for a
+ * PCR with discontinuity_indicator set. */
+static gboolean
+_router_send_cb (gint srtsocket, GstBuffer * buffer, RouterTestData * data)
+{
+  GString *sent = data->sent[srtsocket - ROUTER_TEST_SOCKET];
+  GstMapInfo map;
+  gsize offset;
+
+  if (srtsocket == data->fail_socket) {
+    return FALSE;
+  }
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  for (offset = 0; offset + 188 <= map.size; offset += 188) {
+    const guint8 *packet = map.data + offset;
+    gboolean has_pcr = (packet[3] & 0x20) && packet[4] > 0 &&
+        (packet[5] & 0x10);
+
+    g_string_append_printf (sent, "%u:%u%s ",
+        ((packet[1] & 0x1f) << 8) | packet[2], packet[3] & 0x0f,
+        has_pcr && (packet[5] & 0x80) ? "!" : "");
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  return TRUE;
+}
+
+static void
+_fill_ts_packet (guint8 * packet, guint16 pid, guint8 cc, guint8 flags)
+{
+  memset (packet, 0xff, 188);
+  packet[0] = 0x47;
+  packet[1] = pid >> 8;
+  packet[2] = pid & 0xff;
+  packet[3] = 0x10 | cc;
+  if (flags) {
+    /* An adaptation field with the given PCR and random access flags. */
+    packet[3] |= 0x20;
+    packet[4] = 7;
+    packet[5] = flags;
+  }
+}
+
+#define TS_PCR          0x10
+#define TS_RAP          0x40
+
+static GstBuffer *
+_ts_packet_new (guint16 pid, guint8 cc, guint8 flags)
+{
+  guint8 *data = g_malloc (188);
+
+  _fill_ts_packet (data, pid, cc, flags);
+
+  return gst_buffer_new_wrapped (data, 188);
+}
+
+/* Caps with a PAT and a PMT of the given CC as "streamheader". */
+static GstCaps *
+_ts_caps_new (guint8 cc)
+{
+  GstCaps *caps = gst_caps_new_simple ("video/mpegts",
+      "systemstream", G_TYPE_BOOLEAN, TRUE, NULL);
+  GValue array = G_VALUE_INIT;
+  GValue value = G_VALUE_INIT;
+  guint8 *data = g_malloc (2 * 188);
+
+  _fill_ts_packet (data, 0x00, cc, 0);
+  _fill_ts_packet (data + 188, 0x20, cc, 0);
+
+  g_value_init (&array, GST_TYPE_ARRAY);
+  g_value_init (&value, GST_TYPE_BUFFER);
+  g_value_take_boxed (&value, gst_buffer_new_wrapped (data, 2 * 188));
+  gst_value_array_append_and_take_value (&array, &value);
+  gst_structure_take_value (gst_caps_get_structure (caps, 0), "streamheader",
+      &array);
+
+  return caps;
+}
+
+static gboolean
+_router_push (GaeguliRenditionRouter * router, guint rendition, guint8 cc,
+    guint8 flags)
+{
+  g_autoptr (GstBuffer) buffer = _ts_packet_new (0x41, cc, flags);
+
+  return gaeguli_rendition_router_push (router, rendition, buffer);
+}
+
+static void
+test_gaeguli_rendition_router_push ()
+{
+  g_autoptr (GaeguliRenditionRouter) router = gaeguli_rendition_router_new (2);
+  g_autoptr (GstCaps) caps0 = _ts_caps_new (0);
+  g_autoptr (GstCaps) caps1 = _ts_caps_new (5);
+  const gdouble bandwidths[] = { 10, 2 };
+  RouterTestData data = { 0 };
+
+  data.sent[0] = g_string_new (NULL);
+  data.sent[1] = g_string_new (NULL);
+
+  gaeguli_rendition_router_set_send_func (router,
+      (GaeguliRenditionRouterSendFunc) _router_send_cb, &data);
+  gaeguli_rendition_router_set_caps (router, 0, caps0);
+  gaeguli_rendition_router_set_caps (router, 1, caps1);
+  gaeguli_rendition_router_add_caller (router, ROUTER_TEST_SOCKET);
+  gaeguli_rendition_router_add_caller (router, ROUTER_TEST_SOCKET + 1);
+
+  /* New callers get the headers first. */
+  g_assert_false (_router_push (router, 0, 3, TS_PCR));
+
+  /* The slow caller waits for a keyframe of the other rendition. */
+  _router_update (router, bandwidths, G_N_ELEMENTS (bandwidths));
+  g_assert_cmpuint (gaeguli_rendition_router_get_n_renditions (router), ==, 2);
+  g_assert_true (_router_push (router, 1, 8, 0));
+  g_assert_false (_router_push (router, 1, 9, 0));
+  g_assert_false (_router_push (router, 0, 4, 0));
+
+  /* It switches with the headers of the new rendition; the CCs carry on and
+   * the new PCR is marked. */
+  g_assert_false (_router_push (router, 1, 10, TS_PCR | TS_RAP));
+  g_assert_false (_router_push (router, 0, 5, 0));
+  g_assert_false (_router_push (router, 1, 11, 0));
+
+  g_assert_cmpstr (data.sent[0]->str, ==,
+      "0:0 32:0 65:3 65:4 65:5 ");
+  g_assert_cmpstr (data.sent[1]->str, ==,
+      "0:0 32:0 65:3 65:4 0:1 32:1 65:5! 65:6 ");
+
+  g_string_free (data.sent[0], TRUE);
+  g_string_free (data.sent[1], TRUE);
+}
+
+static void
+test_gaeguli_rendition_router_behind ()
+{
+  g_autoptr (GaeguliRenditionRouter) router = gaeguli_rendition_router_new (1);
+  g_autoptr (GstCaps) caps = _ts_caps_new (0);
+  RouterTestData data = { 0 };
+
+  data.sent[0] = g_string_new (NULL);
+
+  gaeguli_rendition_router_set_send_func (router,
+      (GaeguliRenditionRouterSendFunc) _router_send_cb, &data);
+  gaeguli_rendition_router_set_caps (router, 0, caps);
+  gaeguli_rendition_router_add_caller (router, ROUTER_TEST_SOCKET);
+
+  g_assert_false (_router_push (router, 0, 3, TS_PCR));
+  g_assert_false (_router_push (router, 0, 4, 0));
+
+  /* The socket can't take any more data. */
+  data.fail_socket = ROUTER_TEST_SOCKET;
+  g_assert_false (_router_push (router, 0, 5, 0));
+  data.fail_socket = 0;
+
+  /* The caller gets nothing until the next keyframe. */
+  g_assert_true (_router_push (router, 0, 6, 0));
+  g_assert_false (_router_push (router, 0, 7, 0));
+  g_assert_false (_router_push (router, 0, 8, TS_PCR | TS_RAP));
+  g_assert_false (_router_push (router, 0, 9, 0));
+
+  /* The dropped packet shows in the CCs, and the PCR is marked. */
+  g_assert_cmpstr (data.sent[0]->str, ==,
+      "0:0 32:0 65:3 65:4 0:1 32:1 65:6! 65:7 ");
+
+  g_string_free (data.sent[0], TRUE);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -427,6 +1347,25 @@ main (int argc, char *argv[])
   g_test_add_func ("/gaeguli/adaptor-stats", test_gaeguli_adaptor_stats);
   g_test_add_func ("/gaeguli/adaptor-bandwidth",
       test_gaeguli_adaptor_bandwidth);
+  g_test_add_func ("/gaeguli/adaptor-delay-gradient",
+      test_gaeguli_adaptor_delay_gradient);
+  g_test_add_func ("/gaeguli/adaptor-delay-gradient-callers",
+      test_gaeguli_adaptor_delay_gradient_callers);
+  g_test_add_func ("/gaeguli/adaptor-send-buffer",
+      test_gaeguli_adaptor_send_buffer);
+  g_test_add_func ("/gaeguli/adaptor-ladder", test_gaeguli_adaptor_ladder);
+  g_test_add_func ("/gaeguli/stats-poller-idle",
+      test_gaeguli_stats_poller_idle);
+  g_test_add_func ("/gaeguli/stats-poller-remove-during-poll",
+      test_gaeguli_stats_poller_remove_during_poll);
+  g_test_add_func ("/gaeguli/stats-poller-shared-reading",
+      test_gaeguli_stats_poller_shared_reading);
+  g_test_add_func ("/gaeguli/rendition-router-update",
+      test_gaeguli_rendition_router_update);
+  g_test_add_func ("/gaeguli/rendition-router-push",
+      test_gaeguli_rendition_router_push);
+  g_test_add_func ("/gaeguli/rendition-router-behind",
+      test_gaeguli_rendition_router_behind);
 
   return g_test_run ();
 }
@@ -574,6 +574,358 @@ test_gaeguli_pipeline_connection_error (TestFixture * fixture,
   gst_element_set_state (receiver, GST_STATE_NULL);
 }
 
+/* Not multiples of each other, so that one timer serving both would skew the
+ * updates of the slower one. */
+static const guint stats_subscription_intervals[] = { 200, 300 };
+
+typedef struct
+{
+  GMainLoop *loop;
+  GaeguliPipeline *pipeline;
+  GaeguliTarget *target;
+  guint subscriptions[2];
+  guint n_updates[2];
+} StatsSubscriptionTestData;
+
+static void
+_on_stats_update (GaeguliPipeline * pipeline,
+    const GaeguliTargetStatsUpdate * update, StatsSubscriptionTestData * data,
+    guint n)
+{
+  g_assert_true (update->target == data->target);
+  g_assert_cmpfloat (update->interval * 1000, >,
+      stats_subscription_intervals[n] * 0.75);
+  g_assert_cmpfloat (update->interval * 1000, <,
+      stats_subscription_intervals[n] * 1.25);
+
+  if (update->packets_sent == 0) {
+    g_debug ("Subscription %u: nothing sent yet", n);
+    return;
+  }
+
+  g_assert_cmpfloat (update->packets_per_second, >, 0);
+  g_assert_cmpfloat (update->send_bitrate, >, 0);
+  g_assert_cmpfloat (update->encoder_bitrate, >, 0);
+  g_assert_cmpfloat (update->retransmit_ratio, >=, 0);
+  g_assert_cmpfloat (update->loss_ratio, >=, 0);
+
+  if (++data->n_updates[n] == 2) {
+    gaeguli_pipeline_unsubscribe_stats (pipeline, data->subscriptions[n]);
+  }
+
+  if (data->n_updates[0] >= 2 && data->n_updates[1] >= 2) {
+    g_main_loop_quit (data->loop);
+  }
+}
+
+static void
+_on_stats_update_fast (GaeguliPipeline * pipeline,
+    const GaeguliTargetStatsUpdate * update, StatsSubscriptionTestData * data)
+{
+  /* Unsubscribed from within the callback. */
+  g_assert_cmpuint (data->n_updates[0], <, 2);
+
+  _on_stats_update (pipeline, update, data, 0);
+}
+
+static void
+_on_stats_update_slow (GaeguliPipeline * pipeline,
+    const GaeguliTargetStatsUpdate * update, StatsSubscriptionTestData * data)
+{
+  g_assert_cmpuint (data->n_updates[1], <, 2);
+
+  _on_stats_update (pipeline, update, data, 1);
+}
+
+static void
+test_gaeguli_pipeline_stats_subscription (TestFixture * fixture,
+    gconstpointer unused)
+{
+  StatsSubscriptionTestData data = { 0 };
+  g_autoptr (GaeguliPipeline) pipeline =
+      gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 30);
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *uri = NULL;
+
+  uri = g_strdup_printf ("srt://127.0.0.1:%d?mode=caller", fixture->port_base);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER,
+      fixture->port_base);
+
+  data.loop = fixture->loop;
+  data.pipeline = pipeline;
+  data.target = gaeguli_pipeline_add_srt_target (pipeline, uri, NULL, &error);
+  g_assert_no_error (error);
+
+  data.subscriptions[0] = gaeguli_pipeline_subscribe_stats (pipeline,
+      stats_subscription_intervals[0],
+      (GaeguliStatsUpdateFunc) _on_stats_update_fast, &data, NULL);
+  data.subscriptions[1] = gaeguli_pipeline_subscribe_stats (pipeline,
+      stats_subscription_intervals[1],
+      (GaeguliStatsUpdateFunc) _on_stats_update_slow, &data, NULL);
+  g_assert_cmpuint (data.subscriptions[0], !=, data.subscriptions[1]);
+
+  gaeguli_target_start (data.target, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_run (fixture->loop);
+
+  gaeguli_pipeline_stop (pipeline);
+  gst_element_set_state (receiver, GST_STATE_NULL);
+}
+
+static gboolean
+_change_resolution (GaeguliPipeline * pipeline)
+{
+  g_object_set (pipeline, "resolution", GAEGULI_VIDEO_RESOLUTION_1280X720,
+      NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_on_stream_started_change_resolution (GaeguliPipeline * pipeline,
+    GaeguliTarget * target, gpointer unused)
+{
+  /* Emitted from a streaming thread. */
+  g_idle_add ((GSourceFunc) _change_resolution, pipeline);
+}
+
+static void
+test_gaeguli_pipeline_source_switch (TestFixture * fixture,
+    gconstpointer unused)
+{
+  g_autoptr (GaeguliPipeline) pipeline =
+      gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 30);
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *uri = NULL;
+  GaeguliTarget *target;
+  guint64 switch_time = 0;
+
+  uri = g_strdup_printf ("srt://127.0.0.1:%d?mode=caller", fixture->port_base);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER,
+      fixture->port_base);
+
+  g_signal_connect (pipeline, "stream-started",
+      G_CALLBACK (_on_stream_started_change_resolution), NULL);
+  g_signal_connect_swapped (pipeline, "notify::source-switch-time",
+      G_CALLBACK (g_main_loop_quit), fixture->loop);
+
+  target = gaeguli_pipeline_add_srt_target (pipeline, uri, NULL, &error);
+  g_assert_no_error (error);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_run (fixture->loop);
+
+  g_object_get (pipeline, "source-switch-time", &switch_time, NULL);
+  g_assert_cmpuint (switch_time, >, 0);
+
+  gaeguli_pipeline_stop (pipeline);
+  gst_element_set_state (receiver, GST_STATE_NULL);
+}
+
+static gboolean
+_has_clock_overlay (GaeguliPipeline * pipeline)
+{
+  g_autoptr (GstElement) gst_pipeline = NULL;
+  g_autoptr (GstElement) overlay = NULL;
+
+  g_object_get (pipeline, "gst-pipeline", &gst_pipeline, NULL);
+  overlay = gst_bin_get_by_name (GST_BIN (gst_pipeline), "overlay");
+
+  return overlay != NULL;
+}
+
+static gboolean
+_check_clock_overlay_removed (TestFixture * fixture)
+{
+  g_assert_false (_has_clock_overlay (fixture->pipeline));
+  g_main_loop_quit (fixture->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_toggle_clock_overlay (TestFixture * fixture)
+{
+  g_object_set (fixture->pipeline, "clock-overlay", TRUE, NULL);
+  g_assert_true (_has_clock_overlay (fixture->pipeline));
+
+  g_object_set (fixture->pipeline, "clock-overlay", FALSE, NULL);
+  g_timeout_add (200, (GSourceFunc) _check_clock_overlay_removed, fixture);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_on_stream_started_toggle_overlay (GaeguliPipeline * pipeline,
+    GaeguliTarget * target, TestFixture * fixture)
+{
+  g_idle_add ((GSourceFunc) _toggle_clock_overlay, fixture);
+}
+
+static void
+test_gaeguli_pipeline_clock_overlay (TestFixture * fixture,
+    gconstpointer unused)
+{
+  g_autoptr (GaeguliPipeline) pipeline =
+      gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 30);
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *uri = NULL;
+  GaeguliTarget *target;
+
+  fixture->pipeline = pipeline;
+
+  uri = g_strdup_printf ("srt://127.0.0.1:%d?mode=caller", fixture->port_base);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER,
+      fixture->port_base);
+
+  g_signal_connect (fixture->pipeline, "stream-started",
+      G_CALLBACK (_on_stream_started_toggle_overlay), fixture);
+
+  target = gaeguli_pipeline_add_srt_target (fixture->pipeline, uri, NULL,
+      &error);
+  g_assert_no_error (error);
+
+  /* Not part of the pipeline while hidden. */
+  g_assert_false (_has_clock_overlay (fixture->pipeline));
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_run (fixture->loop);
+
+  gaeguli_pipeline_stop (fixture->pipeline);
+  gst_element_set_state (receiver, GST_STATE_NULL);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GBytes *snapshots[3];
+  guint n_snapshots;
+} SnapshotTestData;
+
+static void
+_on_snapshot (GaeguliPipeline * pipeline, GAsyncResult * result,
+    SnapshotTestData * data)
+{
+  g_autoptr (GError) error = NULL;
+  GBytes *bytes;
+  const guint8 *jpeg;
+  gsize size;
+
+  bytes = gaeguli_pipeline_create_snapshot_finish (pipeline, result, &error);
+  g_assert_no_error (error);
+
+  jpeg = g_bytes_get_data (bytes, &size);
+  g_assert_cmpuint (size, >, 2);
+  g_assert_cmpuint (jpeg[0], ==, 0xff);
+  g_assert_cmpuint (jpeg[1], ==, 0xd8);
+
+  data->snapshots[data->n_snapshots++] = bytes;
+
+  if (data->n_snapshots == G_N_ELEMENTS (data->snapshots)) {
+    g_main_loop_quit (data->loop);
+  }
+}
+
+static void
+test_gaeguli_pipeline_snapshot (TestFixture * fixture, gconstpointer unused)
+{
+  SnapshotTestData data = { 0 };
+  g_autoptr (GaeguliPipeline) pipeline =
+      gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 30);
+  guint i;
+
+  data.loop = fixture->loop;
+
+  for (i = 0; i != G_N_ELEMENTS (data.snapshots); ++i) {
+    gaeguli_pipeline_create_snapshot_async (pipeline, NULL, NULL,
+        (GAsyncReadyCallback) _on_snapshot, &data);
+  }
+
+  g_main_loop_run (fixture->loop);
+
+  /* Requests made together share a single encoded frame. */
+  for (i = 1; i != G_N_ELEMENTS (data.snapshots); ++i) {
+    g_assert_true (g_bytes_get_data (data.snapshots[i], NULL) ==
+        g_bytes_get_data (data.snapshots[0], NULL));
+  }
+
+  for (i = 0; i != G_N_ELEMENTS (data.snapshots); ++i) {
+    g_bytes_unref (data.snapshots[i]);
+  }
+
+  gaeguli_pipeline_stop (pipeline);
+}
+
+static void
+test_gaeguli_pipeline_snapshot_thumbnail (TestFixture * fixture,
+    gconstpointer unused)
+{
+  SnapshotTestData data = { 0 };
+  g_autoptr (GaeguliPipeline) pipeline =
+      gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 30);
+  const guint8 *full_image = NULL;
+  const guint8 *thumbnail = NULL;
+  gsize full_size = 0;
+  guint i;
+
+  data.loop = fixture->loop;
+
+  gaeguli_pipeline_create_snapshot_async (pipeline, NULL, NULL,
+      (GAsyncReadyCallback) _on_snapshot, &data);
+  gaeguli_pipeline_create_snapshot_full_async (pipeline, NULL, 160, 0, 0, NULL,
+      (GAsyncReadyCallback) _on_snapshot, &data);
+  gaeguli_pipeline_create_snapshot_full_async (pipeline, NULL, 160, 0, 0, NULL,
+      (GAsyncReadyCallback) _on_snapshot, &data);
+
+  g_main_loop_run (fixture->loop);
+
+  /* Identify the full-size image; the thumbnails share one smaller image. */
+  for (i = 0; i != G_N_ELEMENTS (data.snapshots); ++i) {
+    gsize size;
+
+    g_bytes_get_data (data.snapshots[i], &size);
+    if (size > full_size) {
+      full_image = g_bytes_get_data (data.snapshots[i], &full_size);
+    }
+  }
+
+  for (i = 0; i != G_N_ELEMENTS (data.snapshots); ++i) {
+    const guint8 *image = g_bytes_get_data (data.snapshots[i], NULL);
+
+    if (image != full_image) {
+      g_assert_cmpuint (g_bytes_get_size (data.snapshots[i]), <, full_size);
+      if (thumbnail) {
+        g_assert_true (image == thumbnail);
+      }
+      thumbnail = image;
+    }
+  }
+
+  g_assert_nonnull (thumbnail);
+
+  for (i = 0; i != G_N_ELEMENTS (data.snapshots); ++i) {
+    g_bytes_unref (data.snapshots[i]);
+  }
+
+  gaeguli_pipeline_stop (pipeline);
+}
+
 static gboolean
 _stop_pipeline (TestFixture * fixture)
 {
@@ -632,6 +984,209 @@ test_gaeguli_pipeline_debug_tx1 (TestFixture * fixture, gconstpointer unused)
   }
 }
 
+typedef struct
+{
+  guint encoders;
+  guint scalers;
+} BranchCount;
+
+static void
+_count_branch (const GValue * value, BranchCount * count)
+{
+  GstElement *element = g_value_get_object (value);
+  g_autoptr (GstElement) encoder = NULL;
+
+  if (!g_object_get_data (G_OBJECT (element), "gaeguli-encode-branch")) {
+    return;
+  }
+
+  /* Scaling tiers are encode branches without an encoder. */
+  encoder = gst_bin_get_by_name (GST_BIN (element), "enc");
+  if (encoder) {
+    ++count->encoders;
+  } else {
+    ++count->scalers;
+  }
+}
+
+/* Returns the top-level pipeline the target's elements are in. */
+static GstBin *
+_get_top_bin (GaeguliTarget * target)
+{
+  GstObject *top = gst_object_ref (target->pipeline);
+  GstObject *parent;
+
+  while ((parent = gst_object_get_parent (top))) {
+    gst_object_unref (top);
+    top = parent;
+  }
+
+  return GST_BIN (top);
+}
+
+static BranchCount
+_count_branches (GstBin * top)
+{
+  g_autoptr (GstIterator) it = gst_bin_iterate_recurse (top);
+  BranchCount count = { 0 };
+
+  gst_iterator_foreach (it, (GstIteratorForeachFunction) _count_branch,
+      &count);
+
+  return count;
+}
+
+/* Iterates the main context until the branch counts match or time runs
+ * out; retired branches leave the pipeline asynchronously. */
+static BranchCount
+_wait_for_branches (GstBin * top, guint encoders, guint scalers)
+{
+  gint64 deadline = g_get_monotonic_time () + 10 * G_TIME_SPAN_SECOND;
+  BranchCount count = _count_branches (top);
+
+  while ((count.encoders != encoders || count.scalers != scalers) &&
+      g_get_monotonic_time () < deadline) {
+    g_main_context_iteration (NULL, FALSE);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+    count = _count_branches (top);
+  }
+
+  return count;
+}
+
+static void
+_buffer_quit_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    TestFixture * fixture)
+{
+  g_main_context_invoke (NULL, (GSourceFunc) _quit_loop, fixture);
+}
+
+static GaeguliTarget *
+_add_mpegts_target (GaeguliPipeline * pipeline, guint port,
+    GaeguliVideoResolution resolution, guint bitrate)
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *uri = NULL;
+  GaeguliTarget *target;
+  GVariantDict attr;
+
+  uri = g_strdup_printf ("srt://127.0.0.1:%u?mode=caller", port);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "resolution", "i", resolution);
+  g_variant_dict_insert (&attr, "bitrate", "u", bitrate);
+  g_variant_dict_insert (&attr, "uri", "s", uri);
+
+  target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  return target;
+}
+
+static void
+test_gaeguli_pipeline_shared_branch (TestFixture * fixture,
+    gconstpointer unused)
+{
+  g_autoptr (GaeguliPipeline) pipeline =
+      gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GstBin) top = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *uri = NULL;
+  GaeguliTarget *target;
+  BranchCount count;
+  guint timeout_id;
+
+  /* Identical settings get encoded only once. */
+  target = _add_mpegts_target (pipeline, fixture->port_base,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 2048000);
+  _add_mpegts_target (pipeline, fixture->port_base + 1,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 2048000);
+
+  top = _get_top_bin (target);
+  count = _wait_for_branches (top, 1, 1);
+  g_assert_cmpuint (count.encoders, ==, 1);
+
+  /* An RTP branch can't be shared, but still has to stream. */
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER,
+      fixture->port_base + 2);
+  gaeguli_tests_receiver_set_handoff_callback (receiver,
+      G_CALLBACK (_buffer_quit_cb), fixture);
+
+  uri = g_strdup_printf ("srt://127.0.0.1:%u?mode=caller",
+      fixture->port_base + 2);
+  target = gaeguli_pipeline_add_srt_target_full (pipeline,
+      GAEGULI_VIDEO_CODEC_H264_X264, GAEGULI_VIDEO_STREAM_TYPE_RTP_OVER_SRT,
+      2048000, uri, NULL, &error);
+  g_assert_no_error (error);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  timeout_id = g_timeout_add_seconds (10, (GSourceFunc) _quit_loop, fixture);
+  g_main_loop_run (fixture->loop);
+  g_assert_true (g_source_remove (timeout_id));
+
+  count = _count_branches (top);
+  g_assert_cmpuint (count.encoders, ==, 2);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+static void
+test_gaeguli_pipeline_shared_scaler (TestFixture * fixture,
+    gconstpointer unused)
+{
+  g_autoptr (GaeguliPipeline) pipeline =
+      gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_1280X720, 15);
+  g_autoptr (GstBin) top = NULL;
+  g_autoptr (GError) error = NULL;
+  GaeguliTarget *target_720p_1;
+  GaeguliTarget *target_720p_2;
+  BranchCount count;
+
+  /* Different bitrates need their own encoders, but one scaler per
+   * resolution feeds them all. */
+  target_720p_1 = _add_mpegts_target (pipeline, fixture->port_base,
+      GAEGULI_VIDEO_RESOLUTION_1280X720, 2048000);
+  target_720p_2 = _add_mpegts_target (pipeline, fixture->port_base + 1,
+      GAEGULI_VIDEO_RESOLUTION_1280X720, 1024000);
+  _add_mpegts_target (pipeline, fixture->port_base + 2,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 1024000);
+
+  top = _get_top_bin (target_720p_1);
+  count = _wait_for_branches (top, 3, 2);
+  g_assert_cmpuint (count.encoders, ==, 3);
+  g_assert_cmpuint (count.scalers, ==, 2);
+
+  /* The 720p scaler goes away with the last encoder it feeds. */
+  gaeguli_pipeline_remove_target (pipeline, target_720p_1, &error);
+  g_assert_no_error (error);
+
+  count = _wait_for_branches (top, 2, 2);
+  g_assert_cmpuint (count.encoders, ==, 2);
+  g_assert_cmpuint (count.scalers, ==, 2);
+
+  gaeguli_pipeline_remove_target (pipeline, target_720p_2, &error);
+  g_assert_no_error (error);
+
+  count = _wait_for_branches (top, 1, 1);
+  g_assert_cmpuint (count.encoders, ==, 1);
+  g_assert_cmpuint (count.scalers, ==, 1);
+
+  gaeguli_pipeline_stop (pipeline);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -664,6 +1219,29 @@ main (int argc, char *argv[])
       TestFixture, NULL, fixture_setup,
       test_gaeguli_pipeline_connection_error, fixture_teardown);
 
+  g_test_add ("/gaeguli/pipeline-stats-subscription",
+      TestFixture, NULL, fixture_setup,
+      test_gaeguli_pipeline_stats_subscription, fixture_teardown);
+
+  g_test_add ("/gaeguli/pipeline-source-switch", TestFixture, NULL,
+      fixture_setup, test_gaeguli_pipeline_source_switch, fixture_teardown);
+
+  g_test_add ("/gaeguli/pipeline-clock-overlay", TestFixture, NULL,
+      fixture_setup, test_gaeguli_pipeline_clock_overlay, fixture_teardown);
+
+  g_test_add ("/gaeguli/pipeline-snapshot", TestFixture, NULL, fixture_setup,
+      test_gaeguli_pipeline_snapshot, fixture_teardown);
+
+  g_test_add ("/gaeguli/pipeline-snapshot-thumbnail", TestFixture, NULL,
+      fixture_setup, test_gaeguli_pipeline_snapshot_thumbnail,
+      fixture_teardown);
+
+  g_test_add ("/gaeguli/pipeline-shared-branch", TestFixture, NULL,
+      fixture_setup, test_gaeguli_pipeline_shared_branch, fixture_teardown);
+
+  g_test_add ("/gaeguli/pipeline-shared-scaler", TestFixture, NULL,
+      fixture_setup, test_gaeguli_pipeline_shared_scaler, fixture_teardown);
+
   g_test_add ("/gaeguli/pipeline-debug-tx1", TestFixture, NULL, fixture_setup,
       test_gaeguli_pipeline_debug_tx1, fixture_teardown);
 
@@ -0,0 +1,231 @@
+/**
+ *  tests/test-snapshot
+ *
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <gaeguli/gaeguli.h>
+
+#include <string.h>
+
+/* GaeguliTestJpegSrc class */
+
+/*
+ * Stands in for "videotestsrc" in this test, so that GaeguliPipeline gets a
+ * source producing JPEG like a MJPEG camera would. Keeps the frames it sends
+ * for comparison with the snapshots.
+ */
+
+#define GAEGULI_TYPE_TEST_JPEG_SRC   (gaeguli_test_jpeg_src_get_type ())
+
+/* *INDENT-OFF* */
+G_DECLARE_FINAL_TYPE (GaeguliTestJpegSrc, gaeguli_test_jpeg_src, GAEGULI,
+    TEST_JPEG_SRC, GstBin)
+/* *INDENT-ON* */
+
+enum
+{
+  PROP_IS_LIVE = 1
+};
+
+struct _GaeguliTestJpegSrc
+{
+  GstBin parent;
+
+  GstElement *videotestsrc;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (GaeguliTestJpegSrc, gaeguli_test_jpeg_src, GST_TYPE_BIN)
+/* *INDENT-ON* */
+
+#define MAX_SOURCE_FRAMES 60
+
+static GstElementFactory *videotestsrc_factory;
+
+static GMutex source_frames_lock;
+static GQueue source_frames = G_QUEUE_INIT;
+
+static GstPadProbeReturn
+_keep_source_frame (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstMapInfo map;
+
+  if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    g_mutex_lock (&source_frames_lock);
+    g_queue_push_tail (&source_frames, g_bytes_new (map.data, map.size));
+    while (g_queue_get_length (&source_frames) > MAX_SOURCE_FRAMES) {
+      g_bytes_unref (g_queue_pop_head (&source_frames));
+    }
+    g_mutex_unlock (&source_frames_lock);
+
+    gst_buffer_unmap (buffer, &map);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+gaeguli_test_jpeg_src_init (GaeguliTestJpegSrc * self)
+{
+  GstElement *jpegenc = gst_element_factory_make ("jpegenc", NULL);
+  g_autoptr (GstPad) jpegenc_src = NULL;
+  GstPad *srcpad;
+
+  self->videotestsrc = gst_element_factory_create (videotestsrc_factory,
+      NULL);
+
+  gst_bin_add_many (GST_BIN (self), self->videotestsrc, jpegenc, NULL);
+  gst_element_link (self->videotestsrc, jpegenc);
+
+  jpegenc_src = gst_element_get_static_pad (jpegenc, "src");
+  srcpad = gst_ghost_pad_new ("src", jpegenc_src);
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER, _keep_source_frame,
+      NULL, NULL);
+  gst_element_add_pad (GST_ELEMENT (self), srcpad);
+}
+
+static void
+gaeguli_test_jpeg_src_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GaeguliTestJpegSrc *self = GAEGULI_TEST_JPEG_SRC (object);
+
+  switch (property_id) {
+    case PROP_IS_LIVE:
+      g_object_set_property (G_OBJECT (self->videotestsrc), "is-live", value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+gaeguli_test_jpeg_src_class_init (GaeguliTestJpegSrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gaeguli_test_jpeg_src_set_property;
+
+  g_object_class_install_property (gobject_class, PROP_IS_LIVE,
+      g_param_spec_boolean ("is-live", "Is live", "Whether to act as a live "
+          "source", FALSE, G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS));
+}
+
+/* *** */
+
+/* Returns the entropy-coded image data, which follows the start of scan
+ * marker. Muxing the snapshot may rewrite the headers, but not the image. */
+static GBytes *
+_get_jpeg_scan (GBytes * jpeg)
+{
+  gsize size;
+  const guint8 *data = g_bytes_get_data (jpeg, &size);
+  gsize i;
+
+  for (i = 0; i + 1 < size; ++i) {
+    if (data[i] == 0xff && data[i + 1] == 0xda) {
+      return g_bytes_new_from_bytes (jpeg, i, size - i);
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean
+_is_source_frame (GBytes * snapshot)
+{
+  g_autoptr (GBytes) scan = _get_jpeg_scan (snapshot);
+  gboolean result = FALSE;
+  GList *l;
+
+  g_assert_nonnull (scan);
+
+  g_mutex_lock (&source_frames_lock);
+  for (l = source_frames.head; l && !result; l = l->next) {
+    g_autoptr (GBytes) source_scan = _get_jpeg_scan (l->data);
+
+    result = source_scan && g_bytes_equal (scan, source_scan);
+  }
+  g_mutex_unlock (&source_frames_lock);
+
+  return result;
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GBytes *snapshot;
+} SnapshotTestData;
+
+static void
+_on_snapshot (GaeguliPipeline * pipeline, GAsyncResult * result,
+    SnapshotTestData * data)
+{
+  g_autoptr (GError) error = NULL;
+
+  data->snapshot = gaeguli_pipeline_create_snapshot_finish (pipeline, result,
+      &error);
+  g_assert_no_error (error);
+
+  g_main_loop_quit (data->loop);
+}
+
+static void
+test_gaeguli_snapshot_jpeg_passthrough ()
+{
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  SnapshotTestData data = { 0 };
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+  g_object_set (pipeline, "snapshot-jpeg-passthrough", TRUE, NULL);
+
+  data.loop = loop;
+
+  gaeguli_pipeline_create_snapshot_async (pipeline, NULL, NULL,
+      (GAsyncReadyCallback) _on_snapshot, &data);
+  g_main_loop_run (loop);
+
+  /* The snapshot carries a frame of the source as it was, not one that got
+   * decoded and encoded again. */
+  g_assert_nonnull (data.snapshot);
+  g_assert_true (_is_source_frame (data.snapshot));
+
+  g_bytes_unref (data.snapshot);
+
+  gaeguli_pipeline_stop (pipeline);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gst_init (&argc, &argv);
+
+  /* GaeguliPipeline creates its source by name; give it ours instead. */
+  videotestsrc_factory = gst_element_factory_find ("videotestsrc");
+  g_assert_nonnull (videotestsrc_factory);
+  gst_element_register (NULL, "videotestsrc", GST_RANK_NONE,
+      GAEGULI_TYPE_TEST_JPEG_SRC);
+
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/gaeguli/snapshot-jpeg-passthrough",
+      test_gaeguli_snapshot_jpeg_passthrough);
+
+  return g_test_run ();
+}
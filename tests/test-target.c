@@ -22,6 +22,10 @@
 
 #include "gaeguli/test/receiver.h"
 
+#include <streamsplicer.h>
+
+#include <string.h>
+
 #define DEFAULT_BITRATE 1500000
 #define CHANGED_BITRATE 3000000
 #define ROUNDED_BITRATE 9999999
@@ -153,6 +157,1098 @@ test_gaeguli_target_passphrase ()
       (GCallback) connection_error_not_reached_cb, (GCallback) buffer_cb);
 }
 
+static gboolean
+switch_to_vbr (GaeguliTarget * target)
+{
+  GaeguliVideoBitrateControl bitrate_control;
+
+  g_object_get (target, "bitrate-control", &bitrate_control, NULL);
+
+  if (bitrate_control != GAEGULI_VIDEO_BITRATE_CONTROL_VBR) {
+    /* Depending on the encoder, this either reconfigures it in place or
+     * switches the target to a new one. */
+    g_object_set (target, "bitrate-control",
+        GAEGULI_VIDEO_BITRATE_CONTROL_VBR, NULL);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+reconfigure_buffer_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    GaeguliTarget * target)
+{
+  /* Handoffs come from a single streaming thread. */
+  if (!g_object_get_data (G_OBJECT (object), "reconfigure-requested")) {
+    g_object_set_data (G_OBJECT (object), "reconfigure-requested",
+        GINT_TO_POINTER (TRUE));
+    g_main_context_invoke (NULL, (GSourceFunc) switch_to_vbr, target);
+  }
+}
+
+static void
+reconfigured_cb (GaeguliTarget * target, GParamSpec * pspec, gpointer data)
+{
+  g_main_loop_quit (data);
+}
+
+static void
+test_gaeguli_target_reconfigure ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  GaeguliTarget *target;
+  guint64 latency;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  target = gaeguli_pipeline_add_srt_target_full (pipeline,
+      GAEGULI_VIDEO_CODEC_H264_X264, GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      DEFAULT_BITRATE, "srt://127.0.0.1:1111", NULL, &error);
+  g_assert_no_error (error);
+
+  g_signal_connect (target, "notify::reconfiguration-latency",
+      G_CALLBACK (reconfigured_cb), loop);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER, 1111);
+  gaeguli_tests_receiver_set_handoff_callback (receiver,
+      G_CALLBACK (reconfigure_buffer_cb), target);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_run (loop);
+
+  g_object_get (target, "reconfiguration-latency", &latency, NULL);
+  g_assert_cmpuint (latency, >, 0);
+  g_assert_cmpuint (latency, <, 5 * GST_SECOND);
+
+  g_assert_cmpint (gaeguli_target_get_state (target), ==,
+      GAEGULI_TARGET_STATE_RUNNING);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GaeguliTarget *target;
+  GMutex lock;
+  gint last_cc[8192];
+  guint n_packets;
+  guint n_discontinuities;
+  guint n_packets_after_switch;
+  gboolean switched;
+} SpliceTestData;
+
+static void
+splice_buffer_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    SpliceTestData * data)
+{
+  GstMapInfo map;
+  gsize offset;
+
+  g_mutex_lock (&data->lock);
+
+  if (data->n_packets == 0) {
+    g_main_context_invoke (NULL, (GSourceFunc) switch_to_vbr, data->target);
+  }
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  for (offset = 0; offset + 188 <= map.size; offset += 188) {
+    const guint8 *packet = map.data + offset;
+    guint16 pid = ((packet[1] & 0x1f) << 8) | packet[2];
+    gint cc = packet[3] & 0x0f;
+    gboolean has_payload = packet[3] & 0x10;
+
+    if (packet[0] != 0x47 || pid == 0x1fff) {
+      continue;
+    }
+
+    if (data->last_cc[pid] >= 0) {
+      gint expected = has_payload ? (data->last_cc[pid] + 1) & 0x0f :
+          data->last_cc[pid];
+
+      /* A single duplicate packet is allowed. */
+      if (cc != expected && cc != data->last_cc[pid]) {
+        g_debug ("PID %u: CC %d follows %d", pid, cc, data->last_cc[pid]);
+        ++data->n_discontinuities;
+      }
+    }
+    data->last_cc[pid] = cc;
+
+    ++data->n_packets;
+    if (data->switched) {
+      ++data->n_packets_after_switch;
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  g_mutex_unlock (&data->lock);
+}
+
+static gboolean
+splice_done_cb (SpliceTestData * data)
+{
+  g_main_loop_quit (data->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+splice_switched_cb (GaeguliTarget * target, GParamSpec * pspec,
+    SpliceTestData * data)
+{
+  g_mutex_lock (&data->lock);
+  if (!data->switched) {
+    data->switched = TRUE;
+    /* Give the new encoder's stream time to reach the receiver. */
+    g_timeout_add_seconds (2, (GSourceFunc) splice_done_cb, data);
+  }
+  g_mutex_unlock (&data->lock);
+}
+
+static void
+test_gaeguli_target_reconfigure_continuity ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GstElement) other_receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  SpliceTestData data = { 0 };
+  GaeguliTarget *other_target;
+  guint i;
+
+  g_mutex_init (&data.lock);
+  data.loop = loop;
+  for (i = 0; i < G_N_ELEMENTS (data.last_cc); ++i) {
+    data.last_cc[i] = -1;
+  }
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  /* Both targets share one encoder, so reconfiguring the first one moves it
+   * onto an encoder and muxer of its own. */
+  data.target = gaeguli_pipeline_add_srt_target_full (pipeline,
+      GAEGULI_VIDEO_CODEC_H264_X264, GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      DEFAULT_BITRATE, "srt://127.0.0.1:1111", NULL, &error);
+  g_assert_no_error (error);
+
+  other_target = gaeguli_pipeline_add_srt_target_full (pipeline,
+      GAEGULI_VIDEO_CODEC_H264_X264, GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS,
+      DEFAULT_BITRATE, "srt://127.0.0.1:1112", NULL, &error);
+  g_assert_no_error (error);
+
+  g_signal_connect (data.target, "notify::reconfiguration-latency",
+      G_CALLBACK (splice_switched_cb), &data);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER, 1111);
+  gaeguli_tests_receiver_set_handoff_callback (receiver,
+      G_CALLBACK (splice_buffer_cb), &data);
+  other_receiver =
+      gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER, 1112);
+
+  gaeguli_target_start (other_target, &error);
+  g_assert_no_error (error);
+  gaeguli_target_start (data.target, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_run (loop);
+
+  gaeguli_tests_receiver_set_handoff_callback (receiver, NULL, NULL);
+
+  g_assert_true (data.switched);
+  g_assert_cmpuint (data.n_packets_after_switch, >, 0);
+  g_assert_cmpuint (data.n_discontinuities, ==, 0);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gst_element_set_state (other_receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+
+  g_mutex_clear (&data.lock);
+}
+
+static void
+_fill_ts_packet (guint8 * packet, guint16 pid, guint8 cc, gboolean has_pcr)
+{
+  memset (packet, 0xff, 188);
+  packet[0] = 0x47;
+  packet[1] = pid >> 8;
+  packet[2] = pid & 0xff;
+  packet[3] = 0x10 | cc;
+  if (has_pcr) {
+    packet[3] |= 0x20;
+    packet[4] = 7;
+    packet[5] = 0x10;
+  }
+}
+
+static GstBuffer *
+_ts_buffer_new (guint16 pid, guint8 cc, gboolean has_pcr, guint16 pid2,
+    guint8 cc2)
+{
+  guint8 *data = g_malloc (2 * 188);
+
+  _fill_ts_packet (data, pid, cc, has_pcr);
+  _fill_ts_packet (data + 188, pid2, cc2, FALSE);
+
+  return gst_buffer_new_wrapped (data, 2 * 188);
+}
+
+static void
+_assert_ts_packet (GstBuffer * buffer, guint index, guint16 pid, guint8 cc,
+    gboolean discontinuity)
+{
+  guint8 packet[188];
+
+  gst_buffer_extract (buffer, index * 188, packet, sizeof (packet));
+
+  g_assert_cmpuint (((packet[1] & 0x1f) << 8) | packet[2], ==, pid);
+  g_assert_cmpuint (packet[3] & 0x0f, ==, cc);
+  if (packet[3] & 0x20) {
+    g_assert_cmpint (! !(packet[5] & 0x80), ==, discontinuity);
+  }
+}
+
+static void
+test_gaeguli_stream_splicer_ts ()
+{
+  g_autoptr (GaeguliStreamSplicer) splicer =
+      gaeguli_stream_splicer_new (GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_autoptr (GstBuffer) buffer = NULL;
+  g_autoptr (GstBuffer) shared = NULL;
+  gint source_a, source_b;
+  guint8 cc;
+
+  buffer = gaeguli_stream_splicer_process (splicer, &source_a,
+      _ts_buffer_new (0x41, 5, TRUE, 0x00, 3));
+  _assert_ts_packet (buffer, 0, 0x41, 5, FALSE);
+  _assert_ts_packet (buffer, 1, 0x00, 3, FALSE);
+  gst_clear_buffer (&buffer);
+
+  /* The other source counts from elsewhere; the output keeps counting. */
+  shared = _ts_buffer_new (0x41, 12, TRUE, 0x00, 9);
+  buffer = gaeguli_stream_splicer_process (splicer, &source_b,
+      gst_buffer_ref (shared));
+  _assert_ts_packet (buffer, 0, 0x41, 6, TRUE);
+  _assert_ts_packet (buffer, 1, 0x00, 4, FALSE);
+  gst_clear_buffer (&buffer);
+
+  /* Buffers of a tee are shared; the splicer works on a copy. */
+  _assert_ts_packet (shared, 0, 0x41, 12, FALSE);
+
+  /* Only the first PCR after a switch is marked. */
+  buffer = gaeguli_stream_splicer_process (splicer, &source_b,
+      _ts_buffer_new (0x41, 13, TRUE, 0x00, 10));
+  _assert_ts_packet (buffer, 0, 0x41, 7, FALSE);
+  _assert_ts_packet (buffer, 1, 0x00, 5, FALSE);
+  gst_clear_buffer (&buffer);
+
+  /* Back to the first source, whose counters moved on meanwhile. */
+  buffer = gaeguli_stream_splicer_process (splicer, &source_a,
+      _ts_buffer_new (0x41, 15, FALSE, 0x00, 0));
+  _assert_ts_packet (buffer, 0, 0x41, 8, FALSE);
+  _assert_ts_packet (buffer, 1, 0x00, 6, FALSE);
+  gst_clear_buffer (&buffer);
+
+  /* Counters wrap around. */
+  for (cc = 0; cc < 16; ++cc) {
+    buffer = gaeguli_stream_splicer_process (splicer, &source_a,
+        _ts_buffer_new (0x41, cc, FALSE, 0x00, cc));
+    _assert_ts_packet (buffer, 0, 0x41, (cc + 9) & 0x0f, FALSE);
+    gst_clear_buffer (&buffer);
+  }
+}
+
+static GstBuffer *
+_rtp_buffer_new (guint16 seq, guint32 ts, guint32 ssrc, GstClockTime pts)
+{
+  guint8 *data = g_malloc0 (20);
+  GstBuffer *buffer;
+
+  data[0] = 0x80;
+  data[1] = 96;
+  GST_WRITE_UINT16_BE (data + 2, seq);
+  GST_WRITE_UINT32_BE (data + 4, ts);
+  GST_WRITE_UINT32_BE (data + 8, ssrc);
+
+  buffer = gst_buffer_new_wrapped (data, 20);
+  GST_BUFFER_PTS (buffer) = pts;
+
+  return buffer;
+}
+
+static void
+_assert_rtp_header (GstBuffer * buffer, guint16 seq, guint32 ts, guint32 ssrc)
+{
+  guint8 header[12];
+
+  gst_buffer_extract (buffer, 0, header, sizeof (header));
+
+  g_assert_cmpuint (GST_READ_UINT16_BE (header + 2), ==, seq);
+  g_assert_cmpuint (GST_READ_UINT32_BE (header + 4), ==, ts);
+  g_assert_cmpuint (GST_READ_UINT32_BE (header + 8), ==, ssrc);
+}
+
+static void
+test_gaeguli_stream_splicer_rtp ()
+{
+  g_autoptr (GaeguliStreamSplicer) splicer =
+      gaeguli_stream_splicer_new (GAEGULI_VIDEO_STREAM_TYPE_RTP);
+  g_autoptr (GstBuffer) buffer = NULL;
+  g_autoptr (GstCaps) caps = NULL;
+  gint source_a, source_b;
+  guint ssrc;
+
+  buffer = gaeguli_stream_splicer_process (splicer, &source_a,
+      _rtp_buffer_new (65535, 1000, 0xaaaa, 0));
+  _assert_rtp_header (buffer, 65535, 1000, 0xaaaa);
+  gst_clear_buffer (&buffer);
+
+  /* 40 ms later, a new SSRC and sequence number from the other source. */
+  buffer = gaeguli_stream_splicer_process (splicer, &source_b,
+      _rtp_buffer_new (7, 50, 0xbbbb, 40 * GST_MSECOND));
+  _assert_rtp_header (buffer, 0, 1000 + 3600, 0xaaaa);
+  gst_clear_buffer (&buffer);
+
+  buffer = gaeguli_stream_splicer_process (splicer, &source_b,
+      _rtp_buffer_new (8, 50 + 3000, 0xbbbb, 73 * GST_MSECOND));
+  _assert_rtp_header (buffer, 1, 1000 + 3600 + 3000, 0xaaaa);
+  gst_clear_buffer (&buffer);
+
+  /* Caps of the other source keep the fields of the first one. */
+  caps = gaeguli_stream_splicer_process_caps (splicer, &source_a,
+      gst_caps_from_string ("application/x-rtp, ssrc=(uint)43690"));
+  gst_clear_caps (&caps);
+  caps = gaeguli_stream_splicer_process_caps (splicer, &source_b,
+      gst_caps_from_string ("application/x-rtp, ssrc=(uint)48059, "
+          "seqnum-offset=(uint)7"));
+  g_assert_true (gst_structure_get_uint (gst_caps_get_structure (caps, 0),
+          "ssrc", &ssrc));
+  g_assert_cmpuint (ssrc, ==, 0xaaaa);
+  g_assert_false (gst_structure_has_field (gst_caps_get_structure (caps, 0),
+          "seqnum-offset"));
+}
+
+static void
+intra_refresh_caller_added_cb (GaeguliTarget * target, gint srtsocket,
+    GSocketAddress * address, gboolean * caller_added)
+{
+  *caller_added = TRUE;
+}
+
+static void
+test_gaeguli_target_intra_refresh ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  GaeguliVideoRefreshMode refresh_mode;
+  gboolean caller_added = FALSE;
+  GaeguliTarget *target;
+  GVariantDict attr;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "refresh-mode", "i",
+      GAEGULI_VIDEO_REFRESH_MODE_INTRA_REFRESH);
+  g_variant_dict_insert (&attr, "bitrate", "u", DEFAULT_BITRATE);
+  g_variant_dict_insert (&attr, "uri", "s",
+      "srt://127.0.0.1:1111?mode=listener");
+
+  target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  g_object_get (target, "refresh-mode", &refresh_mode, NULL);
+  g_assert_cmpint (refresh_mode, ==, GAEGULI_VIDEO_REFRESH_MODE_INTRA_REFRESH);
+
+  g_signal_connect (target, "caller-added",
+      G_CALLBACK (intra_refresh_caller_added_cb), &caller_added);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_CALLER, 1111);
+  gaeguli_tests_receiver_set_handoff_callback (receiver,
+      G_CALLBACK (buffer_cb), loop);
+
+  g_main_loop_run (loop);
+
+  g_assert_true (caller_added);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GaeguliTarget *target;
+  GstElement *receiver;
+  gboolean got_keyframe;
+} GopCacheTestData;
+
+static void
+gop_cache_buffer_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    GopCacheTestData * data)
+{
+  GstMapInfo map;
+  gsize offset;
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  for (offset = 0; offset + 188 <= map.size; offset += 188) {
+    const guint8 *packet = map.data + offset;
+
+    /* random_access_indicator marks the start of a keyframe */
+    if (packet[0] == 0x47 && (packet[3] & 0x20) && packet[4] > 0 &&
+        (packet[5] & 0x40)) {
+      data->got_keyframe = TRUE;
+      g_main_loop_quit (data->loop);
+      break;
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+}
+
+static gboolean
+gop_cache_connect_cb (GopCacheTestData * data)
+{
+  data->receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_CALLER,
+      1111);
+  gaeguli_tests_receiver_set_handoff_callback (data->receiver,
+      G_CALLBACK (gop_cache_buffer_cb), data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+gop_cache_timeout_cb (GopCacheTestData * data)
+{
+  g_main_loop_quit (data->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_gaeguli_target_gop_cache ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GError) error = NULL;
+  GopCacheTestData data = { 0 };
+  GVariantDict attr;
+  guint timeout_id;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "bitrate", "u", DEFAULT_BITRATE);
+  /* One keyframe every 20 seconds; a caller joining in between depends on the
+   * GOP cache. */
+  g_variant_dict_insert (&attr, "idr-period", "u", 300);
+  g_variant_dict_insert (&attr, "uri", "s",
+      "srt://127.0.0.1:1111?mode=listener");
+
+  data.loop = loop;
+  data.target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  gaeguli_target_start (data.target, &error);
+  g_assert_no_error (error);
+
+  g_timeout_add_seconds (2, (GSourceFunc) gop_cache_connect_cb, &data);
+  timeout_id =
+      g_timeout_add_seconds (7, (GSourceFunc) gop_cache_timeout_cb, &data);
+
+  g_main_loop_run (loop);
+
+  g_source_remove (timeout_id);
+
+  g_assert_true (data.got_keyframe);
+
+  gst_element_set_state (data.receiver, GST_STATE_NULL);
+  gst_clear_object (&data.receiver);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GaeguliTarget *target;
+  gint requested;
+} KeyframeTestData;
+
+static gboolean
+keyframe_request_again_cb (KeyframeTestData * data)
+{
+  /* The minimum interval has passed. */
+  g_assert_true (gaeguli_target_request_keyframe (data->target));
+
+  g_main_loop_quit (data->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+keyframe_request_cb (KeyframeTestData * data)
+{
+  /* The target asked for a keyframe itself when it got linked. */
+  g_assert_false (gaeguli_target_request_keyframe (data->target));
+
+  g_timeout_add (3500, (GSourceFunc) keyframe_request_again_cb, data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+keyframe_buffer_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    KeyframeTestData * data)
+{
+  if (g_atomic_int_compare_and_exchange (&data->requested, FALSE, TRUE)) {
+    g_main_context_invoke (NULL, (GSourceFunc) keyframe_request_cb, data);
+  }
+}
+
+static void
+test_gaeguli_target_request_keyframe ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  KeyframeTestData data = { 0 };
+  GVariantDict attr;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "bitrate", "u", DEFAULT_BITRATE);
+  g_variant_dict_insert (&attr, "keyframe-min-interval", "u", 3000);
+  g_variant_dict_insert (&attr, "uri", "s", "srt://127.0.0.1:1111");
+
+  data.loop = loop;
+  data.target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER, 1111);
+  gaeguli_tests_receiver_set_handoff_callback (receiver,
+      G_CALLBACK (keyframe_buffer_cb), &data);
+
+  gaeguli_target_start (data.target, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_run (loop);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GaeguliTarget *target;
+  gint checked;
+} StatsTestData;
+
+static gboolean
+stats_check_cb (StatsTestData * data)
+{
+  g_autoptr (GArray) callers =
+      g_array_new (FALSE, FALSE, sizeof (GaeguliTargetStats));
+  GaeguliTargetStats stats;
+
+  g_assert_true (gaeguli_target_get_stats_into (data->target, &stats,
+          callers));
+
+  /* A caller target doesn't report any listener callers. */
+  g_assert_cmpuint (callers->len, ==, 0);
+  g_assert_cmpuint (stats.packets_sent, >, 0);
+  g_assert_cmpuint (stats.bytes_sent, >, 0);
+  g_assert_cmpfloat (stats.rtt_ms, >=, 0);
+
+  g_main_loop_quit (data->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+stats_buffer_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    StatsTestData * data)
+{
+  if (g_atomic_int_compare_and_exchange (&data->checked, FALSE, TRUE)) {
+    g_main_context_invoke (NULL, (GSourceFunc) stats_check_cb, data);
+  }
+}
+
+static void
+test_gaeguli_target_stats ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  StatsTestData data = { 0 };
+  GVariantDict attr;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "bitrate", "u", DEFAULT_BITRATE);
+  g_variant_dict_insert (&attr, "uri", "s", "srt://127.0.0.1:1111");
+
+  data.loop = loop;
+  data.target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER, 1111);
+  gaeguli_tests_receiver_set_handoff_callback (receiver,
+      G_CALLBACK (stats_buffer_cb), &data);
+
+  gaeguli_target_start (data.target, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_run (loop);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+static void
+test_gaeguli_target_latency_budget ()
+{
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GError) error = NULL;
+  GaeguliTarget *target;
+  GaeguliTargetStats stats;
+  GaeguliLatencyBudget *budget = &stats.latency_budget;
+  GVariantDict attr;
+  gint latency;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "bitrate", "u", DEFAULT_BITRATE);
+  g_variant_dict_insert (&attr, "latency-budget-ms", "u", 200);
+  g_variant_dict_insert (&attr, "uri", "s",
+      "srt://127.0.0.1:1111?mode=listener");
+
+  target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  g_assert_true (gaeguli_target_get_stats_into (target, &stats, NULL));
+  g_assert_cmpuint (budget->total_ms, ==, 200);
+  g_assert_cmpuint (budget->encoder_ms, >, 0);
+  g_assert_cmpuint (budget->mux_ms, >, 0);
+  g_assert_cmpuint (budget->queue_ms, >, 0);
+  g_assert_cmpuint (budget->srt_ms, >, 0);
+  g_assert_cmpuint (budget->encoder_ms + budget->mux_ms + budget->queue_ms +
+      budget->srt_ms, <=, budget->total_ms);
+
+  g_object_get (target, "latency", &latency, NULL);
+  g_assert_cmpint (latency, ==, budget->srt_ms);
+
+  gaeguli_pipeline_stop (pipeline);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GstElement *receivers[2];
+  gboolean got_keyframe[2];
+} RenditionsTestData;
+
+static gboolean
+_buffer_has_keyframe (GstBuffer * buffer)
+{
+  GstMapInfo map;
+  gsize offset;
+  gboolean result = FALSE;
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  for (offset = 0; offset + 188 <= map.size; offset += 188) {
+    const guint8 *packet = map.data + offset;
+
+    if (packet[0] == 0x47 && (packet[3] & 0x20) && packet[4] > 0 &&
+        (packet[5] & 0x40)) {
+      result = TRUE;
+      break;
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  return result;
+}
+
+static gboolean
+renditions_check_cb (RenditionsTestData * data)
+{
+  if (data->got_keyframe[0] && data->got_keyframe[1]) {
+    g_main_loop_quit (data->loop);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+renditions_buffer_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    RenditionsTestData * data)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (data->receivers); ++i) {
+    if (gst_object_has_as_ancestor (GST_OBJECT (object),
+            GST_OBJECT (data->receivers[i])) && !data->got_keyframe[i] &&
+        _buffer_has_keyframe (buffer)) {
+      data->got_keyframe[i] = TRUE;
+      g_main_context_invoke (NULL, (GSourceFunc) renditions_check_cb, data);
+    }
+  }
+}
+
+static gboolean
+renditions_connect_cb (RenditionsTestData * data)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (data->receivers); ++i) {
+    data->receivers[i] =
+        gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_CALLER, 1111);
+    gaeguli_tests_receiver_set_handoff_callback (data->receivers[i],
+        G_CALLBACK (renditions_buffer_cb), data);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+renditions_timeout_cb (RenditionsTestData * data)
+{
+  g_main_loop_quit (data->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_gaeguli_target_renditions ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GError) error = NULL;
+  RenditionsTestData data = { 0 };
+  GaeguliTarget *target;
+  GVariantDict attr;
+  guint timeout_id;
+  guint i;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "bitrate", "u", DEFAULT_BITRATE);
+  g_variant_dict_insert (&attr, "max-renditions", "u", 3);
+  g_variant_dict_insert (&attr, "uri", "s",
+      "srt://127.0.0.1:1111?mode=listener");
+
+  data.loop = loop;
+  target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  g_timeout_add_seconds (1, (GSourceFunc) renditions_connect_cb, &data);
+  timeout_id =
+      g_timeout_add_seconds (10, (GSourceFunc) renditions_timeout_cb, &data);
+
+  g_main_loop_run (loop);
+
+  g_source_remove (timeout_id);
+
+  /* The router, not srtsink, delivers the stream to each caller. */
+  g_assert_true (data.got_keyframe[0]);
+  g_assert_true (data.got_keyframe[1]);
+
+  for (i = 0; i < G_N_ELEMENTS (data.receivers); ++i) {
+    gst_element_set_state (data.receivers[i], GST_STATE_NULL);
+    gst_clear_object (&data.receivers[i]);
+  }
+  gaeguli_pipeline_stop (pipeline);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  gint n_programs;
+} SimulcastTestData;
+
+/* Counts the programs listed in the first PAT found in the buffer. */
+static gint
+_count_pat_programs (GstBuffer * buffer)
+{
+  GstMapInfo map;
+  gsize offset;
+  gint result = 0;
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  for (offset = 0; offset + 188 <= map.size && result == 0; offset += 188) {
+    const guint8 *packet = map.data + offset;
+    const guint8 *section;
+    guint start = 4;
+    guint section_length;
+    guint i;
+
+    /* PID 0 with a section starting in this packet */
+    if (packet[0] != 0x47 || (packet[1] & 0x5f) != 0x40 || packet[2] != 0) {
+      continue;
+    }
+
+    if (packet[3] & 0x20) {
+      start += 1 + packet[4];
+    }
+    start += 1 + packet[MIN (start, 187)];
+    if (start + 8 > 188) {
+      continue;
+    }
+
+    section = packet + start;
+    section_length = ((section[1] & 0x0f) << 8) | section[2];
+
+    /* 5 bytes of header after the length and a 4 byte CRC */
+    for (i = 8; i + 4 <= section_length - 1 && start + i + 4 <= 188; i += 4) {
+      /* Program 0 points to the network information table. */
+      if (section[i] != 0 || section[i + 1] != 0) {
+        ++result;
+      }
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  return result;
+}
+
+static gboolean
+simulcast_quit_cb (SimulcastTestData * data)
+{
+  g_main_loop_quit (data->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+simulcast_buffer_cb (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    SimulcastTestData * data)
+{
+  gint n_programs = _count_pat_programs (buffer);
+
+  if (n_programs > 0 &&
+      g_atomic_int_compare_and_exchange (&data->n_programs, 0, n_programs)) {
+    g_main_context_invoke (NULL, (GSourceFunc) simulcast_quit_cb, data);
+  }
+}
+
+static void
+test_gaeguli_target_simulcast ()
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+  SimulcastTestData data = { 0 };
+  GaeguliTarget *target;
+  GVariantBuilder renditions;
+  GVariantDict attr;
+  guint timeout_id;
+  guint bitrate;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_builder_init (&renditions, G_VARIANT_TYPE ("a(iu)"));
+  g_variant_builder_add (&renditions, "(iu)",
+      GAEGULI_VIDEO_RESOLUTION_1280X720, 2 * DEFAULT_BITRATE);
+  g_variant_builder_add (&renditions, "(iu)",
+      GAEGULI_VIDEO_RESOLUTION_640X480, DEFAULT_BITRATE);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert_value (&attr, "renditions",
+      g_variant_builder_end (&renditions));
+  g_variant_dict_insert (&attr, "uri", "s", "srt://127.0.0.1:1111");
+
+  data.loop = loop;
+  target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  /* The target itself carries the first rendition's settings. */
+  g_object_get (target, "bitrate", &bitrate, NULL);
+  g_assert_cmpuint (bitrate, ==, 2 * DEFAULT_BITRATE);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER, 1111);
+  gaeguli_tests_receiver_set_handoff_callback (receiver,
+      G_CALLBACK (simulcast_buffer_cb), &data);
+
+  gaeguli_target_start (target, &error);
+  g_assert_no_error (error);
+
+  timeout_id =
+      g_timeout_add_seconds (10, (GSourceFunc) simulcast_quit_cb, &data);
+
+  g_main_loop_run (loop);
+
+  g_source_remove (timeout_id);
+
+  /* Each rendition is a program of its own. */
+  g_assert_cmpint (data.n_programs, ==, 2);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  GaeguliTarget *target;
+} QueueDropTestData;
+
+static gboolean
+queue_drop_check_cb (QueueDropTestData * data)
+{
+  GaeguliTargetStats stats;
+
+  if (!gaeguli_target_get_stats_into (data->target, &stats, NULL) ||
+      stats.buffers_dropped == 0) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  g_main_loop_quit (data->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn
+block_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+queue_drop_run (GaeguliQueueDropMode mode)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (GaeguliPipeline) pipeline = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GstElement) sink = NULL;
+  g_autoptr (GstPad) sinkpad = NULL;
+  g_autoptr (GError) error = NULL;
+  QueueDropTestData data = { 0 };
+  GVariantDict attr;
+  gulong block_probe;
+
+  pipeline = gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
+      GAEGULI_VIDEO_RESOLUTION_640X480, 15);
+
+  g_variant_dict_init (&attr, NULL);
+  g_variant_dict_insert (&attr, "codec", "i", GAEGULI_VIDEO_CODEC_H264_X264);
+  g_variant_dict_insert (&attr, "stream-type", "i",
+      GAEGULI_VIDEO_STREAM_TYPE_MPEG_TS);
+  g_variant_dict_insert (&attr, "bitrate", "u", DEFAULT_BITRATE);
+  g_variant_dict_insert (&attr, "uri", "s", "srt://127.0.0.1:1111");
+  g_variant_dict_insert (&attr, "queue-drop-mode", "i", mode);
+  g_variant_dict_insert (&attr, "queue-max-buffers", "u", 2);
+
+  data.loop = loop;
+  data.target = gaeguli_pipeline_add_target_full (pipeline,
+      g_variant_dict_end (&attr), &error);
+  g_assert_no_error (error);
+
+  /* The sink stops taking data, so the target's queue fills up. */
+  sink = gst_bin_get_by_name (GST_BIN (data.target->pipeline), "sink");
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  block_probe = gst_pad_add_probe (sinkpad,
+      GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, block_cb, NULL, NULL);
+
+  receiver = gaeguli_tests_create_receiver (GAEGULI_SRT_MODE_LISTENER, 1111);
+
+  gaeguli_target_start (data.target, &error);
+  g_assert_no_error (error);
+
+  g_timeout_add (100, (GSourceFunc) queue_drop_check_cb, &data);
+
+  g_main_loop_run (loop);
+
+  gst_pad_remove_probe (sinkpad, block_probe);
+
+  /* Removing the target takes the drop mode off its queue. */
+  gaeguli_pipeline_remove_target (pipeline, data.target, &error);
+  g_assert_no_error (error);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gaeguli_pipeline_stop (pipeline);
+}
+
+static void
+test_gaeguli_target_queue_drop_oldest ()
+{
+  queue_drop_run (GAEGULI_QUEUE_DROP_MODE_OLDEST);
+}
+
+static void
+test_gaeguli_target_queue_drop_until_keyframe ()
+{
+  queue_drop_run (GAEGULI_QUEUE_DROP_MODE_UNTIL_KEYFRAME);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -163,6 +1259,31 @@ main (int argc, char *argv[])
       test_gaeguli_target_encoding_params);
   g_test_add_func ("/gaeguli/target-passphrase",
       test_gaeguli_target_passphrase);
+  g_test_add_func ("/gaeguli/target-reconfigure",
+      test_gaeguli_target_reconfigure);
+  g_test_add_func ("/gaeguli/target-reconfigure-continuity",
+      test_gaeguli_target_reconfigure_continuity);
+  g_test_add_func ("/gaeguli/target-intra-refresh",
+      test_gaeguli_target_intra_refresh);
+  g_test_add_func ("/gaeguli/target-gop-cache",
+      test_gaeguli_target_gop_cache);
+  g_test_add_func ("/gaeguli/target-request-keyframe",
+      test_gaeguli_target_request_keyframe);
+  g_test_add_func ("/gaeguli/target-stats", test_gaeguli_target_stats);
+  g_test_add_func ("/gaeguli/target-latency-budget",
+      test_gaeguli_target_latency_budget);
+  g_test_add_func ("/gaeguli/target-renditions",
+      test_gaeguli_target_renditions);
+  g_test_add_func ("/gaeguli/target-simulcast",
+      test_gaeguli_target_simulcast);
+  g_test_add_func ("/gaeguli/target-queue-drop-oldest",
+      test_gaeguli_target_queue_drop_oldest);
+  g_test_add_func ("/gaeguli/target-queue-drop-until-keyframe",
+      test_gaeguli_target_queue_drop_until_keyframe);
+  g_test_add_func ("/gaeguli/stream-splicer-ts",
+      test_gaeguli_stream_splicer_ts);
+  g_test_add_func ("/gaeguli/stream-splicer-rtp",
+      test_gaeguli_stream_splicer_rtp);
 
   return g_test_run ();
 }
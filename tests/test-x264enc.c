@@ -0,0 +1,150 @@
+/**
+ *  tests/test-x264enc
+ *
+ *  Copyright 2021 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "gaegulix264enc.h"
+#include "encodedframemeta.h"
+
+#define N_FRAMES        30
+#define KEY_INT_MAX     10
+
+#define X264ENC_PIPELINE_STR "\
+    videotestsrc num-buffers=%d ! \
+    video/x-raw,format=I420,width=320,height=240,framerate=30/1 ! \
+    gaegulix264enc name=enc speed-preset=ultrafast key-int-max=%d \
+    scenecut=false ! fakesink name=sink signal-handoffs=1"
+
+typedef struct
+{
+  GstElement *encoder;
+  guint n_frames;
+  guint n_keyframes;
+  guint n_metas;
+  guint reconfigure_at;
+} EncodeData;
+
+static void
+_handoff_cb (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    EncodeData * data)
+{
+  GaeguliEncodedFrameMeta *meta = gaeguli_buffer_get_encoded_frame_meta
+      (buffer);
+  gboolean keyframe =
+      !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  if (data->n_frames == 0) {
+    g_assert_true (keyframe);
+  }
+
+  if (keyframe) {
+    ++data->n_keyframes;
+  }
+
+  if (meta) {
+    ++data->n_metas;
+
+    g_assert_cmpuint (meta->encoded_size, ==, gst_buffer_get_size (buffer));
+    g_assert_cmpfloat (meta->average_qp, >=, 0);
+    g_assert_cmpfloat (meta->average_qp, <=, 51);
+    if (keyframe) {
+      g_assert_cmpint (meta->frame_type, ==, GAEGULI_FRAME_TYPE_IDR);
+    }
+  }
+
+  if (++data->n_frames == data->reconfigure_at) {
+    /* The largest VBV buffer the properties allow at the highest bitrate. */
+    g_object_set (data->encoder, "bitrate", 2000 * 1024, "vbv-buf-capacity",
+        10000, NULL);
+  }
+}
+
+static void
+_run_encoder (EncodeData * data)
+{
+  g_autofree gchar *pipeline_str = NULL;
+  g_autoptr (GstElement) pipeline = NULL;
+  g_autoptr (GstElement) sink = NULL;
+  g_autoptr (GstBus) bus = NULL;
+  g_autoptr (GstMessage) message = NULL;
+  g_autoptr (GError) error = NULL;
+
+  pipeline_str = g_strdup_printf (X264ENC_PIPELINE_STR, N_FRAMES,
+      KEY_INT_MAX);
+  pipeline = gst_parse_launch (pipeline_str, &error);
+  g_assert_no_error (error);
+
+  data->encoder = gst_bin_get_by_name (GST_BIN (pipeline), "enc");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_signal_connect (sink, "handoff", G_CALLBACK (_handoff_cb), data);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  message = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  g_assert_nonnull (message);
+  g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_EOS);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_clear_object (&data->encoder);
+}
+
+static void
+test_gaeguli_x264enc_encode ()
+{
+  EncodeData data = { 0 };
+
+  _run_encoder (&data);
+
+  /* Every frame comes out with its statistics and keyframes come only at the
+   * configured interval. */
+  g_assert_cmpuint (data.n_frames, ==, N_FRAMES);
+  g_assert_cmpuint (data.n_metas, ==, N_FRAMES);
+  g_assert_cmpuint (data.n_keyframes, ==, N_FRAMES / KEY_INT_MAX);
+}
+
+static void
+test_gaeguli_x264enc_reconfigure ()
+{
+  EncodeData data = { 0 };
+
+  data.reconfigure_at = 5;
+
+  _run_encoder (&data);
+
+  /* Rate control changes apply to the running encoder, without a restart
+   * that would start the stream over with an extra keyframe. */
+  g_assert_cmpuint (data.n_frames, ==, N_FRAMES);
+  g_assert_cmpuint (data.n_keyframes, ==, N_FRAMES / KEY_INT_MAX);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gst_init (&argc, &argv);
+  gaeguli_x264_enc_register ();
+
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/gaeguli/x264enc-encode", test_gaeguli_x264enc_encode);
+  g_test_add_func ("/gaeguli/x264enc-reconfigure",
+      test_gaeguli_x264enc_reconfigure);
+
+  return g_test_run ();
+}